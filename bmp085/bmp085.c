@@ -29,6 +29,13 @@
 // TODO: Avoid global variriables in drivers implementation.
 
 static bmp085_calib_data_t bmp085_calib_data;
+
+/*
+ * Published results, bmp085_samples[bmp085_version & 1] is the last one.
+ */
+static bmp085_sample_t    bmp085_samples[2];
+static volatile uint32_t  bmp085_version = 0;
+static EVENTSOURCE_DECL(bmp085_event);
 const float sealevelpress = 1013.25;  /**< Sea level pressure (hpa).  */
 const float absaltitude   = 0;        /**< Absolute altitude.         */
 
@@ -47,7 +54,7 @@ const float absaltitude   = 0;        /**< Absolute altitude.         */
  * @retval    14    if the BMP085 mode is set to High Resolution
  * @retval    26    if the BMP085 mode is set to Utltra High Resolution
  */
-static uint8_t getPressureConversionTime(uint8_t oss) {
+uint8_t bmp085GetPressureConversionTime(uint8_t oss) {
 
   uint8_t time;
 
@@ -76,8 +83,181 @@ static uint8_t getPressureConversionTime(uint8_t oss) {
   return time;
 }
 
+/**
+ * @brief   Publish a temperature or a pressure.
+ * @details The result is written in the snapshot not read by the readers,
+ *          the writers only wait for each other. The listeners of the
+ *          driver events are then notified.
+ *
+ * @param[in] temp    pointer to the new temperature, NULL if unchanged
+ * @param[in] press   pointer to the new pressure, NULL if unchanged
+ * @param[in] pa      new compensated pressure (Pa), used with press
+ */
+static void bmp085Publish(const float *temp, const float *press,
+                          int32_t pa) {
+
+  bmp085_sample_t *sp;
+
+  chSysLock();
+  sp = &bmp085_samples[(bmp085_version + 1) & 1];
+  *sp = bmp085_samples[bmp085_version & 1];
+  if (temp != NULL)
+    sp->temp = *temp;
+  if (press != NULL) {
+    sp->press = *press;
+    sp->pa = pa;
+  }
+  __sync_synchronize();
+  bmp085_version++;
+  chEvtBroadcastFlagsI(&bmp085_event, BMP085_EVENT_NEW_DATA);
+  chSchRescheduleS();
+  chSysUnlock();
+}
+
+/**
+ * @brief   Get a consistent copy of the last results of the sensor.
+ * @details The readers never block and never block the writers. A copy is
+ *          only done again when two results were published during the copy,
+ *          the snapshot being copied was then overwritten.
+ *          Each reader keeps the version of the last results it took, any
+ *          number of readers can tell the results they missed.
+ * @note    The retry only detects an overwritten snapshot because the
+ *          writers publish under chSysLock() on a single core: a writer
+ *          never runs during the check of the version. On a multi-core
+ *          part the snapshots need a seqlock.
+ *
+ * @param[out]    sp      pointer to the copy of the results
+ * @param[in,out] last    version of the results last taken by the reader,
+ *                        0 at first, set to the version of the copy. Can be
+ *                        NULL if the reader does not count its overruns
+ * @return        missed  number of results published since the last copy
+ *                        of the reader and not taken by it
+ */
+uint32_t bmp085GetSnapshot(bmp085_sample_t *sp, uint32_t *last) {
+
+  uint32_t version, missed = 0;
+
+  do {
+    version = bmp085_version;
+    __sync_synchronize();
+    *sp = bmp085_samples[version & 1];
+    __sync_synchronize();
+  } while ((uint32_t)(bmp085_version - version) >= 2);
+
+  if (last != NULL) {
+    if (version != *last)
+      missed = (uint32_t)(version - *last - 1);
+    *last = version;
+  }
+
+  return missed;
+}
+
+/**
+ * @brief   Get the event source of the driver.
+ * @details The event source broadcasts BMP085_EVENT_NEW_DATA when a result
+ *          is published and BMP085_EVENT_ERROR when a result cannot be
+ *          read. The results missed by a reader are counted by
+ *          bmp085GetSnapshot().
+ *
+ * @return    esp   pointer to the event source
+ */
+event_source_t *bmp085GetEventSource(void) {
+
+  return &bmp085_event;
+}
+
+/**
+ * @brief   Compute the temperature from a raw temperature.
+ * @details The intermediate value B5, used by the pressure compensation, is
+ *          stored in the calibration data.
+ *
+ * @param[in,out] cdp   pointer to the calibration data
+ * @param[in]     ut    raw temperature read from the sensor
+ * @return        temp  temperature in 0.1 degree Celsius
+ */
+int32_t bmp085CompensateTemp(bmp085_calib_data_t *cdp, int32_t ut) {
+
+  int32_t x1,x2;
+
+  x1 = ((ut - cdp->ac6) * cdp->ac5) >> 15;
+  x2 = (cdp->mc << 11) / (x1 + cdp->md);
+  cdp->b5 = x1 + x2;
+
+  return (cdp->b5 + 8) >> 4;
+}
+
+/**
+ * @brief   Compute the pressure from a raw pressure.
+ * @note    The temperature must have been compensated before, see
+ *          bmp085CompensateTemp().
+ *
+ * @param[in] cdp     pointer to the calibration data
+ * @param[in] up      raw pressure read from the sensor, shifted by 8 - oss
+ * @param[in] oss     oversampling setting of the conversion
+ * @return    press   pressure in Pa
+ */
+int32_t bmp085CompensatePress(const bmp085_calib_data_t *cdp, int32_t up,
+                              uint8_t oss) {
+
+  int32_t   x1,x2,x3;
+  int32_t   b3,b6;
+  uint32_t  b4,b7;
+  int32_t   pressure;
+
+  b6 = cdp->b5 - 4000;
+  x1 = (cdp->b2 * ((b6 * b6) >> 12)) >> 11;
+  x2 = (cdp->ac2 * b6) >> 11;
+  x3 = x1 + x2;
+  b3 = ((((int32_t)cdp->ac1 * 4 + x3) << oss) + 2) >> 2;
+  x1 = ((cdp->ac3)*b6) >> 13;
+  x2 = (cdp->b1 * (b6*b6 >> 12)) >> 16;
+  x3 = ((x1 + x2) + 2) >> 2;
+  b4 = cdp->ac4 * (uint32_t)(x3 + 32768) >> 15;
+  b7 = ((uint32_t)up - b3)*(50000 >> oss);
+
+  if (b7 < 0x80000000)
+    pressure = (b7*2)/b4;
+  else
+    pressure = (b7/b4)*2;
+
+  x1 = (pressure >> 8)*(pressure >> 8);
+  x1 = (x1*3038) >> 16;
+  x2 = (-7357*pressure) >> 16;
+
+  return pressure + ((x1 + x2 + 3791) >> 4);
+}
+
+/**
+ * @brief   Compute the altitude from a pressure, international barometric
+ *          formula.
+ *
+ * @param[in] press     pressure
+ * @param[in] sealevel  pressure at sea level, in the unit of @p press
+ * @return    altitude  altitude in meter
+ */
+float bmp085AltitudeFromPress(float press, float sealevel) {
+
+  return 44330 * (1 - (pow((press / sealevel), 0.191)));
+}
+
+/**
+ * @brief   Compute the pressure at sea level from a pressure measured at a
+ *          known altitude.
+ *
+ * @param[in] press     pressure
+ * @param[in] altitude  altitude of the measure in meter
+ * @return    press     pressure at sea level, in the unit of @p press
+ */
+float bmp085SeaLevelFromPress(float press, float altitude) {
+
+  return (press / (pow((1 - (altitude / 44330)), 5.225)));
+}
+
 /**
  * @brief   Read BMP085 calibration data.
+ * @note    The sensor is registered by the caller, i2cBringUp() does it
+ *          with the clock and the priority of its table.
  *
  * @param[in] i2cp  pointer to the I2C device
  * @param[in] addr  bmpO85 digital pressure sensor address
@@ -85,12 +265,20 @@ static uint8_t getPressureConversionTime(uint8_t oss) {
  */
 msg_t bmp085GetCalibrationData(I2CDriver *i2cp, uint8_t addr) {
 
-  uint8_t txbuf;
-  uint8_t rxbuf[22];
-  msg_t   msg;
+  iic_xfer_t  *xp;
+  uint8_t     *rxbuf;
+  msg_t       msg;
 
-  txbuf = BMP085_CALIBRATION_DATA_AC1_MSB;
-  msg = i2cReadRegisters(i2cp, addr, &txbuf, rxbuf, 22);
+  xp = i2cXferAlloc(i2cp, addr);
+  if (xp == NULL)
+    return MSG_RESET;
+
+  /* The coefficients are decoded in the slab of the transfer. */
+  xp->buf[0] = BMP085_CALIBRATION_DATA_AC1_MSB;
+  xp->txn = 1;
+  xp->rxn = 22;
+  msg = i2cXferRun(xp);
+  rxbuf = IIC_XFER_RX(xp);
 
   if (msg == MSG_OK) {
     bmp085_calib_data.ac1 = ((rxbuf[0]  << 8) | rxbuf[1]);
@@ -104,11 +292,11 @@ msg_t bmp085GetCalibrationData(I2CDriver *i2cp, uint8_t addr) {
     bmp085_calib_data.mb  = ((rxbuf[16] << 8) | rxbuf[17]);
     bmp085_calib_data.mc  = ((rxbuf[18] << 8) | rxbuf[19]);
     bmp085_calib_data.md  = ((rxbuf[20] << 8) | rxbuf[21]);
-
-    return msg;
   }
-  else
-    return msg;
+
+  i2cXferFree(xp);
+
+  return msg;
 }
 
 /**
@@ -121,21 +309,53 @@ msg_t bmp085GetCalibrationData(I2CDriver *i2cp, uint8_t addr) {
  */
 msg_t bmp085ReadTemp(I2CDriver *i2cp, uint8_t addr, float *temp) {
 
-  int32_t utemp;
-  int32_t x1,x2;
-  int32_t temperature = 0;
+  msg_t msg;
+
+  msg = bmp085StartTemp(i2cp, addr);
+
+  if (msg != MSG_OK)
+    return msg;
+
+  chThdSleepMilliseconds(BMP085_TEMP_CONVERSION_TIME);
+
+  return bmp085FetchTemp(i2cp, addr, temp);
+}
+
+/**
+ * @brief   Start a temperature conversion.
+ * @details The result is read with bmp085FetchTemp() once the conversion
+ *          time, BMP085_TEMP_CONVERSION_TIME, is elapsed. The bus can be
+ *          used by other devices meanwhile.
+ *
+ * @param[in] i2cp  pointer to the I2C device
+ * @param[in] addr  the bmp085 digital pressure sensor address
+ * @return    msg   the result of the operation
+ */
+msg_t bmp085StartTemp(I2CDriver *i2cp, uint8_t addr) {
+
   uint8_t txbuf[2];
-  uint8_t rxbuf[2];
-  msg_t   msg;
 
   txbuf[0] = BMP085_CR;
   txbuf[1] = BMP085_MODE_TEMP;
-  msg = i2cWriteRegisters(i2cp, addr, txbuf, 2);
 
-  if (msg != MSG_OK)
-    return msg;
+  return i2cWriteRegisters(i2cp, addr, txbuf, 2);
+}
+
+/**
+ * @brief   Read the result of a temperature conversion.
+ *
+ * @param[in]  i2cp   pointer to the I2C device
+ * @param[in]  addr   the bmp085 digital pressure sensor address
+ * @param[out] temp   pointer to the temperature variable
+ * @return     msg    the result of the temperature reading operation
+ */
+msg_t bmp085FetchTemp(I2CDriver *i2cp, uint8_t addr, float *temp) {
 
-  chThdSleepMilliseconds(5);
+  int32_t utemp;
+  int32_t temperature = 0;
+  uint8_t txbuf[1];
+  uint8_t rxbuf[2];
+  msg_t   msg;
 
   txbuf[0] = BMP085_DATA;
   msg = i2cReadRegisters(i2cp, addr, txbuf, rxbuf, 2);
@@ -145,17 +365,17 @@ msg_t bmp085ReadTemp(I2CDriver *i2cp, uint8_t addr, float *temp) {
     utemp = (int32_t)((rxbuf[0] << 8) | rxbuf[1]);
 
     /* Converting value. */
-    x1 = ((utemp - bmp085_calib_data.ac6) * bmp085_calib_data.ac5) >> 15;
-    x2 = (bmp085_calib_data.mc << 11) / (x1 + bmp085_calib_data.md);
-    bmp085_calib_data.b5 = x1 + x2;
-    temperature = (bmp085_calib_data.b5 + 8) >> 4;
+    temperature = bmp085CompensateTemp(&bmp085_calib_data, utemp);
 
     *temp = (float)(temperature * 0.1);
+    bmp085Publish(temp, NULL, 0);
 
     return msg;
   }
-  else
+  else {
+    chEvtBroadcastFlags(&bmp085_event, BMP085_EVENT_ERROR);
     return msg;
+  }
 }
 
 /**
@@ -170,14 +390,33 @@ msg_t bmp085ReadTemp(I2CDriver *i2cp, uint8_t addr, float *temp) {
 msg_t bmp085ReadPress(I2CDriver *i2cp, uint8_t addr, uint8_t oss,
                       float *press) {
 
-  int32_t   upress;
-  int32_t   x1,x2,x3;
-  int32_t   b3,b6;
-  uint32_t  b4,b7;
-  int32_t   pressure = 0;
-  uint8_t   txbuf[2];
-  uint8_t   rxbuf[3];
-  msg_t     msg;
+  msg_t msg;
+
+  msg = bmp085StartPress(i2cp, addr, oss);
+
+  if (msg != MSG_OK)
+    return msg;
+
+  /* Waiting for conversion to end . */
+  chThdSleepMilliseconds(bmp085GetPressureConversionTime(oss));
+
+  return bmp085FetchPress(i2cp, addr, oss, press);
+}
+
+/**
+ * @brief   Start a pressure conversion.
+ * @details The result is read with bmp085FetchPress() once the conversion
+ *          time, see bmp085GetPressureConversionTime(), is elapsed. The bus
+ *          can be used by other devices meanwhile.
+ *
+ * @param[in] i2cp  pointer to the I2C device
+ * @param[in] addr  bmp085 digital pressure sensor address
+ * @param[in] oss   oversampling setting parameter
+ * @return    msg   the result of the operation
+ */
+msg_t bmp085StartPress(I2CDriver *i2cp, uint8_t addr, uint8_t oss) {
+
+  uint8_t txbuf[2];
 
   txbuf[0] = BMP085_CR;
 
@@ -190,13 +429,27 @@ msg_t bmp085ReadPress(I2CDriver *i2cp, uint8_t addr, uint8_t oss,
   else
     txbuf[1] = BMP085_MODE_PR3 + (oss << 6);
 
-  msg = i2cWriteRegisters(i2cp, addr, txbuf, 2);
+  return i2cWriteRegisters(i2cp, addr, txbuf, 2);
+}
 
-  if (msg != MSG_OK)
-    return msg;
+/**
+ * @brief   Read the result of a pressure conversion.
+ * @note    The compensation uses the last temperature read.
+ *
+ * @param[in]   i2cp        pointer to the I2C device
+ * @param[in]   addr        bmp085 digital pressure sensor address
+ * @param[in]   oss         oversampling setting of the conversion
+ * @param[out]  press       pointer to the pressure variable
+ * @return      msg         result of the pressure reading operation
+ */
+msg_t bmp085FetchPress(I2CDriver *i2cp, uint8_t addr, uint8_t oss,
+                       float *press) {
 
-  /* Waiting for conversion to end . */
-  chThdSleepMilliseconds(getPressureConversionTime(oss));
+  int32_t   upress;
+  int32_t   pressure = 0;
+  uint8_t   txbuf[1];
+  uint8_t   rxbuf[3];
+  msg_t     msg;
 
   txbuf[0] = BMP085_DATA;
 
@@ -208,33 +461,17 @@ msg_t bmp085ReadPress(I2CDriver *i2cp, uint8_t addr, uint8_t oss,
     upress = upress >> (8-oss);
 
     /* Converting value. */
-    b6 = bmp085_calib_data.b5 - 4000;
-    x1 = (bmp085_calib_data.b2 * ((b6 * b6) >> 12)) >> 11;
-    x2 = (bmp085_calib_data.ac2 * b6) >> 11;
-    x3 = x1 + x2;
-    b3 = ((((int32_t)bmp085_calib_data.ac1 * 4 + x3) << oss) + 2) >> 2;
-    x1 = ((bmp085_calib_data.ac3)*b6) >> 13;
-    x2 = (bmp085_calib_data.b1 * (b6*b6 >> 12)) >> 16;
-    x3 = ((x1 + x2) + 2) >> 2;
-    b4 = bmp085_calib_data.ac4 * (uint32_t)(x3 + 32768) >> 15;
-    b7 = ((uint32_t)upress - b3)*(50000 >> oss);
-
-    if (b7 < 0x80000000)
-      pressure = (b7*2)/b4;
-    else
-      pressure = (b7/b4)*2;
-
-    x1 = (pressure >> 8)*(pressure >> 8);
-    x1 = (x1*3038) >> 16;
-    x2 = (-7357*pressure) >> 16;
-    pressure = pressure + ((x1 + x2 + 3791) >> 4);
+    pressure = bmp085CompensatePress(&bmp085_calib_data, upress, oss);
 
     *press = (float)(pressure * 0.01);
+    bmp085Publish(NULL, press, pressure);
 
     return msg;
   }
-  else
+  else {
+    chEvtBroadcastFlags(&bmp085_event, BMP085_EVENT_ERROR);
     return msg;
+  }
 }
 
 /**
@@ -251,7 +488,7 @@ msg_t bmp085GetAltitude(I2CDriver *i2cp, uint8_t addr, float *altitude) {
   msg_t msg;
 
   msg = bmp085ReadPress(i2cp, addr, BMP085_ULTRA_HIGH_RESOLUTION, &press);
-  *altitude = 44330 * (1 - (pow((press / sealevelpress), 0.191)));
+  *altitude = bmp085AltitudeFromPress(press, sealevelpress);
 
   return msg;
 }
@@ -274,7 +511,7 @@ msg_t bmp085GetPressureAtSeaLevel(I2CDriver *i2cp, uint8_t addr,
   msg = bmp085GetAltitude(i2cp, addr, &altitude);
   msg = bmp085ReadPress(i2cp, addr, BMP085_ULTRA_HIGH_RESOLUTION, &press);
 
-  *presssealevel = (press / (pow((1 - (absaltitude / 44330)), 5.225)));
+  *presssealevel = bmp085SeaLevelFromPress(press, absaltitude);
 
   return msg;
 }
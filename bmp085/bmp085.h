@@ -33,7 +33,31 @@
 #if !defined(BMP085_USE_I2C) || defined(__DOXYGEN__)
 #define BMP085_USE_I2C                    TRUE
 #endif
+
+/**
+ * @brief   BMP085 maximum I2C clock speed.
+ * @note    The default is the I2C fast mode, 400 kHz.
+ */
+#if !defined(BMP085_I2C_CLOCK) || defined(__DOXYGEN__)
+#define BMP085_I2C_CLOCK                  IIC_FAST_MODE
+#endif
  
+/**
+ * @brief   Adaptive sampling, a temperature is read every n pressures.
+ * @note    The default is 4.
+ */
+#if !defined(BMP085_RATE_TEMP_DIV) || defined(__DOXYGEN__)
+#define BMP085_RATE_TEMP_DIV              4
+#endif
+
+/**
+ * @brief   Cycle budget of an update of the altitude filter.
+ * @note    The default is 200 cycles.
+ */
+#if !defined(BMP085_FILTER_BUDGET) || defined(__DOXYGEN__)
+#define BMP085_FILTER_BUDGET              200
+#endif
+
 /*===========================================================================*/
 /* Derived constants and error checks.                                       */
 /*===========================================================================*/
@@ -64,6 +88,15 @@ typedef struct bmp085_eprom{
   int32_t b5;
 } bmp085_calib_data_t;
 
+/**
+ * @brief   Last results of the sensor.
+ */
+typedef struct bmp085_sample {
+  float     temp;   /**< Last temperature (degree Celsius).                 */
+  float     press;  /**< Last pressure (hPa).                               */
+  int32_t   pa;     /**< Last compensated pressure (Pa).                    */
+} bmp085_sample_t;
+
 /*==========================================================================*/
 /* Driver macros.                                                           */
 /*==========================================================================*/
@@ -130,13 +163,83 @@ typedef struct bmp085_eprom{
 #define BMP085_HIGH_RESOLUTION              ((uint8_t)0x02)
 #define BMP085_ULTRA_HIGH_RESOLUTION        ((uint8_t)0x03)
 
+/*
+ * Event flags of the driver.
+ */
+#define BMP085_EVENT_NEW_DATA               ((eventflags_t)1)
+#define BMP085_EVENT_ERROR                  ((eventflags_t)2)
+
+/*
+ * Temperature conversion time (ms).
+ */
+#define BMP085_TEMP_CONVERSION_TIME         5
+
+/**
+ * @brief   Adaptive sampling controller.
+ * @details The sample rate follows the rate of change of the pressure, the
+ *          oversampling being lowered when the rate is raised.
+ */
+typedef struct bmp085_rate {
+  I2CDriver *i2cp;      /**< Bus of the sensor.                             */
+  uint8_t   addr;       /**< Address of the sensor.                         */
+  uint16_t  budget;     /**< Largest duty cycle of the sensor (permille).   */
+  uint8_t   level;      /**< Sampling level, 0 is the sparsest.             */
+  uint8_t   oss;        /**< Oversampling of the next sample.               */
+  systime_t period;     /**< Time between two samples.                      */
+  float     press;      /**< Last pressure (hPa).                           */
+  float     slope;      /**< Smoothed |dP/dt| (hPa/s).                      */
+  systime_t last;       /**< Time of the last sample.                       */
+  systime_t start;      /**< Start of the duty cycle window.                */
+  systime_t busy;       /**< Time spent in the conversions in the window.   */
+  uint32_t  samples;    /**< Number of samples.                             */
+} bmp085_rate_t;
+
+/**
+ * @brief   Altitude and vertical speed filter.
+ * @details Alpha-beta filter in fixed point, the altitude and the speed are
+ *          in 1/256 cm and 1/256 cm/s, the gains in 1/65536.
+ */
+typedef struct bmp085_filter {
+  int32_t   altitude;   /**< Filtered altitude.                             */
+  int32_t   speed;      /**< Filtered vertical speed.                       */
+  int32_t   alpha;      /**< Altitude gain.                                 */
+  int32_t   gain;       /**< Speed gain, beta over the nominal period (/s). */
+  systime_t last;       /**< Time of the last sample.                       */
+  uint32_t  samples;    /**< Number of samples.                             */
+  uint32_t  cycles;     /**< Longest update (realtime counter cycles).      */
+  uint32_t  overBudget; /**< Updates longer than BMP085_FILTER_BUDGET.      */
+} bmp085_filter_t;
+
 /*==========================================================================*/
 /* Driver functions prototypes.                                             */
 /*==========================================================================*/
 
 msg_t bmp085GetCalibrationData(I2CDriver *i2cp, uint8_t addr);
+uint8_t bmp085GetPressureConversionTime(uint8_t oss);
+int32_t bmp085CompensateTemp(bmp085_calib_data_t *cdp, int32_t ut);
+int32_t bmp085CompensatePress(const bmp085_calib_data_t *cdp, int32_t up,
+                              uint8_t oss);
+float bmp085AltitudeFromPress(float press, float sealevel);
+float bmp085SeaLevelFromPress(float press, float altitude);
 msg_t bmp085ReadTemp(I2CDriver *i2cp, uint8_t addr, float *temp);
+msg_t bmp085StartTemp(I2CDriver *i2cp, uint8_t addr);
+msg_t bmp085FetchTemp(I2CDriver *i2cp, uint8_t addr, float *temp);
 msg_t bmp085ReadPress(I2CDriver *i2cp, uint8_t addr, uint8_t oss, float *press);
+msg_t bmp085StartPress(I2CDriver *i2cp, uint8_t addr, uint8_t oss);
+msg_t bmp085FetchPress(I2CDriver *i2cp, uint8_t addr, uint8_t oss,
+                       float *press);
+uint32_t bmp085GetSnapshot(bmp085_sample_t *sp, uint32_t *last);
+event_source_t *bmp085GetEventSource(void);
+void  bmp085RateInit(bmp085_rate_t *rp, I2CDriver *i2cp, uint8_t addr,
+                     uint16_t budget);
+msg_t bmp085RateStep(bmp085_rate_t *rp, float *press, systime_t *delay);
+uint16_t bmp085RateGetDuty(bmp085_rate_t *rp);
+int32_t bmp085PressToAltitude(int32_t press);
+void  bmp085FilterInit(bmp085_filter_t *fp, systime_t period, uint32_t q,
+                       uint32_t r);
+void  bmp085FilterUpdate(bmp085_filter_t *fp, int32_t press, systime_t time);
+int32_t bmp085FilterGetAltitude(const bmp085_filter_t *fp);
+int32_t bmp085FilterGetSpeed(const bmp085_filter_t *fp);
 msg_t bmp085GetAltitude(I2CDriver *i2cp, uint8_t addr, float *altitude);
 msg_t bmp085GetPressureAtSeaLevel(I2CDriver *i2cp, uint8_t addr,
                                   float *presssealevel);
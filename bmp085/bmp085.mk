@@ -1,5 +1,7 @@
 # List of all the BMP085 device files.
-BMP085SRC := $(DRIVERS)/bmp085/bmp085.c
+BMP085SRC := $(DRIVERS)/bmp085/bmp085.c \
+             $(DRIVERS)/bmp085/bmp085_rate.c \
+             $(DRIVERS)/bmp085/bmp085_filter.c
 
 # Required include directories.
 BMP085INC := $(DRIVERS)/bmp085/
@@ -0,0 +1,207 @@
+/**
+ *
+ * @file    bmp085_filter.c
+ *
+ * @brief   BMP085 altitude and vertical speed filter source file.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    23 June 2016
+ *
+ */
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Standard files. */
+#include <math.h>
+
+/* Driver file. */
+#include "bmp085.h"
+
+/*==========================================================================*/
+/* Driver local definitions.                                                */
+/*==========================================================================*/
+
+#define FILTER_TAB_MIN    29696   /**< Pressure of the first entry (Pa).    */
+#define FILTER_TAB_SHIFT  9       /**< log2 of the step of the table (Pa).  */
+
+/*
+ * Altitude of the standard atmosphere (cm) every 512 Pa, from 29696 Pa to
+ * 110592 Pa, with 101325 Pa at sea level:
+ *   altitude = 4433000 * (1 - (p / 101325)^(1 / 5.255))
+ * The linear interpolation between two entries is within 20 cm of the
+ * formula at 300 hPa, and within 2 cm near sea level.
+ */
+static const int32_t filterAltitudes[] = {
+   923324,  911889,  900609,  889481,  878499,  867660,  856959,
+   846393,  835958,  825650,  815465,  805401,  795455,  785623,
+   775903,  766291,  756785,  747383,  738082,  728879,  719772,
+   710760,  701839,  693009,  684266,  675609,  667036,  658545,
+   650135,  641804,  633550,  625371,  617267,  609235,  601274,
+   593383,  585561,  577805,  570115,  562490,  554929,  547429,
+   539991,  532612,  525293,  518031,  510827,  503678,  496584,
+   489544,  482557,  475622,  468739,  461906,  455123,  448388,
+   441702,  435063,  428471,  421924,  415423,  408966,  402553,
+   396183,  389855,  383570,  377325,  371122,  364958,  358834,
+   352748,  346701,  340692,  334721,  328786,  322887,  317024,
+   311196,  305404,  299645,  293921,  288230,  282572,  276947,
+   271354,  265793,  260263,  254764,  249296,  243858,  238450,
+   233071,  227722,  222401,  217109,  211845,  206609,  201400,
+   196219,  191064,  185935,  180833,  175757,  170707,  165681,
+   160681,  155706,  150755,  145828,  140926,  136047,  131191,
+   126359,  121549,  116763,  111999,  107257,  102537,   97839,
+    93162,   88507,   83873,   79260,   74667,   70096,   65544,
+    61012,   56501,   52009,   47536,   43083,   38649,   34234,
+    29838,   25460,   21101,   16760,   12437,    8132,    3845,
+     -425,   -4677,   -8912,  -13130,  -17330,  -21514,  -25682,
+   -29833,  -33967,  -38086,  -42188,  -46274,  -50345,  -54400,
+   -58439,  -62463,  -66471,  -70465,  -74443,
+};
+
+#define FILTER_TAB_SIZE \
+  ((int32_t)(sizeof(filterAltitudes) / sizeof(filterAltitudes[0])))
+
+/*==========================================================================*/
+/* Driver functions.                                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Convert a pressure to an altitude, without floating point.
+ * @details The altitude is interpolated in a table of the standard
+ *          atmosphere, the pressures out of the table are clamped.
+ *
+ * @param[in] press     compensated pressure (Pa)
+ * @return    altitude  altitude (cm)
+ */
+int32_t bmp085PressToAltitude(int32_t press) {
+
+  int32_t i, frac;
+
+  press -= FILTER_TAB_MIN;
+  if (press < 0)
+    return filterAltitudes[0];
+
+  i = press >> FILTER_TAB_SHIFT;
+  if (i >= FILTER_TAB_SIZE - 1)
+    return filterAltitudes[FILTER_TAB_SIZE - 1];
+
+  frac = press & ((1 << FILTER_TAB_SHIFT) - 1);
+
+  return filterAltitudes[i] +
+         ((filterAltitudes[i + 1] - filterAltitudes[i]) * frac) /
+         (1 << FILTER_TAB_SHIFT);
+}
+
+/**
+ * @brief   Initialize an altitude and vertical speed filter.
+ * @details The filter is the steady state Kalman filter of a constant
+ *          speed model, an alpha-beta filter whose gains follow from the
+ *          tracking index q * T^2 / r. A larger process noise follows the
+ *          climbs faster, a larger measurement noise smooths more. The
+ *          gains are computed once here, the updates only use integers.
+ *
+ * @param[out] fp       pointer to the filter
+ * @param[in]  period   nominal time between two samples
+ * @param[in]  q        process noise, the unmodeled acceleration (cm/s^2)
+ * @param[in]  r        measurement noise of the altitude (cm)
+ */
+void bmp085FilterInit(bmp085_filter_t *fp, systime_t period, uint32_t q,
+                      uint32_t r) {
+
+  float t, lambda, s, alpha, beta;
+
+  chDbgCheck((period > 0) && (r > 0));
+
+  t = (float)period / (float)CH_CFG_ST_FREQUENCY;
+  lambda = (float)q * t * t / (float)r;
+  s = sqrtf(lambda * lambda + 8.0f * lambda);
+
+  alpha = -(lambda * lambda + 8.0f * lambda - (lambda + 4.0f) * s) / 8.0f;
+  beta  = (lambda * lambda + 4.0f * lambda - lambda * s) / 4.0f;
+
+  fp->alpha      = (int32_t)(alpha * 65536.0f);
+  fp->gain       = (int32_t)(beta / t * 65536.0f);
+  fp->altitude   = 0;
+  fp->speed      = 0;
+  fp->samples    = 0;
+  fp->cycles     = 0;
+  fp->overBudget = 0;
+}
+
+/**
+ * @brief   Update a filter with a new pressure.
+ * @details The altitude is predicted at the time of the sample from the
+ *          speed, then both are corrected by the residual. The time
+ *          between two samples can vary, the gains stay the ones of the
+ *          nominal period.
+ * @note    The cost of the update is compared to BMP085_FILTER_BUDGET when
+ *          the port has a realtime counter.
+ *
+ * @param[in] fp      pointer to the filter
+ * @param[in] press   compensated pressure (Pa)
+ * @param[in] time    time of the sample
+ */
+void bmp085FilterUpdate(bmp085_filter_t *fp, int32_t press,
+                        systime_t time) {
+
+#if PORT_SUPPORTS_RT
+  rtcnt_t   start = chSysGetRealtimeCounterX();
+  rtcnt_t   cycles;
+#endif
+  uint32_t  dt;
+  int32_t   z, res;
+
+  z = bmp085PressToAltitude(press) * 256;
+
+  if (fp->samples == 0) {
+    fp->altitude = z;
+    fp->speed = 0;
+  }
+  else {
+    /* Time since the last sample in Q16 seconds, clamped to 65535 ticks. */
+    dt = (systime_t)(time - fp->last);
+    if (dt > 0xFFFF)
+      dt = 0xFFFF;
+    dt = (dt << 16) / CH_CFG_ST_FREQUENCY;
+
+    fp->altitude += (int32_t)(((int64_t)fp->speed * dt) >> 16);
+    res = z - fp->altitude;
+    fp->altitude += (int32_t)(((int64_t)fp->alpha * res) >> 16);
+    fp->speed += (int32_t)(((int64_t)fp->gain * res) >> 16);
+  }
+
+  fp->last = time;
+  fp->samples++;
+
+#if PORT_SUPPORTS_RT
+  cycles = chSysGetRealtimeCounterX() - start;
+  if (cycles > fp->cycles)
+    fp->cycles = cycles;
+  if (cycles > BMP085_FILTER_BUDGET)
+    fp->overBudget++;
+#endif
+}
+
+/**
+ * @brief   Get the filtered altitude.
+ *
+ * @param[in] fp        pointer to the filter
+ * @return    altitude  altitude (cm)
+ */
+int32_t bmp085FilterGetAltitude(const bmp085_filter_t *fp) {
+
+  return fp->altitude / 256;
+}
+
+/**
+ * @brief   Get the filtered vertical speed.
+ *
+ * @param[in] fp      pointer to the filter
+ * @return    speed   vertical speed, positive when climbing (cm/s)
+ */
+int32_t bmp085FilterGetSpeed(const bmp085_filter_t *fp) {
+
+  return fp->speed / 256;
+}
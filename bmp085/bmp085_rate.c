@@ -0,0 +1,196 @@
+/**
+ *
+ * @file    bmp085_rate.c
+ *
+ * @brief   BMP085 adaptive sampling source file.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    23 June 2016
+ *
+ */
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Standard files. */
+#include <math.h>
+
+/* Driver file. */
+#include "bmp085.h"
+
+/*==========================================================================*/
+/* Driver local definitions.                                                */
+/*==========================================================================*/
+
+/**
+ * @brief   Sampling level.
+ */
+typedef struct rate_level {
+  float     slope;    /**< Lowest |dP/dt| of the level (hPa/s).             */
+  uint8_t   oss;      /**< Oversampling setting.                            */
+  uint16_t  period;   /**< Time between two samples (ms).                   */
+} rate_level_t;
+
+/*
+ * Sampling levels, from the sparse ultra high resolution samples of a static
+ * pressure to the fast ultra low power samples of a climb or a descent.
+ */
+static const rate_level_t rateLevels[] = {
+  {0.00f, BMP085_ULTRA_HIGH_RESOLUTION,      1000},
+  {0.02f, BMP085_HIGH_RESOLUTION,             500},
+  {0.10f, BMP085_STANDARD_RESOLUTION,         200},
+  {0.50f, BMP085_ULTRA_LOW_POWER_RESOLUTION,   50},
+};
+
+#define RATE_LEVELS   ((uint8_t)(sizeof(rateLevels) / sizeof(rateLevels[0])))
+
+/*==========================================================================*/
+/* Driver local functions.                                                  */
+/*==========================================================================*/
+
+/**
+ * @brief   Apply a sampling level within the duty cycle budget.
+ * @details The period is stretched when the conversions of the level would
+ *          use the sensor more than the budget.
+ *
+ * @param[in] rp      pointer to the controller
+ * @param[in] level   sampling level
+ */
+static void rateSetLevel(bmp085_rate_t *rp, uint8_t level) {
+
+  uint32_t conv, period;
+
+  rp->level = level;
+  rp->oss   = rateLevels[level].oss;
+
+  /* A temperature is read every BMP085_RATE_TEMP_DIV samples. */
+  conv = bmp085GetPressureConversionTime(rp->oss) +
+         (BMP085_TEMP_CONVERSION_TIME + BMP085_RATE_TEMP_DIV - 1) /
+         BMP085_RATE_TEMP_DIV;
+
+  period = rateLevels[level].period;
+  if ((rp->budget > 0) && (conv * 1000 > period * rp->budget))
+    period = (conv * 1000 + rp->budget - 1) / rp->budget;
+
+  rp->period = MS2ST(period);
+}
+
+/*==========================================================================*/
+/* Driver Functions.                                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Initialize an adaptive sampling controller.
+ * @details The sampling starts at the sparsest level.
+ *
+ * @param[out] rp       pointer to the controller
+ * @param[in]  i2cp     pointer to the I2C device
+ * @param[in]  addr     bmp085 digital pressure sensor address
+ * @param[in]  budget   largest part of the time the sensor can convert, in
+ *                      permille, 0 for no limit
+ */
+void bmp085RateInit(bmp085_rate_t *rp, I2CDriver *i2cp, uint8_t addr,
+                    uint16_t budget) {
+
+  rp->i2cp    = i2cp;
+  rp->addr    = addr;
+  rp->budget  = budget;
+  rp->press   = 0;
+  rp->slope   = 0;
+  rp->busy    = 0;
+  rp->samples = 0;
+  rp->start   = chVTGetSystemTime();
+  rp->last    = rp->start;
+
+  rateSetLevel(rp, 0);
+}
+
+/**
+ * @brief   Take a sample and adapt the sampling to the pressure changes.
+ * @details The rate of change of the pressure is smoothed over the last
+ *          samples. A faster change moves the sampling one or more levels
+ *          up at once, a slower one moves it down one level per sample.
+ *
+ * @param[in]  rp       pointer to the controller
+ * @param[out] press    pointer to the pressure (hPa)
+ * @param[out] delay    time to wait before the next sample, the sampling
+ *                      period less the time spent in this sample, 0 if the
+ *                      sample took longer
+ * @return     msg      the result of the sample
+ */
+msg_t bmp085RateStep(bmp085_rate_t *rp, float *press, systime_t *delay) {
+
+  systime_t now = chVTGetSystemTime();
+  systime_t dt = (systime_t)(now - rp->last);
+  systime_t elapsed;
+  float     temp, slope;
+  uint8_t   level;
+  msg_t     msg = MSG_OK;
+
+  if ((rp->samples % BMP085_RATE_TEMP_DIV) == 0)
+    msg = bmp085ReadTemp(rp->i2cp, rp->addr, &temp);
+
+  if (msg == MSG_OK)
+    msg = bmp085ReadPress(rp->i2cp, rp->addr, rp->oss, press);
+
+  /* The reads block during the conversions, the next sample is a period
+     after the start of this one. */
+  chSysLock();
+  elapsed = chVTTimeElapsedSinceX(now);
+  rp->busy += elapsed;
+  chSysUnlock();
+  *delay = (elapsed < rp->period) ? (systime_t)(rp->period - elapsed) : 0;
+
+  if (msg != MSG_OK)
+    return msg;
+
+  if ((rp->samples > 0) && (dt > 0)) {
+    slope = fabsf(*press - rp->press) * CH_CFG_ST_FREQUENCY / dt;
+    rp->slope += (slope - rp->slope) / 4;
+  }
+
+  rp->press = *press;
+  rp->last  = now;
+  rp->samples++;
+
+  level = 0;
+  while ((level + 1 < RATE_LEVELS) &&
+         (rp->slope >= rateLevels[level + 1].slope))
+    level++;
+  if (level + 1 < rp->level)
+    level = rp->level - 1;
+  if (level != rp->level)
+    rateSetLevel(rp, level);
+
+  *delay = (elapsed < rp->period) ? (systime_t)(rp->period - elapsed) : 0;
+
+  return MSG_OK;
+}
+
+/**
+ * @brief   Get the achieved duty cycle of the sensor since the last call.
+ * @note    The duty cycle must be read more often than the system time
+ *          wraps.
+ *
+ * @param[in] rp      pointer to the controller
+ * @return    duty    part of the time spent in the conversions (permille),
+ *                    0 if unknown
+ */
+uint16_t bmp085RateGetDuty(bmp085_rate_t *rp) {
+
+  systime_t span, busy;
+
+  chSysLock();
+  span = chVTTimeElapsedSinceX(rp->start);
+  busy = rp->busy;
+  rp->start += span;
+  rp->busy = 0;
+  chSysUnlock();
+
+  if (span == 0)
+    return 0;
+
+  return (uint16_t)(((uint64_t)busy * 1000) / span);
+}
@@ -24,6 +24,8 @@
 
 /**
  * @brief I2C Configuration structure
+ * @note  The clock speed is the highest speed of the bus, the I2C driver
+ *        lowers it during the transfers with the DS1307.
  */
 static const I2CConfig i2cConfig = {
   OPMODE_I2C,         /**< I2C Operation mode.                              */
@@ -31,6 +33,19 @@ static const I2CConfig i2cConfig = {
   FAST_DUTY_CYCLE_2,  /**< I2C Duty cycle mode.                             */
 };
 
+/**
+ * @brief   Shadow of the control register.
+ * @note    The time registers are not shadowed, the RTC changes them.
+ */
+static iic_shadow_t ds1307Shadow[] = {
+  {DS1307_CONTROL_REG, 0, false},
+};
+
+/**
+ * @brief   Event source of the driver.
+ */
+static EVENTSOURCE_DECL(ds1307Event);
+
 /*==========================================================================*/
 /* Driver functions.                                                        */
 /*==========================================================================*/
@@ -59,6 +74,82 @@ uint8_t dec2Bcd(uint8_t val) {
   return res;
 }
 
+/**
+ * @brief   Decode the clock and calendar registers of the RTC.
+ *
+ * @param[in]   regs      pointer to the seven registers, from the seconds
+ * @param[in]   refYear   reference year of the RTC
+ * @param[out]  rtc       pointer to the decoded clock
+ */
+void ds1307DecodeClock(const uint8_t *regs, uint16_t refYear,
+                       ds1307_data_t *rtc) {
+
+  rtc->seconds  = bcd2Dec(regs[0] & 0x7F);
+  rtc->minutes  = bcd2Dec(regs[1]);
+  rtc->hours    = bcd2Dec(regs[2] & 0x3F );
+  rtc->day      = bcd2Dec(regs[3]);
+  rtc->date     = bcd2Dec(regs[4]);
+  rtc->month    = bcd2Dec(regs[5]);
+  rtc->year     = bcd2Dec(regs[6]) + refYear;
+}
+
+/**
+ * @brief   Encode a clock into the clock and calendar registers of the RTC.
+ *
+ * @param[in]   rtc       pointer to the clock
+ * @param[in]   refYear   reference year of the RTC
+ * @param[out]  regs      pointer to the seven registers, from the seconds
+ */
+void ds1307EncodeClock(const ds1307_data_t *rtc, uint16_t refYear,
+                       uint8_t *regs) {
+
+  regs[0] = dec2Bcd(rtc->seconds);
+  regs[1] = dec2Bcd(rtc->minutes);
+  regs[2] = dec2Bcd(rtc->hours);
+  regs[3] = dec2Bcd(rtc->day);
+  regs[4] = dec2Bcd(rtc->date);
+  regs[5] = dec2Bcd(rtc->month);
+  regs[6] = dec2Bcd(rtc->year - refYear);
+}
+
+/**
+ * @brief   Convert a clock to a number of seconds.
+ * @note    The clock must be between the years 2000 and 2099, the leap
+ *          years are the years divisible by 4.
+ *
+ * @param[in]   rtc       pointer to the clock
+ * @return      epoch     seconds since 01/01/2000 00:00:00,
+ *                        DS1307_EPOCH_INVALID if a field of the clock is
+ *                        out of range, a RTC which lost its power or a
+ *                        corrupted read for example
+ */
+uint32_t ds1307GetEpoch(const ds1307_data_t *rtc) {
+
+  static const uint16_t monthDays[13] = {
+    0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365
+  };
+  uint32_t  years = rtc->year - 2000;
+  uint32_t  days, length;
+
+  if ((rtc->year < 2000) || (years > 99) ||
+      (rtc->month < 1) || (rtc->month > 12) ||
+      (rtc->hours > 23) || (rtc->minutes > 59) || (rtc->seconds > 59))
+    return DS1307_EPOCH_INVALID;
+
+  length = monthDays[rtc->month] - monthDays[rtc->month - 1];
+  if (((years % 4) == 0) && (rtc->month == 2))
+    length++;
+  if ((rtc->date < 1) || (rtc->date > length))
+    return DS1307_EPOCH_INVALID;
+
+  days = years * 365 + (years + 3) / 4 + monthDays[rtc->month - 1] +
+         rtc->date - 1;
+  if (((years % 4) == 0) && (rtc->month > 2))
+    days++;
+
+  return ((days * 24 + rtc->hours) * 60 + rtc->minutes) * 60 + rtc->seconds;
+}
+
 /* TODO: This function must me remove. */
 
 /**
@@ -99,7 +190,13 @@ void printn(int16_t number) {
  */
  void ds1307InitInterface(void) {
  
-  i2cStart(&I2CD1, &i2cConfig);
+  (void)i2cBusStart(&I2CD1, &i2cConfig);
+  (void)i2cRegisterDevice(&I2CD1, DS1307_ADDRESS, DS1307_I2C_CLOCK,
+                          IIC_PRIO_LOW);
+  (void)i2cShadowRegisters(&I2CD1, DS1307_ADDRESS, ds1307Shadow,
+                           sizeof(ds1307Shadow) / sizeof(ds1307Shadow[0]),
+                           true);
+  (void)i2cCoalesceReads(&I2CD1, DS1307_ADDRESS, DS1307_READ_WINDOW);
   palSetPadMode(GPIOB, 8, PAL_MODE_ALTERNATE(4) |
                 PAL_STM32_OTYPE_OPENDRAIN); /* SCL. */
   palSetPadMode(GPIOB, 9, PAL_MODE_ALTERNATE(4) |
@@ -116,13 +213,7 @@ void ds1307SetClock(rtcDriver_t *rtcp) {
   msg_t msg;
 
   rtcp->txbuf[0] = DS1307_SECONDS_REG;
-  rtcp->txbuf[1] = dec2Bcd(rtcp->rtc.seconds);
-  rtcp->txbuf[2] = dec2Bcd(rtcp->rtc.minutes);
-  rtcp->txbuf[3] = dec2Bcd(rtcp->rtc.hours);
-  rtcp->txbuf[4] = dec2Bcd(rtcp->rtc.day);
-  rtcp->txbuf[5] = dec2Bcd(rtcp->rtc.date);
-  rtcp->txbuf[6] = dec2Bcd(rtcp->rtc.month);
-  rtcp->txbuf[7] = dec2Bcd(rtcp->rtc.year - rtcp->refYear);
+  ds1307EncodeClock(&rtcp->rtc, rtcp->refYear, &rtcp->txbuf[1]);
 
   msg = i2cWriteRegisters(&I2CD1, DS1307_ADDRESS, rtcp->txbuf,
                           DS1307_MAX_DATA_SIZE);
@@ -133,6 +224,23 @@ void ds1307SetClock(rtcDriver_t *rtcp) {
     print("\n\r DS1307 was setting succefuly.");
 }
 
+/**
+ * @brief   Set the control register of the RTC.
+ * @details The register is only written when its value changes.
+ *
+ * @param[in]   control   value of the register, DS1307_CONTROL_xxx bits
+ * @return      msg       the result of the writing operation
+ */
+msg_t ds1307SetControl(uint8_t control) {
+
+  uint8_t txbuf[2];
+
+  txbuf[0] = DS1307_CONTROL_REG;
+  txbuf[1] = control;
+
+  return i2cWriteRegisters(&I2CD1, DS1307_ADDRESS, txbuf, 2);
+}
+
 /* TODO: This function must be removed from here. */
 
 /**
@@ -142,47 +250,116 @@ void ds1307SetClock(rtcDriver_t *rtcp) {
  */
 void ds1307PrintClock(rtcDriver_t *rtcp) {
 
+  ds1307_data_t rtc;
+
+  /* The clock may be published by another thread during the print. */
+  (void)ds1307GetSnapshot(rtcp, &rtc, NULL);
+
   print("\n\r");
-  printn(rtcp->rtc.date);
+  printn(rtc.date);
   print("/");
-  printn( rtcp->rtc.month);
+  printn(rtc.month);
   print("/");
-  printn(rtcp->rtc.year);
+  printn(rtc.year);
   print(" ");
 
-  printn(rtcp->rtc.hours);
+  printn(rtc.hours);
   print(":");
-  printn(rtcp->rtc.minutes);
+  printn(rtc.minutes);
   print(":");
-  printn(rtcp->rtc.seconds);
+  printn(rtc.seconds);
 }
 
 /**
  * @brief   Get Clock and Calendar.
  *
  * @param[out]  rtcp  pointer to the RTC driver module
+ * @return      msg   the result of the reading operation
  */
-void ds1307GetClock(rtcDriver_t *rtcp) {
+msg_t ds1307GetClock(rtcDriver_t *rtcp) {
 
-  msg_t msg;
+  uint8_t       txbuf[1];
+  uint8_t       rxbuf[DS1307_MAX_DATA_SIZE - 1];
+  ds1307_data_t rtc;
+  msg_t         msg;
 
-  rtcp->txbuf[0] = DS1307_SECONDS_REG; /* Register address of the Seconds. */
+  txbuf[0] = DS1307_SECONDS_REG; /* Register address of the Seconds. */
 
-  msg = i2cReadRegisters(&I2CD1, DS1307_ADDRESS, rtcp->txbuf, rtcp->rxbuf,
+  msg = i2cReadRegisters(&I2CD1, DS1307_ADDRESS, txbuf, rxbuf,
                          DS1307_MAX_DATA_SIZE - 1);
 
   if (msg != MSG_OK) {
       rtcp->errors = i2cGetErrors(&I2CD1);
       print("\n\r I2C transmission error!");
+      chEvtBroadcastFlags(&ds1307Event, DS1307_EVENT_ERROR);
   }
   else {
-    rtcp->rtc.seconds  = bcd2Dec(rtcp->rxbuf[0] & 0x7F);
-    rtcp->rtc.minutes  = bcd2Dec(rtcp->rxbuf[1]);
-    rtcp->rtc.hours    = bcd2Dec(rtcp->rxbuf[2] & 0x3F );
-    rtcp->rtc.day      = bcd2Dec(rtcp->rxbuf[3]);
-    rtcp->rtc.date     = bcd2Dec(rtcp->rxbuf[4]);
-    rtcp->rtc.month    = bcd2Dec(rtcp->rxbuf[5]);
-    rtcp->rtc.year     = bcd2Dec(rtcp->rxbuf[6]) + rtcp->refYear;
+    ds1307DecodeClock(rxbuf, rtcp->refYear, &rtc);
+
+    /* Publish the clock in the snapshot not read by the readers, the
+       writers only wait for each other. */
+    chSysLock();
+    rtcp->rtc = rtc;
+    rtcp->snapshot[(rtcp->version + 1) & 1] = rtc;
+    __sync_synchronize();
+    rtcp->version++;
+    chEvtBroadcastFlagsI(&ds1307Event, DS1307_EVENT_NEW_DATA);
+    chSchRescheduleS();
+    chSysUnlock();
   }
+
+  return msg;
+}
+
+/**
+ * @brief   Get a consistent copy of the last clock read from the RTC.
+ * @details The readers never block and never block the writers. A copy is
+ *          only done again when two clocks were published during the copy,
+ *          the snapshot being copied was then overwritten.
+ *          Each reader keeps the version of the last clock it took, any
+ *          number of readers can tell the clocks they missed.
+ * @note    The retry only detects an overwritten snapshot because
+ *          ds1307GetClock() publishes under chSysLock() on a single core.
+ *
+ * @param[in]     rtcp    pointer to the RTC driver module
+ * @param[out]    rtc     pointer to the copy of the clock
+ * @param[in,out] last    version of the clock last taken by the reader, 0
+ *                        at first, set to the version of the copy. Can be
+ *                        NULL if the reader does not count its overruns
+ * @return        missed  number of clocks published since the last copy of
+ *                        the reader and not taken by it
+ */
+uint32_t ds1307GetSnapshot(rtcDriver_t *rtcp, ds1307_data_t *rtc,
+                           uint32_t *last) {
+
+  uint32_t version, missed = 0;
+
+  do {
+    version = rtcp->version;
+    __sync_synchronize();
+    *rtc = rtcp->snapshot[version & 1];
+    __sync_synchronize();
+  } while ((uint32_t)(rtcp->version - version) >= 2);
+
+  if (last != NULL) {
+    if (version != *last)
+      missed = (uint32_t)(version - *last - 1);
+    *last = version;
+  }
+
+  return missed;
+}
+
+/**
+ * @brief   Get the event source of the driver.
+ * @details The event source broadcasts DS1307_EVENT_NEW_DATA when a clock
+ *          is read and DS1307_EVENT_ERROR when the clock cannot be read.
+ *          The clocks missed by a reader are counted by ds1307GetSnapshot().
+ *
+ * @return    esp   pointer to the event source
+ */
+event_source_t *ds1307GetEventSource(void) {
+
+  return &ds1307Event;
 }
 
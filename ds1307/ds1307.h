@@ -24,6 +24,18 @@
 #include "ch.h"
 #include "hal.h"
 
+/*==========================================================================*/
+/* Driver pre-compile time settings.                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Number of day slots of the calendar timer wheel.
+ * @note    The default is 32.
+ */
+#if !defined(DS1307_WHEEL_DAYS) || defined(__DOXYGEN__)
+#define DS1307_WHEEL_DAYS   32
+#endif
+
 /*==========================================================================*/
 /* Driver macro.                                                            */
 /*==========================================================================*/
@@ -32,6 +44,30 @@
 
 #define DS1307_ADDRESS      0x68 /**< RTC Address.                          */
 #define DS1307_SECONDS_REG  0x00 /**< RTC register containing the seconds.  */
+#define DS1307_CONTROL_REG  0x07 /**< RTC square wave control register.     */
+#define DS1307_I2C_CLOCK    100000 /**< RTC maximum I2C clock (Hz).         */
+#define DS1307_READ_WINDOW  MS2ST(5) /**< Reads of the clock are shared.    */
+
+/**
+ * @brief   Epoch of a clock out of range, see ds1307GetEpoch().
+ */
+#define DS1307_EPOCH_INVALID  ((uint32_t)0xFFFFFFFF)
+
+/*
+ * Event flags of the driver.
+ */
+#define DS1307_EVENT_NEW_DATA ((eventflags_t)1) /**< A clock was read.      */
+#define DS1307_EVENT_ERROR    ((eventflags_t)2) /**< A read failed.         */
+
+/*
+ * Bits of the control register.
+ */
+#define DS1307_CONTROL_OUT  0x80 /**< Output level, square wave disabled.   */
+#define DS1307_CONTROL_SQWE 0x10 /**< Square wave output enable.            */
+#define DS1307_CONTROL_1HZ  0x00 /**< Square wave at 1 Hz.                  */
+#define DS1307_CONTROL_4KHZ 0x01 /**< Square wave at 4.096 kHz.             */
+#define DS1307_CONTROL_8KHZ 0x02 /**< Square wave at 8.192 kHz.             */
+#define DS1307_CONTROL_32KHZ 0x03 /**< Square wave at 32.768 kHz.           */
 
 /*==========================================================================*/
 /* Driver data structure.                                                   */
@@ -56,11 +92,48 @@ typedef struct rtcDriver {
   i2cflags_t    errors;
 
   ds1307_data_t rtc;
+  ds1307_data_t snapshot[2];  /**< Published clocks, see ds1307GetSnapshot. */
+  volatile uint32_t version;  /**< Number of published clocks.              */
   uint16_t      refYear;  /**< RTC reference year.  */
   uint8_t       dps;
   uint8_t       dtp;
 }rtcDriver_t;
 
+/**
+ * @brief   Callback of a calendar timer.
+ */
+typedef void (*ds1307_timer_cb_t)(void *arg);
+
+/**
+ * @brief   Calendar timer.
+ */
+typedef struct ds1307_timer {
+  struct ds1307_timer   *next;    /**< Next timer of the slot.              */
+  struct ds1307_timer   **pprev;  /**< Link to the timer, NULL if not set.  */
+  uint32_t              when;     /**< RTC time of the next firing (s).     */
+  uint32_t              period;   /**< Time between two firings (s), or 0.  */
+  ds1307_timer_cb_t     cb;       /**< Function called at the firing.       */
+  void                  *arg;     /**< Argument of the callback.            */
+} ds1307_timer_t;
+
+/**
+ * @brief   Calendar timer wheel.
+ * @details The timers are kept in the slots of four wheels, the seconds of
+ *          the current minute, the minutes of the current hour, the hours
+ *          of the current day and the days. Setting, resetting and firing
+ *          a timer do not depend on the number of timers.
+ */
+typedef struct ds1307_wheel {
+  ds1307_timer_t    *seconds[60];               /**< Seconds wheel.         */
+  ds1307_timer_t    *minutes[60];               /**< Minutes wheel.         */
+  ds1307_timer_t    *hours[24];                 /**< Hours wheel.           */
+  ds1307_timer_t    *days[DS1307_WHEEL_DAYS];   /**< Days wheel.            */
+  mutex_t           mtx;                        /**< Lock of the wheel.     */
+  uint32_t          now;                        /**< RTC time of the wheel. */
+  volatile uint32_t pending;                    /**< Ticks not advanced.    */
+  thread_reference_t thread;                    /**< Thread of the wheel.   */
+} ds1307_wheel_t;
+
 
 //typedef struct ds1307_t rtcDriver;
 //rtcDriver_t rtcDriver;
@@ -72,11 +145,27 @@ typedef struct rtcDriver {
 
 uint8_t bcd2Dec(uint8_t val);
 uint8_t dec2Bcd(uint8_t val);
+void    ds1307DecodeClock(const uint8_t *regs, uint16_t refYear,
+                          ds1307_data_t *rtc);
+void    ds1307EncodeClock(const ds1307_data_t *rtc, uint16_t refYear,
+                          uint8_t *regs);
+uint32_t ds1307GetEpoch(const ds1307_data_t *rtc);
 void    print(char *p);
 void    ds1307InitInterface(void);
 void    ds1307PrintClock(rtcDriver_t *rtcp);
-void    ds1307GetClock(rtcDriver_t *rtcp);
+msg_t   ds1307GetClock(rtcDriver_t *rtcp);
+uint32_t ds1307GetSnapshot(rtcDriver_t *rtcp, ds1307_data_t *rtc,
+                           uint32_t *last);
+event_source_t *ds1307GetEventSource(void);
 void    ds1307SetClock(rtcDriver_t *rtcp);
+msg_t   ds1307SetControl(uint8_t control);
+void    ds1307WheelInit(ds1307_wheel_t *wp, uint32_t now);
+void    ds1307WheelSet(ds1307_wheel_t *wp, ds1307_timer_t *tp, uint32_t when,
+                       uint32_t period, ds1307_timer_cb_t cb, void *arg);
+void    ds1307WheelReset(ds1307_wheel_t *wp, ds1307_timer_t *tp);
+void    ds1307WheelAdvance(ds1307_wheel_t *wp, uint32_t now);
+void    ds1307WheelTickI(ds1307_wheel_t *wp);
+void    ds1307WheelRun(ds1307_wheel_t *wp);
 
 #endif /* DS1307_H */
 
@@ -1,5 +1,6 @@
 # List of all the DS1307 device files.
-DS1307SRC := $(DRIVERS)/ds1307/ds1307.c
+DS1307SRC := $(DRIVERS)/ds1307/ds1307.c \
+             $(DRIVERS)/ds1307/ds1307_wheel.c
 
 # Required include directories.
 DS1307INC := $(DRIVERS)/ds1307/
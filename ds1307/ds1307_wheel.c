@@ -0,0 +1,334 @@
+/**
+ *
+ * @file     ds1307_wheel.c
+ *
+ * @brief    Calendar timer wheel driven by the real time clock.
+ *
+ * @author   Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date     21 June 2015
+ *
+ */
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Drivers files. */
+#include "ds1307.h"
+
+/*==========================================================================*/
+/* Driver local definitions.                                                */
+/*==========================================================================*/
+
+#define WHEEL_MINUTE  60UL
+#define WHEEL_HOUR    3600UL
+#define WHEEL_DAY     86400UL
+
+/*==========================================================================*/
+/* Driver local functions.                                                  */
+/*==========================================================================*/
+
+/**
+ * @brief   Link a timer at the head of a list.
+ *
+ * @param[in] head    pointer to the head of the list
+ * @param[in] tp      pointer to the timer
+ */
+static void wheelLink(ds1307_timer_t **head, ds1307_timer_t *tp) {
+
+  tp->next = *head;
+  if (tp->next != NULL)
+    tp->next->pprev = &tp->next;
+  tp->pprev = head;
+  *head = tp;
+}
+
+/**
+ * @brief   Unlink a timer from its list.
+ *
+ * @param[in] tp      pointer to the timer
+ */
+static void wheelUnlink(ds1307_timer_t *tp) {
+
+  *tp->pprev = tp->next;
+  if (tp->next != NULL)
+    tp->next->pprev = tp->pprev;
+  tp->pprev = NULL;
+}
+
+/**
+ * @brief   Insert a timer in the wheel.
+ * @details The timer goes in the seconds of the current minute, the minutes
+ *          of the current hour, the hours of the current day or the days,
+ *          and moves to a finer wheel when its minute, hour or day starts.
+ *          The time of the timer is after the time of the wheel, or equal
+ *          to it when the timers of the current second are not fired yet.
+ *
+ * @param[in] wp      pointer to the wheel
+ * @param[in] tp      pointer to the timer
+ */
+static void wheelInsert(ds1307_wheel_t *wp, ds1307_timer_t *tp) {
+
+  uint32_t when = tp->when;
+  uint32_t now = wp->now;
+
+  if (when / WHEEL_MINUTE == now / WHEEL_MINUTE)
+    wheelLink(&wp->seconds[when % WHEEL_MINUTE], tp);
+  else if (when / WHEEL_HOUR == now / WHEEL_HOUR)
+    wheelLink(&wp->minutes[(when / WHEEL_MINUTE) % 60], tp);
+  else if (when / WHEEL_DAY == now / WHEEL_DAY)
+    wheelLink(&wp->hours[(when / WHEEL_HOUR) % 24], tp);
+  else
+    wheelLink(&wp->days[(when / WHEEL_DAY) % DS1307_WHEEL_DAYS], tp);
+}
+
+/**
+ * @brief   Move the timers of a slot to the finer wheels.
+ * @note    The timers more than DS1307_WHEEL_DAYS days away go back to
+ *          their day slot.
+ *
+ * @param[in] wp      pointer to the wheel
+ * @param[in] slot    pointer to the slot
+ */
+static void wheelCascade(ds1307_wheel_t *wp, ds1307_timer_t **slot) {
+
+  ds1307_timer_t *list = NULL, *tp;
+
+  /* Detached first, a timer can go back to the same slot. */
+  if (*slot != NULL) {
+    list = *slot;
+    list->pprev = &list;
+    *slot = NULL;
+  }
+
+  while ((tp = list) != NULL) {
+    wheelUnlink(tp);
+    wheelInsert(wp, tp);
+  }
+}
+
+/**
+ * @brief   Get the next time the wheel has something to do.
+ * @details The time is the next firing of a timer of the seconds wheel or
+ *          the next start of a minute, an hour or a day whose slot holds
+ *          timers to cascade. The slots in between are empty, the wheel
+ *          can jump over them.
+ *
+ * @param[in] wp      pointer to the wheel, locked
+ * @return    next    time of the next step of the wheel
+ */
+static uint32_t wheelNext(const ds1307_wheel_t *wp) {
+
+  uint32_t  now = wp->now;
+  uint32_t  t;
+  uint8_t   i;
+
+  /* The slots before the current one were fired or cascaded already. */
+  for (i = now % 60 + 1; i < 60; i++) {
+    if (wp->seconds[i] != NULL)
+      return now - now % 60 + i;
+  }
+
+  t = now / WHEEL_MINUTE;
+  for (i = t % 60 + 1; i < 60; i++) {
+    if (wp->minutes[i] != NULL)
+      return (t - t % 60 + i) * WHEEL_MINUTE;
+  }
+
+  t = now / WHEEL_HOUR;
+  for (i = t % 24 + 1; i < 24; i++) {
+    if (wp->hours[i] != NULL)
+      return (t - t % 24 + i) * WHEEL_HOUR;
+  }
+
+  /* The slot of the current day comes back after DS1307_WHEEL_DAYS days,
+     the wheel is empty when no day slot holds timers. */
+  t = now / WHEEL_DAY;
+  for (i = 1; i <= DS1307_WHEEL_DAYS; i++) {
+    if (wp->days[(t + i) % DS1307_WHEEL_DAYS] != NULL)
+      break;
+  }
+
+  return (t + i) * WHEEL_DAY;
+}
+
+/**
+ * @brief   Advance the wheel by one second and fire its timers.
+ * @details The callbacks are called with the wheel unlocked, they can set
+ *          or reset any timer.
+ *
+ * @param[in] wp      pointer to the wheel, locked
+ */
+static void wheelStep(ds1307_wheel_t *wp) {
+
+  ds1307_timer_t    *fired = NULL, *tp;
+  ds1307_timer_cb_t cb;
+  void              *arg;
+  uint32_t          now = ++wp->now;
+
+  if ((now % WHEEL_DAY) == 0)
+    wheelCascade(wp, &wp->days[(now / WHEEL_DAY) % DS1307_WHEEL_DAYS]);
+  if ((now % WHEEL_HOUR) == 0)
+    wheelCascade(wp, &wp->hours[(now / WHEEL_HOUR) % 24]);
+  if ((now % WHEEL_MINUTE) == 0)
+    wheelCascade(wp, &wp->minutes[(now / WHEEL_MINUTE) % 60]);
+
+  if (wp->seconds[now % WHEEL_MINUTE] != NULL) {
+    fired = wp->seconds[now % WHEEL_MINUTE];
+    fired->pprev = &fired;
+    wp->seconds[now % WHEEL_MINUTE] = NULL;
+  }
+
+  while ((tp = fired) != NULL) {
+    wheelUnlink(tp);
+    cb  = tp->cb;
+    arg = tp->arg;
+    if (tp->period > 0) {
+      tp->when += tp->period;
+      wheelInsert(wp, tp);
+    }
+
+    chMtxUnlock(&wp->mtx);
+    cb(arg);
+    chMtxLock(&wp->mtx);
+  }
+}
+
+/*==========================================================================*/
+/* Driver functions.                                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Initialize a calendar timer wheel.
+ *
+ * @param[out] wp     pointer to the wheel
+ * @param[in]  now    current RTC time, see ds1307GetEpoch()
+ */
+void ds1307WheelInit(ds1307_wheel_t *wp, uint32_t now) {
+
+  uint8_t i;
+
+  for (i = 0; i < 60; i++) {
+    wp->seconds[i] = NULL;
+    wp->minutes[i] = NULL;
+  }
+  for (i = 0; i < 24; i++)
+    wp->hours[i] = NULL;
+  for (i = 0; i < DS1307_WHEEL_DAYS; i++)
+    wp->days[i] = NULL;
+
+  chMtxObjectInit(&wp->mtx);
+  wp->now     = now;
+  wp->pending = 0;
+  wp->thread  = NULL;
+}
+
+/**
+ * @brief   Set a timer of a wheel.
+ * @details The timer is reset first if it is already set. The insertion
+ *          does not depend on the number of timers.
+ * @note    A timer never set must be cleared to zero.
+ *
+ * @param[in] wp      pointer to the wheel
+ * @param[in] tp      pointer to the timer
+ * @param[in] when    RTC time of the first firing, see ds1307GetEpoch(),
+ *                    a time already reached fires at the next second
+ * @param[in] period  time between two firings (s), 0 for a single firing
+ * @param[in] cb      function called when the timer fires
+ * @param[in] arg     argument of the callback
+ */
+void ds1307WheelSet(ds1307_wheel_t *wp, ds1307_timer_t *tp, uint32_t when,
+                    uint32_t period, ds1307_timer_cb_t cb, void *arg) {
+
+  chMtxLock(&wp->mtx);
+  if (tp->pprev != NULL)
+    wheelUnlink(tp);
+  tp->when   = ((int32_t)(when - wp->now) > 0) ? when : wp->now + 1;
+  tp->period = period;
+  tp->cb     = cb;
+  tp->arg    = arg;
+  wheelInsert(wp, tp);
+  chMtxUnlock(&wp->mtx);
+}
+
+/**
+ * @brief   Reset a timer of a wheel.
+ * @note    A timer never set must be cleared to zero.
+ *
+ * @param[in] wp      pointer to the wheel
+ * @param[in] tp      pointer to the timer
+ */
+void ds1307WheelReset(ds1307_wheel_t *wp, ds1307_timer_t *tp) {
+
+  chMtxLock(&wp->mtx);
+  if (tp->pprev != NULL)
+    wheelUnlink(tp);
+  chMtxUnlock(&wp->mtx);
+}
+
+/**
+ * @brief   Advance a wheel to an RTC time and fire the timers reached.
+ * @details The wheel jumps over its empty slots, a large jump of the RTC
+ *          costs a step per slot holding timers and at most a step per day.
+ *          A time before the time of the wheel is ignored, the wheel then
+ *          waits for the RTC.
+ *
+ * @param[in] wp      pointer to the wheel
+ * @param[in] now     current RTC time, see ds1307GetEpoch()
+ */
+void ds1307WheelAdvance(ds1307_wheel_t *wp, uint32_t now) {
+
+  uint32_t next;
+
+  chMtxLock(&wp->mtx);
+  while ((int32_t)(now - wp->now) > 0) {
+    next = wheelNext(wp);
+    if ((int32_t)(next - now) > 0)
+      next = now;
+    wp->now = next - 1;
+    wheelStep(wp);
+  }
+  chMtxUnlock(&wp->mtx);
+}
+
+/**
+ * @brief   Signal a second boundary of the RTC.
+ * @details Called from the interrupt of the 1 Hz square wave output of the
+ *          RTC, enabled with ds1307SetControl(DS1307_CONTROL_SQWE |
+ *          DS1307_CONTROL_1HZ). The wheel is advanced by ds1307WheelRun().
+ *
+ * @param[in] wp      pointer to the wheel
+ *
+ * @iclass
+ */
+void ds1307WheelTickI(ds1307_wheel_t *wp) {
+
+  wp->pending++;
+  chThdResumeI(&wp->thread, MSG_OK);
+}
+
+/**
+ * @brief   Advance a wheel at each second boundary of the RTC.
+ * @details The calling thread sleeps between the ticks given by
+ *          ds1307WheelTickI() and runs the callbacks of the timers. The
+ *          seconds missed while the callbacks run are caught up.
+ * @note    This function never returns.
+ *
+ * @param[in] wp      pointer to the wheel
+ */
+void ds1307WheelRun(ds1307_wheel_t *wp) {
+
+  uint32_t ticks;
+
+  for (;;) {
+    chSysLock();
+    if (wp->pending == 0)
+      (void)chThdSuspendS(&wp->thread);
+    ticks = wp->pending;
+    wp->pending = 0;
+    chSysUnlock();
+
+    ds1307WheelAdvance(wp, wp->now + ticks);
+  }
+}
@@ -0,0 +1,531 @@
+/**
+ *
+ * @file    bench.c
+ *
+ * @brief   Microbenchmarks of the compute kernels of the drivers on the host.
+ *
+ * @details Each benchmark runs a kernel in a loop, the number of operations
+ *          is doubled until a run lasts BENCH_MIN_NS, the time of an
+ *          operation is the best of BENCH_REPEATS runs. A reference loop
+ *          is timed before each run and the costs are taken in reference
+ *          units, so that a change of the speed of the host does not look
+ *          like a regression. The allocations are counted by
+ *          wrapping malloc(), calloc() and realloc() at the link:
+ *          - run [baseline]: the benchmarks are compared to a baseline, a
+ *            cost BENCH_THRESHOLD times higher or a new allocation is a
+ *            regression and the program fails. A benchmark over the
+ *            threshold is measured again BENCH_RETRIES times, the best
+ *            measure is kept, the noise of a shared host lasts longer than
+ *            a run.
+ *          - save [baseline]: the suite is run BENCH_SAVES times, the
+ *            median of each benchmark is written as the new baseline.
+ *          The led-cube kernels write the simulated ports, the program is
+ *          built with the AVR tick.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Standard files. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* ChibiOS files. */
+#include "ch.h"
+#include "hal.h"
+
+/* Driver files. */
+#include "bmp085.h"
+#include "ds1307.h"
+#include "ledcube.h"
+
+/*==========================================================================*/
+/* Local definitions.                                                       */
+/*==========================================================================*/
+
+#define BENCH_MIN_NS      10000000ULL /**< Shortest run (ns).               */
+#define BENCH_REPEATS     15          /**< Runs of a benchmark.             */
+#define BENCH_THRESHOLD   2.0         /**< Slowdown taken as a regression.  */
+#define BENCH_MAX         16          /**< Benchmarks of a baseline.        */
+#define BENCH_BASELINE    "bench.txt" /**< Default baseline file.           */
+#define BENCH_REF_OPS     1000000     /**< Iterations of the reference.     */
+#define BENCH_RETRIES     5           /**< New measures of a regression.    */
+#define BENCH_SAVES       3           /**< Runs of a baseline, odd.         */
+
+/**
+ * @brief   Benchmark, runs @p n iterations of a kernel.
+ */
+typedef struct {
+  const char  *name;                          /**< Name of the benchmark.   */
+  void        (*fn)(uint32_t n);              /**< Function.                */
+  uint32_t    ops;                            /**< Operations an iteration. */
+} bench_t;
+
+/**
+ * @brief   Result of a benchmark.
+ */
+typedef struct {
+  char        name[32];                       /**< Name of the benchmark.   */
+  double      ns;                             /**< Time of an operation.    */
+  double      allocs;                         /**< Allocations an operation.*/
+  double      ref;                            /**< Time of the reference.   */
+} bench_result_t;
+
+/**
+ * @brief   Command of the program.
+ */
+typedef struct {
+  const char  *name;                          /**< Name of the command.     */
+  int         (*fn)(int argc, char **argv);   /**< Function.                */
+  const char  *help;                          /**< Arguments.               */
+} sim_cmd_t;
+
+/*==========================================================================*/
+/* Local variables.                                                         */
+/*==========================================================================*/
+
+static volatile uint32_t  benchRefSink = 2463534242UL;
+static volatile int32_t   benchSink;
+static volatile float     benchSinkf;
+static uint32_t           benchAllocs;
+static uint32_t           benchIsrBody = ~0U;
+
+/**
+ * @brief   Calibration of the example of the BMP085 datasheet.
+ */
+static bmp085_calib_data_t benchCalib = {
+  .ac1 = 408, .ac2 = -72, .ac3 = -14383, .ac4 = 32741, .ac5 = 32757,
+  .ac6 = 23153, .b1 = 6190, .b2 = 4, .mb = -32768, .mc = -8711, .md = 2868
+};
+
+/**
+ * @brief   Clock registers of the DS1307, 31/12/2016 23:59:59.
+ */
+static const uint8_t benchClock[7] = {
+  0x59, 0x59, 0x23, 0x06, 0x31, 0x12, 0x16
+};
+
+/*==========================================================================*/
+/* Allocation counters.                                                     */
+/*==========================================================================*/
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+
+  benchAllocs++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+
+  benchAllocs++;
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+
+  benchAllocs++;
+  return __real_realloc(p, size);
+}
+
+/*==========================================================================*/
+/* Benchmarks.                                                              */
+/*==========================================================================*/
+
+/**
+ * @brief   Step of the reference, a xorshift generator.
+ * @details It is called and its result stored as the kernels are, the
+ *          reference follows the speed of the calls and of the stores.
+ */
+static __attribute__((noinline)) uint32_t benchXorshift(uint32_t x) {
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+/**
+ * @brief   Reference loop.
+ */
+static void benchReference(uint32_t n) {
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    benchRefSink = benchXorshift(benchRefSink + i);
+}
+
+static void benchCompensateTemp(uint32_t n) {
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    benchSink = bmp085CompensateTemp(&benchCalib, 27898 + (int32_t)(i & 63));
+}
+
+static void benchCompensatePress(uint32_t n) {
+  uint32_t i;
+
+  (void)bmp085CompensateTemp(&benchCalib, 27898);
+  for (i = 0; i < n; i++)
+    benchSink = bmp085CompensatePress(&benchCalib,
+                                      (23843 << 3) + (int32_t)(i & 63), 3);
+}
+
+static void benchAltitude(uint32_t n) {
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    benchSinkf = bmp085AltitudeFromPress(1000.0f + (float)(i & 63),
+                                         1013.25f);
+}
+
+static void benchSeaLevel(uint32_t n) {
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    benchSinkf = bmp085SeaLevelFromPress(1000.0f, (float)(i & 1023));
+}
+
+static void benchPressToAltitude(uint32_t n) {
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    benchSink = bmp085PressToAltitude(95000 + (int32_t)(i & 8191));
+}
+
+static void benchBcd2Dec(uint32_t n) {
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    benchSink = bcd2Dec((uint8_t)(i & 0x99));
+}
+
+static void benchDec2Bcd(uint32_t n) {
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    benchSink = dec2Bcd((uint8_t)(i & 63));
+}
+
+static void benchDecodeClock(uint32_t n) {
+  ds1307_data_t rtc;
+  uint32_t i;
+
+  for (i = 0; i < n; i++) {
+    ds1307DecodeClock(benchClock, 2000, &rtc);
+    benchSink = rtc.seconds;
+  }
+}
+
+static void benchEncodeClock(uint32_t n) {
+  ds1307_data_t rtc;
+  uint8_t regs[7];
+  uint32_t i;
+
+  ds1307DecodeClock(benchClock, 2000, &rtc);
+  for (i = 0; i < n; i++) {
+    ds1307EncodeClock(&rtc, 2000, regs);
+    benchSink = regs[0];
+  }
+}
+
+/**
+ * @brief   Draw a frame voxel by voxel in the back buffer.
+ */
+static void benchFrameDraw(uint32_t n) {
+  ledcube_frame_t *fp = ledCubeGetBackBuffer();
+  uint32_t i;
+  uint8_t x, y, z;
+
+  for (i = 0; i < n; i++) {
+    for (z = 0; z < LEDCUBE_LAYERS; z++) {
+      for (y = 0; y < LEDCUBE_SIZE; y++) {
+        for (x = 0; x < LEDCUBE_SIZE; x++)
+          ledCubeFrameSetVoxel(fp, x, y, z,
+                               (uint8_t)((x + y + z + i) % LEDCUBE_LEVELS));
+      }
+    }
+  }
+}
+
+/**
+ * @brief   Flush a frame, it is swapped in at the end of a full scan of
+ *          the cube, the refresh engine writing the simulated ports.
+ */
+static void benchFrameFlush(uint32_t n) {
+  uint32_t i;
+
+  for (i = 0; i < n; i++) {
+    ledCubeFrameFill(ledCubeGetBackBuffer());
+    ledCubeSwapBuffers();
+    ledCubeWaitSwap();
+  }
+}
+
+/**
+ * @brief   Refresh interrupts of full scans of the cube, the callback and
+ *          the virtual timer dispatch of the simulation.
+ * @details The thread sleeps for the ticks of the scans, the interrupts
+ *          run back to back. The longest callback of the run, measured by
+ *          ledCubeGetIsrCycles() in host ns, is kept when it is the best
+ *          one.
+ */
+static void benchRefreshIsr(uint32_t n) {
+  uint32_t scans, body;
+
+  (void)ledCubeGetIsrCycles();
+  while (n > 0) {
+    scans = (n > 65536) ? 65536 : n;
+    chThdSleep((systime_t)(scans * LEDCUBE_FRAME_TICKS));
+    n -= scans;
+  }
+  body = ledCubeGetIsrCycles();
+  if (body < benchIsrBody)
+    benchIsrBody = body;
+}
+
+static const bench_t benchs[] = {
+  {"bmp085CompensateTemp",    benchCompensateTemp,  1},
+  {"bmp085CompensatePress",   benchCompensatePress, 1},
+  {"bmp085AltitudeFromPress", benchAltitude,        1},
+  {"bmp085SeaLevelFromPress", benchSeaLevel,        1},
+  {"bmp085PressToAltitude",   benchPressToAltitude, 1},
+  {"bcd2Dec",                 benchBcd2Dec,         1},
+  {"dec2Bcd",                 benchDec2Bcd,         1},
+  {"ds1307DecodeClock",       benchDecodeClock,     1},
+  {"ds1307EncodeClock",       benchEncodeClock,     1},
+  {"ledCubeFrameDraw",        benchFrameDraw,       1},
+  {"ledCubeFrameFlush",       benchFrameFlush,      1},
+  {"ledCubeRefreshIsr",       benchRefreshIsr,      LEDCUBE_ISR_PER_FRAME},
+};
+
+#define BENCHS  (sizeof(benchs) / sizeof(benchs[0]))
+
+/*==========================================================================*/
+/* Local functions.                                                         */
+/*==========================================================================*/
+
+/**
+ * @brief   Host time, in nanoseconds.
+ */
+static uint64_t hostNs(void) {
+  struct timespec ts;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief   Measure a benchmark.
+ */
+static void benchRun(const bench_t *bp, bench_result_t *rp) {
+  uint64_t t, ref, best = ~0ULL, bestRef = 1;
+  uint32_t n = 1, allocs = 0;
+  unsigned i;
+
+  /* Operations of a run. */
+  for (;;) {
+    t = hostNs();
+    bp->fn(n);
+    t = hostNs() - t;
+    if ((t >= BENCH_MIN_NS) || (n >= 0x40000000UL))
+      break;
+    n *= 2;
+  }
+
+  /* The run of the lowest cost in reference units is kept, each run being
+     paired with the reference timed just before it. */
+  for (i = 0; i < BENCH_REPEATS; i++) {
+    ref = hostNs();
+    benchReference(BENCH_REF_OPS);
+    ref = hostNs() - ref;
+
+    benchAllocs = 0;
+    t = hostNs();
+    bp->fn(n);
+    t = hostNs() - t;
+    if ((double)t / ref < (double)best / bestRef) {
+      best    = t;
+      bestRef = ref;
+    }
+    if (benchAllocs > allocs)
+      allocs = benchAllocs;
+  }
+
+  snprintf(rp->name, sizeof(rp->name), "%s", bp->name);
+  rp->ns     = (double)best / ((double)n * bp->ops);
+  rp->allocs = (double)allocs / ((double)n * bp->ops);
+  rp->ref    = (double)bestRef / BENCH_REF_OPS;
+}
+
+/**
+ * @brief   Run all the benchmarks.
+ * @note    The kernel and the refresh of the led-cube are started by the
+ *          caller.
+ */
+static void benchRunAll(bench_result_t *results) {
+  unsigned i;
+
+  for (i = 0; i < BENCHS; i++)
+    benchRun(&benchs[i], &results[i]);
+}
+
+/**
+ * @brief   Read a baseline.
+ *
+ * @return  number of benchmarks read, -1 if the file cannot be read
+ */
+static int benchLoad(const char *name, bench_result_t *results) {
+  char line[128];
+  int n = 0;
+  FILE *f;
+
+  if ((f = fopen(name, "r")) == NULL)
+    return -1;
+  while ((n < BENCH_MAX) && (fgets(line, sizeof(line), f) != NULL)) {
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line, "%31s %lf %lf %lf", results[n].name, &results[n].ns,
+               &results[n].allocs, &results[n].ref) == 4)
+      n++;
+  }
+  fclose(f);
+  return n;
+}
+
+/**
+ * @brief   Run the benchmarks and compare them to a baseline.
+ */
+static int cmdRun(int argc, char **argv) {
+  const char *name = (argc > 0) ? argv[0] : BENCH_BASELINE;
+  bench_result_t results[BENCHS], base[BENCH_MAX];
+  const bench_result_t *bp;
+  bench_result_t retry;
+  unsigned i, k, regressions = 0;
+  double ratio;
+  int j, n;
+
+  n = benchLoad(name, base);
+  if (n < 0)
+    fprintf(stderr, "no baseline %s\n", name);
+  simInit();
+  ledCubeInit();
+  benchRunAll(results);
+
+  printf("%-26s %10s %9s %10s %6s\n", "benchmark", "ns/op", "allocs/op",
+         "baseline", "ratio");
+  for (i = 0; i < BENCHS; i++) {
+    bp = NULL;
+    for (j = 0; j < n; j++) {
+      if (strcmp(base[j].name, results[i].name) == 0)
+        bp = &base[j];
+    }
+    if (bp == NULL) {
+      printf("%-26s %10.2f %9.2f %10s\n", results[i].name, results[i].ns,
+             results[i].allocs, "-");
+      continue;
+    }
+
+    /* Costs in reference units. */
+    ratio = (results[i].ns / results[i].ref) / (bp->ns / bp->ref);
+    for (k = 0; (k < BENCH_RETRIES) && (ratio > BENCH_THRESHOLD); k++) {
+      benchRun(&benchs[i], &retry);
+      if (retry.ns / retry.ref < results[i].ns / results[i].ref) {
+        results[i] = retry;
+        ratio = (retry.ns / retry.ref) / (bp->ns / bp->ref);
+      }
+    }
+    printf("%-26s %10.2f %9.2f %10.2f %6.2f", results[i].name,
+           results[i].ns, results[i].allocs, bp->ns, ratio);
+    if ((ratio > BENCH_THRESHOLD) || (results[i].allocs > bp->allocs)) {
+      printf("  REGRESSION");
+      regressions++;
+    }
+    printf("\n");
+  }
+
+  printf("longest refresh callback %u ns\n", (unsigned)benchIsrBody);
+
+  if (regressions > 0) {
+    printf("%u regressions against %s\n", regressions, name);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief   Run the benchmarks and write them as the baseline.
+ */
+static int cmdSave(int argc, char **argv) {
+  const char *name = (argc > 0) ? argv[0] : BENCH_BASELINE;
+  bench_result_t results[BENCH_SAVES][BENCHS], r;
+  unsigned i, j, k;
+  FILE *f;
+
+  simInit();
+  ledCubeInit();
+  for (k = 0; k < BENCH_SAVES; k++)
+    benchRunAll(results[k]);
+
+  /* Median of the runs, in reference units. */
+  for (i = 0; i < BENCHS; i++) {
+    for (k = 1; k < BENCH_SAVES; k++) {
+      r = results[k][i];
+      for (j = k; (j > 0) && (results[j - 1][i].ns / results[j - 1][i].ref >
+                              r.ns / r.ref); j--)
+        results[j][i] = results[j - 1][i];
+      results[j][i] = r;
+    }
+  }
+
+  if ((f = fopen(name, "w")) == NULL) {
+    fprintf(stderr, "cannot write %s\n", name);
+    return 1;
+  }
+  fprintf(f, "# Baseline of the host benchmarks, make baseline.\n");
+  fprintf(f, "# benchmark ns/op allocs/op reference-ns/op\n");
+  for (i = 0; i < BENCHS; i++) {
+    r = results[BENCH_SAVES / 2][i];
+    fprintf(f, "%-26s %10.2f %6.2f %8.4f\n", r.name, r.ns, r.allocs, r.ref);
+    printf("%-26s %10.2f ns/op %6.2f allocs/op\n", r.name, r.ns, r.allocs);
+  }
+  fclose(f);
+  return 0;
+}
+
+static const sim_cmd_t simCmds[] = {
+  {"run",   cmdRun,   "[baseline]"},
+  {"save",  cmdSave,  "[baseline]"},
+};
+
+#define SIM_CMDS  (sizeof(simCmds) / sizeof(simCmds[0]))
+
+/*==========================================================================*/
+/* Main.                                                                    */
+/*==========================================================================*/
+
+int main(int argc, char **argv) {
+  unsigned i;
+
+  for (i = 0; (argc > 1) && (i < SIM_CMDS); i++) {
+    if (strcmp(argv[1], simCmds[i].name) == 0)
+      return simCmds[i].fn(argc - 2, argv + 2);
+  }
+
+  fprintf(stderr, "usage:\n");
+  for (i = 0; i < SIM_CMDS; i++)
+    fprintf(stderr, "  %s %s %s\n", argv[0], simCmds[i].name,
+            simCmds[i].help);
+  return 2;
+}
@@ -0,0 +1,323 @@
+/**
+ *
+ * @file    ch.h
+ *
+ * @brief   Virtual time kernel header file, host simulations.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+#ifndef CH_H
+#define CH_H
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Standard files. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*==========================================================================*/
+/* Kernel pre-compile time settings.                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Frequency of the system ticks, in Hz.
+ * @note    The default is 10000, the frequency of the STM32 targets.
+ */
+#if !defined(CH_CFG_ST_FREQUENCY) || defined(__DOXYGEN__)
+#define CH_CFG_ST_FREQUENCY               10000
+#endif
+
+/**
+ * @brief   Number of threads which can be created.
+ * @note    The default is 8, the main thread included.
+ */
+#if !defined(SIM_MAX_THREADS) || defined(__DOXYGEN__)
+#define SIM_MAX_THREADS                   8
+#endif
+
+/**
+ * @brief   Stack size of the created threads.
+ * @details The working area given to chThdCreateStatic() is sized for the
+ *          target, the host threads run on their own stacks.
+ * @note    The default is 64 kB.
+ */
+#if !defined(SIM_STACK_SIZE) || defined(__DOXYGEN__)
+#define SIM_STACK_SIZE                    65536
+#endif
+
+/*==========================================================================*/
+/* Kernel macros.                                                           */
+/*==========================================================================*/
+
+#define TRUE                1
+#define FALSE               0
+
+#define MSG_OK              ((msg_t)0)    /**< Normal wakeup message.       */
+#define MSG_TIMEOUT         ((msg_t)-1)   /**< Wakeup caused by a timeout.  */
+#define MSG_RESET           ((msg_t)-2)   /**< Wakeup caused by a reset.    */
+
+#define TIME_IMMEDIATE      ((systime_t)0)            /**< No wait.         */
+#define TIME_INFINITE       ((systime_t)~(systime_t)0) /**< Wait forever.   */
+
+#define ALL_EVENTS          ((eventmask_t)~(eventmask_t)0)
+#define EVENT_MASK(eid)     ((eventmask_t)1 << (eventmask_t)(eid))
+
+#define IDLEPRIO            ((tprio_t)1)
+#define LOWPRIO             ((tprio_t)2)
+#define NORMALPRIO          ((tprio_t)128)
+#define HIGHPRIO            ((tprio_t)255)
+
+/*
+ * Time conversions, rounded up as the kernel does.
+ */
+#define S2ST(sec)                                                           \
+  ((systime_t)((uint32_t)(sec) * (uint32_t)CH_CFG_ST_FREQUENCY))
+#define MS2ST(msec)                                                         \
+  ((systime_t)((((uint32_t)(msec)) * ((uint32_t)CH_CFG_ST_FREQUENCY) +      \
+                999UL) / 1000UL))
+#define US2ST(usec)                                                         \
+  ((systime_t)((((uint32_t)(usec)) * ((uint32_t)CH_CFG_ST_FREQUENCY) +      \
+                999999UL) / 1000000UL))
+#define ST2MS(n)                                                            \
+  (((uint32_t)(n) * 1000UL + (uint32_t)CH_CFG_ST_FREQUENCY - 1UL) /         \
+   (uint32_t)CH_CFG_ST_FREQUENCY)
+#define ST2US(n)                                                            \
+  (((uint32_t)(n) * 1000000UL + (uint32_t)CH_CFG_ST_FREQUENCY - 1UL) /      \
+   (uint32_t)CH_CFG_ST_FREQUENCY)
+
+/**
+ * @brief   The realtime counter counts the host nanoseconds.
+ */
+#define PORT_SUPPORTS_RT    TRUE
+
+#define CC_ALIGN(n)         __attribute__((aligned(n)))
+
+#define THD_FUNCTION(tname, arg)  void tname(void *arg)
+#define THD_WORKING_AREA_SIZE(n)  ((size_t)(n) + 256U)
+#define THD_WORKING_AREA(s, n)                                              \
+  stkalign_t s[THD_WORKING_AREA_SIZE(n) / sizeof(stkalign_t)]
+
+#define MEMORYPOOL_DECL(name, size, provider)                               \
+  memory_pool_t name = {NULL, (size), (provider)}
+#define EVENTSOURCE_DECL(name)  event_source_t name = {NULL, 0, 0}
+
+#define chDbgCheck(c)       simAssert((c), #c, __FILE__, __LINE__)
+#define chDbgAssert(c, r)   simAssert((c), (r), __FILE__, __LINE__)
+
+/*
+ * The simulation is not preemptive, a thread runs until it waits. The
+ * critical sections only exist on the target.
+ */
+#define chSysLock()
+#define chSysUnlock()
+#define chSysLockFromISR()
+#define chSysUnlockFromISR()
+#define chSchRescheduleS()  simYield()
+
+#define chVTGetSystemTimeX()  chVTGetSystemTime()
+#define chVTTimeElapsedSinceX(start)                                        \
+  ((systime_t)(chVTGetSystemTime() - (start)))
+#define chVTIsTimeWithinX(time, start, end)                                 \
+  ((bool)((systime_t)((time) - (start)) < (systime_t)((end) - (start))))
+
+#define chThdSleepMilliseconds(msec)  chThdSleep(MS2ST(msec))
+#define chThdSleepMicroseconds(usec)  chThdSleep(US2ST(usec))
+#define chThdSleepSeconds(sec)        chThdSleep(S2ST(sec))
+
+#define chThdEnqueueTimeoutS    chThdEnqueueTimeout
+#define chThdDequeueAllI        chThdDequeueAll
+#define chThdDequeueNextI       chThdDequeueNext
+#define chThdSuspendS(trp)      chThdSuspendTimeout((trp), TIME_INFINITE)
+#define chThdSuspendTimeoutS    chThdSuspendTimeout
+#define chThdResumeS            chThdResume
+#define chThdResumeI            chThdResume
+#define chEvtBroadcastFlagsI    chEvtBroadcastFlags
+#define chPoolAllocI            chPoolAlloc
+#define chPoolFreeI             chPoolFree
+#define chVTSetI                chVTSet
+#define chVTResetI              chVTReset
+
+#define streamWrite(ip, bp, n)  ((ip)->vmt->write((ip), (bp), (n)))
+#define streamRead(ip, bp, n)   ((ip)->vmt->read((ip), (bp), (n)))
+
+/*==========================================================================*/
+/* Kernel data structures and types.                                        */
+/*==========================================================================*/
+
+typedef uint32_t  systime_t;    /**< System time.                           */
+typedef uint32_t  rtcnt_t;      /**< Realtime counter.                      */
+typedef int32_t   msg_t;        /**< Wakeup message.                        */
+typedef uint32_t  tprio_t;      /**< Thread priority.                       */
+typedef uint32_t  eventmask_t;  /**< Mask of event identifiers.             */
+typedef uint32_t  eventflags_t; /**< Mask of event flags.                   */
+typedef uint64_t  stkalign_t;   /**< Stack alignment unit.                  */
+typedef uint64_t  simtime_t;    /**< Virtual time, in nanoseconds.          */
+
+typedef struct thread thread_t;
+typedef thread_t  *thread_reference_t;
+
+typedef void (*tfunc_t)(void *p);
+typedef void (*vtfunc_t)(void *p);
+
+/**
+ * @brief   Event of the discrete-event scheduler.
+ * @details The events are kept by time, then by order of scheduling, so
+ *          a simulation always runs the same way.
+ */
+typedef struct sim_event {
+  struct sim_event  *next;                /**< Next event by time.          */
+  simtime_t         time;                 /**< Time of the event.           */
+  uint64_t          seq;                  /**< Order of scheduling.         */
+  void              (*fn)(struct sim_event *ep); /**< Function of the event.*/
+  bool              armed;                /**< The event is scheduled.      */
+} sim_event_t;
+
+/**
+ * @brief   Queue of waiting threads.
+ */
+typedef struct {
+  thread_t          *head;                /**< First waiting thread.        */
+  thread_t          *tail;                /**< Last waiting thread.         */
+} threads_queue_t;
+
+/**
+ * @brief   Virtual timer.
+ */
+typedef struct {
+  sim_event_t       event;                /**< Event of the timer.          */
+  vtfunc_t          func;                 /**< Callback of the timer.       */
+  void              *par;                 /**< Argument of the callback.    */
+} virtual_timer_t;
+
+/**
+ * @brief   Mutex, without priority inheritance.
+ */
+typedef struct {
+  thread_t          *owner;               /**< Owner, NULL if free.         */
+  threads_queue_t   queue;                /**< Waiting threads.             */
+} mutex_t;
+
+/**
+ * @brief   Listener of an event source.
+ */
+typedef struct event_listener {
+  struct event_listener *next;            /**< Next listener of the source. */
+  thread_t          *listener;            /**< Listening thread.            */
+  eventmask_t       events;               /**< Events added to the thread.  */
+  eventflags_t      flags;                /**< Flags broadcasted.           */
+  eventflags_t      wflags;               /**< Flags listened.              */
+} event_listener_t;
+
+/**
+ * @brief   Event source.
+ */
+typedef struct {
+  event_listener_t  *next;                /**< First listener.              */
+  eventflags_t      flags;                /**< Flags broadcasted, ORed.     */
+  uint32_t          broadcasts;           /**< Number of broadcasts.        */
+} event_source_t;
+
+/**
+ * @brief   Memory pool.
+ */
+typedef struct {
+  void              *next;                /**< First free object.           */
+  size_t            object_size;          /**< Size of an object.           */
+  void              *provider;            /**< Not used.                    */
+} memory_pool_t;
+
+/**
+ * @brief   Sequential stream.
+ */
+typedef struct BaseSequentialStream BaseSequentialStream;
+
+/**
+ * @brief   Methods of a sequential stream.
+ */
+struct BaseSequentialStreamVMT {
+  size_t (*write)(BaseSequentialStream *ip, const uint8_t *bp, size_t n);
+  size_t (*read)(BaseSequentialStream *ip, uint8_t *bp, size_t n);
+};
+
+struct BaseSequentialStream {
+  const struct BaseSequentialStreamVMT *vmt; /**< Methods of the stream.    */
+};
+
+/*==========================================================================*/
+/* Kernel functions prototypes.                                             */
+/*==========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  /* Simulation. */
+  void      simInit(void);
+  simtime_t simGetTime(void);
+  void      simSchedule(sim_event_t *ep, simtime_t time,
+                        void (*fn)(sim_event_t *ep));
+  void      simCancel(sim_event_t *ep);
+  void      simSleepNs(simtime_t ns);
+  void      simYield(void);
+  uint64_t  simGetSwitches(void);
+  void      simAssert(bool c, const char *what, const char *file, int line);
+
+  /* System. */
+  rtcnt_t   chSysGetRealtimeCounterX(void);
+
+  /* Virtual timers. */
+  systime_t chVTGetSystemTime(void);
+  void      chVTObjectInit(virtual_timer_t *vtp);
+  void      chVTSet(virtual_timer_t *vtp, systime_t delay, vtfunc_t vtfunc,
+                    void *par);
+  void      chVTReset(virtual_timer_t *vtp);
+  bool      chVTIsArmed(const virtual_timer_t *vtp);
+
+  /* Threads. */
+  thread_t  *chThdCreateStatic(void *wsp, size_t size, tprio_t prio,
+                               tfunc_t pf, void *arg);
+  thread_t  *chThdGetSelfX(void);
+  tprio_t   chThdGetPriorityX(void);
+  void      chThdExit(msg_t msg);
+  msg_t     chThdWait(thread_t *tp);
+  void      chThdSleep(systime_t time);
+  void      chThdSleepUntil(systime_t time);
+  systime_t chThdSleepUntilWindowed(systime_t prev, systime_t next);
+  msg_t     chThdSuspendTimeout(thread_reference_t *trp, systime_t timeout);
+  void      chThdResume(thread_reference_t *trp, msg_t msg);
+  void      chThdQueueObjectInit(threads_queue_t *tqp);
+  msg_t     chThdEnqueueTimeout(threads_queue_t *tqp, systime_t timeout);
+  void      chThdDequeueNext(threads_queue_t *tqp, msg_t msg);
+  void      chThdDequeueAll(threads_queue_t *tqp, msg_t msg);
+
+  /* Mutexes. */
+  void      chMtxObjectInit(mutex_t *mp);
+  void      chMtxLock(mutex_t *mp);
+  void      chMtxUnlock(mutex_t *mp);
+
+  /* Events. */
+  void      chEvtObjectInit(event_source_t *esp);
+  void      chEvtRegisterMaskWithFlags(event_source_t *esp,
+                                       event_listener_t *elp,
+                                       eventmask_t events,
+                                       eventflags_t wflags);
+  void      chEvtUnregister(event_source_t *esp, event_listener_t *elp);
+  void      chEvtBroadcastFlags(event_source_t *esp, eventflags_t flags);
+  eventflags_t chEvtGetAndClearFlags(event_listener_t *elp);
+  eventmask_t chEvtWaitAnyTimeout(eventmask_t events, systime_t timeout);
+
+  /* Memory pools. */
+  void      chPoolObjectInit(memory_pool_t *mp, size_t size, void *provider);
+  void      *chPoolAlloc(memory_pool_t *mp);
+  void      chPoolFree(memory_pool_t *mp, void *objp);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CH_H */
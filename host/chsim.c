@@ -0,0 +1,912 @@
+/**
+ *
+ * @file    chsim.c
+ *
+ * @brief   Virtual time kernel, host simulations.
+ *
+ * @details The kernel runs the drivers on the host against a virtual
+ *          clock. The threads are cooperative, a thread runs until it
+ *          waits; when no thread is ready, the discrete-event scheduler
+ *          takes the next event, moves the virtual time to it and runs it.
+ *          The events are the timeouts of the threads, the virtual timers
+ *          and the ends of the simulated transfers, so an hour of the
+ *          target takes the host time needed to run its code only.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Standard files. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ucontext.h>
+
+/* Kernel files. */
+#include "ch.h"
+
+/*==========================================================================*/
+/* Local definitions.                                                       */
+/*==========================================================================*/
+
+#if (1000000000UL % CH_CFG_ST_FREQUENCY) != 0
+#error "CH_CFG_ST_FREQUENCY must divide one second in nanoseconds"
+#endif
+
+/**
+ * @brief   Length of a system tick, in nanoseconds.
+ */
+#define SIM_TICK_NS   ((simtime_t)(1000000000UL / CH_CFG_ST_FREQUENCY))
+
+/*
+ * States of the threads.
+ */
+#define SIM_FREE      0U            /**< The slot is not used.              */
+#define SIM_READY     1U            /**< Ready to run.                      */
+#define SIM_CURRENT   2U            /**< Running.                           */
+#define SIM_SLEEPING  3U            /**< Sleeping.                          */
+#define SIM_QUEUED    4U            /**< In a threads queue.                */
+#define SIM_SUSPENDED 5U            /**< Suspended on a reference.          */
+#define SIM_WTEVENT   6U            /**< Waiting for events.                */
+#define SIM_FINAL     7U            /**< Terminated.                        */
+
+/**
+ * @brief   Simulated thread.
+ */
+struct thread {
+  ucontext_t          ctx;          /**< Context of the thread.             */
+  uint8_t             state;        /**< State of the thread.               */
+  tprio_t             prio;         /**< Priority.                          */
+  uint64_t            readySeq;     /**< Order in the ready list.           */
+  msg_t               msg;          /**< Wakeup message.                    */
+  sim_event_t         timeout;      /**< Timeout of the wait.               */
+  thread_t            *next;        /**< Next thread in a queue.            */
+  threads_queue_t     *queue;       /**< Queue the thread waits in.         */
+  thread_reference_t  *trp;         /**< Reference the thread waits on.     */
+  eventmask_t         epending;     /**< Pending events.                    */
+  eventmask_t         ewmask;       /**< Events waited for.                 */
+  tfunc_t             pf;           /**< Function of the thread.            */
+  void                *arg;         /**< Argument of the function.          */
+  msg_t               exitcode;     /**< Exit code.                         */
+  threads_queue_t     waiting;      /**< Threads in chThdWait().            */
+};
+
+/*==========================================================================*/
+/* Local variables.                                                         */
+/*==========================================================================*/
+
+static thread_t     simThreads[SIM_MAX_THREADS];
+static uint8_t      simStacks[SIM_MAX_THREADS][SIM_STACK_SIZE]
+                              CC_ALIGN(16);
+static thread_t     *simCurrent;
+static sim_event_t  *simEvents;
+static simtime_t    simNow;
+static uint64_t     simSeq;
+static uint64_t     simSwitches;
+static bool         simInEvent;
+
+/*==========================================================================*/
+/* Local functions.                                                         */
+/*==========================================================================*/
+
+/**
+ * @brief   Convert a system time to the virtual time of its tick.
+ *
+ * @param[in] ticks   ticks from the current one
+ * @return            virtual time of the tick
+ */
+static simtime_t simTicksFromNow(systime_t ticks) {
+
+  return (simNow / SIM_TICK_NS + ticks) * SIM_TICK_NS;
+}
+
+/**
+ * @brief   Remove a thread from the queue it waits in.
+ *
+ * @param[in] tp      thread to remove
+ */
+static void simDequeue(thread_t *tp) {
+  threads_queue_t *tqp = tp->queue;
+  thread_t *prev = NULL;
+  thread_t *p;
+
+  for (p = tqp->head; p != NULL; prev = p, p = p->next) {
+    if (p == tp) {
+      if (prev == NULL)
+        tqp->head = p->next;
+      else
+        prev->next = p->next;
+      if (tqp->tail == p)
+        tqp->tail = prev;
+      break;
+    }
+  }
+  tp->queue = NULL;
+  tp->next  = NULL;
+}
+
+/**
+ * @brief   Make a thread ready to run.
+ *
+ * @param[in] tp      thread to wake up
+ * @param[in] msg     wakeup message
+ */
+static void simReady(thread_t *tp, msg_t msg) {
+
+  if (tp->timeout.armed)
+    simCancel(&tp->timeout);
+  tp->msg       = msg;
+  tp->state     = SIM_READY;
+  tp->readySeq  = simSeq++;
+}
+
+/**
+ * @brief   Find the next thread to run.
+ * @details The highest priority wins, then the longest ready.
+ *
+ * @return            thread to run, NULL if no thread is ready
+ */
+static thread_t *simPickReady(void) {
+  thread_t *best = NULL;
+  unsigned i;
+
+  for (i = 0; i < SIM_MAX_THREADS; i++) {
+    thread_t *tp = &simThreads[i];
+
+    if (tp->state != SIM_READY)
+      continue;
+    if ((best == NULL) || (tp->prio > best->prio) ||
+        ((tp->prio == best->prio) && (tp->readySeq < best->readySeq)))
+      best = tp;
+  }
+  return best;
+}
+
+/**
+ * @brief   Give the CPU to the next thread.
+ * @details The current thread has left the ready state or has been put
+ *          back in it. While no thread is ready, the events are run in
+ *          time order and the virtual time moves to each of them.
+ */
+static void simReschedule(void) {
+  thread_t *otp = simCurrent;
+  thread_t *ntp;
+
+  while ((ntp = simPickReady()) == NULL) {
+    sim_event_t *ep = simEvents;
+
+    if (ep == NULL) {
+      fprintf(stderr, "sim: deadlock, every thread waits forever\n");
+      exit(2);
+    }
+    simEvents = ep->next;
+    ep->armed = false;
+    simNow    = ep->time;
+    simInEvent = true;
+    ep->fn(ep);
+    simInEvent = false;
+  }
+  ntp->state = SIM_CURRENT;
+  if (ntp == otp)
+    return;
+  simCurrent = ntp;
+  simSwitches++;
+  (void)swapcontext(&otp->ctx, &ntp->ctx);
+}
+
+/**
+ * @brief   Block the current thread until it is woken up.
+ *
+ * @param[in] state   waiting state
+ * @param[in] timeout timeout of the wait, TIME_INFINITE for none
+ * @return            wakeup message
+ */
+static msg_t simWait(uint8_t state, systime_t timeout);
+
+/**
+ * @brief   End of the timeout of a waiting thread.
+ *
+ * @param[in] ep      timeout event of the thread
+ */
+static void simTimeoutEvent(sim_event_t *ep) {
+  thread_t *tp = (thread_t *)((uint8_t *)ep - offsetof(thread_t, timeout));
+
+  if (tp->queue != NULL)
+    simDequeue(tp);
+  if (tp->trp != NULL) {
+    *tp->trp = NULL;
+    tp->trp  = NULL;
+  }
+  simReady(tp, MSG_TIMEOUT);
+}
+
+static msg_t simWait(uint8_t state, systime_t timeout) {
+  thread_t *tp = simCurrent;
+
+  chDbgAssert(!simInEvent, "wait from an event");
+  tp->state = state;
+  if (timeout != TIME_INFINITE)
+    simSchedule(&tp->timeout, simTicksFromNow(timeout), simTimeoutEvent);
+  simReschedule();
+  return tp->msg;
+}
+
+/**
+ * @brief   Start of a created thread.
+ *
+ * @param[in] i       index of the thread
+ */
+static void simThreadStart(int i) {
+  thread_t *tp = &simThreads[i];
+
+  tp->pf(tp->arg);
+  chThdExit(MSG_OK);
+}
+
+/**
+ * @brief   End of a virtual timer.
+ *
+ * @param[in] ep      event of the timer
+ */
+static void simTimerEvent(sim_event_t *ep) {
+  virtual_timer_t *vtp = (virtual_timer_t *)ep;
+
+  vtp->func(vtp->par);
+}
+
+/*==========================================================================*/
+/* Simulation functions.                                                    */
+/*==========================================================================*/
+
+/**
+ * @brief   Initialize the kernel, the caller becomes the main thread.
+ */
+void simInit(void) {
+
+  if (simCurrent != NULL)
+    return;
+  simCurrent        = &simThreads[0];
+  simCurrent->state = SIM_CURRENT;
+  simCurrent->prio  = NORMALPRIO;
+}
+
+/**
+ * @brief   Get the virtual time.
+ *
+ * @return            virtual time, in nanoseconds
+ */
+simtime_t simGetTime(void) {
+
+  return simNow;
+}
+
+/**
+ * @brief   Schedule an event.
+ * @details A time in the past runs the event at the current time, after
+ *          the events already scheduled for it.
+ *
+ * @param[in] ep      event to schedule
+ * @param[in] time    virtual time of the event
+ * @param[in] fn      function of the event
+ */
+void simSchedule(sim_event_t *ep, simtime_t time,
+                 void (*fn)(sim_event_t *ep)) {
+  sim_event_t **pp = &simEvents;
+
+  if (ep->armed)
+    simCancel(ep);
+  if (time < simNow)
+    time = simNow;
+  ep->time  = time;
+  ep->seq   = simSeq++;
+  ep->fn    = fn;
+  ep->armed = true;
+  while ((*pp != NULL) && ((*pp)->time <= time))
+    pp = &(*pp)->next;
+  ep->next = *pp;
+  *pp = ep;
+}
+
+/**
+ * @brief   Cancel a scheduled event.
+ *
+ * @param[in] ep      event to cancel
+ */
+void simCancel(sim_event_t *ep) {
+  sim_event_t **pp;
+
+  for (pp = &simEvents; *pp != NULL; pp = &(*pp)->next) {
+    if (*pp == ep) {
+      *pp = ep->next;
+      break;
+    }
+  }
+  ep->armed = false;
+}
+
+/**
+ * @brief   Sleep for a time shorter than a tick.
+ * @details The drivers of the simulated buses wait for their transfers
+ *          with it.
+ *
+ * @param[in] ns      time to sleep, in nanoseconds
+ */
+void simSleepNs(simtime_t ns) {
+  thread_t *tp = simCurrent;
+
+  chDbgAssert(!simInEvent, "sleep from an event");
+  tp->state = SIM_SLEEPING;
+  simSchedule(&tp->timeout, simNow + ns, simTimeoutEvent);
+  simReschedule();
+}
+
+/**
+ * @brief   Give the CPU to a ready thread of higher priority.
+ * @details Does nothing in an event, as the kernel reschedules at the end
+ *          of an interrupt.
+ */
+void simYield(void) {
+  thread_t *ntp;
+
+  if (simInEvent)
+    return;
+  ntp = simPickReady();
+  if ((ntp == NULL) || (ntp->prio <= simCurrent->prio))
+    return;
+  simReady(simCurrent, MSG_OK);
+  simReschedule();
+}
+
+/**
+ * @brief   Get the number of context switches.
+ *
+ * @return            context switches since the start
+ */
+uint64_t simGetSwitches(void) {
+
+  return simSwitches;
+}
+
+/**
+ * @brief   Stop the simulation on a failed check.
+ *
+ * @param[in] c       condition checked
+ * @param[in] what    text of the check
+ * @param[in] file    file of the check
+ * @param[in] line    line of the check
+ */
+void simAssert(bool c, const char *what, const char *file, int line) {
+
+  if (!c) {
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    abort();
+  }
+}
+
+/*==========================================================================*/
+/* System and virtual timers functions.                                     */
+/*==========================================================================*/
+
+/**
+ * @brief   Read the realtime counter.
+ * @details The counter counts the host nanoseconds, the drivers measure
+ *          the host time of their code with it.
+ *
+ * @return            realtime counter
+ */
+rtcnt_t chSysGetRealtimeCounterX(void) {
+  struct timespec ts;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (rtcnt_t)((uint64_t)ts.tv_sec * 1000000000ULL +
+                   (uint64_t)ts.tv_nsec);
+}
+
+/**
+ * @brief   Get the system time.
+ *
+ * @return            system time, wrapping as on the target
+ */
+systime_t chVTGetSystemTime(void) {
+
+  return (systime_t)(simNow / SIM_TICK_NS);
+}
+
+/**
+ * @brief   Initialize a virtual timer.
+ *
+ * @param[out] vtp    timer to initialize
+ */
+void chVTObjectInit(virtual_timer_t *vtp) {
+
+  vtp->event.armed = false;
+  vtp->func = NULL;
+  vtp->par  = NULL;
+}
+
+/**
+ * @brief   Arm a virtual timer.
+ *
+ * @param[in] vtp     timer to arm
+ * @param[in] delay   delay in ticks, not TIME_IMMEDIATE
+ * @param[in] vtfunc  callback of the timer
+ * @param[in] par     argument of the callback
+ */
+void chVTSet(virtual_timer_t *vtp, systime_t delay, vtfunc_t vtfunc,
+             void *par) {
+
+  chDbgCheck((delay != TIME_IMMEDIATE) && (vtfunc != NULL));
+  vtp->func = vtfunc;
+  vtp->par  = par;
+  simSchedule(&vtp->event, simTicksFromNow(delay), simTimerEvent);
+}
+
+/**
+ * @brief   Disarm a virtual timer.
+ *
+ * @param[in] vtp     timer to disarm
+ */
+void chVTReset(virtual_timer_t *vtp) {
+
+  if (vtp->event.armed)
+    simCancel(&vtp->event);
+}
+
+/**
+ * @brief   Tell if a virtual timer is armed.
+ *
+ * @param[in] vtp     timer
+ * @return            true if it is armed
+ */
+bool chVTIsArmed(const virtual_timer_t *vtp) {
+
+  return vtp->event.armed;
+}
+
+/*==========================================================================*/
+/* Threads functions.                                                       */
+/*==========================================================================*/
+
+/**
+ * @brief   Create a thread.
+ * @details The working area is not used, the thread runs on a host stack.
+ *          A thread of higher priority than the caller runs at once.
+ *
+ * @param[in] wsp     working area, not used
+ * @param[in] size    size of the working area, not used
+ * @param[in] prio    priority of the thread
+ * @param[in] pf      function of the thread
+ * @param[in] arg     argument of the function
+ * @return            created thread
+ */
+thread_t *chThdCreateStatic(void *wsp, size_t size, tprio_t prio,
+                            tfunc_t pf, void *arg) {
+  thread_t *tp = NULL;
+  unsigned i;
+
+  (void)wsp;
+  (void)size;
+  simInit();
+  for (i = 1; i < SIM_MAX_THREADS; i++) {
+    if ((simThreads[i].state == SIM_FREE) ||
+        (simThreads[i].state == SIM_FINAL)) {
+      tp = &simThreads[i];
+      break;
+    }
+  }
+  chDbgAssert(tp != NULL, "SIM_MAX_THREADS reached");
+  tp->prio      = prio;
+  tp->pf        = pf;
+  tp->arg       = arg;
+  tp->queue     = NULL;
+  tp->trp       = NULL;
+  tp->next      = NULL;
+  tp->epending  = 0;
+  tp->ewmask    = 0;
+  tp->exitcode  = MSG_OK;
+  tp->timeout.armed = false;
+  chThdQueueObjectInit(&tp->waiting);
+  (void)getcontext(&tp->ctx);
+  tp->ctx.uc_stack.ss_sp    = simStacks[i];
+  tp->ctx.uc_stack.ss_size  = sizeof(simStacks[i]);
+  tp->ctx.uc_link           = NULL;
+  makecontext(&tp->ctx, (void (*)(void))simThreadStart, 1, (int)i);
+  simReady(tp, MSG_OK);
+  simYield();
+  return tp;
+}
+
+/**
+ * @brief   Get the current thread.
+ *
+ * @return            current thread
+ */
+thread_t *chThdGetSelfX(void) {
+
+  return simCurrent;
+}
+
+/**
+ * @brief   Get the priority of the current thread.
+ *
+ * @return            priority
+ */
+tprio_t chThdGetPriorityX(void) {
+
+  return simCurrent->prio;
+}
+
+/**
+ * @brief   Terminate the current thread.
+ *
+ * @param[in] msg     exit code
+ */
+void chThdExit(msg_t msg) {
+  thread_t *tp = simCurrent;
+
+  chDbgAssert(tp != &simThreads[0], "exit of the main thread");
+  tp->exitcode = msg;
+  chThdDequeueAll(&tp->waiting, MSG_OK);
+  tp->state = SIM_FINAL;
+  simReschedule();
+  chDbgAssert(false, "terminated thread resumed");
+}
+
+/**
+ * @brief   Wait for the end of a thread.
+ *
+ * @param[in] tp      thread to wait for
+ * @return            exit code of the thread
+ */
+msg_t chThdWait(thread_t *tp) {
+
+  if (tp->state != SIM_FINAL)
+    (void)chThdEnqueueTimeout(&tp->waiting, TIME_INFINITE);
+  return tp->exitcode;
+}
+
+/**
+ * @brief   Sleep for a number of ticks.
+ * @details The thread wakes up on a tick, as on the target.
+ *
+ * @param[in] time    ticks to sleep
+ */
+void chThdSleep(systime_t time) {
+
+  if (time == TIME_IMMEDIATE)
+    return;
+  (void)simWait(SIM_SLEEPING, time);
+}
+
+/**
+ * @brief   Sleep until a system time.
+ *
+ * @param[in] time    system time of the wakeup
+ */
+void chThdSleepUntil(systime_t time) {
+
+  chThdSleep((systime_t)(time - chVTGetSystemTime()));
+}
+
+/**
+ * @brief   Sleep until a system time within a window.
+ * @details The thread does not sleep when the current time is out of the
+ *          window, as the kernel does.
+ *
+ * @param[in] prev    start of the window
+ * @param[in] next    end of the window, the wakeup time
+ * @return            the end of the window
+ */
+systime_t chThdSleepUntilWindowed(systime_t prev, systime_t next) {
+  systime_t time = chVTGetSystemTime();
+
+  if (chVTIsTimeWithinX(time, prev, next))
+    chThdSleep((systime_t)(next - time));
+  return next;
+}
+
+/**
+ * @brief   Suspend the current thread on a reference.
+ *
+ * @param[in] trp     reference to the thread
+ * @param[in] timeout timeout of the wait
+ * @return            wakeup message
+ */
+msg_t chThdSuspendTimeout(thread_reference_t *trp, systime_t timeout) {
+
+  if (timeout == TIME_IMMEDIATE)
+    return MSG_TIMEOUT;
+  *trp = simCurrent;
+  simCurrent->trp = trp;
+  return simWait(SIM_SUSPENDED, timeout);
+}
+
+/**
+ * @brief   Resume a thread suspended on a reference.
+ * @details The thread only becomes ready, it runs at the next
+ *          rescheduling.
+ *
+ * @param[in] trp     reference to the thread
+ * @param[in] msg     wakeup message
+ */
+void chThdResume(thread_reference_t *trp, msg_t msg) {
+  thread_t *tp = *trp;
+
+  if (tp == NULL)
+    return;
+  *trp    = NULL;
+  tp->trp = NULL;
+  simReady(tp, msg);
+}
+
+/**
+ * @brief   Initialize a threads queue.
+ *
+ * @param[out] tqp    queue to initialize
+ */
+void chThdQueueObjectInit(threads_queue_t *tqp) {
+
+  tqp->head = NULL;
+  tqp->tail = NULL;
+}
+
+/**
+ * @brief   Wait in a threads queue.
+ *
+ * @param[in] tqp     queue to wait in
+ * @param[in] timeout timeout of the wait
+ * @return            wakeup message
+ */
+msg_t chThdEnqueueTimeout(threads_queue_t *tqp, systime_t timeout) {
+  thread_t *tp = simCurrent;
+
+  if (timeout == TIME_IMMEDIATE)
+    return MSG_TIMEOUT;
+  tp->next  = NULL;
+  tp->queue = tqp;
+  if (tqp->tail == NULL)
+    tqp->head = tp;
+  else
+    tqp->tail->next = tp;
+  tqp->tail = tp;
+  return simWait(SIM_QUEUED, timeout);
+}
+
+/**
+ * @brief   Wake up the first thread of a queue.
+ *
+ * @param[in] tqp     queue
+ * @param[in] msg     wakeup message
+ */
+void chThdDequeueNext(threads_queue_t *tqp, msg_t msg) {
+  thread_t *tp = tqp->head;
+
+  if (tp == NULL)
+    return;
+  simDequeue(tp);
+  simReady(tp, msg);
+}
+
+/**
+ * @brief   Wake up every thread of a queue.
+ *
+ * @param[in] tqp     queue
+ * @param[in] msg     wakeup message
+ */
+void chThdDequeueAll(threads_queue_t *tqp, msg_t msg) {
+
+  while (tqp->head != NULL)
+    chThdDequeueNext(tqp, msg);
+}
+
+/*==========================================================================*/
+/* Mutexes functions.                                                       */
+/*==========================================================================*/
+
+/**
+ * @brief   Initialize a mutex.
+ *
+ * @param[out] mp     mutex to initialize
+ */
+void chMtxObjectInit(mutex_t *mp) {
+
+  mp->owner = NULL;
+  chThdQueueObjectInit(&mp->queue);
+}
+
+/**
+ * @brief   Lock a mutex.
+ * @details The waiting threads get the mutex in arrival order.
+ *
+ * @param[in] mp      mutex to lock
+ */
+void chMtxLock(mutex_t *mp) {
+
+  simInit();
+  if (mp->owner == NULL) {
+    mp->owner = simCurrent;
+    return;
+  }
+  chDbgAssert(mp->owner != simCurrent, "recursive lock");
+  (void)chThdEnqueueTimeout(&mp->queue, TIME_INFINITE);
+}
+
+/**
+ * @brief   Unlock a mutex, the next waiting thread owns it.
+ *
+ * @param[in] mp      mutex to unlock
+ */
+void chMtxUnlock(mutex_t *mp) {
+
+  chDbgAssert(mp->owner == simCurrent, "not owner");
+  mp->owner = mp->queue.head;
+  if (mp->owner != NULL) {
+    chThdDequeueNext(&mp->queue, MSG_OK);
+    simYield();
+  }
+}
+
+/*==========================================================================*/
+/* Events functions.                                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Initialize an event source.
+ *
+ * @param[out] esp    event source to initialize
+ */
+void chEvtObjectInit(event_source_t *esp) {
+
+  esp->next       = NULL;
+  esp->flags      = 0;
+  esp->broadcasts = 0;
+}
+
+/**
+ * @brief   Register the current thread on an event source.
+ *
+ * @param[in] esp     event source
+ * @param[out] elp    listener
+ * @param[in] events  events added to the thread
+ * @param[in] wflags  flags listened, 0 for all
+ */
+void chEvtRegisterMaskWithFlags(event_source_t *esp, event_listener_t *elp,
+                                eventmask_t events, eventflags_t wflags) {
+
+  simInit();
+  elp->listener = simCurrent;
+  elp->events   = events;
+  elp->flags    = 0;
+  elp->wflags   = wflags;
+  elp->next     = esp->next;
+  esp->next     = elp;
+}
+
+/**
+ * @brief   Unregister a listener from an event source.
+ *
+ * @param[in] esp     event source
+ * @param[in] elp     listener
+ */
+void chEvtUnregister(event_source_t *esp, event_listener_t *elp) {
+  event_listener_t **pp;
+
+  for (pp = &esp->next; *pp != NULL; pp = &(*pp)->next) {
+    if (*pp == elp) {
+      *pp = elp->next;
+      break;
+    }
+  }
+}
+
+/**
+ * @brief   Broadcast flags on an event source.
+ *
+ * @param[in] esp     event source
+ * @param[in] flags   flags to broadcast
+ */
+void chEvtBroadcastFlags(event_source_t *esp, eventflags_t flags) {
+  event_listener_t *elp;
+
+  esp->flags |= flags;
+  esp->broadcasts++;
+  for (elp = esp->next; elp != NULL; elp = elp->next) {
+    thread_t *tp = elp->listener;
+
+    elp->flags |= flags;
+    if ((elp->wflags != 0) && ((flags & elp->wflags) == 0))
+      continue;
+    tp->epending |= elp->events;
+    if ((tp->state == SIM_WTEVENT) && ((tp->epending & tp->ewmask) != 0))
+      simReady(tp, MSG_OK);
+  }
+}
+
+/**
+ * @brief   Get and clear the flags of a listener.
+ *
+ * @param[in] elp     listener
+ * @return            flags broadcasted since the last call
+ */
+eventflags_t chEvtGetAndClearFlags(event_listener_t *elp) {
+  eventflags_t flags = elp->flags;
+
+  elp->flags = 0;
+  return flags;
+}
+
+/**
+ * @brief   Wait for any of the events.
+ *
+ * @param[in] events  events waited for
+ * @param[in] timeout timeout of the wait
+ * @return            the lowest pending event, 0 on timeout
+ */
+eventmask_t chEvtWaitAnyTimeout(eventmask_t events, systime_t timeout) {
+  thread_t *tp;
+  eventmask_t m;
+
+  simInit();
+  tp = simCurrent;
+  if ((tp->epending & events) == 0) {
+    if (timeout == TIME_IMMEDIATE)
+      return 0;
+    tp->ewmask = events;
+    if (simWait(SIM_WTEVENT, timeout) != MSG_OK)
+      return 0;
+  }
+  m = tp->epending & events;
+  m &= (eventmask_t)0 - m;
+  tp->epending &= ~m;
+  return m;
+}
+
+/*==========================================================================*/
+/* Memory pools functions.                                                  */
+/*==========================================================================*/
+
+/**
+ * @brief   Initialize a memory pool.
+ *
+ * @param[out] mp     pool to initialize
+ * @param[in] size    size of an object
+ * @param[in] provider  not used
+ */
+void chPoolObjectInit(memory_pool_t *mp, size_t size, void *provider) {
+
+  mp->next        = NULL;
+  mp->object_size = size;
+  mp->provider    = provider;
+}
+
+/**
+ * @brief   Allocate an object from a pool.
+ *
+ * @param[in] mp      pool
+ * @return            object, NULL if the pool is empty
+ */
+void *chPoolAlloc(memory_pool_t *mp) {
+  void *objp = mp->next;
+
+  if (objp != NULL)
+    mp->next = *(void **)objp;
+  return objp;
+}
+
+/**
+ * @brief   Free an object to a pool.
+ *
+ * @param[in] mp      pool
+ * @param[in] objp    object to free
+ */
+void chPoolFree(memory_pool_t *mp, void *objp) {
+
+  *(void **)objp = mp->next;
+  mp->next = objp;
+}
@@ -0,0 +1,483 @@
+/**
+ *
+ * @file    cubesim.c
+ *
+ * @brief   Simulations of the led-cube driver on the host.
+ *
+ * @details The driver runs on the virtual time kernel with the tick of
+ *          the build, the refresh engine writes the simulated ports, or the
+ *          simulated SPI bus when it is built with LEDCUBE_USE_SPI:
+ *          - demo [seconds]: the demo animations play in a loop, the
+ *            refresh rate of the cube is measured.
+ *          - mkstream [file] [frames] [fps]: a frame stream is written to a
+ *            file, a voxel pattern moving at each frame.
+ *          - stream [file] [baud]: the packets of a stream file are sent on
+ *            a serial line at their timestamps, the cube receives and
+ *            displays them, the frame rate and jitter are measured.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Standard files. */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* ChibiOS files. */
+#include "ch.h"
+#include "hal.h"
+
+/* Driver files. */
+#include "ledcube.h"
+
+/*==========================================================================*/
+/* Local definitions.                                                       */
+/*==========================================================================*/
+
+#define STREAM_PACKET   (11 + LEDCUBE_STREAM_PAYLOAD) /**< Packet bytes.  */
+#define STREAM_BAUD     115200      /**< Default baud rate of the line.     */
+#define STREAM_FPS      50          /**< Default frame rate of mkstream.    */
+#define STREAM_FRAMES   3000        /**< Default frames of mkstream.        */
+#define STREAM_POLL     MS2ST(1)    /**< Receive timeout of the cube.       */
+
+/**
+ * @brief   Serial line reading a stream file.
+ * @details Each packet is sent at the time given by its timestamp, or once
+ *          the previous one is sent if the line is too slow, a byte taking
+ *          10 bit times.
+ */
+typedef struct {
+  const struct BaseChannelVMT *vmt;           /**< Methods of the channel.  */
+  FILE      *file;                            /**< File read.               */
+  simtime_t byteTime;                         /**< Time of a byte (ns).     */
+  bool      started;                          /**< First packet read.       */
+  simtime_t origin;                           /**< Time of the first one.   */
+  uint32_t  stamp;                            /**< Its timestamp (ms).      */
+  uint8_t   packet[STREAM_PACKET];            /**< Packet being sent.       */
+  size_t    len;                              /**< Bytes of the packet.     */
+  size_t    pos;                              /**< Bytes already received.  */
+  simtime_t start;                            /**< Time the packet starts.  */
+  uint32_t  packets;                          /**< Packets sent.            */
+  uint32_t  bytes;                            /**< Bytes sent.              */
+} pipe_channel_t;
+
+/**
+ * @brief   Command of the program.
+ */
+typedef struct {
+  const char  *name;                          /**< Name of the command.     */
+  int         (*fn)(int argc, char **argv);   /**< Function.                */
+  const char  *help;                          /**< Arguments.               */
+} sim_cmd_t;
+
+/*==========================================================================*/
+/* Local variables.                                                         */
+/*==========================================================================*/
+
+static pipe_channel_t     pipeChannel;
+static ledcube_stream_t   cubeStream;
+static thread_reference_t displayRef;
+static bool               pipeDone;
+static uint32_t           displayCount;   /**< Frames displayed.          */
+static simtime_t          displayFirst;   /**< Time of the first one.     */
+static simtime_t          displayLast;    /**< Time of the last one.      */
+static uint32_t           displayStamp;   /**< Timestamp of the last one. */
+static simtime_t          displayMin;     /**< Shortest interval.         */
+static simtime_t          displayMax;     /**< Longest interval.          */
+static double             jitterSum;      /**< Sum of the squared errors. */
+static double             jitterMax;      /**< Largest interval error.    */
+static THD_WORKING_AREA(waReceive, 512);
+static THD_WORKING_AREA(waDisplay, 512);
+
+/*==========================================================================*/
+/* Local functions.                                                         */
+/*==========================================================================*/
+
+/**
+ * @brief   Host time, in nanoseconds.
+ */
+static uint64_t hostNs(void) {
+  struct timespec ts;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief   Update a CRC-8 (polynomial 0x07) with one byte, as the cube.
+ */
+static uint8_t streamCrc(uint8_t crc, uint8_t b) {
+  uint8_t i;
+
+  crc ^= b;
+  for (i = 0; i < 8; i++)
+    crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+  return crc;
+}
+
+/**
+ * @brief   Encode a frame in a stream packet.
+ */
+static void streamEncode(uint8_t *bp, uint16_t seq, uint32_t stamp,
+                         const ledcube_frame_t *fp) {
+  unsigned i, z, b, k;
+  uint8_t crc = 0;
+
+  bp[0] = LEDCUBE_STREAM_SYNC0;
+  bp[1] = LEDCUBE_STREAM_SYNC1;
+  bp[2] = (uint8_t)seq;
+  bp[3] = (uint8_t)(seq >> 8);
+  for (i = 0; i < 4; i++)
+    bp[4 + i] = (uint8_t)(stamp >> (8 * i));
+  bp[8] = (uint8_t)LEDCUBE_STREAM_PAYLOAD;
+  bp[9] = (uint8_t)(LEDCUBE_STREAM_PAYLOAD >> 8);
+  i = 10;
+  for (z = 0; z < LEDCUBE_LAYERS; z++) {
+    for (b = 0; b < LEDCUBE_BAM_BITS; b++) {
+      for (k = 0; k < LEDCUBE_LAYER_BYTES; k++)
+        bp[i++] = (uint8_t)(fp->layer[z][b] >> (8 * k));
+    }
+  }
+  for (i = 2; i < STREAM_PACKET - 1; i++)
+    crc = streamCrc(crc, bp[i]);
+  bp[STREAM_PACKET - 1] = crc;
+}
+
+/**
+ * @brief   Read the next packet of the stream file.
+ *
+ * @return  false at the end of the file
+ */
+static bool pipeLoad(pipe_channel_t *cp) {
+  simtime_t end = cp->start + cp->len * cp->byteTime;
+  simtime_t due;
+  uint32_t stamp;
+
+  cp->len = fread(cp->packet, 1, STREAM_PACKET, cp->file);
+  cp->pos = 0;
+  if (cp->len == 0)
+    return false;
+
+  stamp = 0;
+  if (cp->len >= 8)
+    stamp = (uint32_t)cp->packet[4] | ((uint32_t)cp->packet[5] << 8) |
+            ((uint32_t)cp->packet[6] << 16) | ((uint32_t)cp->packet[7] << 24);
+  if (!cp->started) {
+    cp->started = true;
+    cp->origin  = simGetTime();
+    cp->stamp   = stamp;
+    end         = cp->origin;
+  }
+  due = cp->origin + (simtime_t)(uint32_t)(stamp - cp->stamp) * 1000000ULL;
+  cp->start = (due > end) ? due : end;
+  cp->packets++;
+  cp->bytes += (uint32_t)cp->len;
+  return true;
+}
+
+/**
+ * @brief   Read bytes of the line, until @p n are received or the timeout.
+ */
+static size_t pipeReadt(BaseChannel *ip, uint8_t *bp, size_t n,
+                        systime_t time) {
+  pipe_channel_t *cp = (pipe_channel_t *)ip;
+  simtime_t now = simGetTime();
+  simtime_t deadline = (time == TIME_INFINITE) ? ~(simtime_t)0 :
+                       now + (simtime_t)ST2US(time) * 1000ULL;
+  simtime_t at;
+  size_t got = 0, k;
+
+  while (got < n) {
+    if ((cp->pos == cp->len) && !pipeLoad(cp))
+      break;
+
+    /* Bytes of the packet wanted, then those arrived before the
+       deadline. */
+    k  = cp->len - cp->pos;
+    if (k > n - got)
+      k = n - got;
+    at = cp->start + (cp->pos + k) * cp->byteTime;
+    if (at > deadline) {
+      at = deadline;
+      k  = (deadline < cp->start) ? 0 :
+           (size_t)((deadline - cp->start) / cp->byteTime);
+      k  = (k > cp->pos) ? k - cp->pos : 0;
+    }
+    if (at > now) {
+      simSleepNs(at - now);
+      now = simGetTime();
+    }
+    memcpy(bp + got, cp->packet + cp->pos, k);
+    cp->pos += k;
+    got     += k;
+    if (now >= deadline)
+      break;
+  }
+  return got;
+}
+
+static size_t pipeRead(BaseChannel *ip, uint8_t *bp, size_t n) {
+
+  return pipeReadt(ip, bp, n, TIME_INFINITE);
+}
+
+static size_t pipeWritet(BaseChannel *ip, const uint8_t *bp, size_t n,
+                         systime_t time) {
+
+  (void)ip;
+  (void)bp;
+  (void)time;
+  return n;
+}
+
+static size_t pipeWrite(BaseChannel *ip, const uint8_t *bp, size_t n) {
+
+  return pipeWritet(ip, bp, n, TIME_INFINITE);
+}
+
+static const struct BaseChannelVMT pipeVmt = {
+  pipeWrite, pipeRead, pipeWritet, pipeReadt
+};
+
+/**
+ * @brief   Thread of the cube receiving the stream, wakes the display
+ *          at each new frame.
+ */
+static THD_FUNCTION(receiveThread, arg) {
+  uint32_t frames = 0;
+  size_t n;
+
+  (void)arg;
+  do {
+    n = ledCubeStreamReceive(&cubeStream, (BaseChannel *)&pipeChannel,
+                             STREAM_POLL);
+    if (cubeStream.stats.frames != frames) {
+      frames = cubeStream.stats.frames;
+      chThdResume(&displayRef, MSG_OK);
+    }
+  } while ((n > 0) || (pipeChannel.len > 0));
+  pipeDone = true;
+  chThdResume(&displayRef, MSG_OK);
+  chThdExit(MSG_OK);
+}
+
+/**
+ * @brief   Thread of the cube displaying the stream, the intervals between
+ *          the displayed frames are compared to the ones of their
+ *          timestamps.
+ */
+static THD_FUNCTION(displayThread, arg) {
+  uint32_t displayed = 0;
+  systime_t delay;
+  simtime_t now, interval;
+  double jitter;
+
+  (void)arg;
+  while (!pipeDone || (cubeStream.tail != cubeStream.head)) {
+    delay = ledCubeStreamDisplay(&cubeStream);
+    if (cubeStream.stats.displayed != displayed) {
+      displayed = cubeStream.stats.displayed;
+      now = simGetTime();
+      if (displayCount == 0) {
+        displayFirst = now;
+        displayMin   = ~(simtime_t)0;
+      }
+      else {
+        interval = now - displayLast;
+        jitter   = fabs((double)interval - (double)(cubeStream.origin -
+                        displayStamp) * 1e6);
+        jitterSum += jitter * jitter;
+        if (jitter > jitterMax)
+          jitterMax = jitter;
+        if (interval < displayMin)
+          displayMin = interval;
+        if (interval > displayMax)
+          displayMax = interval;
+      }
+      displayCount++;
+      displayLast  = now;
+      displayStamp = cubeStream.origin;
+    }
+    if (delay == TIME_INFINITE) {
+      if (pipeDone)
+        break;
+      (void)chThdSuspendTimeout(&displayRef, TIME_INFINITE);
+    }
+    else if (delay != TIME_IMMEDIATE)
+      chThdSleep(delay);
+  }
+  chThdExit(MSG_OK);
+}
+
+/**
+ * @brief   Play the demo for a virtual time, an hour by default.
+ */
+static int cmdDemo(int argc, char **argv) {
+  uint32_t seconds = (argc > 0) ? (uint32_t)strtoul(argv[0], NULL, 0) : 3600;
+  uint32_t anims = 0;
+  uint32_t refresh;
+  systime_t end;
+  uint64_t host;
+
+  simInit();
+  ledCubeInit();
+  host = hostNs();
+  end  = chVTGetSystemTime() + S2ST(seconds);
+  while ((int32_t)(end - chVTGetSystemTime()) > 0) {
+    ledCubeDemo();
+    anims++;
+  }
+  host = hostNs() - host;
+  refresh = ledCubeGetRefreshRate();
+
+  printf("virtual time  %.3f s\n", simGetTime() / 1e9);
+  printf("host time     %.3f s (%.0fx real time)\n", host / 1e9,
+         (double)simGetTime() / (double)host);
+  printf("cube          %ux%ux%u, %u levels\n", LEDCUBE_SIZE, LEDCUBE_SIZE,
+         LEDCUBE_SIZE, 1U << LEDCUBE_BAM_BITS);
+  printf("animations    %u\n", (unsigned)anims);
+  printf("refresh       %.1f Hz\n", refresh / 1000.0);
+#if LEDCUBE_USE_SPI
+  printf("spi shifts    %u, %u bytes\n",
+         (unsigned)LEDCUBE_SPI_DRIVER.transfers,
+         (unsigned)LEDCUBE_SPI_DRIVER.bytes);
+#else
+  printf("port writes   %u lines %u layers\n",
+         (unsigned)IOPORT2->writes, (unsigned)IOPORT4->writes);
+  printf("latches       %02x %02x\n", (unsigned)IOPORT2->latch,
+         (unsigned)IOPORT4->latch);
+#endif
+  return 0;
+}
+
+/**
+ * @brief   Write a stream file, 3000 frames at 50 fps by default.
+ */
+static int cmdMkstream(int argc, char **argv) {
+  const char *name = (argc > 0) ? argv[0] : "stream.bin";
+  uint32_t frames = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) :
+                                 STREAM_FRAMES;
+  uint32_t fps = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) :
+                              STREAM_FPS;
+  uint8_t packet[STREAM_PACKET];
+  ledcube_frame_t frame;
+  uint32_t i;
+  uint8_t x, y, z;
+  FILE *f;
+
+  if ((fps == 0) || ((f = fopen(name, "wb")) == NULL)) {
+    fprintf(stderr, "cannot write %s\n", name);
+    return 1;
+  }
+  for (i = 0; i < frames; i++) {
+    ledCubeFrameClear(&frame);
+    for (z = 0; z < LEDCUBE_LAYERS; z++) {
+      for (y = 0; y < LEDCUBE_SIZE; y++) {
+        for (x = 0; x < LEDCUBE_SIZE; x++)
+          ledCubeFrameSetVoxel(&frame, x, y, z,
+                               (uint8_t)((x + y + z + i) % LEDCUBE_LEVELS));
+      }
+    }
+    streamEncode(packet, (uint16_t)i,
+                 (uint32_t)(((uint64_t)i * 1000 + fps / 2) / fps), &frame);
+    (void)fwrite(packet, 1, STREAM_PACKET, f);
+  }
+  fclose(f);
+
+  printf("%u frames at %u fps, %u bytes a packet, %.1f s\n",
+         (unsigned)frames, (unsigned)fps, (unsigned)STREAM_PACKET,
+         (double)frames / fps);
+  return 0;
+}
+
+/**
+ * @brief   Pipe a stream file to the cube at a baud rate, 115200 by default.
+ */
+static int cmdStream(int argc, char **argv) {
+  const char *name = (argc > 0) ? argv[0] : "stream.bin";
+  uint32_t baud = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) :
+                               STREAM_BAUD;
+  const ledcube_stream_stats_t *sp = &cubeStream.stats;
+  thread_t *receiveTp, *displayTp;
+  double seconds, rms;
+  uint64_t host;
+
+  if (baud == 0)
+    baud = STREAM_BAUD;
+  pipeChannel.vmt      = &pipeVmt;
+  pipeChannel.byteTime = 10ULL * 1000000000ULL / baud;
+  if ((pipeChannel.file = fopen(name, "rb")) == NULL) {
+    fprintf(stderr, "cannot read %s\n", name);
+    return 1;
+  }
+
+  simInit();
+  ledCubeInit();
+  ledCubeStreamInit(&cubeStream);
+  host      = hostNs();
+  receiveTp = chThdCreateStatic(waReceive, sizeof(waReceive),
+                                NORMALPRIO + 1, receiveThread, NULL);
+  displayTp = chThdCreateStatic(waDisplay, sizeof(waDisplay), NORMALPRIO,
+                                displayThread, NULL);
+  (void)chThdWait(receiveTp);
+  (void)chThdWait(displayTp);
+  host = hostNs() - host;
+  fclose(pipeChannel.file);
+
+  seconds = (double)(displayLast - displayFirst) / 1e9;
+  rms = (displayCount > 1) ? sqrt(jitterSum / (displayCount - 1)) : 0.0;
+  printf("virtual time  %.3f s\n", simGetTime() / 1e9);
+  printf("host time     %.3f s (%.0fx real time)\n", host / 1e9,
+         (double)simGetTime() / (double)host);
+  printf("line          %u baud, %u packets, %u bytes\n", (unsigned)baud,
+         (unsigned)pipeChannel.packets, (unsigned)pipeChannel.bytes);
+  printf("received      %u frames, %u errors, %u lost, %u overruns\n",
+         (unsigned)sp->frames, (unsigned)sp->errors, (unsigned)sp->lost,
+         (unsigned)sp->overruns);
+  printf("displayed     %u frames, %u late, %u underruns\n",
+         (unsigned)sp->displayed, (unsigned)sp->late,
+         (unsigned)sp->underruns);
+  printf("frame rate    %.2f fps\n",
+         (seconds > 0.0) ? (displayCount - 1) / seconds : 0.0);
+  printf("interval      min %.1f ms max %.1f ms\n",
+         (displayCount > 1) ? displayMin / 1e6 : 0.0, displayMax / 1e6);
+  printf("jitter        rms %.0f us max %.0f us\n", rms / 1e3,
+         jitterMax / 1e3);
+  return 0;
+}
+
+static const sim_cmd_t simCmds[] = {
+  {"demo",      cmdDemo,      "[seconds]"},
+  {"mkstream",  cmdMkstream,  "[file] [frames] [fps]"},
+  {"stream",    cmdStream,    "[file] [baud]"},
+};
+
+#define SIM_CMDS  (sizeof(simCmds) / sizeof(simCmds[0]))
+
+/*==========================================================================*/
+/* Main.                                                                    */
+/*==========================================================================*/
+
+int main(int argc, char **argv) {
+  unsigned i;
+
+  for (i = 0; (argc > 1) && (i < SIM_CMDS); i++) {
+    if (strcmp(argv[1], simCmds[i].name) == 0)
+      return simCmds[i].fn(argc - 2, argv + 2);
+  }
+
+  fprintf(stderr, "usage:\n");
+  for (i = 0; i < SIM_CMDS; i++)
+    fprintf(stderr, "  %s %s %s\n", argv[0], simCmds[i].name,
+            simCmds[i].help);
+  return 2;
+}
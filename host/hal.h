@@ -0,0 +1,272 @@
+/**
+ *
+ * @file    hal.h
+ *
+ * @brief   Simulated HAL header file, host simulations.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+#ifndef HAL_H
+#define HAL_H
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Kernel files. */
+#include "ch.h"
+
+/*==========================================================================*/
+/* HAL pre-compile time settings.                                           */
+/*==========================================================================*/
+
+#define HAL_USE_I2C                       TRUE
+#define HAL_USE_SPI                       TRUE
+#define HAL_USE_SERIAL                    TRUE
+
+/**
+ * @brief   Clock of the simulated SPI buses, in Hz.
+ * @note    The default is 4 MHz.
+ */
+#if !defined(SIM_SPI_CLOCK) || defined(__DOXYGEN__)
+#define SIM_SPI_CLOCK                     4000000
+#endif
+
+/*==========================================================================*/
+/* HAL macros.                                                              */
+/*==========================================================================*/
+
+/*
+ * I2C error flags.
+ */
+#define I2C_NO_ERROR          0x00  /**< No error.                          */
+#define I2C_BUS_ERROR         0x01  /**< Bus error, a slave was overdriven. */
+#define I2C_ARBITRATION_LOST  0x02  /**< Arbitration lost.                  */
+#define I2C_ACK_FAILURE       0x04  /**< No acknowledge.                    */
+#define I2C_OVERRUN           0x08  /**< Overrun.                           */
+#define I2C_TIMEOUT           0x20  /**< Timeout of the transfer.           */
+
+/*
+ * Modes of the pads.
+ */
+#define PAL_MODE_RESET              0U
+#define PAL_MODE_UNCONNECTED        1U
+#define PAL_MODE_INPUT              2U
+#define PAL_MODE_INPUT_PULLUP       3U
+#define PAL_MODE_INPUT_PULLDOWN     4U
+#define PAL_MODE_INPUT_ANALOG       5U
+#define PAL_MODE_OUTPUT_PUSHPULL    6U
+#define PAL_MODE_OUTPUT_OPENDRAIN   7U
+#define PAL_MODE_ALTERNATE(n)       (0x80U | ((uint32_t)(n) << 8))
+#define PAL_STM32_OTYPE_OPENDRAIN   0x10U
+
+#define PAL_PORT_BIT(n)             ((ioportmask_t)1 << (n))
+
+/*
+ * Simulated ports, the AVR and the STM32 names.
+ */
+#define IOPORT1               (&simPorts[0])
+#define IOPORT2               (&simPorts[1])
+#define IOPORT3               (&simPorts[2])
+#define IOPORT4               (&simPorts[3])
+#define GPIOA                 (&simPorts[4])
+#define GPIOB                 (&simPorts[5])
+#define GPIOC                 (&simPorts[6])
+#define GPIOD                 (&simPorts[7])
+#define SIM_PORTS             8
+
+#define palWriteGroup(port, mask, offset, bits)                             \
+  simPalWriteGroup((port), (mask), (offset), (bits))
+#define palSetPad(port, pad)                                                \
+  simPalWriteGroup((port), 1U, (pad), 1U)
+#define palClearPad(port, pad)                                              \
+  simPalWriteGroup((port), 1U, (pad), 0U)
+#define palReadPad(port, pad)       (((port)->latch >> (pad)) & 1U)
+#define palSetPadMode(port, pad, m)                                         \
+  ((void)((port)->mode[(pad)] = (uint32_t)(m)))
+
+#define chnReadTimeout(ip, bp, n, time)                                     \
+  ((ip)->vmt->readt((ip), (bp), (n), (time)))
+#define chnWriteTimeout(ip, bp, n, time)                                    \
+  ((ip)->vmt->writet((ip), (bp), (n), (time)))
+
+/*==========================================================================*/
+/* HAL data structures and types.                                           */
+/*==========================================================================*/
+
+typedef uint32_t  i2cflags_t;   /**< I2C error flags.                       */
+typedef uint16_t  i2caddr_t;    /**< I2C slave address.                     */
+typedef uint32_t  ioportmask_t; /**< Mask of the pads of a port.            */
+
+/**
+ * @brief   Simulated port.
+ */
+typedef struct {
+  ioportmask_t  latch;          /**< Output latch.                          */
+  uint32_t      mode[32];       /**< Mode of the pads.                      */
+  uint32_t      writes;         /**< Writes to the latch.                   */
+} sim_port_t;
+
+typedef sim_port_t *ioportid_t; /**< Port identifier.                       */
+
+/**
+ * @brief   State of an I2C driver.
+ */
+typedef enum {
+  I2C_UNINIT = 0,
+  I2C_STOP = 1,
+  I2C_READY = 2,
+  I2C_ACTIVE_TX = 3,
+  I2C_ACTIVE_RX = 4,
+  I2C_LOCKED = 5
+} i2cstate_t;
+
+typedef enum {
+  OPMODE_I2C = 1,
+  OPMODE_SMBUS_DEVICE = 2,
+  OPMODE_SMBUS_HOST = 3
+} i2copmode_t;
+
+typedef enum {
+  STD_DUTY_CYCLE = 1,
+  FAST_DUTY_CYCLE_2 = 2,
+  FAST_DUTY_CYCLE_16_9 = 3
+} i2cdutycycle_t;
+
+/**
+ * @brief   I2C configuration, STM32 I2Cv1.
+ */
+typedef struct {
+  i2copmode_t     op_mode;      /**< Operation mode.                        */
+  uint32_t        clock_speed;  /**< Clock speed (Hz).                      */
+  i2cdutycycle_t  duty_cycle;   /**< Duty cycle of the fast mode.           */
+} I2CConfig;
+
+/**
+ * @brief   Slave on a simulated I2C bus.
+ * @details The transfer function is called at the end of each transfer
+ *          addressed to the slave, at the virtual time of the stop.
+ */
+typedef struct sim_i2c_dev {
+  struct sim_i2c_dev  *next;    /**< Next slave of the bus.                 */
+  uint8_t             sad;      /**< Slave address without R/W bit.         */
+  uint32_t            maxClock; /**< Fastest clock of the slave (Hz).       */
+  msg_t (*xfer)(struct sim_i2c_dev *dp, const uint8_t *txbuf, size_t txn,
+                uint8_t *rxbuf, size_t rxn); /**< Transfer of the slave.    */
+  void                *priv;    /**< Model of the slave.                    */
+  uint32_t            transfers;  /**< Transfers with the slave.            */
+  uint32_t            overdriven; /**< Transfers above its clock.           */
+  bool                hold;     /**< The slave holds SCL low.               */
+} sim_i2c_dev_t;
+
+/**
+ * @brief   Simulated I2C bus.
+ */
+typedef struct I2CDriver {
+  i2cstate_t      state;        /**< State of the driver.                   */
+  const I2CConfig *config;      /**< Current configuration, NULL if stopped.*/
+  i2cflags_t      errors;       /**< Errors of the last transfer.           */
+  mutex_t         mutex;        /**< Bus mutex, i2cAcquireBus().            */
+  sim_i2c_dev_t   *devices;     /**< Slaves of the bus.                     */
+  uint32_t        transfers;    /**< Transfers done.                        */
+  uint32_t        bytes;        /**< Data bytes, addresses excluded.        */
+  uint32_t        starts;       /**< Starts of the driver.                  */
+  uint32_t        locked;       /**< Transfers failed on a locked driver.   */
+  simtime_t       busy;         /**< Time spent in the transfers (ns).      */
+} I2CDriver;
+
+typedef struct SPIDriver SPIDriver;
+typedef void (*spicallback_t)(SPIDriver *spip);
+
+/**
+ * @brief   SPI configuration.
+ */
+typedef struct {
+  spicallback_t   end_cb;       /**< End of the transfer.                   */
+  ioportid_t      ssport;       /**< Port of the slave select.              */
+  uint16_t        sspad;        /**< Pad of the slave select.               */
+  uint16_t        cr1;          /**< Mode and clock, not used.              */
+} SPIConfig;
+
+/**
+ * @brief   Simulated SPI bus.
+ */
+struct SPIDriver {
+  const SPIConfig *config;      /**< Current configuration.                 */
+  sim_event_t     event;        /**< End of the transfer.                   */
+  uint32_t        transfers;    /**< Transfers done.                        */
+  uint32_t        bytes;        /**< Bytes sent.                            */
+};
+
+/**
+ * @brief   Simulated serial driver, the bytes are counted or written to a
+ *          file.
+ */
+typedef struct {
+  void            *out;         /**< FILE receiving the bytes, can be NULL. */
+  uint32_t        bytes;        /**< Bytes written.                         */
+} SerialDriver;
+
+/**
+ * @brief   Channel, a sequential stream with timeouts.
+ */
+typedef struct BaseChannel BaseChannel;
+
+/**
+ * @brief   Methods of a channel.
+ */
+struct BaseChannelVMT {
+  size_t (*write)(BaseChannel *ip, const uint8_t *bp, size_t n);
+  size_t (*read)(BaseChannel *ip, uint8_t *bp, size_t n);
+  size_t (*writet)(BaseChannel *ip, const uint8_t *bp, size_t n,
+                   systime_t time);
+  size_t (*readt)(BaseChannel *ip, uint8_t *bp, size_t n, systime_t time);
+};
+
+struct BaseChannel {
+  const struct BaseChannelVMT *vmt; /**< Methods of the channel.            */
+};
+
+/*==========================================================================*/
+/* External declarations.                                                   */
+/*==========================================================================*/
+
+extern sim_port_t   simPorts[SIM_PORTS];
+extern I2CDriver    I2CD1;
+extern I2CDriver    I2CD2;
+extern SPIDriver    SPID1;
+extern SerialDriver SD1;
+extern SerialDriver SD2;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void      simPalWriteGroup(ioportid_t port, ioportmask_t mask,
+                             unsigned offset, ioportmask_t bits);
+  void      i2cStart(I2CDriver *i2cp, const I2CConfig *config);
+  void      i2cStop(I2CDriver *i2cp);
+  void      i2cAcquireBus(I2CDriver *i2cp);
+  void      i2cReleaseBus(I2CDriver *i2cp);
+  i2cflags_t i2cGetErrors(I2CDriver *i2cp);
+  msg_t     i2cMasterTransmitTimeout(I2CDriver *i2cp, i2caddr_t addr,
+                                     const uint8_t *txbuf, size_t txbytes,
+                                     uint8_t *rxbuf, size_t rxbytes,
+                                     systime_t timeout);
+  msg_t     i2cMasterReceiveTimeout(I2CDriver *i2cp, i2caddr_t addr,
+                                    uint8_t *rxbuf, size_t rxbytes,
+                                    systime_t timeout);
+  void      simI2cAttach(I2CDriver *i2cp, sim_i2c_dev_t *dp);
+  void      spiStart(SPIDriver *spip, const SPIConfig *config);
+  void      spiSelectI(SPIDriver *spip);
+  void      spiUnselectI(SPIDriver *spip);
+  void      spiStartSendI(SPIDriver *spip, size_t n, const void *txbuf);
+  void      sdPut(SerialDriver *sdp, uint8_t b);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HAL_H */
@@ -0,0 +1,345 @@
+/**
+ *
+ * @file    halsim.c
+ *
+ * @brief   Simulated HAL, host simulations.
+ *
+ * @details The I2C transfers take the virtual time of their bits at the
+ *          clock of the bus, then the slave model answers. The SPI
+ *          transfers end with an event, as the DMA interrupt does.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Standard files. */
+#include <stdio.h>
+
+/* ChibiOS files. */
+#include "hal.h"
+
+/*==========================================================================*/
+/* Global variables.                                                        */
+/*==========================================================================*/
+
+sim_port_t    simPorts[SIM_PORTS];
+I2CDriver     I2CD1;
+I2CDriver     I2CD2;
+SPIDriver     SPID1;
+SerialDriver  SD1;
+SerialDriver  SD2;
+
+/*==========================================================================*/
+/* Local functions.                                                         */
+/*==========================================================================*/
+
+/**
+ * @brief   Time of an I2C transfer on the wire.
+ * @details Each byte takes 9 bits with its acknowledge; the start, the
+ *          repeated start and the stop take one bit each.
+ *
+ * @param[in] clock   clock of the bus (Hz)
+ * @param[in] txn     bytes to send
+ * @param[in] rxn     bytes to receive
+ * @return            time of the transfer, in nanoseconds
+ */
+static simtime_t i2cWireTime(uint32_t clock, size_t txn, size_t rxn) {
+  uint64_t bits = 0;
+
+  if (txn > 0)
+    bits += 1U + 9U * (1U + txn);
+  if (rxn > 0)
+    bits += 1U + 9U * (1U + rxn);
+  bits += 1U;
+  return (simtime_t)((bits * 1000000000ULL + clock - 1U) / clock);
+}
+
+/**
+ * @brief   End of a SPI transfer.
+ *
+ * @param[in] ep      event of the driver
+ */
+static void spiEndEvent(sim_event_t *ep) {
+  SPIDriver *spip = (SPIDriver *)((uint8_t *)ep -
+                                  offsetof(SPIDriver, event));
+
+  if (spip->config->end_cb != NULL)
+    spip->config->end_cb(spip);
+}
+
+/*==========================================================================*/
+/* PAL functions.                                                           */
+/*==========================================================================*/
+
+/**
+ * @brief   Write a group of pads.
+ *
+ * @param[in] port    port
+ * @param[in] mask    mask of the group, right aligned
+ * @param[in] offset  first pad of the group
+ * @param[in] bits    value of the group
+ */
+void simPalWriteGroup(ioportid_t port, ioportmask_t mask, unsigned offset,
+                      ioportmask_t bits) {
+
+  port->latch = (port->latch & ~(mask << offset)) |
+                ((bits & mask) << offset);
+  port->writes++;
+}
+
+/*==========================================================================*/
+/* I2C functions.                                                           */
+/*==========================================================================*/
+
+/**
+ * @brief   Start or reconfigure an I2C bus.
+ *
+ * @param[in] i2cp    bus
+ * @param[in] config  configuration
+ */
+void i2cStart(I2CDriver *i2cp, const I2CConfig *config) {
+
+  chDbgCheck((config != NULL) && (config->clock_speed > 0));
+  i2cp->state  = I2C_READY;
+  i2cp->config = config;
+  i2cp->errors = I2C_NO_ERROR;
+  i2cp->starts++;
+}
+
+/**
+ * @brief   Stop an I2C bus.
+ *
+ * @param[in] i2cp    bus
+ */
+void i2cStop(I2CDriver *i2cp) {
+
+  i2cp->state  = I2C_STOP;
+  i2cp->config = NULL;
+}
+
+/**
+ * @brief   Get exclusive access to an I2C bus.
+ *
+ * @param[in] i2cp    bus
+ */
+void i2cAcquireBus(I2CDriver *i2cp) {
+
+  chMtxLock(&i2cp->mutex);
+}
+
+/**
+ * @brief   Release an I2C bus.
+ *
+ * @param[in] i2cp    bus
+ */
+void i2cReleaseBus(I2CDriver *i2cp) {
+
+  chMtxUnlock(&i2cp->mutex);
+}
+
+/**
+ * @brief   Get the errors of the last transfer.
+ *
+ * @param[in] i2cp    bus
+ * @return            error flags
+ */
+i2cflags_t i2cGetErrors(I2CDriver *i2cp) {
+
+  return i2cp->errors;
+}
+
+/**
+ * @brief   Write then read a slave.
+ * @details The caller sleeps for the time of the transfer on the wire.
+ *          A transfer longer than the timeout, or addressed to a slave
+ *          holding SCL low, stops at the timeout, an absent slave does not
+ *          acknowledge and a slave driven above its clock makes a bus error.
+ *          As on the target, a timeout leaves the driver in the I2C_LOCKED
+ *          state until it is stopped and started again, every transfer on
+ *          a locked driver waits for its timeout and fails.
+ *
+ * @param[in] i2cp    bus
+ * @param[in] addr    slave address
+ * @param[in] txbuf   bytes to send
+ * @param[in] txbytes number of bytes to send
+ * @param[out] rxbuf  received bytes
+ * @param[in] rxbytes number of bytes to receive
+ * @param[in] timeout timeout of the transfer
+ * @return            status of the transfer
+ * @retval MSG_OK       the transfer is done.
+ * @retval MSG_RESET    an error happened, see i2cGetErrors().
+ * @retval MSG_TIMEOUT  the transfer did not end in time.
+ */
+msg_t i2cMasterTransmitTimeout(I2CDriver *i2cp, i2caddr_t addr,
+                               const uint8_t *txbuf, size_t txbytes,
+                               uint8_t *rxbuf, size_t rxbytes,
+                               systime_t timeout) {
+  sim_i2c_dev_t *dp;
+  simtime_t wire;
+  msg_t msg;
+
+  chDbgCheck((i2cp->config != NULL) && ((txbytes > 0) || (rxbytes > 0)));
+  wire = i2cWireTime(i2cp->config->clock_speed, txbytes, rxbytes);
+  i2cp->errors = I2C_NO_ERROR;
+  for (dp = i2cp->devices; dp != NULL; dp = dp->next) {
+    if (dp->sad == addr)
+      break;
+  }
+
+  if (i2cp->state == I2C_LOCKED) {
+    chDbgCheck(timeout != TIME_INFINITE);
+    chThdSleep(timeout);
+    i2cp->busy += (simtime_t)timeout * (1000000000ULL /
+                                        CH_CFG_ST_FREQUENCY);
+    i2cp->errors = I2C_TIMEOUT;
+    i2cp->locked++;
+    return MSG_TIMEOUT;
+  }
+
+  if (dp == NULL) {
+    /* The start, the address and the stop. */
+    wire = (11ULL * 1000000000ULL) / i2cp->config->clock_speed;
+    simSleepNs(wire);
+    i2cp->busy += wire;
+    i2cp->errors = I2C_ACK_FAILURE;
+    return MSG_RESET;
+  }
+
+  chDbgCheck(!dp->hold || (timeout != TIME_INFINITE));
+  if (dp->hold || ((timeout != TIME_INFINITE) &&
+      (wire > (simtime_t)timeout * (1000000000ULL / CH_CFG_ST_FREQUENCY)))) {
+    chThdSleep(timeout);
+    i2cp->busy += (simtime_t)timeout * (1000000000ULL /
+                                        CH_CFG_ST_FREQUENCY);
+    i2cp->state  = I2C_LOCKED;
+    i2cp->errors = I2C_TIMEOUT;
+    return MSG_TIMEOUT;
+  }
+
+  simSleepNs(wire);
+  i2cp->busy += wire;
+  i2cp->transfers++;
+  dp->transfers++;
+  if (i2cp->config->clock_speed > dp->maxClock) {
+    dp->overdriven++;
+    i2cp->errors = I2C_BUS_ERROR;
+    return MSG_RESET;
+  }
+
+  msg = dp->xfer(dp, txbuf, txbytes, rxbuf, rxbytes);
+  if (msg == MSG_OK)
+    i2cp->bytes += (uint32_t)(txbytes + rxbytes);
+  else
+    i2cp->errors = I2C_ACK_FAILURE;
+  return msg;
+}
+
+/**
+ * @brief   Read a slave.
+ *
+ * @param[in] i2cp    bus
+ * @param[in] addr    slave address
+ * @param[out] rxbuf  received bytes
+ * @param[in] rxbytes number of bytes to receive
+ * @param[in] timeout timeout of the transfer
+ * @return            status of the transfer, see
+ *                    i2cMasterTransmitTimeout()
+ */
+msg_t i2cMasterReceiveTimeout(I2CDriver *i2cp, i2caddr_t addr,
+                              uint8_t *rxbuf, size_t rxbytes,
+                              systime_t timeout) {
+
+  return i2cMasterTransmitTimeout(i2cp, addr, NULL, 0, rxbuf, rxbytes,
+                                  timeout);
+}
+
+/**
+ * @brief   Attach a slave model to an I2C bus.
+ *
+ * @param[in] i2cp    bus
+ * @param[in] dp      slave
+ */
+void simI2cAttach(I2CDriver *i2cp, sim_i2c_dev_t *dp) {
+
+  dp->next      = i2cp->devices;
+  i2cp->devices = dp;
+}
+
+/*==========================================================================*/
+/* SPI functions.                                                           */
+/*==========================================================================*/
+
+/**
+ * @brief   Start a SPI bus.
+ *
+ * @param[in] spip    bus
+ * @param[in] config  configuration
+ */
+void spiStart(SPIDriver *spip, const SPIConfig *config) {
+
+  spip->config = config;
+  spip->event.armed = false;
+}
+
+/**
+ * @brief   Select the slave.
+ *
+ * @param[in] spip    bus
+ */
+void spiSelectI(SPIDriver *spip) {
+
+  palClearPad(spip->config->ssport, spip->config->sspad);
+}
+
+/**
+ * @brief   Unselect the slave.
+ *
+ * @param[in] spip    bus
+ */
+void spiUnselectI(SPIDriver *spip) {
+
+  palSetPad(spip->config->ssport, spip->config->sspad);
+}
+
+/**
+ * @brief   Start sending bytes, the end callback is called when they are
+ *          sent at SIM_SPI_CLOCK.
+ *
+ * @param[in] spip    bus
+ * @param[in] n       number of bytes
+ * @param[in] txbuf   bytes to send
+ */
+void spiStartSendI(SPIDriver *spip, size_t n, const void *txbuf) {
+
+  (void)txbuf;
+  chDbgCheck(!spip->event.armed);
+  spip->transfers++;
+  spip->bytes += (uint32_t)n;
+  simSchedule(&spip->event,
+              simGetTime() + ((uint64_t)n * 8U * 1000000000ULL +
+                              SIM_SPI_CLOCK - 1U) / SIM_SPI_CLOCK,
+              spiEndEvent);
+}
+
+/*==========================================================================*/
+/* Serial functions.                                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Write a byte.
+ *
+ * @param[in] sdp     serial driver
+ * @param[in] b       byte to write
+ */
+void sdPut(SerialDriver *sdp, uint8_t b) {
+
+  sdp->bytes++;
+  if (sdp->out != NULL)
+    (void)fputc(b, (FILE *)sdp->out);
+}
@@ -0,0 +1,872 @@
+/**
+ *
+ * @file    sim.c
+ *
+ * @brief   Simulations of the STM32 drivers on the host.
+ *
+ * @details The drivers run on the virtual time kernel against simulated
+ *          slaves, a BMP085 and a DS1307 on I2CD1:
+ *          - hour [seconds]: the sensor hub samples the BMP085 and the
+ *            DS1307 while a thread reads the clock every second.
+ *          - bus [mode] [seconds]: threads read both slaves back to back,
+ *            the throughput of each speed is measured with the per slave
+ *            clocks (managed), or with the whole bus at 400 or 100 kHz.
+ *          - stuck [seconds]: a third slave holds SCL low after a
+ *            second, the reads of the BMP085 and of the DS1307 must go on
+ *            while it is in quarantine.
+ *          - log [seconds] [file] [us]: the samples of the hub are written
+ *            to a binary log file at a period, the file is read back in
+ *            small chunks and decoded, the samples decoded are compared to
+ *            the ones logged.
+ *          - record [seconds] [file]: the hour workload is traced, the
+ *            records are dumped to a file with i2cTraceDump().
+ *          - replay [file]: the transfers of a trace are done again at
+ *            their recorded times through the driver, their status and
+ *            data are compared to the recorded ones.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Standard files. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* ChibiOS files. */
+#include "ch.h"
+#include "hal.h"
+
+/* Driver files. */
+#include "iic.h"
+#include "bmp085.h"
+#include "ds1307.h"
+#include "sensorhub.h"
+
+/* Simulation files. */
+#include "simdev.h"
+
+/*==========================================================================*/
+/* Local definitions.                                                       */
+/*==========================================================================*/
+
+#define SIM_EPOCH       536544000UL /**< Clock of the RTC, 01/01/2017.      */
+#define SIM_STUCK_ADDR  0x76        /**< Slave holding the bus.             */
+#define SIM_POLL        MS2ST(10)   /**< Period of the reads of stuck.      */
+#define SIM_LOG_PERIOD  10500       /**< Period of the log (us).            */
+#define SIM_LOG_CHUNK   64          /**< Bytes of a read of the log file.   */
+
+/**
+ * @brief   Stream writing to a file.
+ */
+typedef struct {
+  const struct BaseSequentialStreamVMT *vmt;  /**< Methods of the stream.   */
+  FILE      *file;                            /**< File written.            */
+} file_stream_t;
+
+/**
+ * @brief   Sample appended to the log, kept to check the decoded one.
+ */
+typedef struct {
+  systime_t time;     /**< System time of the sample.                       */
+  int32_t   press;    /**< Pressure (Pa).                                   */
+  int16_t   temp;     /**< Temperature (0.1 deg C).                         */
+  bool      first;    /**< First sample of a block.                         */
+} log_sample_t;
+
+/**
+ * @brief   Comparison of the decoded log with the samples appended.
+ */
+typedef struct {
+  const log_sample_t  *samples;   /**< Samples appended.                    */
+  uint32_t            n;          /**< Number of samples appended.          */
+  uint32_t            decoded;    /**< Samples decoded.                     */
+  uint32_t            values;     /**< Wrong pressures or temperatures.     */
+  uint32_t            epochs;     /**< Block times far from the RTC.        */
+  uint64_t            base;       /**< Decoded time of the block (ms).      */
+  systime_t           baseTime;   /**< System time of the block.            */
+  int64_t             minLag;     /**< Shortest lag of a decoded time (us). */
+  int64_t             maxLag;     /**< Longest lag of a decoded time (us).  */
+} log_check_t;
+
+/**
+ * @brief   Load of the bus test, a thread reading registers of a slave.
+ */
+typedef struct {
+  uint8_t   sad;      /**< Slave address.                                   */
+  uint8_t   reg;      /**< First register.                                  */
+  uint8_t   n;        /**< Number of registers.                             */
+  uint32_t  reads;    /**< Reads done.                                      */
+  uint32_t  errors;   /**< Reads failed.                                    */
+  uint32_t  bytes;    /**< Bytes of the reads done, addresses included.     */
+} bus_load_t;
+
+/**
+ * @brief   Command of the program.
+ */
+typedef struct {
+  const char  *name;                          /**< Name of the command.     */
+  int         (*fn)(int argc, char **argv);   /**< Function.                */
+  const char  *help;                          /**< Arguments.               */
+} sim_cmd_t;
+
+/*==========================================================================*/
+/* Local variables.                                                         */
+/*==========================================================================*/
+
+static sim_bmp085_t       simBmp;
+static sim_ds1307_t       simRtc;
+static sim_bmp085_t       simStuck;
+static rtcDriver_t        rtcDriver;
+static sensorhub_bmp085_t hubBmp;
+static sensorhub_stream_t hubStreams[3];
+static sensorhub_t        hub;
+static systime_t          runEnd;
+static uint32_t           clockReads;
+static THD_WORKING_AREA(waHub, 1024);
+static THD_WORKING_AREA(waClock, 512);
+static THD_WORKING_AREA(waLoads[4], 512);
+static THD_WORKING_AREA(waDump, 512);
+static THD_WORKING_AREA(waLog, 512);
+static file_stream_t      traceFile;
+static uint32_t           traceRecords;
+static uint32_t           traceLost;
+static sensorhub_log_t    hubLog;
+static file_stream_t      logFile;
+static log_sample_t       *logSamples;
+static uint32_t           logCount;
+static uint32_t           logSize;
+
+/**
+ * @brief   Loads of the bus test, two per slave.
+ */
+static bus_load_t busLoads[4] = {
+  {BMP085_ADDR,    0xAA, 22, 0, 0, 0},  /* Calibration.                    */
+  {BMP085_ADDR,    0xF6, 3,  0, 0, 0},  /* Result.                         */
+  {DS1307_ADDRESS, 0x00, 7,  0, 0, 0},  /* Clock.                          */
+  {DS1307_ADDRESS, 0x08, 8,  0, 0, 0},  /* RAM.                            */
+};
+
+/**
+ * @brief   Loads of the stuck test, one per slave.
+ */
+static bus_load_t stuckLoads[3] = {
+  {BMP085_ADDR,    0xF6, 3,  0, 0, 0},  /* Result.                         */
+  {DS1307_ADDRESS, 0x00, 7,  0, 0, 0},  /* Clock.                          */
+  {SIM_STUCK_ADDR, 0xF6, 3,  0, 0, 0},  /* Result of the stuck slave.      */
+};
+
+static const I2CConfig busFast = {OPMODE_I2C, IIC_FAST_MODE,
+                                  FAST_DUTY_CYCLE_2};
+static const I2CConfig busStd  = {OPMODE_I2C, IIC_STANDARD_MODE,
+                                  STD_DUTY_CYCLE};
+
+/*==========================================================================*/
+/* Local functions.                                                         */
+/*==========================================================================*/
+
+static size_t fileWrite(BaseSequentialStream *ip, const uint8_t *bp,
+                        size_t n) {
+
+  return fwrite(bp, 1, n, ((file_stream_t *)ip)->file);
+}
+
+static size_t fileRead(BaseSequentialStream *ip, uint8_t *bp, size_t n) {
+
+  (void)ip;
+  (void)bp;
+  (void)n;
+  return 0;
+}
+
+static const struct BaseSequentialStreamVMT fileVmt = {fileWrite, fileRead};
+
+/**
+ * @brief   Host time, in nanoseconds.
+ */
+static uint64_t hostNs(void) {
+  struct timespec ts;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief   Attach the slaves to I2CD1 and start the drivers.
+ */
+static void simBoard(void) {
+
+  simInit();
+  simBmp085Init(&simBmp, BMP085_ADDR, IIC_FAST_MODE);
+  simDs1307Init(&simRtc, DS1307_ADDRESS, DS1307_I2C_CLOCK, SIM_EPOCH);
+  simI2cAttach(&I2CD1, &simBmp.dev);
+  simI2cAttach(&I2CD1, &simRtc.dev);
+
+  ds1307InitInterface();
+  rtcDriver.refYear = 2000;
+  (void)i2cRegisterDevice(&I2CD1, BMP085_ADDR, BMP085_I2C_CLOCK,
+                          IIC_PRIO_REALTIME);
+}
+
+/**
+ * @brief   Read the calibration and set up the sensor hub.
+ */
+static void hubSetup(void) {
+  sensorhub_stream_t *streams = hubStreams;
+
+  if (bmp085GetCalibrationData(&I2CD1, BMP085_ADDR) != MSG_OK) {
+    fprintf(stderr, "sim: no BMP085 calibration\n");
+    exit(1);
+  }
+
+  hubBmp.i2cp = &I2CD1;
+  hubBmp.addr = BMP085_ADDR;
+  hubBmp.oss  = BMP085_ULTRA_HIGH_RESOLUTION;
+
+  streams[0].start     = sensorHubBmp085StartTemp;
+  streams[0].fetch     = sensorHubBmp085FetchTemp;
+  streams[0].arg       = &hubBmp;
+  streams[0].device    = 0;
+  streams[0].convTime  = MS2ST(BMP085_TEMP_CONVERSION_TIME);
+  streams[0].startCost = SENSORHUB_XFER_TIME(2, IIC_FAST_MODE);
+  streams[0].fetchCost = SENSORHUB_XFER_TIME(3, IIC_FAST_MODE);
+  streams[1].start     = sensorHubBmp085StartPress;
+  streams[1].fetch     = sensorHubBmp085FetchPress;
+  streams[1].arg       = &hubBmp;
+  streams[1].device    = 0;
+  streams[1].convTime  =
+      MS2ST(bmp085GetPressureConversionTime(hubBmp.oss));
+  streams[1].startCost = SENSORHUB_XFER_TIME(2, IIC_FAST_MODE);
+  streams[1].fetchCost = SENSORHUB_XFER_TIME(4, IIC_FAST_MODE);
+  streams[2].start     = NULL;
+  streams[2].fetch     = sensorHubDs1307FetchClock;
+  streams[2].arg       = &rtcDriver;
+  streams[2].device    = 1;
+  streams[2].fetchCost = SENSORHUB_XFER_TIME(8, DS1307_I2C_CLOCK);
+  streams[2].repeat    = DS1307_READ_WINDOW + streams[2].fetchCost;
+  if (sensorHubInit(&hub, streams, 3) != MSG_OK) {
+    fprintf(stderr, "sim: invalid hub\n");
+    exit(1);
+  }
+}
+
+/**
+ * @brief   Append the last samples of the hub to the log.
+ */
+static void logSample(void) {
+  log_sample_t *sp;
+
+  if (logCount == logSize) {
+    logSize    = (logSize == 0) ? 4096 : 2 * logSize;
+    logSamples = realloc(logSamples, logSize * sizeof(log_sample_t));
+    if (logSamples == NULL) {
+      fprintf(stderr, "sim: out of memory\n");
+      exit(1);
+    }
+  }
+
+  sp = &logSamples[logCount++];
+  sp->time  = chVTGetSystemTime();
+  sp->press = (int32_t)(hubBmp.press * 100.0f + 0.5f);
+  sp->temp  = (int16_t)(hubBmp.temp * 10.0f);
+  sensorHubLogAppend(&hubLog, sp->time, sp->press, sp->temp);
+  sp->first = (hubLog.count == 1);
+}
+
+/**
+ * @brief   Thread of the sensor hub.
+ */
+static THD_FUNCTION(hubThread, arg) {
+
+  (void)arg;
+  while ((int32_t)(runEnd - chVTGetSystemTime()) > 0)
+    sensorHubCycle(&hub);
+  chThdExit(MSG_OK);
+}
+
+/**
+ * @brief   Thread reading the clock every second.
+ */
+static THD_FUNCTION(clockThread, arg) {
+  systime_t next = chVTGetSystemTime();
+
+  (void)arg;
+  while ((int32_t)(runEnd - next) > 0) {
+    if (ds1307GetClock(&rtcDriver) == MSG_OK)
+      clockReads++;
+    next += S2ST(1);
+    chThdSleepUntil(next);
+  }
+  chThdExit(MSG_OK);
+}
+
+/**
+ * @brief   Run the sensor hub and the clock reader for a virtual time.
+ */
+static void hubRun(uint32_t seconds) {
+  thread_t *hubTp, *clockTp;
+
+  runEnd  = chVTGetSystemTime() + S2ST(seconds);
+  hubTp   = chThdCreateStatic(waHub, sizeof(waHub), NORMALPRIO + 1,
+                              hubThread, NULL);
+  clockTp = chThdCreateStatic(waClock, sizeof(waClock), NORMALPRIO,
+                              clockThread, NULL);
+  (void)chThdWait(hubTp);
+  (void)chThdWait(clockTp);
+}
+
+/**
+ * @brief   Print the statistics of a stream of the hub.
+ */
+static void printStream(const char *name, const sensorhub_stream_t *sp) {
+
+  printf("  %-12s %8u samples %4u errors %8.3f Hz  period %u..%u us"
+         "  jitter %u us\n", name, (unsigned)sp->stats.samples,
+         (unsigned)sp->stats.errors, sensorHubGetRate(sp) / 1000.0,
+         (unsigned)ST2US(sp->stats.minPeriod),
+         (unsigned)ST2US(sp->stats.maxPeriod),
+         (unsigned)ST2US(sensorHubGetJitter(sp)));
+}
+
+/**
+ * @brief   Sample the sensors for a virtual time, an hour by default.
+ */
+static int cmdHour(int argc, char **argv) {
+  uint32_t seconds = (argc > 0) ? (uint32_t)strtoul(argv[0], NULL, 0) : 3600;
+  iic_stats_t stats;
+  uint64_t host;
+
+  simBoard();
+  hubSetup();
+  host = hostNs();
+  hubRun(seconds);
+  host = hostNs() - host;
+
+  i2cGetStats(&I2CD1, &stats);
+  printf("virtual time  %.3f s\n", simGetTime() / 1e9);
+  printf("host time     %.3f s (%.0fx real time)\n", host / 1e9,
+         (double)simGetTime() / (double)host);
+  printf("hub cycle     %u us, bus %u us\n", (unsigned)ST2US(hub.cycle),
+         (unsigned)ST2US(hub.busTime));
+  printStream("temperature", &hubStreams[0]);
+  printStream("pressure", &hubStreams[1]);
+  printStream("clock", &hubStreams[2]);
+  printf("clock reads   %u\n", (unsigned)clockReads);
+  printf("bus           %u transfers %u bytes %u errors %u reconfigs,"
+         " busy %.1f %%\n", (unsigned)stats.transfers,
+         (unsigned)stats.bytes, (unsigned)stats.errors,
+         (unsigned)stats.reconfigs,
+         100.0 * I2CD1.busy / (double)simGetTime());
+  printf("bmp085        %u conversions, %u early reads\n",
+         (unsigned)simBmp.conversions, (unsigned)simBmp.earlyReads);
+  printf("switches      %llu\n", (unsigned long long)simGetSwitches());
+  return 0;
+}
+
+/**
+ * @brief   Thread of a load of the bus test.
+ */
+static THD_FUNCTION(loadThread, arg) {
+  bus_load_t *lp = arg;
+  uint8_t rxbuf[32];
+  uint8_t reg;
+
+  while ((int32_t)(runEnd - chVTGetSystemTime()) > 0) {
+    reg = lp->reg;
+    if (i2cReadRegisters(&I2CD1, lp->sad, &reg, rxbuf, lp->n) == MSG_OK) {
+      lp->reads++;
+      lp->bytes += 1U + lp->n;
+    }
+    else
+      lp->errors++;
+  }
+  chThdExit(MSG_OK);
+}
+
+/**
+ * @brief   Measure the throughput of the slaves in one bus mode.
+ */
+static int busRun(const char *mode, uint32_t seconds) {
+  thread_t *tps[4];
+  iic_stats_t stats;
+  uint32_t bmpClock = IIC_FAST_MODE, rtcClock = DS1307_I2C_CLOCK;
+  double t;
+  unsigned i;
+
+  simInit();
+  simBmp085Init(&simBmp, BMP085_ADDR, IIC_FAST_MODE);
+  simDs1307Init(&simRtc, DS1307_ADDRESS, DS1307_I2C_CLOCK, SIM_EPOCH);
+  simI2cAttach(&I2CD1, &simBmp.dev);
+  simI2cAttach(&I2CD1, &simRtc.dev);
+
+  if (strcmp(mode, "managed") == 0) {
+    (void)i2cBusStart(&I2CD1, &busFast);
+    (void)i2cRegisterDevice(&I2CD1, BMP085_ADDR, IIC_FAST_MODE,
+                            IIC_PRIO_NORMAL);
+    (void)i2cRegisterDevice(&I2CD1, DS1307_ADDRESS, DS1307_I2C_CLOCK,
+                            IIC_PRIO_NORMAL);
+  }
+  else if (strcmp(mode, "400k") == 0) {
+    i2cStart(&I2CD1, &busFast);
+    rtcClock = IIC_FAST_MODE;
+  }
+  else if (strcmp(mode, "100k") == 0) {
+    i2cStart(&I2CD1, &busStd);
+    bmpClock = IIC_STANDARD_MODE;
+  }
+  else {
+    fprintf(stderr, "sim: unknown bus mode %s\n", mode);
+    return 2;
+  }
+
+  runEnd = chVTGetSystemTime() + S2ST(seconds);
+  for (i = 0; i < 4; i++)
+    tps[i] = chThdCreateStatic(waLoads[i], sizeof(waLoads[i]), NORMALPRIO,
+                               loadThread, &busLoads[i]);
+  for (i = 0; i < 4; i++)
+    (void)chThdWait(tps[i]);
+
+  t = simGetTime() / 1e9;
+  printf("%s:\n", mode);
+  printf("  bmp085 at %3u kHz: %7u reads %7u errors %8.0f B/s\n",
+         (unsigned)(bmpClock / 1000U),
+         (unsigned)(busLoads[0].reads + busLoads[1].reads),
+         (unsigned)(busLoads[0].errors + busLoads[1].errors),
+         (busLoads[0].bytes + busLoads[1].bytes) / t);
+  printf("  ds1307 at %3u kHz: %7u reads %7u errors %8.0f B/s,"
+         " %u overdriven\n", (unsigned)(rtcClock / 1000U),
+         (unsigned)(busLoads[2].reads + busLoads[3].reads),
+         (unsigned)(busLoads[2].errors + busLoads[3].errors),
+         (busLoads[2].bytes + busLoads[3].bytes) / t,
+         (unsigned)simRtc.dev.overdriven);
+  printf("  bus: %u transfers, busy %.1f %%", (unsigned)I2CD1.transfers,
+         100.0 * I2CD1.busy / (double)simGetTime());
+  if (strcmp(mode, "managed") == 0) {
+    i2cGetStats(&I2CD1, &stats);
+    printf(", %u reconfigs, longest wait %u us",
+           (unsigned)stats.reconfigs,
+           (unsigned)ST2US(stats.maxWait[IIC_PRIO_NORMAL]));
+  }
+  printf("\n");
+  return 0;
+}
+
+/**
+ * @brief   Measure the throughput of the slaves, in each bus mode by
+ *          default.
+ * @details Each mode runs in its own process, the drivers start from
+ *          their reset state.
+ */
+static int cmdBus(int argc, char **argv) {
+  static const char *modes[] = {"managed", "400k", "100k"};
+  uint32_t seconds = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 10;
+  unsigned i;
+  int status;
+
+  if (argc > 0)
+    return busRun(argv[0], seconds);
+
+  for (i = 0; i < 3; i++) {
+    fflush(stdout);
+    if (fork() == 0)
+      exit(busRun(modes[i], seconds));
+    if ((wait(&status) < 0) || !WIFEXITED(status) ||
+        (WEXITSTATUS(status) != 0))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief   Thread of a load of the stuck test, a read every SIM_POLL.
+ */
+static THD_FUNCTION(pollThread, arg) {
+  bus_load_t *lp = arg;
+  systime_t next = chVTGetSystemTime();
+  uint8_t rxbuf[32];
+  uint8_t reg;
+
+  while ((int32_t)(runEnd - next) > 0) {
+    reg = lp->reg;
+    if (i2cReadRegisters(&I2CD1, lp->sad, &reg, rxbuf, lp->n) == MSG_OK)
+      lp->reads++;
+    else
+      lp->errors++;
+    next += SIM_POLL;
+    chThdSleepUntil(next);
+  }
+  chThdExit(MSG_OK);
+}
+
+/**
+ * @brief   Read three slaves while one of them holds the bus.
+ * @details The stuck slave makes its transfers time out, the driver must
+ *          recover the bus after each timeout and put the slave in
+ *          quarantine, the other slaves must not see any error.
+ */
+static int cmdStuck(int argc, char **argv) {
+  uint32_t seconds = (argc > 0) ? (uint32_t)strtoul(argv[0], NULL, 0) : 10;
+  uint32_t quarantines, rejected, errors;
+  thread_t *tps[3];
+  unsigned i;
+
+  simBoard();
+  simBmp085Init(&simStuck, SIM_STUCK_ADDR, IIC_FAST_MODE);
+  simI2cAttach(&I2CD1, &simStuck.dev);
+  (void)i2cRegisterDevice(&I2CD1, SIM_STUCK_ADDR, IIC_FAST_MODE,
+                          IIC_PRIO_NORMAL);
+
+  runEnd = chVTGetSystemTime() + S2ST(seconds);
+  for (i = 0; i < 3; i++)
+    tps[i] = chThdCreateStatic(waLoads[i], sizeof(waLoads[i]), NORMALPRIO,
+                               pollThread, &stuckLoads[i]);
+  chThdSleep(S2ST(1));
+  simStuck.dev.hold = true;
+  for (i = 0; i < 3; i++)
+    (void)chThdWait(tps[i]);
+
+  (void)i2cGetHealth(&I2CD1, SIM_STUCK_ADDR, &quarantines, &rejected);
+  printf("bmp085        %6u reads %6u errors\n",
+         (unsigned)stuckLoads[0].reads, (unsigned)stuckLoads[0].errors);
+  printf("ds1307        %6u reads %6u errors\n",
+         (unsigned)stuckLoads[1].reads, (unsigned)stuckLoads[1].errors);
+  printf("stuck         %6u reads %6u errors, %u quarantines,"
+         " %u rejected\n", (unsigned)stuckLoads[2].reads,
+         (unsigned)stuckLoads[2].errors, (unsigned)quarantines,
+         (unsigned)rejected);
+  printf("bus           %u starts, %u transfers on a locked driver\n",
+         (unsigned)I2CD1.starts, (unsigned)I2CD1.locked);
+
+  errors = stuckLoads[0].errors + stuckLoads[1].errors;
+  return errors == 0 ? 0 : 1;
+}
+
+/**
+ * @brief   Thread logging the samples of the hub at a period, in ticks,
+ *          from the end of the first cycle of the hub.
+ */
+static THD_FUNCTION(logThread, arg) {
+  systime_t period = (systime_t)(uintptr_t)arg;
+  systime_t next = chVTGetSystemTime() + hub.cycle;
+
+  while ((int32_t)(runEnd - next) > 0) {
+    chThdSleepUntil(next);
+    logSample();
+    next += period;
+  }
+  sensorHubLogFlush(&hubLog);
+  chThdExit(MSG_OK);
+}
+
+/**
+ * @brief   Compare a decoded sample with the one appended.
+ * @details The first sample of a block has the RTC time, read at most a
+ *          cycle before. The next ones have the time since it rounded
+ *          down to the ms, they must lag their system time by less than
+ *          1 ms and a tick, whatever the length of the block.
+ */
+static void logCheck(void *arg, const sensorhub_log_sample_t *sp) {
+  log_check_t *cp = (log_check_t *)arg;
+  const log_sample_t *ep;
+  uint64_t time;
+  int64_t lag;
+
+  if (cp->decoded++ >= cp->n)
+    return;
+
+  ep = &cp->samples[cp->decoded - 1];
+  if ((sp->press != ep->press) || (sp->temp != ep->temp))
+    cp->values++;
+
+  time = (uint64_t)sp->epoch * 1000U + sp->ms;
+  if (ep->first) {
+    if ((sp->epoch == DS1307_EPOCH_INVALID) ||
+        (sp->epoch > SIM_EPOCH + ep->time / S2ST(1)) ||
+        (sp->epoch + 1 < SIM_EPOCH + ep->time / S2ST(1)))
+      cp->epochs++;
+    cp->base     = time;
+    cp->baseTime = ep->time;
+    return;
+  }
+
+  lag = (int64_t)((uint64_t)(systime_t)(ep->time - cp->baseTime) *
+                  1000000U / CH_CFG_ST_FREQUENCY) -
+        (int64_t)(time - cp->base) * 1000;
+  if (lag < cp->minLag)
+    cp->minLag = lag;
+  if (lag > cp->maxLag)
+    cp->maxLag = lag;
+}
+
+/**
+ * @brief   Read a log file back in chunks and compare it to the samples.
+ *
+ * @return  resets  number of invalid blocks, of bytes left at the end
+ */
+static uint32_t logDecode(const char *name, log_check_t *cp) {
+  uint8_t buf[SENSORHUB_LOG_BLOCK_SIZE + SIM_LOG_CHUNK];
+  size_t len = 0, got, used;
+  uint32_t resets = 0;
+  FILE *file;
+  msg_t msg;
+
+  file = fopen(name, "rb");
+  if (file == NULL) {
+    perror(name);
+    exit(1);
+  }
+
+  do {
+    got = fread(&buf[len], 1, SIM_LOG_CHUNK, file);
+    len += got;
+    do {
+      msg = sensorHubLogDecode(buf, len, &used, logCheck, cp);
+      if (msg == MSG_RESET)
+        resets++;
+      len -= used;
+      memmove(buf, &buf[used], len);
+    } while ((msg != MSG_TIMEOUT) && (len > 0));
+  } while (got > 0);
+  (void)fclose(file);
+
+  return resets + (uint32_t)len;
+}
+
+/**
+ * @brief   Log the samples of the hub, an hour by default, then decode the
+ *          log and check it.
+ * @details The log has its own period, 10.5 ms by default, the time
+ *          between two samples is not a whole number of ms.
+ */
+static int cmdLog(int argc, char **argv) {
+  uint32_t seconds = (argc > 0) ? (uint32_t)strtoul(argv[0], NULL, 0) : 3600;
+  const char *name = (argc > 1) ? argv[1] : "log.bin";
+  uint32_t period = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) :
+                                 SIM_LOG_PERIOD;
+  log_check_t check;
+  uint32_t resets;
+  thread_t *tp;
+
+  logFile.vmt  = &fileVmt;
+  logFile.file = fopen(name, "wb");
+  if (logFile.file == NULL) {
+    perror(name);
+    return 1;
+  }
+
+  simBoard();
+  hubSetup();
+  sensorHubLogInit(&hubLog, (BaseSequentialStream *)&logFile, &rtcDriver);
+  runEnd = chVTGetSystemTime() + S2ST(seconds);
+  tp = chThdCreateStatic(waLog, sizeof(waLog), NORMALPRIO - 1, logThread,
+                         (void *)(uintptr_t)US2ST(period));
+  hubRun(seconds);
+  (void)chThdWait(tp);
+  (void)fclose(logFile.file);
+  logFile.file = NULL;
+
+  memset(&check, 0, sizeof(check));
+  check.samples = logSamples;
+  check.n       = logCount;
+  check.minLag  = INT64_MAX;
+  check.maxLag  = INT64_MIN;
+  resets = logDecode(name, &check);
+
+  printf("%s: %u samples %u blocks %u bytes, %.2f bytes a sample\n", name,
+         (unsigned)hubLog.samples, (unsigned)hubLog.blocks,
+         (unsigned)hubLog.bytes, (double)hubLog.bytes / hubLog.samples);
+  printf("decoded       %u samples, %u invalid blocks, %u wrong values,"
+         " %u wrong block times\n", (unsigned)check.decoded,
+         (unsigned)resets, (unsigned)check.values, (unsigned)check.epochs);
+  printf("time lag      %lld..%lld us\n", (long long)check.minLag,
+         (long long)check.maxLag);
+  return ((check.decoded == logCount) && (resets == 0) &&
+          (check.values == 0) && (check.epochs == 0) &&
+          (check.minLag >= 0) &&
+          (check.maxLag < 1000 + (int64_t)ST2US(1))) ? 0 : 1;
+}
+
+/**
+ * @brief   Thread dumping the trace, before its ring is full.
+ */
+static THD_FUNCTION(dumpThread, arg) {
+  uint32_t lost;
+
+  (void)arg;
+  while ((int32_t)(runEnd - chVTGetSystemTime()) > 0) {
+    chThdSleepMilliseconds(20);
+    (void)i2cTraceRead(NULL, 0, &lost);
+    traceLost += lost;
+    traceRecords +=
+        (uint32_t)i2cTraceDump((BaseSequentialStream *)&traceFile);
+  }
+  chThdExit(MSG_OK);
+}
+
+/**
+ * @brief   Record the transfers of the hour workload.
+ */
+static int cmdRecord(int argc, char **argv) {
+  uint32_t seconds = (argc > 0) ? (uint32_t)strtoul(argv[0], NULL, 0) : 60;
+  const char *name = (argc > 1) ? argv[1] : "trace.bin";
+  thread_t *tp;
+
+  traceFile.vmt  = &fileVmt;
+  traceFile.file = fopen(name, "wb");
+  if (traceFile.file == NULL) {
+    perror(name);
+    return 1;
+  }
+
+  simBoard();
+  i2cTraceEnable(true);
+  hubSetup();
+  runEnd = chVTGetSystemTime() + S2ST(seconds);
+  tp = chThdCreateStatic(waDump, sizeof(waDump), HIGHPRIO, dumpThread,
+                         NULL);
+  hubRun(seconds);
+  (void)chThdWait(tp);
+  i2cTraceEnable(false);
+  traceRecords += (uint32_t)i2cTraceDump((BaseSequentialStream *)&traceFile);
+  (void)fclose(traceFile.file);
+
+  printf("%s: %u records of %u bytes, %u lost, %.3f s\n", name,
+         (unsigned)traceRecords, (unsigned)sizeof(iic_trace_t),
+         (unsigned)traceLost, simGetTime() / 1e9);
+  return traceLost == 0 ? 0 : 1;
+}
+
+/**
+ * @brief   Do a recorded transfer again through the driver.
+ *
+ * @param[in] tp      record of the transfer
+ * @param[out] rxbuf  received bytes
+ * @return            result of the transfer
+ */
+static msg_t replayXfer(const iic_trace_t *tp, uint8_t *rxbuf) {
+  uint8_t txbuf[IIC_TRACE_DATA];
+
+  memcpy(txbuf, tp->data, tp->txn);
+  if (tp->rxn == 0)
+    return i2cWriteRegisters(&I2CD1, tp->sad, txbuf, (uint8_t)tp->txn);
+  return i2cReadRegisters(&I2CD1, tp->sad, txbuf, rxbuf, (uint8_t)tp->rxn);
+}
+
+/**
+ * @brief   Replay a trace on the simulated bus and check it.
+ * @details The transfers are started at their recorded times, or at once
+ *          when the replay is late. A transfer whose sent bytes were not
+ *          all recorded, or a read sending more than a register address,
+ *          cannot be replayed through the register functions and is
+ *          skipped.
+ */
+static int cmdReplay(int argc, char **argv) {
+  const char *name = (argc > 0) ? argv[0] : "trace.bin";
+  uint32_t records = 0, skipped = 0, statusDiffs = 0, dataDiffs = 0;
+  uint32_t late = 0, transfers;
+  simtime_t latency = 0, maxLatency = 0, maxLate = 0, t;
+  uint64_t host = 0, h;
+  iic_trace_t rec;
+  uint8_t rxbuf[256];
+  FILE *file;
+  msg_t msg;
+
+  file = fopen(name, "rb");
+  if (file == NULL) {
+    perror(name);
+    return 1;
+  }
+
+  simBoard();
+  transfers = I2CD1.transfers;
+  while (fread(&rec, sizeof(rec), 1, file) == 1) {
+    records++;
+    if ((rec.txn > rec.size) || (rec.size > IIC_TRACE_DATA) ||
+        (rec.rxn > sizeof(rxbuf)) || ((rec.txn == 0) && (rec.rxn == 0)) ||
+        ((rec.txn > 1) && (rec.rxn > 0))) {
+      skipped++;
+      continue;
+    }
+
+    if ((int32_t)(rec.time - chVTGetSystemTime()) > 0)
+      chThdSleepUntil(rec.time);
+    else if (rec.time != chVTGetSystemTime()) {
+      t = (simtime_t)(chVTGetSystemTime() - rec.time) *
+          (1000000000ULL / CH_CFG_ST_FREQUENCY);
+      late++;
+      if (t > maxLate)
+        maxLate = t;
+    }
+
+    t = simGetTime();
+    h = hostNs();
+    msg = replayXfer(&rec, rxbuf);
+    host += hostNs() - h;
+    t = simGetTime() - t;
+    latency += t;
+    if (t > maxLatency)
+      maxLatency = t;
+
+    if (msg != rec.status)
+      statusDiffs++;
+    else if ((msg == MSG_OK) &&
+             (memcmp(rxbuf, &rec.data[rec.txn], rec.size - rec.txn) != 0))
+      dataDiffs++;
+  }
+  (void)fclose(file);
+  transfers = I2CD1.transfers - transfers;
+
+  printf("records       %u, %u skipped\n", (unsigned)records,
+         (unsigned)skipped);
+  printf("bus           %u transfers for %u replayed\n",
+         (unsigned)transfers, (unsigned)(records - skipped));
+  printf("mismatches    %u status, %u data\n", (unsigned)statusDiffs,
+         (unsigned)dataDiffs);
+  if (records > skipped) {
+    printf("latency       %.1f us mean, %.1f us max\n",
+           latency / 1e3 / (records - skipped), maxLatency / 1e3);
+    printf("driver        %.0f ns/transfer of host time\n",
+           (double)host / (records - skipped));
+  }
+  printf("late starts   %u, %.1f us max\n", (unsigned)late, maxLate / 1e3);
+  return ((statusDiffs == 0) && (dataDiffs == 0)) ? 0 : 1;
+}
+
+static const sim_cmd_t simCmds[] = {
+  {"hour", cmdHour, "[seconds]"},
+  {"bus",  cmdBus,  "[managed|400k|100k] [seconds]"},
+  {"stuck", cmdStuck, "[seconds]"},
+  {"log", cmdLog, "[seconds] [file] [us]"},
+  {"record", cmdRecord, "[seconds] [file]"},
+  {"replay", cmdReplay, "[file]"},
+};
+
+#define SIM_CMDS  (sizeof(simCmds) / sizeof(simCmds[0]))
+
+/*==========================================================================*/
+/* Main.                                                                    */
+/*==========================================================================*/
+
+int main(int argc, char **argv) {
+  unsigned i;
+
+  for (i = 0; (argc > 1) && (i < SIM_CMDS); i++) {
+    if (strcmp(argv[1], simCmds[i].name) == 0)
+      return simCmds[i].fn(argc - 2, argv + 2);
+  }
+
+  fprintf(stderr, "usage:\n");
+  for (i = 0; i < SIM_CMDS; i++)
+    fprintf(stderr, "  %s %s %s\n", argv[0], simCmds[i].name,
+            simCmds[i].help);
+  return 2;
+}
@@ -0,0 +1,274 @@
+/**
+ *
+ * @file    simdev.c
+ *
+ * @brief   Simulated I2C slaves, host simulations.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Standard files. */
+#include <math.h>
+#include <string.h>
+
+/* Simulation files. */
+#include "simdev.h"
+
+/*==========================================================================*/
+/* Local definitions.                                                       */
+/*==========================================================================*/
+
+#define BMP085_REG_CR     0xF4    /**< Control register.                    */
+#define BMP085_REG_DATA   0xF6    /**< First result register.               */
+#define BMP085_REG_CALIB  0xAA    /**< First calibration register.          */
+
+#define BMP085_UT         27898   /**< Temperature of the datasheet.        */
+#define BMP085_UP         23843   /**< Pressure of the datasheet.           */
+#define BMP085_UP_SWING   40      /**< Swing of the pressure.               */
+#define BMP085_UP_PERIOD  600     /**< Period of the swing (s).             */
+
+#define NS_PER_US         1000ULL
+#define NS_PER_S          1000000000ULL
+#define SECONDS_PER_DAY   86400UL
+
+/*==========================================================================*/
+/* Local variables.                                                         */
+/*==========================================================================*/
+
+/**
+ * @brief   Calibration of the datasheet, AC1 to MD.
+ */
+static const int16_t bmp085Calib[11] = {
+  408, -72, -14383, (int16_t)32741, (int16_t)32757, 23153,
+  6190, 4, -32768, -8711, 2868
+};
+
+/**
+ * @brief   Conversion times of the datasheet, the temperature then the
+ *          pressure for each oversampling (us).
+ */
+static const uint32_t bmp085ConvTime[5] = {4500, 4500, 7500, 13500, 25500};
+
+static const uint8_t monthLength[12] = {
+  31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+};
+
+/*==========================================================================*/
+/* Local functions.                                                         */
+/*==========================================================================*/
+
+/**
+ * @brief   Encode a value in BCD.
+ */
+static uint8_t toBcd(uint32_t v) {
+
+  return (uint8_t)(((v / 10) << 4) | (v % 10));
+}
+
+/**
+ * @brief   Decode a BCD value.
+ */
+static uint32_t fromBcd(uint8_t v) {
+
+  return (uint32_t)((v >> 4) * 10 + (v & 0x0F));
+}
+
+/**
+ * @brief   Number of days of a month, years 2000 to 2099.
+ */
+static uint32_t daysOfMonth(uint32_t year, uint32_t month) {
+
+  if ((month == 2) && ((year % 4) == 0))
+    return 29;
+  return monthLength[month - 1];
+}
+
+/**
+ * @brief   Transfer with the BMP085.
+ */
+static msg_t bmp085Xfer(sim_i2c_dev_t *dp, const uint8_t *txbuf, size_t txn,
+                        uint8_t *rxbuf, size_t rxn) {
+  sim_bmp085_t *sp = dp->priv;
+  simtime_t now = simGetTime();
+  size_t i;
+
+  if (txn > 0) {
+    sp->ptr = txbuf[0];
+    for (i = 1; i < txn; i++)
+      sp->regs[(uint8_t)(sp->ptr + i - 1)] = txbuf[i];
+  }
+
+  if ((txn >= 2) && (sp->ptr == BMP085_REG_CR)) {
+    uint8_t cr = sp->regs[BMP085_REG_CR];
+    uint8_t oss = cr >> 6;
+    uint32_t up;
+    double t = (double)now / NS_PER_S;
+
+    if ((cr & 0x3F) == 0x2E) {
+      sp->result = (uint32_t)BMP085_UT << 8;
+      sp->ready  = now + bmp085ConvTime[0] * NS_PER_US;
+    }
+    else if ((cr & 0x3F) == 0x34) {
+      up = (uint32_t)((BMP085_UP << oss) +
+                      lrint(BMP085_UP_SWING * (1 << oss) *
+                            sin(2.0 * M_PI * t / BMP085_UP_PERIOD)));
+      sp->result = up << (8 - oss);
+      sp->ready  = now + bmp085ConvTime[1 + oss] * NS_PER_US;
+    }
+    else
+      return MSG_RESET;
+    sp->pending = true;
+    sp->conversions++;
+  }
+
+  if (rxn == 0)
+    return MSG_OK;
+
+  if (sp->pending) {
+    if (now >= sp->ready) {
+      sp->regs[BMP085_REG_DATA]     = (uint8_t)(sp->result >> 16);
+      sp->regs[BMP085_REG_DATA + 1] = (uint8_t)(sp->result >> 8);
+      sp->regs[BMP085_REG_DATA + 2] = (uint8_t)sp->result;
+      sp->pending = false;
+    }
+    else if ((sp->ptr >= BMP085_REG_DATA) && (sp->ptr <= BMP085_REG_DATA + 2))
+      sp->earlyReads++;
+  }
+
+  for (i = 0; i < rxn; i++)
+    rxbuf[i] = sp->regs[(uint8_t)(sp->ptr + i)];
+  return MSG_OK;
+}
+
+/**
+ * @brief   Write the clock of the DS1307 in its registers.
+ */
+static void ds1307Update(sim_ds1307_t *sp) {
+  uint32_t now = sp->epoch +
+                 (uint32_t)((simGetTime() - sp->setTime) / NS_PER_S);
+  uint32_t days = now / SECONDS_PER_DAY;
+  uint32_t secs = now % SECONDS_PER_DAY;
+  uint32_t year = 2000, month = 1;
+
+  sp->regs[0] = (uint8_t)((sp->regs[0] & 0x80) | toBcd(secs % 60));
+  sp->regs[1] = toBcd((secs / 60) % 60);
+  sp->regs[2] = toBcd(secs / 3600);
+  sp->regs[3] = (uint8_t)((days + 6) % 7 + 1);
+
+  while (days >= (((year % 4) == 0) ? 366U : 365U)) {
+    days -= ((year % 4) == 0) ? 366U : 365U;
+    year++;
+  }
+  while (days >= daysOfMonth(year, month)) {
+    days -= daysOfMonth(year, month);
+    month++;
+  }
+  sp->regs[4] = toBcd(days + 1);
+  sp->regs[5] = toBcd(month);
+  sp->regs[6] = toBcd(year - 2000);
+}
+
+/**
+ * @brief   Set the clock of the DS1307 from its registers.
+ */
+static void ds1307Set(sim_ds1307_t *sp) {
+  uint32_t year  = 2000 + fromBcd(sp->regs[6]);
+  uint32_t month = fromBcd(sp->regs[5]);
+  uint32_t days  = fromBcd(sp->regs[4]) - 1;
+  uint32_t y, m;
+
+  if ((month < 1) || (month > 12))
+    month = 1;
+  for (y = 2000; y < year; y++)
+    days += ((y % 4) == 0) ? 366U : 365U;
+  for (m = 1; m < month; m++)
+    days += daysOfMonth(year, m);
+
+  sp->epoch   = days * SECONDS_PER_DAY +
+                fromBcd(sp->regs[2] & 0x3F) * 3600 +
+                fromBcd(sp->regs[1]) * 60 +
+                fromBcd(sp->regs[0] & 0x7F);
+  sp->setTime = simGetTime();
+}
+
+/**
+ * @brief   Transfer with the DS1307.
+ */
+static msg_t ds1307Xfer(sim_i2c_dev_t *dp, const uint8_t *txbuf, size_t txn,
+                        uint8_t *rxbuf, size_t rxn) {
+  sim_ds1307_t *sp = dp->priv;
+  bool clock = false;
+  size_t i;
+
+  ds1307Update(sp);
+  if (txn > 0) {
+    sp->ptr = txbuf[0] & 0x3F;
+    for (i = 1; i < txn; i++) {
+      if (sp->ptr < 7)
+        clock = true;
+      sp->regs[sp->ptr] = txbuf[i];
+      sp->ptr = (sp->ptr + 1) & 0x3F;
+    }
+  }
+  if (clock)
+    ds1307Set(sp);
+
+  for (i = 0; i < rxn; i++) {
+    rxbuf[i] = sp->regs[sp->ptr];
+    sp->ptr = (sp->ptr + 1) & 0x3F;
+  }
+  return MSG_OK;
+}
+
+/*==========================================================================*/
+/* Functions.                                                               */
+/*==========================================================================*/
+
+/**
+ * @brief   Initialize a simulated BMP085.
+ *
+ * @param[out] sp       slave to initialize
+ * @param[in] sad       slave address
+ * @param[in] maxClock  fastest clock of the slave (Hz)
+ */
+void simBmp085Init(sim_bmp085_t *sp, uint8_t sad, uint32_t maxClock) {
+  unsigned i;
+
+  memset(sp, 0, sizeof(*sp));
+  sp->dev.sad      = sad;
+  sp->dev.maxClock = maxClock;
+  sp->dev.xfer     = bmp085Xfer;
+  sp->dev.priv     = sp;
+  for (i = 0; i < 11; i++) {
+    sp->regs[BMP085_REG_CALIB + 2 * i]     = (uint8_t)(bmp085Calib[i] >> 8);
+    sp->regs[BMP085_REG_CALIB + 2 * i + 1] = (uint8_t)bmp085Calib[i];
+  }
+  sp->regs[0xD0] = 0x55;
+}
+
+/**
+ * @brief   Initialize a simulated DS1307.
+ *
+ * @param[out] sp       slave to initialize
+ * @param[in] sad       slave address
+ * @param[in] maxClock  fastest clock of the slave (Hz)
+ * @param[in] epoch     clock, seconds since 01/01/2000
+ */
+void simDs1307Init(sim_ds1307_t *sp, uint8_t sad, uint32_t maxClock,
+                   uint32_t epoch) {
+
+  memset(sp, 0, sizeof(*sp));
+  sp->dev.sad      = sad;
+  sp->dev.maxClock = maxClock;
+  sp->dev.xfer     = ds1307Xfer;
+  sp->dev.priv     = sp;
+  sp->epoch        = epoch;
+  sp->setTime      = simGetTime();
+}
@@ -0,0 +1,70 @@
+/**
+ *
+ * @file    simdev.h
+ *
+ * @brief   Simulated I2C slaves header file, host simulations.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+#ifndef SIMDEV_H
+#define SIMDEV_H
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* ChibiOS files. */
+#include "hal.h"
+
+/*==========================================================================*/
+/* Data structures and types.                                               */
+/*==========================================================================*/
+
+/**
+ * @brief   Simulated BMP085.
+ * @details The calibration is the one of the example of the datasheet. A
+ *          conversion ends after its datasheet time, a read done before
+ *          gets the result of the previous conversion.
+ */
+typedef struct sim_bmp085 {
+  sim_i2c_dev_t dev;          /**< Slave of the bus.                        */
+  uint8_t       regs[256];    /**< Registers.                               */
+  uint8_t       ptr;          /**< Register pointer.                        */
+  simtime_t     ready;        /**< End of the conversion in progress.       */
+  uint32_t      result;       /**< Result of the conversion in progress.    */
+  bool          pending;      /**< A conversion is in progress.             */
+  uint32_t      conversions;  /**< Conversions started.                     */
+  uint32_t      earlyReads;   /**< Reads of a conversion in progress.       */
+} sim_bmp085_t;
+
+/**
+ * @brief   Simulated DS1307.
+ * @details The clock counts the virtual seconds from the time it was set.
+ */
+typedef struct sim_ds1307 {
+  sim_i2c_dev_t dev;          /**< Slave of the bus.                        */
+  uint8_t       regs[64];     /**< Clock registers then RAM.                */
+  uint8_t       ptr;          /**< Register pointer.                        */
+  uint32_t      epoch;        /**< Clock set, seconds since 2000.           */
+  simtime_t     setTime;      /**< Virtual time of the setting.             */
+} sim_ds1307_t;
+
+/*==========================================================================*/
+/* External declarations.                                                   */
+/*==========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void  simBmp085Init(sim_bmp085_t *sp, uint8_t sad, uint32_t maxClock);
+  void  simDs1307Init(sim_ds1307_t *sp, uint8_t sad, uint32_t maxClock,
+                      uint32_t epoch);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMDEV_H */
@@ -17,9 +17,1523 @@
 #include "iic.h"
 
 /*==========================================================================*/
-/* Driver Functions                                                         */ 
+/* Driver local variables.                                                  */
 /*==========================================================================*/
 
+static iic_bus_t    iicBuses[IIC_MAX_BUSES];
+static iic_device_t iicDevices[IIC_MAX_DEVICES];
+
+/*
+ * Transfer descriptors and their buffer slabs, the descriptors are put in
+ * the pool at the first allocation.
+ */
+static MEMORYPOOL_DECL(iicPool, sizeof(iic_xfer_t), NULL);
+static iic_xfer_t   iicXfers[IIC_POOL_SIZE];
+static uint8_t      iicSlabs[IIC_POOL_SIZE][IIC_SLAB_SIZE]
+                    IIC_DMA_SECTION CC_ALIGN(IIC_SLAB_ALIGN);
+static bool         iicPoolLoaded = false;
+static uint8_t      iicPoolUsed = 0;
+static uint8_t      iicPoolHighWater = 0;
+
+#if IIC_USE_TRACE
+/*
+ * Trace ring, the oldest records are overwritten when it is full.
+ */
+static iic_trace_t  iicTrace[IIC_TRACE_SIZE];
+static size_t       iicTraceHead = 0;
+static size_t       iicTraceCount = 0;
+static uint32_t     iicTraceLost = 0;
+static bool         iicTraceOn = false;
+#endif
+
+/*==========================================================================*/
+/* Driver local functions.                                                  */
+/*==========================================================================*/
+
+/**
+ * @brief   Find the bus managed for an I2C driver.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @return    busp    pointer to the bus, NULL if the bus was not started
+ *                    with i2cBusStart()
+ */
+static iic_bus_t *iicGetBus(I2CDriver *i2cp) {
+
+  uint8_t i;
+
+  for (i = 0; i < IIC_MAX_BUSES; i++) {
+    if (iicBuses[i].i2cp == i2cp)
+      return &iicBuses[i];
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief   Find a registered slave.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] sad     slave address without R/W bit
+ * @return    devp    pointer to the slave, NULL if it is not registered
+ */
+static iic_device_t *iicGetDevice(I2CDriver *i2cp, uint8_t sad) {
+
+  uint8_t i;
+
+  for (i = 0; i < IIC_MAX_DEVICES; i++) {
+    if ((iicDevices[i].i2cp == i2cp) && (iicDevices[i].sad == sad))
+      return &iicDevices[i];
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief   Get the clock speed used for the transfers with a slave.
+ * @details A slave which is not registered uses the clock speed of the bus
+ *          configuration.
+ *
+ * @param[in] busp    pointer to the bus
+ * @param[in] devp    pointer to the slave, can be NULL
+ * @return    clock   clock speed (Hz)
+ */
+static uint32_t iicGetClock(const iic_bus_t *busp, const iic_device_t *devp) {
+
+  if ((devp != NULL) && (devp->clock < busp->maxClock))
+    return devp->clock;
+
+  return busp->maxClock;
+}
+
+/**
+ * @brief   Set the bus clock speed.
+ * @details The bus is only restarted when the speed changes, so the
+ *          successive transfers to slaves of the same speed do not cost any
+ *          reconfiguration.
+ * @note    The bus must be owned by the caller.
+ *
+ * @param[in] busp    pointer to the bus
+ * @param[in] clock   clock speed (Hz)
+ */
+static void iicSetClock(iic_bus_t *busp, uint32_t clock) {
+
+  if (clock == busp->config.clock_speed)
+    return;
+
+  busp->config.clock_speed = clock;
+  busp->config.duty_cycle  = (clock <= IIC_STANDARD_MODE) ?
+                             STD_DUTY_CYCLE : FAST_DUTY_CYCLE_2;
+  i2cStop(busp->i2cp);
+  i2cStart(busp->i2cp, &busp->config);
+
+  chSysLock();
+  busp->stats.reconfigs++;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Elect the next owner of a bus.
+ * @details The first waiter of the highest priority class is elected, a
+ *          waiter of the class using the current clock speed being preferred
+ *          to avoid a reconfiguration. A waiter whose wait exceeded
+ *          IIC_MAX_WAIT is elected first whatever its class, so every wait
+ *          is bounded.
+ * @note    Must be called in locked state.
+ *
+ * @param[in] busp    pointer to the bus
+ * @return    wp      pointer to the elected waiter removed from its list,
+ *                    NULL if no thread is waiting
+ */
+static iic_waiter_t *iicElect(iic_bus_t *busp) {
+
+  iic_waiter_t  **wpp, **best = NULL;
+  iic_waiter_t  *wp;
+  systime_t     wait, oldest = 0;
+  uint8_t       c;
+
+  for (c = 0; c < IIC_PRIO_CLASSES; c++) {
+    if (busp->waiters[c] == NULL)
+      continue;
+
+    wait = chVTTimeElapsedSinceX(busp->waiters[c]->since);
+    if ((wait >= IIC_MAX_WAIT) && ((best == NULL) || (wait > oldest))) {
+      best = &busp->waiters[c];
+      oldest = wait;
+    }
+  }
+
+  for (c = 0; (best == NULL) && (c < IIC_PRIO_CLASSES); c++) {
+    if (busp->waiters[c] == NULL)
+      continue;
+
+    best = &busp->waiters[c];
+    for (wpp = &busp->waiters[c]; *wpp != NULL; wpp = &(*wpp)->next) {
+      if ((*wpp)->clock == busp->config.clock_speed) {
+        best = wpp;
+        break;
+      }
+    }
+  }
+
+  if (best == NULL)
+    return NULL;
+
+  wp = *best;
+  *best = wp->next;
+
+  return wp;
+}
+
+/**
+ * @brief   Get the ownership of a bus.
+ *
+ * @param[in] busp    pointer to the bus
+ * @param[in] prio    priority class of the transfer
+ * @param[in] clock   clock speed of the transfer (Hz)
+ */
+static void iicAcquire(iic_bus_t *busp, uint8_t prio, uint32_t clock) {
+
+  iic_waiter_t  w, **wpp;
+  systime_t     wait = 0;
+
+  chSysLock();
+  if (busp->busy) {
+    w.next   = NULL;
+    w.thread = NULL;
+    w.since  = chVTGetSystemTimeX();
+    w.clock  = clock;
+
+    for (wpp = &busp->waiters[prio]; *wpp != NULL; wpp = &(*wpp)->next)
+      ;
+    *wpp = &w;
+
+    /* The releasing thread gives the bus and keeps it busy. */
+    (void)chThdSuspendS(&w.thread);
+    wait = chVTTimeElapsedSinceX(w.since);
+  }
+  else
+    busp->busy = true;
+
+  busp->stats.grants[prio]++;
+  if (wait > busp->stats.maxWait[prio])
+    busp->stats.maxWait[prio] = wait;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Release the ownership of a bus.
+ *
+ * @param[in] busp    pointer to the bus
+ */
+static void iicRelease(iic_bus_t *busp) {
+
+  iic_waiter_t *wp;
+
+  chSysLock();
+  wp = iicElect(busp);
+  if (wp != NULL)
+    chThdResumeS(&wp->thread, MSG_OK);
+  else
+    busp->busy = false;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Get the ownership of the bus of a slave.
+ * @details On a managed bus the clock is set to the speed of the slave.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] busp    pointer to the bus, NULL if the bus is not managed
+ * @param[in] devp    pointer to the slave, can be NULL
+ */
+static void iicLock(I2CDriver *i2cp, iic_bus_t *busp,
+                    const iic_device_t *devp) {
+
+  uint32_t clock;
+
+  if (busp != NULL) {
+    clock = iicGetClock(busp, devp);
+    iicAcquire(busp, (devp != NULL) ? devp->prio : IIC_PRIO_NORMAL, clock);
+    iicSetClock(busp, clock);
+  }
+  else
+    i2cAcquireBus(i2cp);
+}
+
+/**
+ * @brief   Release the ownership of a bus.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] busp    pointer to the bus, NULL if the bus is not managed
+ */
+static void iicUnlock(I2CDriver *i2cp, iic_bus_t *busp) {
+
+  if (busp != NULL)
+    iicRelease(busp);
+  else
+    i2cReleaseBus(i2cp);
+}
+
+#if IIC_USE_TRACE
+/**
+ * @brief   Record a transfer in the trace ring.
+ *
+ * @param[in] busp    pointer to the bus, NULL if the bus is not managed
+ * @param[in] sad     slave address without R/W bit
+ * @param[in] start   start of the transfer
+ * @param[in] txbuf   pointer to the data sent
+ * @param[in] txn     size of the data sent
+ * @param[in] rxbuf   pointer to the data received
+ * @param[in] rxn     size of the data received
+ * @param[in] msg     result of the transfer
+ */
+static void iicTraceRecord(const iic_bus_t *busp, uint8_t sad,
+                           systime_t start, const uint8_t *txbuf,
+                           size_t txn, const uint8_t *rxbuf, size_t rxn,
+                           msg_t msg) {
+
+  iic_trace_t *tp;
+  size_t      i;
+  uint8_t     n = 0;
+
+  chSysLock();
+  if (!iicTraceOn) {
+    chSysUnlock();
+    return;
+  }
+
+  tp = &iicTrace[iicTraceHead];
+  iicTraceHead = (iicTraceHead + 1) % IIC_TRACE_SIZE;
+  if (iicTraceCount < IIC_TRACE_SIZE)
+    iicTraceCount++;
+  else
+    iicTraceLost++;
+
+  tp->time   = (uint32_t)start;
+  tp->txn    = (uint16_t)txn;
+  tp->rxn    = (uint16_t)rxn;
+  tp->sad    = sad;
+  tp->status = (int8_t)msg;
+  tp->bus    = (busp != NULL) ? (uint8_t)(busp - iicBuses) : 0xFF;
+
+  for (i = 0; (i < txn) && (n < IIC_TRACE_DATA); i++)
+    tp->data[n++] = txbuf[i];
+  for (i = 0; (i < rxn) && (n < IIC_TRACE_DATA); i++)
+    tp->data[n++] = rxbuf[i];
+  tp->size = n;
+  chSysUnlock();
+}
+#endif
+
+/**
+ * @brief   Do a transfer on an owned bus, without accounting it.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] busp    pointer to the bus, NULL if the bus is not managed
+ * @param[in] sad     slave address without R/W bit
+ * @param[in] txbuf   pointer to the data to send
+ * @param[in] txn     size of the data to send
+ * @param[in] rxbuf   pointer to the buffer to store the data readed
+ * @param[in] rxn     size of the data to read
+ *
+ * @return    msg     the result of the transfer
+ */
+static msg_t iicMasterXfer(I2CDriver *i2cp, iic_bus_t *busp, uint8_t sad,
+                           const uint8_t *txbuf, size_t txn, uint8_t *rxbuf,
+                           size_t rxn) {
+
+  const I2CConfig *config;
+  msg_t           msg;
+
+  /* The driver needs a receive alone when nothing is sent. */
+  if (txn > 0)
+    msg = i2cMasterTransmitTimeout(i2cp, sad, txbuf, txn, rxbuf, rxn,
+                                   IIC_TIMEOUT); // TODO: Test the usage of TIMEINFINITE
+  else
+    msg = i2cMasterReceiveTimeout(i2cp, sad, rxbuf, rxn, IIC_TIMEOUT);
+
+  /* A timeout leaves the driver in the I2C_LOCKED state, it must be
+     restarted before the next transfer, whatever the slave. */
+  if (msg == MSG_TIMEOUT) {
+    config = (busp != NULL) ? &busp->config : i2cp->config;
+    i2cStop(i2cp);
+    i2cStart(i2cp, config);
+  }
+
+  return msg;
+}
+
+/**
+ * @brief   Account a transfer done on an owned bus.
+ * @details The transfer is counted in the statistics of the bus, an event
+ *          is broadcast and the transfer is traced.
+ *
+ * @param[in] busp    pointer to the bus, NULL if the bus is not managed
+ * @param[in] sad     slave address without R/W bit
+ * @param[in] start   start of the transfer
+ * @param[in] txbuf   pointer to the data sent
+ * @param[in] txn     size of the data sent
+ * @param[in] rxbuf   pointer to the data received
+ * @param[in] rxn     size of the data received
+ * @param[in] msg     result of the transfer
+ */
+static void iicXferDone(iic_bus_t *busp, uint8_t sad, systime_t start,
+                        const uint8_t *txbuf, size_t txn,
+                        const uint8_t *rxbuf, size_t rxn, msg_t msg) {
+
+  if (busp != NULL) {
+    chSysLock();
+    busp->stats.busyTime += chVTTimeElapsedSinceX(start);
+    busp->stats.transfers++;
+    busp->stats.bytes += txn + rxn;
+    if (msg != MSG_OK)
+      busp->stats.errors++;
+    chSysUnlock();
+
+    chEvtBroadcastFlags(&busp->event,
+                        (msg == MSG_OK) ? IIC_EVENT_DONE : IIC_EVENT_ERROR);
+  }
+
+#if IIC_USE_TRACE
+  iicTraceRecord(busp, sad, start, txbuf, txn, rxbuf, rxn, msg);
+#else
+  (void)sad;
+  (void)txbuf;
+  (void)rxbuf;
+#endif
+}
+
+/**
+ * @brief   Do a transfer on an owned bus.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] busp    pointer to the bus, NULL if the bus is not managed
+ * @param[in] sad     slave address without R/W bit
+ * @param[in] txbuf   pointer to the data to send
+ * @param[in] txn     size of the data to send
+ * @param[in] rxbuf   pointer to the buffer to store the data readed
+ * @param[in] rxn     size of the data to read
+ *
+ * @return    msg     the result of the transfer
+ */
+static msg_t iicXfer(I2CDriver *i2cp, iic_bus_t *busp, uint8_t sad,
+                     const uint8_t *txbuf, size_t txn, uint8_t *rxbuf,
+                     size_t rxn) {
+
+  systime_t start = chVTGetSystemTime();
+  msg_t     msg;
+
+  msg = iicMasterXfer(i2cp, busp, sad, txbuf, txn, rxbuf, rxn);
+  iicXferDone(busp, sad, start, txbuf, txn, rxbuf, rxn, msg);
+
+  return msg;
+}
+
+/**
+ * @brief   Do a write polling a memory in its write cycle, on an owned
+ *          bus.
+ * @details The memory does not acknowledge its address until the end of
+ *          the write cycle of the previous page. Such a poll is not an
+ *          error: it is only counted in the polls of the bus, without event
+ *          nor trace record. The other results are accounted as by
+ *          iicXfer().
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] busp    pointer to the bus, NULL if the bus is not managed
+ * @param[in] sad     slave address without R/W bit
+ * @param[in] txbuf   pointer to the data to send
+ * @param[in] txn     size of the data to send
+ *
+ * @return    msg     the result of the transfer
+ * @retval    MSG_RESET the memory is still in its write cycle
+ */
+static msg_t iicPoll(I2CDriver *i2cp, iic_bus_t *busp, uint8_t sad,
+                     const uint8_t *txbuf, size_t txn) {
+
+  systime_t start = chVTGetSystemTime();
+  msg_t     msg;
+
+  msg = iicMasterXfer(i2cp, busp, sad, txbuf, txn, NULL, 0);
+
+  if (msg != MSG_RESET)
+    iicXferDone(busp, sad, start, txbuf, txn, NULL, 0, msg);
+  else if (busp != NULL) {
+    chSysLock();
+    busp->stats.busyTime += chVTTimeElapsedSinceX(start);
+    busp->stats.polls++;
+    chSysUnlock();
+  }
+
+  return msg;
+}
+
+/**
+ * @brief   Tell if a transfer with a slave can be done.
+ * @details A slave in quarantine is probed by one transfer once its backoff
+ *          delay is elapsed, the other transfers fail at once.
+ *
+ * @param[in] devp    pointer to the slave, can be NULL
+ * @return    allowed false if the transfer must fail at once
+ */
+static bool iicHealthCheck(iic_device_t *devp) {
+
+  bool allowed = true;
+
+  if (devp == NULL)
+    return true;
+
+  chSysLock();
+  if (devp->health == IIC_HEALTH_DOWN) {
+    if (chVTTimeElapsedSinceX(devp->downTime) >= devp->backoff)
+      devp->health = IIC_HEALTH_PROBE;
+    else
+      allowed = false;
+  }
+  else if (devp->health == IIC_HEALTH_PROBE)
+    allowed = false;
+
+  if (!allowed)
+    devp->rejected++;
+  chSysUnlock();
+
+  return allowed;
+}
+
+/**
+ * @brief   Update the health of a slave with the result of a transfer.
+ * @details After IIC_FAIL_LIMIT consecutive failures the slave is put in
+ *          quarantine. A failed probe doubles the backoff delay, up to
+ *          IIC_BACKOFF_MAX, a successful one ends the quarantine.
+ *
+ * @param[in] devp    pointer to the slave, can be NULL
+ * @param[in] msg     result of the transfer
+ */
+static void iicHealthUpdate(iic_device_t *devp, msg_t msg) {
+
+  if (devp == NULL)
+    return;
+
+  chSysLock();
+  if (msg == MSG_OK) {
+    devp->health   = IIC_HEALTH_OK;
+    devp->failures = 0;
+    devp->backoff  = IIC_BACKOFF_MIN;
+  }
+  else if (devp->health == IIC_HEALTH_PROBE) {
+    devp->health   = IIC_HEALTH_DOWN;
+    devp->downTime = chVTGetSystemTimeX();
+    devp->backoff  = (devp->backoff >= IIC_BACKOFF_MAX / 2) ?
+                     IIC_BACKOFF_MAX : (systime_t)(devp->backoff * 2);
+  }
+  else if (++devp->failures >= IIC_FAIL_LIMIT) {
+    devp->health   = IIC_HEALTH_DOWN;
+    devp->downTime = chVTGetSystemTimeX();
+    devp->backoff  = IIC_BACKOFF_MIN;
+    devp->quarantines++;
+  }
+  chSysUnlock();
+}
+
+/**
+ * @brief   Do a transfer with a slave.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] sad     slave address without R/W bit
+ * @param[in] txbuf   pointer to the data to send
+ * @param[in] txn     size of the data to send
+ * @param[in] rxbuf   pointer to the buffer to store the data readed
+ * @param[in] rxn     size of the data to read
+ *
+ * @return    msg     the result of the transfer
+ * @retval    MSG_RESET the transfer failed or the slave is in quarantine
+ */
+static msg_t iicTransfer(I2CDriver *i2cp, uint8_t sad, const uint8_t *txbuf,
+                         size_t txn, uint8_t *rxbuf, size_t rxn) {
+
+  iic_bus_t     *busp = iicGetBus(i2cp);
+  iic_device_t  *devp = iicGetDevice(i2cp, sad);
+  msg_t         msg;
+
+  if (!iicHealthCheck(devp))
+    return MSG_RESET;
+
+  iicLock(i2cp, busp, devp);
+  msg = iicXfer(i2cp, busp, sad, txbuf, txn, rxbuf, rxn);
+  iicUnlock(i2cp, busp);
+
+  iicHealthUpdate(devp, msg);
+
+  return msg;
+}
+
+/**
+ * @brief   Find the shadow of a register.
+ *
+ * @param[in] devp    pointer to the slave
+ * @param[in] reg     register address
+ * @return    shp     pointer to the shadow, NULL if the register is not
+ *                    shadowed
+ */
+static iic_shadow_t *iicGetShadow(iic_device_t *devp, uint8_t reg) {
+
+  uint8_t i;
+
+  for (i = 0; i < devp->shadowSize; i++) {
+    if (devp->shadow[i].reg == reg)
+      return &devp->shadow[i];
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief   Write registers of a slave having shadowed registers.
+ * @details The registers whose shadow holds the value to write are not
+ *          written again. When no register changes the write is skipped,
+ *          else, if the slave increments the register address, the write
+ *          is shortened to the changed registers.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] devp    pointer to the slave
+ * @param[in] txbuf   pointer to the data to write into the sensor
+ *                    txbuf[0] is the first register to write
+ * @param[in] lenght  size of data to write to the sensor, at least one
+ *                    data byte follows the register address
+ *
+ * @return    msg     the result of the writing operation
+ */
+static msg_t iicShadowWrite(I2CDriver *i2cp, iic_device_t *devp,
+                            uint8_t *txbuf, uint8_t lenght) {
+
+  iic_bus_t     *busp = iicGetBus(i2cp);
+  iic_shadow_t  *shp;
+  uint8_t       first = lenght, last = 0, i, save;
+  bool          sent = true;
+  msg_t         msg = MSG_OK;
+
+  if (!iicHealthCheck(devp))
+    return MSG_RESET;
+
+  iicLock(i2cp, busp, devp);
+
+  /* Find the first and last changed registers, txbuf[i] is written into
+     the register txbuf[0] + i - 1. */
+  for (i = 1; i < lenght; i++) {
+    shp = iicGetShadow(devp, (uint8_t)(txbuf[0] + i - 1));
+    if ((shp == NULL) || !shp->valid || (shp->value != txbuf[i])) {
+      if (first == lenght)
+        first = i;
+      last = i;
+    }
+  }
+
+  if (first == lenght) {
+    devp->shadowHits++;
+
+    /* A probe of a slave in quarantine must reach the slave. */
+    if (devp->health == IIC_HEALTH_PROBE)
+      msg = iicXfer(i2cp, busp, devp->sad, txbuf, lenght, NULL, 0);
+    else
+      sent = false;
+  }
+  else if (devp->autoInc) {
+    /* The byte before the first changed one becomes the register address,
+       it is restored after the transfer. */
+    save = txbuf[first - 1];
+    txbuf[first - 1] = (uint8_t)(txbuf[0] + first - 1);
+    msg = iicXfer(i2cp, busp, devp->sad, &txbuf[first - 1],
+                  (size_t)(last - first + 2), NULL, 0);
+    txbuf[first - 1] = save;
+    devp->shadowMisses++;
+  }
+  else {
+    first = 1;
+    last = (uint8_t)(lenght - 1);
+    msg = iicXfer(i2cp, busp, devp->sad, txbuf, lenght, NULL, 0);
+    devp->shadowMisses++;
+  }
+
+  /* Update the shadows, an error leaves the registers unknown. */
+  for (i = first; (i <= last) && (i < lenght); i++) {
+    shp = iicGetShadow(devp, (uint8_t)(txbuf[0] + i - 1));
+    if (shp != NULL) {
+      shp->value = txbuf[i];
+      shp->valid = (msg == MSG_OK);
+    }
+  }
+
+  iicUnlock(i2cp, busp);
+
+  if (sent)
+    iicHealthUpdate(devp, msg);
+
+  return msg;
+}
+
+/**
+ * @brief   Tell if the last read of a slave contains a block of registers.
+ *
+ * @param[in] devp    pointer to the slave
+ * @param[in] reg     first register of the block
+ * @param[in] lenght  number of registers of the block
+ * @return    covered true if the block is inside the last read
+ */
+static bool iicReadCovers(const iic_device_t *devp, uint8_t reg,
+                          uint8_t lenght) {
+
+  return (reg >= devp->readReg) &&
+         ((uint16_t)reg + lenght <= (uint16_t)devp->readReg + devp->readSize);
+}
+
+/**
+ * @brief   Discard the last read of registers of a slave.
+ * @details The read in flight, if any, is not kept when it ends.
+ *
+ * @param[in] devp    pointer to the slave
+ */
+static void iicReadInvalidate(iic_device_t *devp) {
+
+  chSysLock();
+  devp->readValid = false;
+  devp->writeGen++;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Read registers of a slave, coalescing the concurrent reads.
+ * @details A read of registers already read within the freshness window of
+ *          the slave is served from the last read. A read of registers
+ *          being read by another thread waits for this read and gets its
+ *          result. Otherwise the registers are read from the slave.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] devp    pointer to the slave
+ * @param[in] reg     first register address to read
+ * @param[in] rxbuf   pointer to the buffer to store the data readed
+ * @param[in] lenght  size of data to read, at most IIC_READ_CACHE_SIZE
+ *
+ * @return    msg     the result of the reading operation
+ */
+static msg_t iicCoalescedRead(I2CDriver *i2cp, iic_device_t *devp,
+                              uint8_t reg, uint8_t *rxbuf, uint8_t lenght) {
+
+  bool      joined = false;
+  uint32_t  gen;
+  msg_t     msg;
+  uint8_t   i;
+
+  chSysLock();
+  for (;;) {
+    if (devp->readBusy) {
+      /* Wait for the read in flight, get its result if it covers ours. */
+      msg = chThdEnqueueTimeoutS(&devp->readQueue, TIME_INFINITE);
+      if ((msg != MSG_OK) && iicReadCovers(devp, reg, lenght)) {
+        chSysUnlock();
+        return msg;
+      }
+      joined = true;
+      continue;
+    }
+
+    if (devp->readValid && iicReadCovers(devp, reg, lenght) &&
+        (joined ||
+         (chVTTimeElapsedSinceX(devp->readTime) < devp->readWindow))) {
+      for (i = 0; i < lenght; i++)
+        rxbuf[i] = devp->readCache[reg - devp->readReg + i];
+      if (joined)
+        devp->readJoins++;
+      else
+        devp->readHits++;
+      chSysUnlock();
+      return MSG_OK;
+    }
+
+    break;
+  }
+
+  devp->readBusy  = true;
+  devp->readValid = false;
+  devp->readReg   = reg;
+  devp->readSize  = lenght;
+  gen = devp->writeGen;
+  chSysUnlock();
+
+  msg = iicTransfer(i2cp, devp->sad, &reg, 1, devp->readCache, lenght);
+
+  chSysLock();
+  for (i = 0; i < lenght; i++)
+    rxbuf[i] = devp->readCache[i];
+  devp->readBusy  = false;
+  /* A write during the transfer may have changed the registers. */
+  devp->readValid = (msg == MSG_OK) && (gen == devp->writeGen);
+  devp->readTime  = chVTGetSystemTimeX();
+  chThdDequeueAllI(&devp->readQueue, msg);
+  chSchRescheduleS();
+  chSysUnlock();
+
+  return msg;
+}
+
+/**
+ * @brief   Tell if a block fits in the addresses of a memory.
+ * @details A block past the last address would wrap to the first ones.
+ *
+ * @param[in] devp    pointer to the memory
+ * @param[in] addr    first address of the block
+ * @param[in] lenght  size of the block
+ * @return    fits    false if the block does not fit
+ */
+static bool iicMemFits(const iic_device_t *devp, uint16_t addr,
+                       uint16_t lenght) {
+
+  return (uint32_t)addr + lenght <= (1UL << (8 * devp->memAddrSize));
+}
+
+/**
+ * @brief   Account a transfer with a memory.
+ *
+ * @param[in] devp    pointer to the memory
+ * @param[in] n       bytes transferred
+ * @param[in] time    time spent
+ */
+static void iicMemAccount(iic_device_t *devp, uint16_t n, systime_t time) {
+
+  chSysLock();
+  devp->memBytes += n;
+  devp->memTime  += time;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Put a memory address in front of a buffer.
+ *
+ * @param[in]  devp   pointer to the memory
+ * @param[out] buf    pointer to the buffer
+ * @param[in]  addr   memory address
+ * @return     n      size of the address in bytes
+ */
+static uint8_t iicMemAddress(const iic_device_t *devp, uint8_t *buf,
+                             uint16_t addr) {
+
+  if (devp->memAddrSize == 2) {
+    buf[0] = (uint8_t)(addr >> 8);
+    buf[1] = (uint8_t)addr;
+    return 2;
+  }
+
+  buf[0] = (uint8_t)addr;
+  return 1;
+}
+
+/*==========================================================================*/
+/* Driver Functions                                                         */
+/*==========================================================================*/
+
+/**
+ * @brief   Start an I2C bus managed by the driver.
+ * @details The clock speed of the configuration is the highest speed used on
+ *          the bus, it is lowered for the slower slaves. The bus is shared
+ *          between the threads following the priority class of the slaves.
+ * @note    All the transfers on a managed bus must be done through this
+ *          driver.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] config  pointer to the bus configuration
+ *
+ * @return    msg     the result of the operation
+ * @retval    MSG_OK    the bus is started
+ * @retval    MSG_RESET there is no free bus
+ */
+msg_t i2cBusStart(I2CDriver *i2cp, const I2CConfig *config) {
+
+  iic_bus_t *busp = iicGetBus(i2cp);
+  uint8_t   c;
+
+  if (busp == NULL)
+    busp = iicGetBus(NULL);
+
+  if (busp == NULL)
+    return MSG_RESET;
+
+  busp->i2cp     = i2cp;
+  busp->config   = *config;
+  busp->maxClock = config->clock_speed;
+  busp->busy     = false;
+
+  busp->stats.transfers = 0;
+  busp->stats.bytes     = 0;
+  busp->stats.errors    = 0;
+  busp->stats.polls     = 0;
+  busp->stats.reconfigs = 0;
+  busp->stats.busyTime  = 0;
+
+  for (c = 0; c < IIC_PRIO_CLASSES; c++) {
+    busp->waiters[c]       = NULL;
+    busp->stats.grants[c]  = 0;
+    busp->stats.maxWait[c] = 0;
+  }
+
+  chEvtObjectInit(&busp->event);
+  i2cStart(i2cp, &busp->config);
+
+  return MSG_OK;
+}
+
+/**
+ * @brief   Register a slave, its maximum clock speed and its priority.
+ * @details The bus is clocked at this speed, or at the bus speed if it is
+ *          lower, during the transfers with the slave. The slaves which are
+ *          not registered use the IIC_PRIO_NORMAL class.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] sad     slave address without R/W bit
+ * @param[in] clock   maximum clock speed of the slave (Hz)
+ * @param[in] prio    priority class of the transfers, see IIC_PRIO_xxx
+ *
+ * @return    msg     the result of the operation
+ * @retval    MSG_OK    the slave is registered
+ * @retval    MSG_RESET there is no room left to register the slave
+ */
+msg_t i2cRegisterDevice(I2CDriver *i2cp, uint8_t sad, uint32_t clock,
+                        uint8_t prio) {
+
+  iic_device_t  *devp;
+
+  if (prio >= IIC_PRIO_CLASSES)
+    return MSG_RESET;
+
+  /* The slaves can be registered by several threads at once, a free slot
+     is initialized and published in the same critical section. */
+  chSysLock();
+  devp = iicGetDevice(i2cp, sad);
+  if (devp == NULL) {
+    devp = iicGetDevice(NULL, 0);
+    if (devp == NULL) {
+      chSysUnlock();
+      return MSG_RESET;
+    }
+
+    devp->shadow       = NULL;
+    devp->shadowSize   = 0;
+    devp->shadowHits   = 0;
+    devp->shadowMisses = 0;
+    devp->readWindow   = 0;
+    devp->readBusy     = false;
+    devp->readValid    = false;
+    devp->writeGen     = 0;
+    devp->readHits     = 0;
+    devp->readJoins    = 0;
+    devp->memAddrSize  = 1;
+    devp->memPage      = 0;
+    devp->memWriteTime = 0;
+    devp->memBytes     = 0;
+    devp->memTime      = 0;
+    devp->health       = IIC_HEALTH_OK;
+    devp->failures     = 0;
+    devp->backoff      = IIC_BACKOFF_MIN;
+    devp->quarantines  = 0;
+    devp->rejected     = 0;
+    chThdQueueObjectInit(&devp->readQueue);
+
+    /* Published last, iicGetDevice() finds the slave from now on. */
+    devp->sad  = sad;
+    devp->i2cp = i2cp;
+  }
+  devp->clock = clock;
+  devp->prio  = prio;
+  chSysUnlock();
+
+  return MSG_OK;
+}
+
+/**
+ * @brief   Tell if a slave answers on a bus.
+ * @details One byte is read from the slave, at the clock speed of the slave
+ *          if it is registered. The read is accounted like any transfer
+ *          and updates the health of a registered slave.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] sad     slave address without R/W bit
+ * @return    present true if the slave acknowledged its address
+ */
+bool i2cProbe(I2CDriver *i2cp, uint8_t sad) {
+
+  iic_bus_t     *busp = iicGetBus(i2cp);
+  iic_device_t  *devp = iicGetDevice(i2cp, sad);
+  uint8_t       b;
+  msg_t         msg;
+
+  iicLock(i2cp, busp, devp);
+  msg = iicXfer(i2cp, busp, sad, NULL, 0, &b, 1);
+  iicUnlock(i2cp, busp);
+
+  iicHealthUpdate(devp, msg);
+
+  return msg == MSG_OK;
+}
+
+/**
+ * @brief   Get the transfer completion events of a bus.
+ * @details The event source broadcasts IIC_EVENT_DONE after each successful
+ *          transfer on the bus and IIC_EVENT_ERROR after each failed one.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @return    esp     pointer to the event source, NULL if the bus is not
+ *                    managed by the driver
+ */
+event_source_t *i2cGetEventSource(I2CDriver *i2cp) {
+
+  iic_bus_t *busp = iicGetBus(i2cp);
+
+  return (busp != NULL) ? &busp->event : NULL;
+}
+
+/**
+ * @brief   Borrow a transfer descriptor from the pool.
+ * @details The descriptor comes with its buffer slab, the transfer data are
+ *          built and decoded in the slab without copies.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] sad     slave address without R/W bit
+ * @return    xp      pointer to the descriptor, NULL if the pool is empty
+ */
+iic_xfer_t *i2cXferAlloc(I2CDriver *i2cp, uint8_t sad) {
+
+  iic_xfer_t  *xp;
+  uint8_t     i;
+
+  chSysLock();
+  if (!iicPoolLoaded) {
+    for (i = 0; i < IIC_POOL_SIZE; i++) {
+      iicXfers[i].buf = iicSlabs[i];
+      chPoolFreeI(&iicPool, &iicXfers[i]);
+    }
+    iicPoolLoaded = true;
+  }
+
+  xp = chPoolAllocI(&iicPool);
+  if (xp != NULL) {
+    if (++iicPoolUsed > iicPoolHighWater)
+      iicPoolHighWater = iicPoolUsed;
+  }
+  chSysUnlock();
+
+  if (xp != NULL) {
+    xp->i2cp = i2cp;
+    xp->sad  = sad;
+    xp->txn  = 0;
+    xp->rxn  = 0;
+  }
+
+  return xp;
+}
+
+/**
+ * @brief   Do the transfer of a descriptor.
+ * @details The txn bytes at the start of the slab are sent, then rxn bytes
+ *          are received after them.
+ *
+ * @param[in] xp      pointer to the descriptor
+ * @return    msg     the result of the transfer
+ * @retval    MSG_RESET the transfer failed or does not fit in the slab
+ */
+msg_t i2cXferRun(iic_xfer_t *xp) {
+
+  if ((xp->txn == 0) || (xp->txn + xp->rxn > IIC_SLAB_SIZE))
+    return MSG_RESET;
+
+  return iicTransfer(xp->i2cp, xp->sad, xp->buf, xp->txn, IIC_XFER_RX(xp),
+                     xp->rxn);
+}
+
+/**
+ * @brief   Give back a transfer descriptor to the pool.
+ *
+ * @param[in] xp      pointer to the descriptor
+ */
+void i2cXferFree(iic_xfer_t *xp) {
+
+  chSysLock();
+  chPoolFreeI(&iicPool, xp);
+  iicPoolUsed--;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Get the usage of the transfer descriptor pool.
+ *
+ * @param[out] used       descriptors borrowed now
+ * @param[out] highWater  most descriptors borrowed at once
+ */
+void i2cGetPoolStats(uint8_t *used, uint8_t *highWater) {
+
+  chSysLock();
+  *used      = iicPoolUsed;
+  *highWater = iicPoolHighWater;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Get the statistics of a bus.
+ * @details The statistics are copied in a critical section, the caller
+ *          does not wait for the bus and the statistics are not changed.
+ *
+ * @param[in]  i2cp   pointer to the i2c interface
+ * @param[out] stats  pointer to the statistics, zeroed if the bus is not
+ *                    managed by the driver
+ */
+void i2cGetStats(I2CDriver *i2cp, iic_stats_t *stats) {
+
+  iic_bus_t *busp = iicGetBus(i2cp);
+  uint8_t   c;
+
+  if (busp != NULL) {
+    chSysLock();
+    *stats = busp->stats;
+    chSysUnlock();
+  }
+  else {
+    stats->transfers = 0;
+    stats->bytes     = 0;
+    stats->errors    = 0;
+    stats->polls     = 0;
+    stats->reconfigs = 0;
+    stats->busyTime  = 0;
+
+    for (c = 0; c < IIC_PRIO_CLASSES; c++) {
+      stats->grants[c]  = 0;
+      stats->maxWait[c] = 0;
+    }
+  }
+}
+
+/**
+ * @brief   Enable the shadow cache of registers of a slave.
+ * @details The driver remembers the last value written into each of the
+ *          given registers and does not write a register again with the
+ *          same value. Only configuration registers must be shadowed, not
+ *          the registers changed by the slave itself or whose write starts
+ *          an action.
+ * @note    The slave must be registered.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] sad     slave address without R/W bit
+ * @param[in] shadow  pointer to the shadows, with their reg field set
+ * @param[in] n       number of shadows
+ * @param[in] autoInc true if the slave increments the register address
+ *                    during a write, the writes can then be shortened
+ *
+ * @return    msg     the result of the operation
+ * @retval    MSG_OK    the shadow cache is enabled
+ * @retval    MSG_RESET the slave is not registered
+ */
+msg_t i2cShadowRegisters(I2CDriver *i2cp, uint8_t sad, iic_shadow_t *shadow,
+                         uint8_t n, bool autoInc) {
+
+  iic_device_t  *devp = iicGetDevice(i2cp, sad);
+  iic_bus_t     *busp = iicGetBus(i2cp);
+  uint8_t       i;
+
+  if (devp == NULL)
+    return MSG_RESET;
+
+  for (i = 0; i < n; i++)
+    shadow[i].valid = false;
+
+  iicLock(i2cp, busp, devp);
+  devp->shadow     = shadow;
+  devp->shadowSize = n;
+  devp->autoInc    = autoInc;
+  iicUnlock(i2cp, busp);
+
+  return MSG_OK;
+}
+
+/**
+ * @brief   Forget the values of the shadowed registers of a slave.
+ * @details To be called when the slave registers are changed outside of
+ *          the driver, after a reset of the slave for example.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] sad     slave address without R/W bit
+ */
+void i2cShadowInvalidate(I2CDriver *i2cp, uint8_t sad) {
+
+  iic_device_t  *devp = iicGetDevice(i2cp, sad);
+  iic_bus_t     *busp = iicGetBus(i2cp);
+  uint8_t       i;
+
+  if ((devp == NULL) || (devp->shadow == NULL))
+    return;
+
+  iicLock(i2cp, busp, devp);
+  for (i = 0; i < devp->shadowSize; i++)
+    devp->shadow[i].valid = false;
+  iicUnlock(i2cp, busp);
+}
+
+/**
+ * @brief   Get the shadow cache counters of a slave.
+ *
+ * @param[in]  i2cp     pointer to the i2c interface
+ * @param[in]  sad      slave address without R/W bit
+ * @param[out] hits     writes skipped thanks to the shadows
+ * @param[out] misses   writes done, possibly shortened
+ */
+void i2cGetShadowStats(I2CDriver *i2cp, uint8_t sad, uint32_t *hits,
+                       uint32_t *misses) {
+
+  iic_device_t *devp = iicGetDevice(i2cp, sad);
+
+  *hits   = (devp != NULL) ? devp->shadowHits : 0;
+  *misses = (devp != NULL) ? devp->shadowMisses : 0;
+}
+
+/**
+ * @brief   Coalesce the concurrent reads of registers of a slave.
+ * @details The reads of the same registers done by several threads within
+ *          the freshness window are served by a single bus transfer. A
+ *          write to the slave discards the last read and the read in
+ *          flight.
+ * @note    Only the slaves whose registers can be read again without side
+ *          effects must use it, the window must be shorter than the time
+ *          needed by the registers to change.
+ * @note    The slave must be registered.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] sad     slave address without R/W bit
+ * @param[in] window  freshness window of a read, 0 disables the coalescing
+ *
+ * @return    msg     the result of the operation
+ * @retval    MSG_OK    the window is set
+ * @retval    MSG_RESET the slave is not registered
+ */
+msg_t i2cCoalesceReads(I2CDriver *i2cp, uint8_t sad, systime_t window) {
+
+  iic_device_t *devp = iicGetDevice(i2cp, sad);
+
+  if (devp == NULL)
+    return MSG_RESET;
+
+  chSysLock();
+  devp->readWindow = window;
+  chSysUnlock();
+  iicReadInvalidate(devp);
+
+  return MSG_OK;
+}
+
+/**
+ * @brief   Get the read coalescing counters of a slave.
+ *
+ * @param[in]  i2cp     pointer to the i2c interface
+ * @param[in]  sad      slave address without R/W bit
+ * @param[out] hits     reads served from a recent read
+ * @param[out] joins    reads served from a read in flight
+ */
+void i2cGetReadStats(I2CDriver *i2cp, uint8_t sad, uint32_t *hits,
+                     uint32_t *joins) {
+
+  iic_device_t *devp = iicGetDevice(i2cp, sad);
+
+  *hits  = (devp != NULL) ? devp->readHits : 0;
+  *joins = (devp != NULL) ? devp->readJoins : 0;
+}
+
+#if IIC_USE_TRACE || defined(__DOXYGEN__)
+/**
+ * @brief   Start or stop the recording of the transfers.
+ * @details Starting the recording clears the trace.
+ *
+ * @param[in] enable  true to start the recording, false to stop it
+ */
+void i2cTraceEnable(bool enable) {
+
+  chSysLock();
+  if (enable && !iicTraceOn) {
+    iicTraceHead  = 0;
+    iicTraceCount = 0;
+    iicTraceLost  = 0;
+  }
+  iicTraceOn = enable;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Take the oldest records out of the trace.
+ *
+ * @param[out] trace  pointer to the buffer receiving the records
+ * @param[in]  n      size of the buffer in records
+ * @param[out] lost   number of records overwritten since the last call,
+ *                    can be NULL
+ * @return     count  number of records taken
+ */
+size_t i2cTraceRead(iic_trace_t *trace, size_t n, uint32_t *lost) {
+
+  size_t count = 0;
+
+  chSysLock();
+  while ((count < n) && (iicTraceCount > 0)) {
+    trace[count++] =
+      iicTrace[(iicTraceHead + IIC_TRACE_SIZE - iicTraceCount) %
+               IIC_TRACE_SIZE];
+    iicTraceCount--;
+  }
+  if (lost != NULL) {
+    *lost = iicTraceLost;
+    iicTraceLost = 0;
+  }
+  chSysUnlock();
+
+  return count;
+}
+
+/**
+ * @brief   Write the records of the trace to a stream in binary.
+ * @details The records are taken out of the trace one at a time, so the
+ *          recording can go on during the dump.
+ *
+ * @param[in] chp     pointer to the stream, a serial driver for example
+ * @return    count   number of records written
+ */
+size_t i2cTraceDump(BaseSequentialStream *chp) {
+
+  iic_trace_t record;
+  size_t      count = 0;
+
+  while (i2cTraceRead(&record, 1, NULL) == 1) {
+    (void)streamWrite(chp, (const uint8_t *)&record, sizeof(record));
+    count++;
+  }
+
+  return count;
+}
+#endif
+
+/**
+ * @brief   Get the health of a slave.
+ *
+ * @param[in]  i2cp         pointer to the i2c interface
+ * @param[in]  sad          slave address without R/W bit
+ * @param[out] quarantines  number of quarantines, can be NULL
+ * @param[out] rejected     transfers failed during the quarantines, can be
+ *                          NULL
+ * @return     health       IIC_HEALTH_xxx, IIC_HEALTH_OK if the slave is
+ *                          not registered
+ */
+uint8_t i2cGetHealth(I2CDriver *i2cp, uint8_t sad, uint32_t *quarantines,
+                     uint32_t *rejected) {
+
+  iic_device_t *devp = iicGetDevice(i2cp, sad);
+
+  if (quarantines != NULL)
+    *quarantines = (devp != NULL) ? devp->quarantines : 0;
+  if (rejected != NULL)
+    *rejected = (devp != NULL) ? devp->rejected : 0;
+
+  return (devp != NULL) ? devp->health : IIC_HEALTH_OK;
+}
+
+/**
+ * @brief   Declare a registered slave as a memory, EEPROM or FRAM.
+ * @note    The slave must be registered.
+ *
+ * @param[in] i2cp      pointer to the i2c interface
+ * @param[in] sad       slave address without R/W bit
+ * @param[in] addrSize  size of a memory address, 1 or 2 bytes
+ * @param[in] page      size of a write page, 0 if the writes can cross any
+ *                      boundary (FRAM), at most IIC_MEM_PAGE_MAX
+ * @param[in] writeTime longest write cycle of a page, 0 for a FRAM
+ *
+ * @return    msg       the result of the operation
+ * @retval    MSG_OK      the memory is declared
+ * @retval    MSG_RESET   the slave is not registered or the geometry is not
+ *                        supported
+ */
+msg_t i2cRegisterMemory(I2CDriver *i2cp, uint8_t sad, uint8_t addrSize,
+                        uint16_t page, systime_t writeTime) {
+
+  iic_device_t *devp = iicGetDevice(i2cp, sad);
+
+  if ((devp == NULL) || (addrSize < 1) || (addrSize > 2) ||
+      (page > IIC_MEM_PAGE_MAX))
+    return MSG_RESET;
+
+  devp->memAddrSize  = addrSize;
+  devp->memPage      = page;
+  devp->memWriteTime = writeTime;
+
+  return MSG_OK;
+}
+
+/**
+ * @brief   Read a block of a memory.
+ * @details The block is read by chunks of IIC_MEM_CHUNK bytes, the bus is
+ *          given to the waiting transfers between the chunks.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] sad     slave address without R/W bit
+ * @param[in] addr    first address to read
+ * @param[in] rxbuf   pointer to the buffer to store the data readed
+ * @param[in] lenght  size of data to read
+ *
+ * @return    msg     the result of the reading operation
+ * @retval    MSG_RESET the slave is not registered, the block goes past the
+ *                      last address of the memory or an error occurred
+ */
+msg_t i2cReadMemory(I2CDriver *i2cp, uint8_t sad, uint16_t addr,
+                    uint8_t *rxbuf, uint16_t lenght) {
+
+  iic_device_t  *devp = iicGetDevice(i2cp, sad);
+  systime_t     start = chVTGetSystemTime();
+  uint8_t       txbuf[2], txn;
+  uint16_t      n, done = 0;
+  msg_t         msg = MSG_OK;
+
+  if ((devp == NULL) || !iicMemFits(devp, addr, lenght))
+    return MSG_RESET;
+
+  while ((lenght > 0) && (msg == MSG_OK)) {
+    n = (lenght > IIC_MEM_CHUNK) ? IIC_MEM_CHUNK : lenght;
+    txn = iicMemAddress(devp, txbuf, addr);
+    msg = iicTransfer(i2cp, sad, txbuf, txn, rxbuf, n);
+    if (msg == MSG_OK)
+      done += n;
+
+    addr   += n;
+    rxbuf  += n;
+    lenght -= n;
+  }
+
+  iicMemAccount(devp, done, chVTTimeElapsedSinceX(start));
+
+  return msg;
+}
+
+/**
+ * @brief   Write a block of a memory.
+ * @details The block is split at the page boundaries of the memory. The
+ *          memory does not answer during the write cycle of a page, it is
+ *          polled until it acknowledges the next page. The bus is given to
+ *          the waiting transfers during the write cycles.
+ * @note    The polls not acknowledged during a write cycle are counted in
+ *          the polls of the bus, not in its errors.
+ * @note    The last read of the registers and the register shadows of the
+ *          slave are discarded.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] sad     slave address without R/W bit
+ * @param[in] addr    first address to write
+ * @param[in] txbuf   pointer to the data to write
+ * @param[in] lenght  size of data to write
+ *
+ * @return    msg     the result of the writing operation
+ * @retval    MSG_RESET the slave is not registered, the block goes past the
+ *                      last address of the memory, or the memory did not
+ *                      acknowledge a page within its write cycle time
+ */
+msg_t i2cWriteMemory(I2CDriver *i2cp, uint8_t sad, uint16_t addr,
+                     const uint8_t *txbuf, uint16_t lenght) {
+
+  iic_device_t  *devp = iicGetDevice(i2cp, sad);
+  iic_bus_t     *busp = iicGetBus(i2cp);
+  systime_t     start = chVTGetSystemTime();
+  systime_t     poll;
+  uint8_t       buf[2 + IIC_MEM_PAGE_MAX], txn;
+  uint16_t      n, i, done = 0;
+  bool          late, end;
+  msg_t         msg = MSG_OK;
+
+  if ((devp == NULL) || !iicMemFits(devp, addr, lenght))
+    return MSG_RESET;
+
+  while ((lenght > 0) && (msg == MSG_OK)) {
+    /* Stop at the end of the page, or of the buffer without pages. */
+    if (devp->memPage > 0)
+      n = (uint16_t)(devp->memPage - (addr % devp->memPage));
+    else
+      n = IIC_MEM_PAGE_MAX;
+    if (n > lenght)
+      n = lenght;
+
+    txn = iicMemAddress(devp, buf, addr);
+    for (i = 0; i < n; i++)
+      buf[txn + i] = txbuf[i];
+
+    if (!iicHealthCheck(devp)) {
+      msg = MSG_RESET;
+      break;
+    }
+
+    /* The previous page may still be in its write cycle, the polls are
+       not failures of the slave. Once the write cycle time is elapsed
+       the page is written by a plain transfer, its failure is an error. */
+    poll = chVTGetSystemTime();
+    for (;;) {
+      late = (chVTTimeElapsedSinceX(poll) >= devp->memWriteTime);
+      iicLock(i2cp, busp, devp);
+      if (late)
+        msg = iicXfer(i2cp, busp, sad, buf, txn + n, NULL, 0);
+      else
+        msg = iicPoll(i2cp, busp, sad, buf, txn + n);
+      end = late || (msg != MSG_RESET);
+      /* The page may hold the shadowed registers. */
+      if (end && (devp->shadow != NULL))
+        for (i = 0; i < devp->shadowSize; i++)
+          devp->shadow[i].valid = false;
+      iicUnlock(i2cp, busp);
+      if (end)
+        break;
+      chThdSleep(1);
+    }
+    iicHealthUpdate(devp, msg);
+    if (msg == MSG_OK)
+      done += n;
+
+    addr   += n;
+    txbuf  += n;
+    lenght -= n;
+  }
+
+  /* The last read, or the read in flight, may not match the memory
+     anymore. */
+  iicReadInvalidate(devp);
+  iicMemAccount(devp, done, chVTTimeElapsedSinceX(start));
+
+  return msg;
+}
+
+/**
+ * @brief   Get the throughput of the transfers with a memory.
+ * @details The throughput is measured from the start to the end of the
+ *          i2cReadMemory() and i2cWriteMemory() calls, the waits for the
+ *          bus and the write cycles included.
+ *          Only the bytes of the successful transfers are counted.
+ *
+ * @param[in] i2cp    pointer to the i2c interface
+ * @param[in] sad     slave address without R/W bit
+ * @return    rate    throughput in bytes per second, 0 if unknown
+ */
+uint32_t i2cGetMemoryThroughput(I2CDriver *i2cp, uint8_t sad) {
+
+  iic_device_t *devp = iicGetDevice(i2cp, sad);
+  uint32_t     bytes;
+  systime_t    time;
+
+  if (devp == NULL)
+    return 0;
+
+  chSysLock();
+  bytes = devp->memBytes;
+  time  = devp->memTime;
+  chSysUnlock();
+
+  if (time == 0)
+    return 0;
+
+  return (uint32_t)(((uint64_t)bytes * CH_CFG_ST_FREQUENCY) / time);
+}
+
 /**
  * @brief   Read a register from the sensor.
  *
@@ -33,13 +1547,8 @@
  */
 msg_t i2cReadRegister(I2CDriver *i2cp, uint8_t sad, uint8_t *reg,
                       uint8_t *rxbuf) {
-  msg_t msg;
-
-  i2cAcquireBus(i2cp);
-  msg = i2cMasterTransmitTimeout(i2cp, sad, reg, 1, rxbuf, 1, MS2ST(4)); // TODO: Test the usage of TIMEINFINITE
-  i2cReleaseBus(i2cp);
 
-  return msg;
+  return i2cReadRegisters(i2cp, sad, reg, rxbuf, 1);
 }
 
 /**
@@ -55,13 +1564,14 @@ msg_t i2cReadRegister(I2CDriver *i2cp, uint8_t sad, uint8_t *reg,
  */
 msg_t i2cReadRegisters( I2CDriver *i2cp, uint8_t sad, uint8_t *reg,
                         uint8_t *rxbuf, uint8_t lenght) {
-  msg_t msg;
 
-  i2cAcquireBus(i2cp);
-  msg = i2cMasterTransmitTimeout(i2cp, sad, reg, 1, rxbuf, lenght, MS2ST(4));
-  i2cReleaseBus(i2cp);
+  iic_device_t *devp = iicGetDevice(i2cp, sad);
 
-  return msg;
+  if ((devp != NULL) && (devp->readWindow > 0) &&
+      (lenght <= IIC_READ_CACHE_SIZE))
+    return iicCoalescedRead(i2cp, devp, *reg, rxbuf, lenght);
+
+  return iicTransfer(i2cp, sad, reg, 1, rxbuf, lenght);
 }
 
 /**
@@ -77,11 +1587,22 @@ msg_t i2cReadRegisters( I2CDriver *i2cp, uint8_t sad, uint8_t *reg,
  */
 msg_t i2cWriteRegisters(I2CDriver *i2cp, uint8_t sad, uint8_t *txbuf,
                         uint8_t lenght) {
-  msg_t msg;
 
-  i2cAcquireBus(i2cp);
-  msg = i2cMasterTransmitTimeout(i2cp, sad, txbuf, lenght, NULL, 0, MS2ST(4)); // TODO: Test the usage of TIMEINFINITE
-  i2cReleaseBus(i2cp);
+  iic_device_t  *devp = iicGetDevice(i2cp, sad);
+  msg_t         msg;
+
+  /* A write of the register address only, which sets the register
+     pointer of the slave, has no data byte to compare and is always
+     sent. */
+  if ((devp != NULL) && (devp->shadow != NULL) && (lenght >= 2))
+    msg = iicShadowWrite(i2cp, devp, txbuf, lenght);
+  else
+    msg = iicTransfer(i2cp, sad, txbuf, lenght, NULL, 0);
+
+  /* The last read, or the read in flight, may not match the registers
+     anymore. */
+  if (devp != NULL)
+    iicReadInvalidate(devp);
 
   return msg;
 }
@@ -21,9 +21,431 @@
 #include <hal.h>
 
 /*==========================================================================*/
-/* Functions prototypes.                                                    */ 
+/* Driver constants.                                                        */
 /*==========================================================================*/
 
+/**
+ * @brief   Size of a line of the data cache, 0 without data cache.
+ * @details The core header of the part tells if it has a data cache, the
+ *          line size is the one of the HAL or 32 bytes, the line of the
+ *          Cortex-M7.
+ */
+#if (defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT != 0)) ||               \
+    defined(__DOXYGEN__)
+#if defined(CACHE_LINE_SIZE)
+#define IIC_DCACHE_LINE                   CACHE_LINE_SIZE
+#else
+#define IIC_DCACHE_LINE                   32
+#endif
+#else
+#define IIC_DCACHE_LINE                   0
+#endif
+
+/*==========================================================================*/
+/* Driver pre-compile time settings.                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Number of I2C buses managed by the driver.
+ * @note    The default is 2.
+ */
+#if !defined(IIC_MAX_BUSES) || defined(__DOXYGEN__)
+#define IIC_MAX_BUSES                     2
+#endif
+
+/**
+ * @brief   Number of I2C slaves that can be registered.
+ * @note    The default is 8.
+ */
+#if !defined(IIC_MAX_DEVICES) || defined(__DOXYGEN__)
+#define IIC_MAX_DEVICES                   8
+#endif
+
+/**
+ * @brief   Longest time a transfer waits for the bus before being served
+ *          ahead of the higher priority transfers.
+ * @note    The default is 20 ms.
+ */
+#if !defined(IIC_MAX_WAIT) || defined(__DOXYGEN__)
+#define IIC_MAX_WAIT                      MS2ST(20)
+#endif
+
+/**
+ * @brief   Largest block of registers whose reads can be coalesced.
+ * @note    The default is 8 bytes.
+ */
+#if !defined(IIC_READ_CACHE_SIZE) || defined(__DOXYGEN__)
+#define IIC_READ_CACHE_SIZE               8
+#endif
+
+/**
+ * @brief   Largest page of the memories, EEPROM or FRAM, on the buses.
+ * @note    The default is 64 bytes.
+ */
+#if !defined(IIC_MEM_PAGE_MAX) || defined(__DOXYGEN__)
+#define IIC_MEM_PAGE_MAX                  64
+#endif
+
+/**
+ * @brief   Largest block read from a memory in one transfer.
+ * @details The bus is given to the other transfers between the blocks of a
+ *          long read.
+ * @note    The default is 128 bytes.
+ */
+#if !defined(IIC_MEM_CHUNK) || defined(__DOXYGEN__)
+#define IIC_MEM_CHUNK                     128
+#endif
+
+/**
+ * @brief   Consecutive failed transfers putting a slave in quarantine.
+ * @note    The default is 3.
+ */
+#if !defined(IIC_FAIL_LIMIT) || defined(__DOXYGEN__)
+#define IIC_FAIL_LIMIT                    3
+#endif
+
+/**
+ * @brief   First delay before probing a slave in quarantine.
+ * @details The delay is doubled after each failed probe.
+ * @note    The default is 10 ms.
+ */
+#if !defined(IIC_BACKOFF_MIN) || defined(__DOXYGEN__)
+#define IIC_BACKOFF_MIN                   MS2ST(10)
+#endif
+
+/**
+ * @brief   Longest delay before probing a slave in quarantine.
+ * @note    The default is 1 s.
+ */
+#if !defined(IIC_BACKOFF_MAX) || defined(__DOXYGEN__)
+#define IIC_BACKOFF_MAX                   MS2ST(1000)
+#endif
+
+/**
+ * @brief   Number of threads bringing up the slaves at startup.
+ * @note    The default is one thread per bus.
+ */
+#if !defined(IIC_BRINGUP_THREADS) || defined(__DOXYGEN__)
+#define IIC_BRINGUP_THREADS               IIC_MAX_BUSES
+#endif
+
+/**
+ * @brief   Stack size of the bring-up threads.
+ * @details The stack must hold the deepest init function of the slaves.
+ * @note    The default is 512 bytes.
+ */
+#if !defined(IIC_BRINGUP_WA_SIZE) || defined(__DOXYGEN__)
+#define IIC_BRINGUP_WA_SIZE               512
+#endif
+
+/**
+ * @brief   Number of transfer descriptors of the pool.
+ * @note    The default is 4.
+ */
+#if !defined(IIC_POOL_SIZE) || defined(__DOXYGEN__)
+#define IIC_POOL_SIZE                     4
+#endif
+
+/**
+ * @brief   Size of the buffer slab of a transfer descriptor.
+ * @note    The default is 32 bytes, it must be a multiple of
+ *          IIC_SLAB_ALIGN.
+ */
+#if !defined(IIC_SLAB_SIZE) || defined(__DOXYGEN__)
+#define IIC_SLAB_SIZE                     32
+#endif
+
+/**
+ * @brief   Alignment of the buffer slabs.
+ * @details The slabs must not share a cache line with other data when the
+ *          DMA works on a cached memory.
+ * @note    The default is the line of the data cache, 4 bytes without
+ *          data cache.
+ */
+#if !defined(IIC_SLAB_ALIGN) || defined(__DOXYGEN__)
+#if IIC_DCACHE_LINE > 0
+#define IIC_SLAB_ALIGN                    IIC_DCACHE_LINE
+#else
+#define IIC_SLAB_ALIGN                    4
+#endif
+#endif
+
+/**
+ * @brief   Attribute placing the buffer slabs in a DMA capable memory.
+ * @details For example __attribute__((section(".nocache"))) to place them
+ *          in a non cached region.
+ * @note    The default is the default data section, without data cache
+ *          only. With a data cache the setting is required, the driver
+ *          does no cache maintenance.
+ */
+#if (!defined(IIC_DMA_SECTION) && (IIC_DCACHE_LINE == 0)) ||               \
+    defined(__DOXYGEN__)
+#define IIC_DMA_SECTION
+#endif
+
+/**
+ * @brief   Timeout of an I2C transfer.
+ * @note    The default is 4 ms.
+ */
+#if !defined(IIC_TIMEOUT) || defined(__DOXYGEN__)
+#define IIC_TIMEOUT                       MS2ST(4)
+#endif
+
+/**
+ * @brief   Record the transfers in a trace ring.
+ * @note    The default is FALSE.
+ */
+#if !defined(IIC_USE_TRACE) || defined(__DOXYGEN__)
+#define IIC_USE_TRACE                     FALSE
+#endif
+
+/**
+ * @brief   Number of transfers kept in the trace ring.
+ * @note    The default is 32.
+ */
+#if !defined(IIC_TRACE_SIZE) || defined(__DOXYGEN__)
+#define IIC_TRACE_SIZE                    32
+#endif
+
+/**
+ * @brief   Number of data bytes kept for a traced transfer.
+ * @note    The default is 8, it must be a multiple of 4.
+ */
+#if !defined(IIC_TRACE_DATA) || defined(__DOXYGEN__)
+#define IIC_TRACE_DATA                    8
+#endif
+
+/*==========================================================================*/
+/* Derived constants and error checks.                                      */
+/*==========================================================================*/
+
+#if (IIC_SLAB_SIZE % IIC_SLAB_ALIGN) != 0
+#error "IIC_SLAB_SIZE must be a multiple of IIC_SLAB_ALIGN"
+#endif
+
+#if !defined(IIC_DMA_SECTION)
+#error "IIC_DMA_SECTION must place the slabs out of the data cache"
+#endif
+
+/*==========================================================================*/
+/* Driver macros.                                                           */
+/*==========================================================================*/
+
+#define IIC_STANDARD_MODE   100000  /**< Standard mode clock (Hz).          */
+#define IIC_FAST_MODE       400000  /**< Fast mode clock (Hz).              */
+
+/*
+ * Priority classes of the transfers, the bus is given to the highest class
+ * first.
+ */
+#define IIC_PRIO_REALTIME   0       /**< Latency critical sensor fetch.     */
+#define IIC_PRIO_NORMAL     1       /**< Housekeeping, default class.       */
+#define IIC_PRIO_LOW        2       /**< Background jobs, RTC sync.         */
+#define IIC_PRIO_CLASSES    3       /**< Number of priority classes.        */
+
+/**
+ * @brief   Received data of a transfer descriptor, following the sent data
+ *          in its slab.
+ */
+#define IIC_XFER_RX(xp)     ((xp)->buf + (xp)->txn)
+
+/*
+ * Event flags of a bus.
+ */
+#define IIC_EVENT_DONE      ((eventflags_t)1) /**< A transfer succeeded.    */
+#define IIC_EVENT_ERROR     ((eventflags_t)2) /**< A transfer failed.       */
+
+/*
+ * Bring-up state of a slave.
+ */
+#define IIC_BRINGUP_PENDING 0       /**< Not started.                       */
+#define IIC_BRINGUP_RUNNING 1       /**< Being brought up by a thread.      */
+#define IIC_BRINGUP_DONE    2       /**< Done, see the result.              */
+
+/*
+ * Health of a slave.
+ */
+#define IIC_HEALTH_OK       0       /**< The transfers are done.            */
+#define IIC_HEALTH_DOWN     1       /**< Quarantine, the transfers fail.    */
+#define IIC_HEALTH_PROBE    2       /**< A transfer probes the slave.       */
+
+/*==========================================================================*/
+/* Driver data structures and types.                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   I2C bus statistics.
+ */
+typedef struct iic_stats {
+  uint32_t  transfers;  /**< Number of transfers.                           */
+  uint32_t  bytes;      /**< Bytes sent and received.                       */
+  uint32_t  errors;     /**< Transfers ended with an error.                 */
+  uint32_t  polls;      /**< Polls of a memory in its write cycle.          */
+  uint32_t  reconfigs;  /**< Clock speed changes.                           */
+  systime_t busyTime;   /**< Time spent in the transfers.                   */
+  uint32_t  grants[IIC_PRIO_CLASSES];   /**< Bus grants per class.          */
+  systime_t maxWait[IIC_PRIO_CLASSES];  /**< Worst wait for the bus.        */
+} iic_stats_t;
+
+/**
+ * @brief   Thread waiting for a bus.
+ */
+typedef struct iic_waiter {
+  struct iic_waiter   *next;    /**< Next waiter of the same class.         */
+  thread_reference_t  thread;   /**< Waiting thread.                        */
+  systime_t           since;    /**< Start of the wait.                     */
+  uint32_t            clock;    /**< Clock speed of the transfer.           */
+} iic_waiter_t;
+
+/**
+ * @brief   Transfer recorded in the trace.
+ * @details The record has no padding, a dump is the sequence of the records
+ *          in the byte order of the target. A transfer with rxn equal to 0
+ *          is a write, else it is a read preceded by the write of txn
+ *          bytes.
+ */
+typedef struct iic_trace {
+  uint32_t  time;       /**< Start of the transfer (system ticks).          */
+  uint16_t  txn;        /**< Number of bytes sent.                          */
+  uint16_t  rxn;        /**< Number of bytes received.                      */
+  uint8_t   sad;        /**< Slave address without R/W bit.                 */
+  int8_t    status;     /**< Result of the transfer, MSG_xxx.               */
+  uint8_t   bus;        /**< Index of the bus, 0xFF if not managed.         */
+  uint8_t   size;       /**< Number of bytes in data.                       */
+  uint8_t   data[IIC_TRACE_DATA]; /**< Bytes sent then bytes received.      */
+} iic_trace_t;
+
+/**
+ * @brief   Last value written into a slave register.
+ */
+typedef struct iic_shadow {
+  uint8_t   reg;        /**< Register address.                              */
+  uint8_t   value;      /**< Last value written.                            */
+  bool      valid;      /**< The value is known.                            */
+} iic_shadow_t;
+
+/**
+ * @brief   I2C slave registered on a bus.
+ */
+typedef struct iic_device {
+  I2CDriver     *i2cp;        /**< Bus of the slave.                        */
+  uint8_t       sad;          /**< Slave address without R/W bit.           */
+  uint32_t      clock;        /**< Maximum clock speed of the slave (Hz).   */
+  uint8_t       prio;         /**< Priority class of the transfers.         */
+  iic_shadow_t  *shadow;      /**< Shadowed registers, NULL if none.        */
+  uint8_t       shadowSize;   /**< Number of shadowed registers.            */
+  bool          autoInc;      /**< The slave increments the register.       */
+  uint32_t      shadowHits;   /**< Writes skipped thanks to the shadows.    */
+  uint32_t      shadowMisses; /**< Writes done on shadowed slave.           */
+  systime_t     readWindow;   /**< Freshness of a read, 0 if no coalescing. */
+  threads_queue_t readQueue;  /**< Threads waiting for the read in flight.  */
+  systime_t     readTime;     /**< End of the last read.                    */
+  uint8_t       readReg;      /**< First register of the last read.         */
+  uint8_t       readSize;     /**< Number of registers of the last read.    */
+  bool          readBusy;     /**< A read is in flight.                     */
+  bool          readValid;    /**< The last read succeeded.                 */
+  uint32_t      writeGen;     /**< Writes done, discards a read in flight.  */
+  uint8_t       readCache[IIC_READ_CACHE_SIZE]; /**< Last read registers.   */
+  uint32_t      readHits;     /**< Reads served from a recent read.         */
+  uint32_t      readJoins;    /**< Reads served from a read in flight.      */
+  uint8_t       memAddrSize;  /**< Size of a memory address, 1 or 2 bytes.  */
+  uint16_t      memPage;      /**< Page size of the memory, 0 if no pages.  */
+  systime_t     memWriteTime; /**< Longest write cycle of the memory.       */
+  uint32_t      memBytes;     /**< Bytes transferred with the memory.       */
+  systime_t     memTime;      /**< Time spent in the memory transfers.      */
+  uint8_t       health;       /**< Health of the slave, IIC_HEALTH_xxx.     */
+  uint8_t       failures;     /**< Consecutive failed transfers.            */
+  systime_t     backoff;      /**< Delay before the next probe.             */
+  systime_t     downTime;     /**< Start of the quarantine or last probe.   */
+  uint32_t      quarantines;  /**< Number of quarantines.                   */
+  uint32_t      rejected;     /**< Transfers failed during the quarantines. */
+} iic_device_t;
+
+/**
+ * @brief   Transfer descriptor borrowed from the pool.
+ * @details The data to send are written at the start of the slab, the
+ *          received data follow them and are decoded in place, see
+ *          IIC_XFER_RX().
+ */
+typedef struct iic_xfer {
+  struct iic_xfer *next;  /**< Used by the pool.                            */
+  I2CDriver       *i2cp;  /**< Bus of the slave.                            */
+  uint8_t         sad;    /**< Slave address without R/W bit.               */
+  uint8_t         *buf;   /**< Buffer slab, IIC_SLAB_SIZE bytes.            */
+  size_t          txn;    /**< Number of bytes to send.                     */
+  size_t          rxn;    /**< Number of bytes to receive.                  */
+} iic_xfer_t;
+
+/**
+ * @brief   Init function of a slave, bmp085GetCalibrationData() for example.
+ */
+typedef msg_t (*iic_init_t)(I2CDriver *i2cp, uint8_t sad);
+
+/**
+ * @brief   Slave brought up at startup by i2cBringUp().
+ */
+typedef struct iic_bringup {
+  I2CDriver   *i2cp;    /**< Bus of the slave.                              */
+  uint8_t     sad;      /**< Slave address without R/W bit.                 */
+  uint32_t    clock;    /**< Maximum clock speed of the slave (Hz).         */
+  uint8_t     prio;     /**< Priority class of the transfers.               */
+  iic_init_t  init;     /**< Init function, NULL if none.                   */
+  uint8_t     state;    /**< Bring-up state, IIC_BRINGUP_xxx.               */
+  bool        present;  /**< The slave answered the scan.                   */
+  msg_t       result;   /**< Result of the bring-up.                        */
+  systime_t   initTime; /**< Time spent in the bring-up of the slave.       */
+} iic_bringup_t;
+
+/**
+ * @brief   I2C bus managed by the driver.
+ */
+typedef struct iic_bus {
+  I2CDriver   *i2cp;    /**< ChibiOS I2C driver of the bus.                 */
+  I2CConfig   config;   /**< Configuration in use.                          */
+  uint32_t    maxClock; /**< Clock speed of the bus configuration (Hz).     */
+  bool        busy;     /**< The bus is owned by a thread.                  */
+  iic_waiter_t *waiters[IIC_PRIO_CLASSES]; /**< Waiting threads per class.  */
+  iic_stats_t stats;    /**< Bus statistics.                                */
+  event_source_t event; /**< Transfer completion events.                    */
+} iic_bus_t;
+
+/*==========================================================================*/
+/* Functions prototypes.                                                    */
+/*==========================================================================*/
+
+msg_t i2cBusStart(I2CDriver *i2cp, const I2CConfig *config);
+msg_t i2cRegisterDevice(I2CDriver *i2cp, uint8_t sad, uint32_t clock,
+                        uint8_t prio);
+bool  i2cProbe(I2CDriver *i2cp, uint8_t sad);
+msg_t i2cBringUp(iic_bringup_t *devs, uint8_t n);
+void  i2cGetStats(I2CDriver *i2cp, iic_stats_t *stats);
+event_source_t *i2cGetEventSource(I2CDriver *i2cp);
+iic_xfer_t *i2cXferAlloc(I2CDriver *i2cp, uint8_t sad);
+msg_t i2cXferRun(iic_xfer_t *xp);
+void  i2cXferFree(iic_xfer_t *xp);
+void  i2cGetPoolStats(uint8_t *used, uint8_t *highWater);
+msg_t i2cShadowRegisters(I2CDriver *i2cp, uint8_t sad, iic_shadow_t *shadow,
+                         uint8_t n, bool autoInc);
+void  i2cShadowInvalidate(I2CDriver *i2cp, uint8_t sad);
+void  i2cGetShadowStats(I2CDriver *i2cp, uint8_t sad, uint32_t *hits,
+                        uint32_t *misses);
+msg_t i2cCoalesceReads(I2CDriver *i2cp, uint8_t sad, systime_t window);
+void  i2cGetReadStats(I2CDriver *i2cp, uint8_t sad, uint32_t *hits,
+                      uint32_t *joins);
+#if IIC_USE_TRACE || defined(__DOXYGEN__)
+void  i2cTraceEnable(bool enable);
+size_t i2cTraceRead(iic_trace_t *trace, size_t n, uint32_t *lost);
+size_t i2cTraceDump(BaseSequentialStream *chp);
+#endif
+uint8_t i2cGetHealth(I2CDriver *i2cp, uint8_t sad, uint32_t *quarantines,
+                     uint32_t *rejected);
+msg_t i2cRegisterMemory(I2CDriver *i2cp, uint8_t sad, uint8_t addrSize,
+                        uint16_t page, systime_t writeTime);
+msg_t i2cReadMemory(I2CDriver *i2cp, uint8_t sad, uint16_t addr,
+                    uint8_t *rxbuf, uint16_t lenght);
+msg_t i2cWriteMemory(I2CDriver *i2cp, uint8_t sad, uint16_t addr,
+                     const uint8_t *txbuf, uint16_t lenght);
+uint32_t i2cGetMemoryThroughput(I2CDriver *i2cp, uint8_t sad);
 msg_t i2cReadRegister(I2CDriver *i2cp, uint8_t sad, uint8_t *reg,
                       uint8_t *rxbuf);
 msg_t i2cReadRegisters( I2CDriver *i2cp, uint8_t sad, uint8_t *reg,
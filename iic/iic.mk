@@ -1,6 +1,7 @@
 
 # List of all the IIC driver files.
-IICSRC := $(DRIVERS)/iic/iic.c
+IICSRC := $(DRIVERS)/iic/iic.c \
+          $(DRIVERS)/iic/iic_bringup.c
 
 # Required include directories.
 IICINC := $(DRIVERS)/iic/
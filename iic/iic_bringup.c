@@ -0,0 +1,162 @@
+/**
+ *
+ * @file    iic_bringup.c
+ *
+ * @brief   I2C slaves bring-up at startup.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    05 Jully 2016
+ *
+ */
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+#include "iic.h"
+
+/*==========================================================================*/
+/* Driver local definitions.                                                */
+/*==========================================================================*/
+
+/**
+ * @brief   Slaves shared by the bring-up threads.
+ */
+typedef struct iic_bringup_job {
+  iic_bringup_t *devs;  /**< Slaves to bring up.                            */
+  uint8_t       n;      /**< Number of slaves.                              */
+} iic_bringup_job_t;
+
+/*==========================================================================*/
+/* Driver local variables.                                                  */
+/*==========================================================================*/
+
+static stkalign_t iicBringUpWa[IIC_BRINGUP_THREADS]
+                              [THD_WORKING_AREA_SIZE(IIC_BRINGUP_WA_SIZE) /
+                               sizeof(stkalign_t)];
+
+/*==========================================================================*/
+/* Driver local functions.                                                  */
+/*==========================================================================*/
+
+/**
+ * @brief   Take the next slave to bring up.
+ * @details A slave on a bus not used by the other threads is taken first, so
+ *          the buses are brought up in parallel.
+ *
+ * @param[in] jp      pointer to the slaves
+ * @return    dp      pointer to the slave, NULL if all the slaves are taken
+ */
+static iic_bringup_t *iicBringUpNext(iic_bringup_job_t *jp) {
+
+  iic_bringup_t *dp = NULL;
+  uint8_t       i, j;
+  bool          busy;
+
+  chSysLock();
+  for (i = 0; i < jp->n; i++) {
+    if (jp->devs[i].state != IIC_BRINGUP_PENDING)
+      continue;
+
+    busy = false;
+    for (j = 0; j < jp->n; j++) {
+      if ((jp->devs[j].state == IIC_BRINGUP_RUNNING) &&
+          (jp->devs[j].i2cp == jp->devs[i].i2cp))
+        busy = true;
+    }
+
+    if (dp == NULL)
+      dp = &jp->devs[i];
+    if (!busy) {
+      dp = &jp->devs[i];
+      break;
+    }
+  }
+
+  if (dp != NULL)
+    dp->state = IIC_BRINGUP_RUNNING;
+  chSysUnlock();
+
+  return dp;
+}
+
+/**
+ * @brief   Bring-up thread, registers, scans and inits the slaves.
+ *
+ * @param[in] arg     pointer to the slaves
+ */
+static THD_FUNCTION(iicBringUpThread, arg) {
+
+  iic_bringup_job_t *jp = arg;
+  iic_bringup_t     *dp;
+  systime_t         start;
+
+  while ((dp = iicBringUpNext(jp)) != NULL) {
+    start = chVTGetSystemTime();
+
+    /* Registered first, so the scan is done at the clock of the slave. */
+    dp->result  = i2cRegisterDevice(dp->i2cp, dp->sad, dp->clock, dp->prio);
+    dp->present = (dp->result == MSG_OK) && i2cProbe(dp->i2cp, dp->sad);
+
+    if (!dp->present)
+      dp->result = MSG_RESET;
+    else if (dp->init != NULL)
+      dp->result = dp->init(dp->i2cp, dp->sad);
+
+    dp->initTime = chVTTimeElapsedSinceX(start);
+    dp->state = IIC_BRINGUP_DONE;
+  }
+
+  chThdExit(MSG_OK);
+}
+
+/*==========================================================================*/
+/* Driver Functions                                                         */
+/*==========================================================================*/
+
+/**
+ * @brief   Bring up the slaves of the application.
+ * @details Each slave is registered, scanned, then initialized by its init
+ *          function. The slaves are brought up by IIC_BRINGUP_THREADS
+ *          threads, the slaves of different buses in parallel. The result
+ *          and the bring-up time of each slave are stored in its
+ *          descriptor.
+ * @note    The buses must be started with i2cBusStart().
+ *
+ * @param[in] devs    pointer to the slaves, with i2cp, sad, clock, prio and
+ *                    init set
+ * @param[in] n       number of slaves
+ *
+ * @return    msg     the result of the bring-up
+ * @retval    MSG_OK    all the slaves are present and initialized
+ * @retval    MSG_RESET at least one slave failed, see its result
+ */
+msg_t i2cBringUp(iic_bringup_t *devs, uint8_t n) {
+
+  iic_bringup_job_t job;
+  thread_t          *threads[IIC_BRINGUP_THREADS];
+  uint8_t           i;
+  msg_t             msg = MSG_OK;
+
+  job.devs = devs;
+  job.n    = n;
+
+  for (i = 0; i < n; i++)
+    devs[i].state = IIC_BRINGUP_PENDING;
+
+  for (i = 0; i < IIC_BRINGUP_THREADS; i++)
+    threads[i] = chThdCreateStatic(iicBringUpWa[i], sizeof(iicBringUpWa[i]),
+                                   chThdGetPriorityX(), iicBringUpThread,
+                                   &job);
+
+  for (i = 0; i < IIC_BRINGUP_THREADS; i++)
+    (void)chThdWait(threads[i]);
+
+  for (i = 0; i < n; i++) {
+    if (devs[i].result != MSG_OK)
+      msg = MSG_RESET;
+  }
+
+  return msg;
+}
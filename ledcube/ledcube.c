@@ -17,554 +17,435 @@
 /* ChibiOS files. */
 #include "hal.h"
 
+/* Driver files. */
+#include "ledcube.h"
+
 /*==========================================================================*/
 /* Global variables.                                                        */
 /*==========================================================================*/
 
-static uint8_t demoIndex = 0;
+/*
+ * Frame buffers, the refresh engine only reads the front buffer while the
+ * animations only write the back buffer.
+ */
+static ledcube_frame_t  frames[2];
+static ledcube_frame_t  *frontp = &frames[0];
+static ledcube_frame_t  *backp  = &frames[1];
+static volatile bool    swapPending = false;
+static threads_queue_t  swapQueue;
+static virtual_timer_t  refreshVt;
+static uint8_t          scanLayer = 0;
+static uint8_t          scanBit = 0;
+static volatile uint32_t refreshFrames = 0;
+static systime_t        refreshStart;
+#if PORT_SUPPORTS_RT
+static volatile rtcnt_t refreshCycles = 0;
+#endif
+
+#if LEDCUBE_USE_SPI
+static void spiEndCb(SPIDriver *spip);
+
+/*
+ * SPI configuration, the slave select is the latch of the registers.
+ */
+static const SPIConfig spiConfig = {
+  spiEndCb,               /**< End of the shift, latches the registers.     */
+  LEDCUBE_SPI_LATCH_PORT, /**< Latch port.                                  */
+  LEDCUBE_SPI_LATCH_PAD,  /**< Latch pad.                                   */
+  LEDCUBE_SPI_CR1         /**< Mode and clock of the bus.                   */
+};
+
+/*
+ * Bytes of the layer being shifted out, the layer select first.
+ */
+static uint8_t          spiTx[LEDCUBE_SPI_BYTES];
+#endif
 
 /*==========================================================================*/
-/* Functions.                                                               */
+/* Refresh engine.                                                          */
 /*==========================================================================*/
 
+#if !LEDCUBE_USE_SPI
 /**
- * @brief   Initialize the pins used for the led-cube.
+ * @brief   Write the state of the nine lines of the cube.
+ * @note    Lines 0 to 5 are on IOPORT4 pins 2 to 7, lines 6 to 8 are on
+ *          IOPORT2 pins 0 to 2.
+ *
+ * @param[in] lines   state of the lines, bit n controls the line n
  */
-void ledCubeInit(void) {
+static void lineWrite(ledcube_layer_t lines) {
 
-  int8_t i;
-
-  for (i = 5; i >= 0; i--) {
-    palSetPadMode(IOPORT2, i, PAL_MODE_OUTPUT_PUSHPULL);
-  }
-  
-  for (i = 7; i >= 2; i--) {
-    palSetPadMode(IOPORT4, i, PAL_MODE_OUTPUT_PUSHPULL);
-  }
+  palWriteGroup(IOPORT4, 0x3F, 2, lines & 0x3F);
+  palWriteGroup(IOPORT2, 0x07, 0, (lines >> 6) & 0x07);
 }
 
 /**
- * @brief   Set/Clear a gpio pin.
+ * @brief   Select one of the tree layers of the cube.
+ * @note    The top, midle and bottom layers are on IOPORT2 pins 3, 4 and 5.
  *
- * @param[in] port    the gpio pin port to control
- * @param[in] pin     the gpio pin to control
- * @param[in] value   the gpio pin value to set
+ * @param[in] layer   layer to select, LEDCUBE_LAYERS to unselect all
  */
-static void padCtrl(volatile avr_gpio_registers_t *port, uint8_t pin,
-                    uint8_t value) {
+static void layerWrite(uint8_t layer) {
 
-  if (value == 0)
-    palClearPad(port, pin);
-  else if (value == 1)
-    palSetPad(port, pin);
-  else
-    return;
+  palWriteGroup(IOPORT2, 0x07, 3, (1U << layer) & 0x07);
 }
 
 /**
- * @brief   Turn on all the leds on the cube.
+ * @brief   Output a bit plane of a layer.
  *
- * @param[in] tempo   the time to turn on the cube
+ * @param[in] lines     state of the lines of the plane
+ * @param[in] layer     layer of the plane
+ * @param[in] newLayer  true if the layer changes
  */
-static void ledCubeOn(uint16_t tempo) {
-
-  uint8_t i;
-
-  for (i = 5; i >= 0; i--) {
-    padCtrl(IOPORT2, i, 1);
-  }
+static void planeWrite(ledcube_layer_t lines, uint8_t layer, bool newLayer) {
 
-  for (i = 7; i >= 2; i--) {
-    padCtrl(IOPORT4, i, 1);
+  if (newLayer) {
+    /* Unselect the layer while the lines are changing to avoid ghosting. */
+    layerWrite(LEDCUBE_LAYERS);
+    lineWrite(lines);
+    layerWrite(layer);
   }
-
-  chThdSleepMilliseconds(tempo);
+  else
+    lineWrite(lines);
 }
-
+#else
 /**
- * @brief   Turn off all the led on the cube.
+ * @brief   Latch the registers at the end of a shift.
+ * @details The lines and the layer change together on the rising edge of
+ *          the latch, there is no ghosting.
  *
- * @param[in] tempo   the time to turn on the cube
+ * @param[in] spip  pointer to the SPI driver
  */
-static void ledCubeOff(uint16_t tempo) {
-
-  uint8_t i;
-
-  for (i = 5; i >= 0; i--) {
-    padCtrl(IOPORT2, i, 0);
-  }
+static void spiEndCb(SPIDriver *spip) {
 
-  for (i = 7; i >= 2; i--) {
-    padCtrl(IOPORT4, i, 0);
-  }
-
-  chThdSleepMilliseconds(tempo);
+  chSysLockFromISR();
+  spiUnselectI(spip);
+  chSysUnlockFromISR();
 }
 
 /**
- * @brief   Facto is a function that help to turn on led one at time.
+ * @brief   Output a bit plane of a layer.
+ * @details The plane is shifted out by the SPI driver, with DMA when the
+ *          port has it, the CPU only copies a few bytes.
  *
- * @param[in] tempo   the time use between the control of two leds
+ * @param[in] lines     state of the lines of the plane
+ * @param[in] layer     layer of the plane
+ * @param[in] newLayer  not used, the layer is always shifted out
  */
-static void facto(uint16_t tempo) {
+static void planeWrite(ledcube_layer_t lines, uint8_t layer, bool newLayer) {
 
   uint8_t i;
 
-  for (i = 2; i <= 7; i++) {
-    palSetPad(IOPORT4, i);
-    chThdSleepMilliseconds(tempo);
-  }
+  (void)newLayer;
 
-  for (i = 0; i <= 2; i++) {
-    palSetPad(IOPORT2, i);
-    chThdSleepMilliseconds(tempo);
+  /* The first byte shifted out goes to the farthest register. */
+  spiTx[0] = (uint8_t)(1U << layer);
+  for (i = LEDCUBE_SPI_BYTES - 1; i > 0; i--) {
+    spiTx[i] = (uint8_t)lines;
+    lines >>= 8;
   }
-}
 
-/**
- * @brief   First demo function.
- *
- * @param[in] tempo   the time used in the demo
- */
-static void ledCubeDemo1(uint8_t tempo) {
-
-  ledCubeOff(0);
-  padCtrl(IOPORT2, 3, 1);
-  padCtrl(IOPORT2, 4, 0);
-  padCtrl(IOPORT2, 5, 0);
-  facto(tempo);
-
-  ledCubeOff(0);
-  padCtrl(IOPORT2, 3, 0);
-  padCtrl(IOPORT2, 4, 1);
-  padCtrl(IOPORT2, 5, 0);
-  facto(tempo);
-
-  ledCubeOff(0);
-  padCtrl(IOPORT2, 3, 0);
-  padCtrl(IOPORT2, 4, 0);
-  padCtrl(IOPORT2, 5, 1);
-  facto(tempo);
+  spiSelectI(&LEDCUBE_SPI_DRIVER);
+  spiStartSendI(&LEDCUBE_SPI_DRIVER, LEDCUBE_SPI_BYTES, spiTx);
 }
+#endif
 
 /**
- * @brief   Control all leds of an actived layer.
+ * @brief   Display the next bit plane of the front buffer.
+ * @details Each layer is displayed once per bit of brightness, the bit n
+ *          staying on twice as long as the bit n - 1 (bit angle modulation).
+ *          The work done here is the same for every plane, so the cost of
+ *          the refresh only depends on the number of interrupts per frame,
+ *          see @p LEDCUBE_ISR_LOAD.
+ *          At the end of a full scan of the cube the front and back buffers
+ *          are swapped if a swap was requested, so a frame is never
+ *          displayed partially.
  *
- * @param[in] lsbp   pointer to the line state buffer
- * @param[in] lsbs   line state buffer size
+ * @param[in] arg   not used
  */
-static void lineWrite( uint8_t *lsbp, uint8_t lsbs) {
+static void ledCubeRefreshCb(void *arg) {
 
-  uint8_t line = 0, pin;
+#if PORT_SUPPORTS_RT
+  rtcnt_t start = chSysGetRealtimeCounterX();
+  rtcnt_t cycles;
+#endif
 
-  for (pin = 2; pin <= 7; pin++) {
-    padCtrl(IOPORT4, pin, lsbp[line++]);
-    if (line > lsbs)
-      return;
-  }
+  (void)arg;
 
-  for (pin = 0; pin <= 2; pin++) {
-    padCtrl(IOPORT2, pin, lsbp[line++]);
-    if (line > lsbs)
-      return;
-  }
-}
+  chSysLockFromISR();
 
-/**
- * @brief   Selection of one of the tree layer of the cube.
- * 
- * @param[in] lsbp  pointer to the layer state buffer
- * @param[in] lsbs  layer state buffer size
- */
-static void layerWrite(uint8_t *lsbp, uint8_t lsbs) {
+  if (++scanBit >= LEDCUBE_BAM_BITS) {
+    scanBit = 0;
 
-  uint8_t layer = 2, pin;
+    if (++scanLayer >= LEDCUBE_LAYERS) {
+      scanLayer = 0;
+      refreshFrames++;
 
-  for (pin = 5; pin >= 3; pin--) {
-    padCtrl(IOPORT2, pin, lsbp[layer--]);
-    if (layer > lsbs)
-      return;
-  }
-}
+      if (swapPending) {
+        ledcube_frame_t *fp = frontp;
 
-/**
- * @brief   Turn off the cube top layer.
- *
- * @param[in] tempo   the time to trun off the top layer leds
- */
-static void ledCubeTopOff(uint16_t tempo) {
-
-  palClearPad(IOPORT2, 3);
-  chThdSleepMilliseconds(tempo);
-}
+        frontp = backp;
+        backp = fp;
+        swapPending = false;
+        chThdDequeueAllI(&swapQueue, MSG_OK);
+      }
+    }
+  }
 
-/**
- * @brief   Turn on the cube top layer.
- * 
- * @param[in] tempo   the time to turn on the top leyer leds
- */
-static void ledCubeTopOn(uint16_t tempo) {
+  planeWrite(frontp->layer[scanLayer][scanBit], scanLayer, scanBit == 0);
 
-  uint8_t plan[3] = {1,0,0}; /* top , midle, Bottom. */
-  uint8_t lineState[9] = {1, 1, 1, 1,1, 1, 1, 1, 1};
+  chVTSetI(&refreshVt, (systime_t)(LEDCUBE_BAM_TICKS << scanBit),
+           ledCubeRefreshCb, NULL);
 
-	layerWrite(plan, 3);
-	lineWrite(lineState, 9);
-	chThdSleepMilliseconds(tempo);
+#if PORT_SUPPORTS_RT
+  cycles = chSysGetRealtimeCounterX() - start;
+  if (cycles > refreshCycles)
+    refreshCycles = cycles;
+#endif
+  chSysUnlockFromISR();
 }
 
-/**
- * @brief   Turn off the midle layer of the cube.
- *
- * @param[in] tempo   the time to turn off the midle layer leds
- */
-static void ledCubeMidleOff(uint16_t tempo) {
-
-  palClearPad(IOPORT2, 4);
-  chThdSleepMilliseconds(tempo);
-}
+/*==========================================================================*/
+/* Functions.                                                               */
+/*==========================================================================*/
 
 /**
- * @brief   Trun on the midle layer of the cube.
- *
- * @param[in] tempo   the time to turn on the midle layer leds
+ * @brief   Initialize the pins used for the led-cube and start the refresh.
+ * @note    With LEDCUBE_USE_SPI the pins of the SPI bus are set by the
+ *          board files.
  */
-static void ledCubeMidleOn(uint16_t tempo) {
+void ledCubeInit(void) {
 
-  uint8_t plan[3] = {0,1,0}; /* top , midle, Bottom. */
-  uint8_t lineState[9] = {1, 1, 1, 1, 1, 1, 1, 1, 1};
+#if LEDCUBE_USE_SPI
+  palSetPadMode(LEDCUBE_SPI_LATCH_PORT, LEDCUBE_SPI_LATCH_PAD,
+                PAL_MODE_OUTPUT_PUSHPULL);
+  palSetPad(LEDCUBE_SPI_LATCH_PORT, LEDCUBE_SPI_LATCH_PAD);
+  spiStart(&LEDCUBE_SPI_DRIVER, &spiConfig);
+#else
+  int8_t i;
 
-  layerWrite(plan, 3);
-  lineWrite(lineState, 9);
-  chThdSleepMilliseconds(tempo);
+  for (i = 5; i >= 0; i--) {
+    palSetPadMode(IOPORT2, i, PAL_MODE_OUTPUT_PUSHPULL);
+  }
+
+  for (i = 7; i >= 2; i--) {
+    palSetPadMode(IOPORT4, i, PAL_MODE_OUTPUT_PUSHPULL);
+  }
+#endif
+
+  ledCubeFrameClear(&frames[0]);
+  ledCubeFrameClear(&frames[1]);
+  chThdQueueObjectInit(&swapQueue);
+  chVTObjectInit(&refreshVt);
+  refreshStart = chVTGetSystemTime();
+  chVTSet(&refreshVt, LEDCUBE_BAM_TICKS, ledCubeRefreshCb, NULL);
 }
 
 /**
- * @brief   Turn off the bottom layer of the cube.
+ * @brief   Get the frame buffer to draw into.
+ * @note    The buffer must not be modified between a call to
+ *          @p ledCubeSwapBuffers() and the end of @p ledCubeWaitSwap().
  *
- * @param[in] tempo   the time used to turn off the bottom layer leds
+ * @return  fp    pointer to the back frame buffer
  */
-static void ledCubeBottomOff(uint16_t tempo) {
+ledcube_frame_t *ledCubeGetBackBuffer(void) {
 
-  palClearPad(IOPORT2, 5);
-  chThdSleepMilliseconds(tempo);
+  return backp;
 }
 
 /**
- * @brief   Turn on the bottom layer of the cube.
- *
- * @param[in]	tempo   the time used to turn on the bottom leyer leds
+ * @brief   Request the back buffer to be displayed.
+ * @details The swap is done by the refresh engine at the end of the current
+ *          scan of the cube, this function does not wait for it.
  */
-static void ledCubeBottomOn(uint16_t tempo) {
+void ledCubeSwapBuffers(void) {
 
-  uint8_t plan[3] = {0,0,1}; /* top , midle, Bottom. */
-  uint8_t lineState[9] = {1, 1, 1, 1, 1, 1, 1, 1, 1}; 
-
-  layerWrite(plan, 3);
-  lineWrite(lineState, 9);
-  chThdSleepMilliseconds(tempo);
+  chSysLock();
+  swapPending = true;
+  chSysUnlock();
 }
 
 /**
- * @brief   Blink all leds of the cube.
- *
- * @param[in] tempo   the blinking time
- * @param[in] nbr     the number of blink
+ * @brief   Wait for the pending buffer swap to be done.
+ * @details Return immediately if no swap is pending.
  */
-static void ledCubeBlink(uint16_t tempo, uint8_t nbr) {
-
-  int8_t i;
+void ledCubeWaitSwap(void) {
 
-  for (i = nbr; i >= 0; i--) {
-    ledCubeOn(tempo);
-    ledCubeOff(tempo);
-  }
+  chSysLock();
+  if (swapPending)
+    (void)chThdEnqueueTimeoutS(&swapQueue, TIME_INFINITE);
+  chSysUnlock();
 }
 
 /**
- * @brief   Make a circular effect.
+ * @brief   Tell if a buffer swap is pending.
+ * @details Lets a producer that must not block skip a frame instead of
+ *          waiting for the swap.
  *
- * @param[in] tempo   tempo for the rotation effect
+ * @return  pending   true if the back buffer is waiting to be displayed
  */
-static void ledCubeCircularDemo(uint16_t tempo) {
-
-  int8_t i, j;
-  uint8_t lineState[8][9] = { {1, 0, 0, 0, 0, 0, 0, 0, 0},
-                              {0, 1, 0, 0, 0, 0, 0, 0, 0},
-                              {0, 0, 1, 0, 0, 0, 0, 0, 0},
-                              {0, 0, 0, 0, 0, 1, 0, 0, 0},
-                              {0, 0, 0, 0, 0, 0, 0, 0, 1},
-                              {0, 0, 0, 0, 0, 0, 0, 1, 0},
-                              {0, 0, 0, 0, 0, 0, 1, 0, 0},
-                              {0, 0, 0, 1, 0, 0, 0, 0, 0}};
-
-  for (i = 2; i >= 0; i--) {
-    if (i == 0) {
-      uint8_t plan[3] = {1,0,0};
-      layerWrite(plan, 3);
-    }
-
-    if (i == 1) {
-      uint8_t plan[3] = {0,1,0};
-      layerWrite(plan, 3);
-    }
+bool ledCubeIsSwapPending(void) {
 
-    if (i == 2) {
-      uint8_t plan[3] = {0,0,1};
-      layerWrite(plan, 3);
-    }
-
-    for (j = 0; j <= 7; j++) {
-      lineWrite(&(lineState[j][0]), 9);
-      chThdSleepMilliseconds(tempo);
-    }
-  }
+  return swapPending;
 }
 
 /**
- * @brief   Turn on the first face of the cube.
+ * @brief   Get the refresh rate of the cube measured since the last call.
+ * @details The rate is the number of full scans of the cube displayed by
+ *          the refresh engine, it tells if the chosen cube size and
+ *          brightness depth can be refreshed without flicker.
  *
- * @param[in] tempo   the time used to trun on the first face of the cube
+ * @return  rate    full scans per 1000 seconds (mHz), 0 if unknown
  */
-static void ledCubeFace1On(uint16_t tempo) {
+uint32_t ledCubeGetRefreshRate(void) {
 
-  uint8_t plan[3] = {1,1,1}; /* Bottom, midle, top. */
-  uint8_t lineState[9] = {1, 1, 1, 0, 0, 0, 0, 0, 0};
+  systime_t span;
+  uint32_t  frames;
 
-  layerWrite(plan, 3);
-  lineWrite(lineState, 9);
-  chThdSleepMilliseconds(tempo);
-}
+  chSysLock();
+  span = chVTTimeElapsedSinceX(refreshStart);
+  frames = refreshFrames;
+  refreshStart += span;
+  refreshFrames = 0;
+  chSysUnlock();
 
-/**
- * @brief   Turn on the second face of the cube.
- *
- * @param[in] tempo   the time used to trun on the second face of the cube
- */
-static void ledCubeFace2On(uint16_t tempo) {
-
-  uint8_t plan[3] = {1,1,1}; /* Bottom, midle, top. */
-  uint8_t lineState[9] = {1, 0, 0, 1, 0, 0, 1, 0, 0};
+  if (span == 0)
+    return 0;
 
-  layerWrite(plan, 3);
-  lineWrite(lineState, 9);
-  chThdSleepMilliseconds(tempo);
+  return (uint32_t)(((uint64_t)frames * 1000 * CH_CFG_ST_FREQUENCY) / span);
 }
 
 /**
- * @brief   Turn on the third face of the cube.
+ * @brief   Get the longest refresh interrupt measured since the last call.
+ * @details The callback is measured with the realtime counter of the port,
+ *          from its entry to the rearming of its timer. The interrupt entry
+ *          and exit and the virtual timer dispatch of the port come on top
+ *          of it, the sum is the figure to give to @p LEDCUBE_ISR_CYCLES.
  *
- * @param[in] tempo   the time used to trun on the third face of the cube
+ * @return  cycles  CPU cycles, 0 if the port has no realtime counter
  */
-static void ledCubeFace3On(uint16_t tempo) {
+uint32_t ledCubeGetIsrCycles(void) {
 
-  uint8_t plan[3] = {1,1,1}; /* Bottom, midle, top. */
-  uint8_t lineState[9] = {0, 0, 0, 0, 0, 0, 1, 1, 1};
+#if PORT_SUPPORTS_RT
+  uint32_t cycles;
 
-  layerWrite(plan, 3);
-  lineWrite(lineState, 9);
-  chThdSleepMilliseconds(tempo);
+  chSysLock();
+  cycles = refreshCycles;
+  refreshCycles = 0;
+  chSysUnlock();
+
+  return cycles;
+#else
+  return 0;
+#endif
 }
 
 /**
- * @brief   Turn on the fourth face of the cube.
+ * @brief   Turn off all the leds of a frame.
  *
- * @param[in] tempo   the time used to trun on the fourth face of the cube
+ * @param[out] fp   pointer to the frame
  */
-static void ledCubeFace4On(uint16_t tempo) {
+void ledCubeFrameClear(ledcube_frame_t *fp) {
 
-  uint8_t plan[3] = {1,1,1}; /* Bottom, midle, top. */
-  uint8_t lineState[9] = {0, 0, 1, 0, 0, 1, 0, 0, 1};
+  uint8_t i;
 
-  layerWrite(plan, 3);
-  lineWrite(lineState, 9);
-  chThdSleepMilliseconds(tempo);
+  for (i = 0; i < LEDCUBE_LAYERS; i++)
+    ledCubeFrameSetLines(fp, i, 0, 0);
 }
 
 /**
- * @brief   Turn on all the face of the cube.
+ * @brief   Turn on all the leds of a frame.
  *
- * @param[in] tempo   the time used to turn on all the face of the cube
+ * @param[out] fp   pointer to the frame
  */
-static void ledCubeAllFaceOn(uint16_t tempo) {
+void ledCubeFrameFill(ledcube_frame_t *fp) {
 
-  ledCubeFace1On(tempo);
-  ledCubeFace2On(tempo);
-  ledCubeFace3On(tempo);
-  ledCubeFace4On(tempo);
-}
-
-/**
- * @brief   Rotation demo, trun on led to make a circular effect.
- *
- * @param[in] tempo   time to turn on the led on the same layer
- */
-static void rotation(uint16_t tempo) {
   uint8_t i;
-  uint8_t layer[3] = {1,1,1}; /* Bottom, midle, top. */
-  uint8_t lineState[4][9] = { {1, 0, 0, 0, 1, 0, 0, 0, 1},
-                              {0, 0, 0, 1, 1, 1, 0, 0, 0},
-                              {0, 0, 1, 0, 1, 0, 1, 0, 0},
-                              {0, 1, 0, 0, 1, 0, 0, 1, 0}};
-
-  layerWrite(layer, 3);
 
-  for (i = 0; i <= 3; i++) {
-    lineWrite(&(lineState[i][0]), 9);
-    chThdSleepMilliseconds(tempo);
-  }
+  for (i = 0; i < LEDCUBE_LAYERS; i++)
+    ledCubeFrameSetLines(fp, i, LEDCUBE_LAYER_ALL, LEDCUBE_LEVEL_MAX);
 }
 
 /**
- * @brief   This turn on the led from bottom to top.
+ * @brief   Set the leds of a layer, the other leds of the layer are turned
+ *          off.
+ * @note    A level higher than LEDCUBE_LEVEL_MAX is saturated.
  *
- * @param[in] tempo   time between the the control of two leds
- * @param[in] nbr     number of time the effect will be run
+ * @param[out] fp     pointer to the frame
+ * @param[in]  z      layer to set, 0 is the top layer
+ * @param[in]  lines  leds to turn on, bit n controls the line n
+ * @param[in]  level  brightness of the leds turned on
  */
-static void effect(uint16_t tempo, uint8_t nbr) {
+void ledCubeFrameSetLines(ledcube_frame_t *fp, uint8_t z,
+                          ledcube_layer_t lines, uint8_t level) {
 
-  uint8_t j;
+  uint8_t b;
 
-  for (j = 0; j <= nbr; j++) {
-    ledCubeTopOn(tempo);
-    ledCubeMidleOn(tempo);
-    ledCubeBottomOn(tempo);
-    ledCubeMidleOn(tempo);
-  }
+  chDbgCheck(z < LEDCUBE_LAYERS);
+
+  if (level > LEDCUBE_LEVEL_MAX)
+    level = LEDCUBE_LEVEL_MAX;
+
+  for (b = 0; b < LEDCUBE_BAM_BITS; b++)
+    fp->layer[z][b] = (level & (1U << b)) ? lines : 0;
 }
 
 /**
- * @brief   Turn on all the led with a shadow effect.
+ * @brief   Set the brightness of one led.
+ * @note    A level higher than LEDCUBE_LEVEL_MAX is saturated.
  *
- * @param[in] tempo   the time between two led control
+ * @param[out] fp     pointer to the frame
+ * @param[in]  x      column of the led
+ * @param[in]  y      row of the led, the line of the led is
+ *                    y * LEDCUBE_SIZE + x
+ * @param[in]  z      layer of the led, 0 is the top layer
+ * @param[in]  level  brightness of the led, 0 is off
  */
-static void shadowOn(uint16_t tempo) {
+void ledCubeFrameSetVoxel(ledcube_frame_t *fp, uint8_t x, uint8_t y,
+                          uint8_t z, uint8_t level) {
 
-  uint8_t i;
+  uint8_t b;
+  ledcube_layer_t mask;
 
-  for (i = 3; i <= 5; i++) {
-    palSetPad(IOPORT2, i);
-  }
+  chDbgCheck((x < LEDCUBE_SIZE) && (y < LEDCUBE_SIZE) &&
+             (z < LEDCUBE_LAYERS));
 
-  for (i = 0; i <= 2; i++) {
-    padCtrl(IOPORT2, i, 1);
-    chThdSleepMilliseconds(tempo);
-  }
+  mask = LEDCUBE_LAYER_LINE(y * LEDCUBE_SIZE + x);
+  if (level > LEDCUBE_LEVEL_MAX)
+    level = LEDCUBE_LEVEL_MAX;
 
-  for (i = 2; i <= 7; i++) {
-    padCtrl(IOPORT4, i, 1);
-    chThdSleepMilliseconds(tempo);
+  for (b = 0; b < LEDCUBE_BAM_BITS; b++) {
+    if (level & (1U << b))
+      fp->layer[z][b] |= mask;
+    else
+      fp->layer[z][b] &= (ledcube_layer_t)~mask;
   }
 }
 
 /**
- * @brief   Turn off all the led with a shadow effect.
+ * @brief   Get the brightness of one led.
  *
- * @param[in] tempo   the time between two led control
+ * @param[in] fp      pointer to the frame
+ * @param[in] x       column of the led
+ * @param[in] y       row of the led
+ * @param[in] z       layer of the led, 0 is the top layer
+ * @return    level   brightness of the led
  */
-static void shadowOff(uint16_t tempo) {
+uint8_t ledCubeFrameGetVoxel(const ledcube_frame_t *fp, uint8_t x, uint8_t y,
+                             uint8_t z) {
 
-  uint8_t i;
+  uint8_t b, level = 0;
+  ledcube_layer_t mask;
 
-  for (i = 3; i <= 5; i++) {
-    palSetPad(IOPORT2, i);
-  }
+  chDbgCheck((x < LEDCUBE_SIZE) && (y < LEDCUBE_SIZE) &&
+             (z < LEDCUBE_LAYERS));
 
-  for (i = 0; i <= 2; i++) {
-    padCtrl(IOPORT2, i, 0);
-    chThdSleepMilliseconds(tempo);
-  }
+  mask = LEDCUBE_LAYER_LINE(y * LEDCUBE_SIZE + x);
 
-  for (i = 2; i <= 7; i++) {
-    padCtrl(IOPORT4, i, 0);
-    chThdSleepMilliseconds(tempo);
+  for (b = 0; b < LEDCUBE_BAM_BITS; b++) {
+    if (fp->layer[z][b] & mask)
+      level |= (uint8_t)(1U << b);
   }
-}
 
-/**
- * @brief   This demo function call all the define cube functions.
- */
-void ledCubeDemo(void) {
-
-  register uint8_t i, nbr = 10;
-
-  ledCubeOff(0);
-
-  if (demoIndex <= 12) {
-    for (i = 0; i < nbr; i++) {
-      switch (demoIndex) {
-        case 0:
-          ledCubeOff(50);
-          ledCubeOn(50);
-        break;
-
-        case 1:
-          ledCubeTopOff(50);
-          ledCubeTopOn(50);
-        break;
-
-        case 2:
-          ledCubeMidleOn(50);
-          ledCubeMidleOff(50);
-        break;
-
-        case 3:
-          ledCubeBottomOn(50);
-          ledCubeBottomOff(50);
-        break;
-
-        case 4:
-          ledCubeFace1On(50);
-          ledCubeOff(50);
-        break;
-
-        case 5:
-          ledCubeFace2On(50);
-          ledCubeOff(50);
-        break;
-
-        case 6:
-          ledCubeFace3On(50);
-          ledCubeOff(50);
-        break;
-
-        case 7:
-          ledCubeFace4On(50);
-          ledCubeOff(50);
-        break;
-
-        case 8:
-          ledCubeAllFaceOn(100);
-        break;
-
-        case 9:
-          ledCubeCircularDemo(50);
-        break;
-
-        case 10:
-          rotation(100);
-        break;
-
-        case 11:
-          ledCubeDemo1(50);
-        break;
-
-        case 12:
-          shadowOn(80);
-          shadowOff(80);
-        break;
-      }
-    }
-    demoIndex++;
-  }
-  else if (demoIndex == 13) {
-    effect(50, 10);
-    demoIndex++;
-  }
-  else if (demoIndex == 14) {
-    ledCubeBlink(50, 5);
-    demoIndex++;
-  }
-  else
-    demoIndex = 0;
+  return level;
 }
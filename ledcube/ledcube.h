@@ -13,11 +13,484 @@
 #ifndef LEDCUBE_H
 #define LEDCUBE_H
 
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* ChibiOS files. */
+#include "hal.h"
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#endif
+
+/*==========================================================================*/
+/* Driver pre-compile time settings.                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Number of leds on a cube edge, from 2 to 8.
+ * @note    The default is 3, the cube driven by the GPIO backend.
+ */
+#if !defined(LEDCUBE_SIZE) || defined(__DOXYGEN__)
+#define LEDCUBE_SIZE                      3
+#endif
+
+/**
+ * @brief   Output of the cube through a chain of 74HC595 on a SPI bus.
+ * @details The registers next to the MCU hold the lines, line 0 being the
+ *          first output, the last register selects the layer, output 0
+ *          being the top layer. The latch pin of the registers is the
+ *          slave select of the bus.
+ * @note    The default is FALSE, the 3x3x3 cube is driven by GPIO pins.
+ */
+#if !defined(LEDCUBE_USE_SPI) || defined(__DOXYGEN__)
+#define LEDCUBE_USE_SPI                   FALSE
+#endif
+
+/**
+ * @brief   SPI driver of the shift registers.
+ */
+#if !defined(LEDCUBE_SPI_DRIVER) || defined(__DOXYGEN__)
+#define LEDCUBE_SPI_DRIVER                SPID1
+#endif
+
+/**
+ * @brief   Port and pad of the latch of the shift registers.
+ */
+#if !defined(LEDCUBE_SPI_LATCH_PORT) || defined(__DOXYGEN__)
+#define LEDCUBE_SPI_LATCH_PORT            IOPORT2
+#endif
+#if !defined(LEDCUBE_SPI_LATCH_PAD) || defined(__DOXYGEN__)
+#define LEDCUBE_SPI_LATCH_PAD             2
+#endif
+
+/**
+ * @brief   Value of the CR1 register of the SPI, mode 0 at the highest
+ *          clock by default.
+ */
+#if !defined(LEDCUBE_SPI_CR1) || defined(__DOXYGEN__)
+#define LEDCUBE_SPI_CR1                   0
+#endif
+
+/**
+ * @brief   Clock of the SPI used by the cost model, in Hz.
+ * @note    The default is half the CPU clock.
+ */
+#if !defined(LEDCUBE_SPI_CLOCK) || defined(__DOXYGEN__)
+#define LEDCUBE_SPI_CLOCK                 (LEDCUBE_CPU_CLOCK / 2)
+#endif
+
+/**
+ * @brief   Number of bits of the brightness of a led.
+ * @details The brightness is done with bit angle modulation, a led can take
+ *          2^LEDCUBE_BAM_BITS levels, level 0 is off.
+ * @note    The default is 2, this gives 4 brightness levels.
+ */
+#if !defined(LEDCUBE_BAM_BITS) || defined(__DOXYGEN__)
+#define LEDCUBE_BAM_BITS                  2
+#endif
+
+/**
+ * @brief   Number of system ticks used to display the least significant bit
+ *          of the brightness of a layer.
+ * @details The bit n of a layer is displayed during LEDCUBE_BAM_TICKS << n
+ *          system ticks.
+ * @note    The default is 1 system tick.
+ */
+#if !defined(LEDCUBE_BAM_TICKS) || defined(__DOXYGEN__)
+#define LEDCUBE_BAM_TICKS                 1
+#endif
+
+/**
+ * @brief   Number of CPU cycles spent in one refresh interrupt.
+ * @details On the ports with a realtime counter the callback is measured
+ *          by ledCubeGetIsrCycles(), the interrupt entry and exit and the
+ *          virtual timer dispatch of the port are added to the measure.
+ *          On the host, make -C host bench times the refresh interrupt
+ *          with the virtual timer dispatch of the simulation and prints the
+ *          longest callback, a regression of the callback shows there
+ *          before it reaches the target.
+ * @note    The default is 200 cycles, an estimate for the GPIO backend
+ *          on an AVR, which has no realtime counter. It must be replaced
+ *          by the measured figure on the other ports.
+ */
+#if !defined(LEDCUBE_ISR_CYCLES) || defined(__DOXYGEN__)
+#define LEDCUBE_ISR_CYCLES                200
+#endif
+
+/**
+ * @brief   Maximum CPU load allowed for the refresh engine, in per mille.
+ * @note    The default is 50, 5 % of the CPU.
+ */
+#if !defined(LEDCUBE_ISR_BUDGET) || defined(__DOXYGEN__)
+#define LEDCUBE_ISR_BUDGET                50
+#endif
+
+/**
+ * @brief   Minimum refresh rate of the cube, in Hz.
+ * @note    The default is 60 Hz, below the cube flickers.
+ */
+#if !defined(LEDCUBE_MIN_REFRESH) || defined(__DOXYGEN__)
+#define LEDCUBE_MIN_REFRESH               60
+#endif
+
+/**
+ * @brief   CPU clock frequency used by the cost model, in Hz.
+ */
+#if !defined(LEDCUBE_CPU_CLOCK) || defined(__DOXYGEN__)
+#if defined(F_CPU)
+#define LEDCUBE_CPU_CLOCK                 F_CPU
+#else
+#define LEDCUBE_CPU_CLOCK                 16000000UL
+#endif
+#endif
+
+/**
+ * @brief   Maximum number of nested loops in an animation.
+ * @note    The default is 4.
+ */
+#if !defined(LEDCUBE_ANIM_DEPTH) || defined(__DOXYGEN__)
+#define LEDCUBE_ANIM_DEPTH                4
+#endif
+
+/**
+ * @brief   Number of animations the scheduler can run at the same time.
+ * @note    The default is 4.
+ */
+#if !defined(LEDCUBE_SCHED_SLOTS) || defined(__DOXYGEN__)
+#define LEDCUBE_SCHED_SLOTS               4
+#endif
+
+/**
+ * @brief   Number of frames buffered by a frame stream.
+ * @note    The default is 4.
+ */
+#if !defined(LEDCUBE_STREAM_QUEUE) || defined(__DOXYGEN__)
+#define LEDCUBE_STREAM_QUEUE              4
+#endif
+
+/*==========================================================================*/
+/* Driver macros.                                                           */
+/*==========================================================================*/
+
+#define LEDCUBE_LAYERS        LEDCUBE_SIZE  /**< Number of layers.          */
+#define LEDCUBE_LAYER_LEDS    (LEDCUBE_SIZE * LEDCUBE_SIZE) /**< Leds/layer.*/
+
+/**
+ * @brief   Number of bytes used to store the lines of a layer.
+ */
+#if (LEDCUBE_LAYER_LEDS <= 16) || defined(__DOXYGEN__)
+#define LEDCUBE_LAYER_BYTES   2
+#elif LEDCUBE_LAYER_LEDS <= 32
+#define LEDCUBE_LAYER_BYTES   4
+#else
+#define LEDCUBE_LAYER_BYTES   8
+#endif
+
+/**
+ * @brief   Layer state with all the leds turned on.
+ */
+#define LEDCUBE_LAYER_ALL                                                   \
+  ((ledcube_layer_t)((ledcube_layer_t)~(ledcube_layer_t)0 >>                \
+                     (8 * LEDCUBE_LAYER_BYTES - LEDCUBE_LAYER_LEDS)))
+
+/**
+ * @brief   Layer state with the led of a line turned on.
+ */
+#define LEDCUBE_LAYER_LINE(n) ((ledcube_layer_t)((ledcube_layer_t)1 << (n)))
+
+#define LEDCUBE_LEVELS        (1U << LEDCUBE_BAM_BITS)  /**< Brightnesses.  */
+#define LEDCUBE_LEVEL_MAX     (LEDCUBE_LEVELS - 1)      /**< Full on level. */
+
+/*==========================================================================*/
+/* Refresh engine cost model.                                               */
+/*==========================================================================*/
+
+/**
+ * @brief   System ticks needed to display a full frame.
+ */
+#define LEDCUBE_FRAME_TICKS                                                 \
+  (LEDCUBE_LAYERS * LEDCUBE_BAM_TICKS * LEDCUBE_LEVEL_MAX)
+
+/**
+ * @brief   Number of refresh interrupts needed to display a full frame.
+ */
+#define LEDCUBE_ISR_PER_FRAME (LEDCUBE_LAYERS * LEDCUBE_BAM_BITS)
+
+/**
+ * @brief   Refresh rate of the cube, in Hz.
+ */
+#define LEDCUBE_REFRESH_RATE  (CH_CFG_ST_FREQUENCY / LEDCUBE_FRAME_TICKS)
+
+/**
+ * @brief   CPU load of the refresh engine, in per mille.
+ */
+#define LEDCUBE_ISR_LOAD                                                    \
+  ((LEDCUBE_ISR_CYCLES * LEDCUBE_ISR_PER_FRAME * LEDCUBE_REFRESH_RATE *     \
+    1000UL) / LEDCUBE_CPU_CLOCK)
+
+/**
+ * @brief   Bytes shifted out for a layer, the lines and the layer select.
+ */
+#define LEDCUBE_SPI_BYTES     ((LEDCUBE_LAYER_LEDS + 7) / 8 + 1)
+
+#if (LEDCUBE_SIZE < 2) || (LEDCUBE_SIZE > 8)
+#error "LEDCUBE_SIZE must be between 2 and 8"
+#endif
+
+#if !LEDCUBE_USE_SPI && (LEDCUBE_SIZE != 3)
+#error "the GPIO backend only drives a 3x3x3 cube, set LEDCUBE_USE_SPI"
+#endif
+
+#if LEDCUBE_USE_SPI && !HAL_USE_SPI
+#error "LEDCUBE_USE_SPI requires HAL_USE_SPI"
+#endif
+
+#if LEDCUBE_USE_SPI &&                                                      \
+    (LEDCUBE_SPI_BYTES * 8UL * CH_CFG_ST_FREQUENCY >                        \
+     LEDCUBE_SPI_CLOCK * LEDCUBE_BAM_TICKS)
+#error "LEDCUBE layer shift longer than a bit plane, raise LEDCUBE_SPI_CLOCK"
+#endif
+
+#if (LEDCUBE_BAM_BITS < 1) || (LEDCUBE_BAM_BITS > 4)
+#error "LEDCUBE_BAM_BITS must be between 1 and 4"
+#endif
+
+#if LEDCUBE_REFRESH_RATE < LEDCUBE_MIN_REFRESH
+#error "LEDCUBE refresh rate too low, reduce LEDCUBE_BAM_BITS or LEDCUBE_BAM_TICKS"
+#endif
+
+#if LEDCUBE_ISR_LOAD > LEDCUBE_ISR_BUDGET
+#error "LEDCUBE refresh engine exceeds its CPU budget"
+#endif
+
+/*==========================================================================*/
+/* Animation format.                                                        */
+/*==========================================================================*/
+
+/*
+ * An animation is a table of bytes interpreted by ledCubePlay(). It works
+ * on a pattern of leds turned on, the pattern is only displayed by the
+ * SHOW instruction. Multi-bytes arguments are little endian.
+ */
+#define LEDCUBE_OP_END      ((uint8_t)0x00) /**< End of the animation.      */
+#define LEDCUBE_OP_SHOW     ((uint8_t)0x01) /**< Display, arg: time (ms).   */
+#define LEDCUBE_OP_CLEAR    ((uint8_t)0x02) /**< Turn off all the leds.     */
+#define LEDCUBE_OP_FILL     ((uint8_t)0x03) /**< Turn on all the leds.      */
+#define LEDCUBE_OP_LINES    ((uint8_t)0x04) /**< Same lines on all layers.  */
+#define LEDCUBE_OP_LAYER    ((uint8_t)0x05) /**< Lines of one layer.        */
+#define LEDCUBE_OP_LEVEL    ((uint8_t)0x06) /**< Brightness of the leds.    */
+#define LEDCUBE_OP_LOOP     ((uint8_t)0x07) /**< Repeat, arg: count.        */
+#define LEDCUBE_OP_NEXT     ((uint8_t)0x08) /**< End of the loop body.      */
+#define LEDCUBE_OP_ROTATE   ((uint8_t)0x09) /**< Quarter turn, arg: axis.   */
+#define LEDCUBE_OP_SHIFT    ((uint8_t)0x0A) /**< Shift, arg: axis, step.    */
+#define LEDCUBE_OP_MIRROR   ((uint8_t)0x0B) /**< Mirror, arg: axis.         */
+
+/*
+ * Transformation axis.
+ */
+#define LEDCUBE_AXIS_X      ((uint8_t)0x00) /**< Along a line of a layer.   */
+#define LEDCUBE_AXIS_Y      ((uint8_t)0x01) /**< Across the lines.          */
+#define LEDCUBE_AXIS_Z      ((uint8_t)0x02) /**< From top to bottom.        */
+
+/*
+ * Helpers to write the animation tables.
+ */
+#define LEDCUBE_ANIM_BYTE(m, n)   (uint8_t)((uint64_t)(m) >> (8 * (n)))
+#if (LEDCUBE_LAYER_BYTES == 2) || defined(__DOXYGEN__)
+#define LEDCUBE_ANIM_MASK(m)      LEDCUBE_ANIM_BYTE(m, 0),                  \
+                                  LEDCUBE_ANIM_BYTE(m, 1)
+#elif LEDCUBE_LAYER_BYTES == 4
+#define LEDCUBE_ANIM_MASK(m)      LEDCUBE_ANIM_BYTE(m, 0),                  \
+                                  LEDCUBE_ANIM_BYTE(m, 1),                  \
+                                  LEDCUBE_ANIM_BYTE(m, 2),                  \
+                                  LEDCUBE_ANIM_BYTE(m, 3)
+#else
+#define LEDCUBE_ANIM_MASK(m)      LEDCUBE_ANIM_BYTE(m, 0),                  \
+                                  LEDCUBE_ANIM_BYTE(m, 1),                  \
+                                  LEDCUBE_ANIM_BYTE(m, 2),                  \
+                                  LEDCUBE_ANIM_BYTE(m, 3),                  \
+                                  LEDCUBE_ANIM_BYTE(m, 4),                  \
+                                  LEDCUBE_ANIM_BYTE(m, 5),                  \
+                                  LEDCUBE_ANIM_BYTE(m, 6),                  \
+                                  LEDCUBE_ANIM_BYTE(m, 7)
+#endif
+#define LEDCUBE_ANIM_END          LEDCUBE_OP_END
+#define LEDCUBE_ANIM_SHOW(ms)     LEDCUBE_OP_SHOW, (uint8_t)(ms),           \
+                                  (uint8_t)((ms) >> 8)
+#define LEDCUBE_ANIM_CLEAR        LEDCUBE_OP_CLEAR
+#define LEDCUBE_ANIM_FILL         LEDCUBE_OP_FILL
+#define LEDCUBE_ANIM_LINES(m)     LEDCUBE_OP_LINES, LEDCUBE_ANIM_MASK(m)
+#define LEDCUBE_ANIM_LAYER(z, m)  LEDCUBE_OP_LAYER, (uint8_t)(z),           \
+                                  LEDCUBE_ANIM_MASK(m)
+#define LEDCUBE_ANIM_LEVEL(l)     LEDCUBE_OP_LEVEL, (uint8_t)(l)
+#define LEDCUBE_ANIM_LOOP(n)      LEDCUBE_OP_LOOP, (uint8_t)(n)
+#define LEDCUBE_ANIM_NEXT         LEDCUBE_OP_NEXT
+#define LEDCUBE_ANIM_ROTATE(a)    LEDCUBE_OP_ROTATE, (a)
+#define LEDCUBE_ANIM_SHIFT(a, s)  LEDCUBE_OP_SHIFT, (a), (uint8_t)(s)
+#define LEDCUBE_ANIM_MIRROR(a)    LEDCUBE_OP_MIRROR, (a)
+
+/**
+ * @brief   Attribute placing an animation table in flash.
+ */
+#if defined(__AVR__)
+#define LEDCUBE_ANIM_FLASH        PROGMEM
+#define LEDCUBE_ANIM_READ(p)      pgm_read_byte(p)
+#else
+#define LEDCUBE_ANIM_FLASH
+#define LEDCUBE_ANIM_READ(p)      (*(p))
+#endif
+
+/*==========================================================================*/
+/* Driver data structures and types.                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   State of the leds of one layer, bit n controls the line n.
+ * @details The line of the led (x, y) is y * LEDCUBE_SIZE + x.
+ */
+#if (LEDCUBE_LAYER_BYTES == 2) || defined(__DOXYGEN__)
+typedef uint16_t ledcube_layer_t;
+#elif LEDCUBE_LAYER_BYTES == 4
+typedef uint32_t ledcube_layer_t;
+#else
+typedef uint64_t ledcube_layer_t;
+#endif
+
+/**
+ * @brief   Frame displayed by the led cube.
+ * @details Each layer is stored as LEDCUBE_BAM_BITS bit planes, plane n
+ *          holds the bit n of the brightness of the leds of the layer.
+ */
+typedef struct ledcube_frame {
+  ledcube_layer_t layer[LEDCUBE_LAYERS][LEDCUBE_BAM_BITS]; /**< Top first.  */
+} ledcube_frame_t;
+
+/*
+ * Animation player state.
+ */
+#define LEDCUBE_PLAYER_STOP     ((uint8_t)0x00) /**< Not started or ended.  */
+#define LEDCUBE_PLAYER_RUN      ((uint8_t)0x01) /**< Playing.               */
+#define LEDCUBE_PLAYER_ERROR    ((uint8_t)0x02) /**< Invalid instruction.   */
+
+/**
+ * @brief   Animation player, an animation interpreted step by step.
+ */
+typedef struct ledcube_player {
+  const uint8_t   *anim;                          /**< Animation played.    */
+  const uint8_t   *ip;                            /**< Next instruction.    */
+  const uint8_t   *loopStart[LEDCUBE_ANIM_DEPTH]; /**< Loops bodies.        */
+  uint8_t         loopCount[LEDCUBE_ANIM_DEPTH];  /**< Loops iterations.    */
+  uint8_t         depth;                          /**< Nested loops.        */
+  uint8_t         level;                          /**< Leds brightness.     */
+  uint8_t         state;                          /**< Player state.        */
+  ledcube_layer_t pattern[LEDCUBE_LAYERS];        /**< Leds turned on.      */
+} ledcube_player_t;
+
+/*==========================================================================*/
+/* Frame stream.                                                            */
+/*==========================================================================*/
+
+/*
+ * A frame stream is a sequence of packets:
+ *   sync (2 bytes), sequence number (2 bytes), timestamp in ms (4 bytes),
+ *   payload size (2 bytes), payload, CRC-8 of the bytes between the sync
+ *   and the CRC.
+ * The payload is a ledcube_frame_t, bit planes of each layer from the top
+ * layer, each plane being LEDCUBE_LAYER_BYTES little endian bytes.
+ * Multi-bytes fields are little endian.
+ */
+#define LEDCUBE_STREAM_SYNC0    ((uint8_t)0xA5) /**< First sync byte.       */
+#define LEDCUBE_STREAM_SYNC1    ((uint8_t)0x5A) /**< Second sync byte.      */
+#define LEDCUBE_STREAM_PAYLOAD                                              \
+  (LEDCUBE_LAYERS * LEDCUBE_BAM_BITS * LEDCUBE_LAYER_BYTES)
+
+/**
+ * @brief   Frame received from a stream.
+ */
+typedef struct ledcube_stream_frame {
+  ledcube_frame_t frame;      /**< Frame to display.                        */
+  uint16_t        seq;        /**< Sequence number.                         */
+  uint32_t        timestamp;  /**< Display time of the frame (ms).          */
+} ledcube_stream_frame_t;
+
+/**
+ * @brief   Frame stream statistics.
+ */
+typedef struct ledcube_stream_stats {
+  uint32_t  frames;     /**< Frames received.                               */
+  uint32_t  displayed;  /**< Frames displayed.                              */
+  uint32_t  errors;     /**< Packets dropped for a bad size or CRC.         */
+  uint32_t  lost;       /**< Frames missing in the sequence numbers.        */
+  uint32_t  overruns;   /**< Frames dropped because the queue was full.     */
+  uint32_t  underruns;  /**< Display requests with an empty queue.          */
+  uint32_t  late;       /**< Frames skipped because they were too late.     */
+} ledcube_stream_stats_t;
+
+/**
+ * @brief   Frame stream receiver.
+ * @details The queue has a single producer, the function feeding the
+ *          stream, and a single consumer, the function displaying the
+ *          frames, they can run in different threads without lock.
+ */
+typedef struct ledcube_stream {
+  ledcube_stream_frame_t  queue[LEDCUBE_STREAM_QUEUE]; /**< Frame queue.    */
+  volatile uint8_t        head;       /**< Next slot written.               */
+  volatile uint8_t        tail;       /**< Next slot read.                  */
+  ledcube_stream_frame_t  rx;         /**< Frame being received.            */
+  uint8_t                 state;      /**< Position in the packet.          */
+  uint16_t                count;      /**< Bytes received in the field.     */
+  uint16_t                size;       /**< Payload size of the packet.      */
+  uint8_t                 crc;        /**< CRC of the packet.               */
+  bool                    synced;     /**< A frame was already received.    */
+  uint16_t                nextSeq;    /**< Expected sequence number.        */
+  bool                    started;    /**< The playback clock is running.   */
+  uint32_t                origin;     /**< Timestamp of the first frame.    */
+  systime_t               start;      /**< System time of the first frame.  */
+  ledcube_stream_stats_t  stats;      /**< Statistics.                      */
+} ledcube_stream_t;
+
 /*==========================================================================*/
 /* Fonctions prototypes.                                                    */
 /*==========================================================================*/
 
 void ledCubeInit(void);
+ledcube_frame_t *ledCubeGetBackBuffer(void);
+void ledCubeSwapBuffers(void);
+void ledCubeWaitSwap(void);
+bool ledCubeIsSwapPending(void);
+uint32_t ledCubeGetRefreshRate(void);
+uint32_t ledCubeGetIsrCycles(void);
+void ledCubeFrameClear(ledcube_frame_t *fp);
+void ledCubeFrameFill(ledcube_frame_t *fp);
+void ledCubeFrameSetLines(ledcube_frame_t *fp, uint8_t z,
+                          ledcube_layer_t lines, uint8_t level);
+void ledCubeFrameSetVoxel(ledcube_frame_t *fp, uint8_t x, uint8_t y,
+                          uint8_t z, uint8_t level);
+uint8_t ledCubeFrameGetVoxel(const ledcube_frame_t *fp, uint8_t x, uint8_t y,
+                             uint8_t z);
+void ledCubeRotate(ledcube_layer_t *pattern, uint8_t axis);
+void ledCubeMirror(ledcube_layer_t *pattern, uint8_t axis);
+void ledCubeShift(ledcube_layer_t *pattern, uint8_t axis, int8_t step);
+void ledCubeTransform(ledcube_layer_t *pattern, uint8_t op, uint8_t axis,
+                      int8_t step);
+void ledCubeFrameTransform(ledcube_frame_t *fp, uint8_t op, uint8_t axis,
+                           int8_t step);
+void ledCubePlayerInit(ledcube_player_t *pp, const uint8_t *anim);
+bool ledCubePlayerStep(ledcube_player_t *pp, uint16_t *tempo);
+msg_t ledCubePlay(const uint8_t *anim);
+msg_t ledCubeSchedStart(uint8_t slot, const uint8_t *anim,
+                        const ledcube_layer_t *region, bool loop);
+void ledCubeSchedStop(uint8_t slot);
+bool ledCubeSchedIsRunning(uint8_t slot);
+systime_t ledCubeSchedPoll(void);
+systime_t ledCubeDemoPoll(void);
+void ledCubeStreamInit(ledcube_stream_t *sp);
+void ledCubeStreamFeed(ledcube_stream_t *sp, const uint8_t *buf, size_t n);
+size_t ledCubeStreamReceive(ledcube_stream_t *sp, BaseChannel *chp,
+                            systime_t timeout);
+systime_t ledCubeStreamDisplay(ledcube_stream_t *sp);
 void ledCubeDemo(void);
 
 #endif /* LEDCUBE_H */
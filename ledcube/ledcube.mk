@@ -1,6 +1,9 @@
 
 # List of all the LEDCUBE driver files.
-LEDCUBESRC := $(DRIVERS)/ledcube/ledcube.c
+LEDCUBESRC := $(DRIVERS)/ledcube/ledcube.c \
+              $(DRIVERS)/ledcube/ledcube_anim.c \
+              $(DRIVERS)/ledcube/ledcube_stream.c \
+              $(DRIVERS)/ledcube/ledcube_transform.c
 
 # Required include directories
 LEDCUBEINC := $(DRIVERS)/ledcube/
@@ -0,0 +1,598 @@
+/**
+ *
+ * @file    ledcube_anim.c
+ *
+ * @brief   Led cube animations interpreter source file.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+/*==========================================================================*/
+/* Includes files.                                                          */
+/*==========================================================================*/
+
+/* ChibiOS files. */
+#include "hal.h"
+
+/* Driver files. */
+#include "ledcube.h"
+
+/*==========================================================================*/
+/* Demo animations.                                                         */
+/*==========================================================================*/
+
+/* Light the leds of a layer one by one around its border. */
+#define DEMO_RING(z)                                                        \
+  LEDCUBE_ANIM_LAYER(z, 0x001), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x002), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x004), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x020), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x100), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x080), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x040), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x008), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x000)
+
+/* Turn on the leds of a layer one after the other. */
+#define DEMO_FACTO(z)                                                       \
+  LEDCUBE_ANIM_CLEAR,                                                       \
+  LEDCUBE_ANIM_LAYER(z, 0x001), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x003), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x007), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x00F), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x01F), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x03F), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x07F), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x0FF), LEDCUBE_ANIM_SHOW(50),                      \
+  LEDCUBE_ANIM_LAYER(z, 0x1FF), LEDCUBE_ANIM_SHOW(50)
+
+/* Blink a pattern set on all the layers. */
+#define DEMO_FACE(m)                                                        \
+  LEDCUBE_ANIM_LOOP(10),                                                    \
+    LEDCUBE_ANIM_LINES(m), LEDCUBE_ANIM_SHOW(50),                           \
+    LEDCUBE_ANIM_CLEAR, LEDCUBE_ANIM_SHOW(50),                              \
+  LEDCUBE_ANIM_NEXT,                                                        \
+  LEDCUBE_ANIM_END
+
+/* Blink one layer. */
+#define DEMO_LAYER(z)                                                       \
+  LEDCUBE_ANIM_LOOP(10),                                                    \
+    LEDCUBE_ANIM_CLEAR, LEDCUBE_ANIM_SHOW(50),                              \
+    LEDCUBE_ANIM_LAYER(z, LEDCUBE_LAYER_ALL), LEDCUBE_ANIM_SHOW(50),        \
+  LEDCUBE_ANIM_NEXT,                                                        \
+  LEDCUBE_ANIM_END
+
+static const uint8_t demoOnOff[] LEDCUBE_ANIM_FLASH = {
+  LEDCUBE_ANIM_LOOP(10),
+    LEDCUBE_ANIM_CLEAR, LEDCUBE_ANIM_SHOW(50),
+    LEDCUBE_ANIM_FILL, LEDCUBE_ANIM_SHOW(50),
+  LEDCUBE_ANIM_NEXT,
+  LEDCUBE_ANIM_END
+};
+
+static const uint8_t demoTop[] LEDCUBE_ANIM_FLASH = {DEMO_LAYER(0)};
+static const uint8_t demoMidle[] LEDCUBE_ANIM_FLASH = {DEMO_LAYER(1)};
+static const uint8_t demoBottom[] LEDCUBE_ANIM_FLASH = {DEMO_LAYER(2)};
+static const uint8_t demoFace1[] LEDCUBE_ANIM_FLASH = {DEMO_FACE(0x007)};
+static const uint8_t demoFace2[] LEDCUBE_ANIM_FLASH = {DEMO_FACE(0x049)};
+static const uint8_t demoFace3[] LEDCUBE_ANIM_FLASH = {DEMO_FACE(0x1C0)};
+static const uint8_t demoFace4[] LEDCUBE_ANIM_FLASH = {DEMO_FACE(0x124)};
+
+static const uint8_t demoAllFaces[] LEDCUBE_ANIM_FLASH = {
+  LEDCUBE_ANIM_LINES(0x007),
+  LEDCUBE_ANIM_LOOP(10),
+    LEDCUBE_ANIM_LOOP(4),
+      LEDCUBE_ANIM_SHOW(100),
+      LEDCUBE_ANIM_ROTATE(LEDCUBE_AXIS_Z),
+    LEDCUBE_ANIM_NEXT,
+  LEDCUBE_ANIM_NEXT,
+  LEDCUBE_ANIM_END
+};
+
+static const uint8_t demoCircular[] LEDCUBE_ANIM_FLASH = {
+  LEDCUBE_ANIM_LOOP(10),
+    DEMO_RING(2),
+    DEMO_RING(1),
+    DEMO_RING(0),
+  LEDCUBE_ANIM_NEXT,
+  LEDCUBE_ANIM_END
+};
+
+static const uint8_t demoRotation[] LEDCUBE_ANIM_FLASH = {
+  LEDCUBE_ANIM_LOOP(10),
+    LEDCUBE_ANIM_LINES(0x111), LEDCUBE_ANIM_SHOW(100),
+    LEDCUBE_ANIM_LINES(0x038), LEDCUBE_ANIM_SHOW(100),
+    LEDCUBE_ANIM_LINES(0x111), LEDCUBE_ANIM_ROTATE(LEDCUBE_AXIS_Z),
+    LEDCUBE_ANIM_SHOW(100),
+    LEDCUBE_ANIM_LINES(0x038), LEDCUBE_ANIM_ROTATE(LEDCUBE_AXIS_Z),
+    LEDCUBE_ANIM_SHOW(100),
+  LEDCUBE_ANIM_NEXT,
+  LEDCUBE_ANIM_END
+};
+
+static const uint8_t demoFacto[] LEDCUBE_ANIM_FLASH = {
+  LEDCUBE_ANIM_LOOP(10),
+    DEMO_FACTO(0),
+    DEMO_FACTO(1),
+    DEMO_FACTO(2),
+  LEDCUBE_ANIM_NEXT,
+  LEDCUBE_ANIM_END
+};
+
+static const uint8_t demoShadow[] LEDCUBE_ANIM_FLASH = {
+  LEDCUBE_ANIM_LOOP(10),
+    LEDCUBE_ANIM_LINES(0x040), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x0C0), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x1C0), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x1C1), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x1C3), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x1C7), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x1CF), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x1DF), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x1FF), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x1BF), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x13F), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x03F), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x03E), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x03C), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x038), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x030), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x020), LEDCUBE_ANIM_SHOW(80),
+    LEDCUBE_ANIM_LINES(0x000), LEDCUBE_ANIM_SHOW(80),
+  LEDCUBE_ANIM_NEXT,
+  LEDCUBE_ANIM_END
+};
+
+static const uint8_t demoEffect[] LEDCUBE_ANIM_FLASH = {
+  LEDCUBE_ANIM_LAYER(0, LEDCUBE_LAYER_ALL),
+  LEDCUBE_ANIM_LOOP(11),
+    LEDCUBE_ANIM_SHOW(50), LEDCUBE_ANIM_SHIFT(LEDCUBE_AXIS_Z, 1),
+    LEDCUBE_ANIM_SHOW(50), LEDCUBE_ANIM_SHIFT(LEDCUBE_AXIS_Z, 1),
+    LEDCUBE_ANIM_SHOW(50), LEDCUBE_ANIM_SHIFT(LEDCUBE_AXIS_Z, -1),
+    LEDCUBE_ANIM_SHOW(50), LEDCUBE_ANIM_SHIFT(LEDCUBE_AXIS_Z, -1),
+  LEDCUBE_ANIM_NEXT,
+  LEDCUBE_ANIM_END
+};
+
+static const uint8_t demoBlink[] LEDCUBE_ANIM_FLASH = {
+  LEDCUBE_ANIM_LOOP(6),
+    LEDCUBE_ANIM_FILL, LEDCUBE_ANIM_SHOW(50),
+    LEDCUBE_ANIM_CLEAR, LEDCUBE_ANIM_SHOW(50),
+  LEDCUBE_ANIM_NEXT,
+  LEDCUBE_ANIM_END
+};
+
+/**
+ * @brief   Animations played one after the other by ledCubeDemo().
+ */
+static const uint8_t * const demoAnims[] = {
+  demoOnOff, demoTop, demoMidle, demoBottom, demoFace1, demoFace2,
+  demoFace3, demoFace4, demoAllFaces, demoCircular, demoRotation,
+  demoFacto, demoShadow, demoEffect, demoBlink
+};
+
+#define DEMO_ANIMS_NBR  (sizeof(demoAnims) / sizeof(demoAnims[0]))
+
+/*==========================================================================*/
+/* Global variables.                                                        */
+/*==========================================================================*/
+
+static uint8_t demoIndex = 0;
+
+/**
+ * @brief   Animation run by the scheduler.
+ */
+typedef struct sched_slot {
+  ledcube_player_t  player;                   /**< Animation player.        */
+  ledcube_layer_t   region[LEDCUBE_LAYERS];   /**< Leds of the animation.   */
+  bool              loop;                     /**< Restart at the end.      */
+  systime_t         start;                    /**< Time of the last step.   */
+  systime_t         interval;                 /**< Time until the next step.*/
+} sched_slot_t;
+
+static sched_slot_t schedSlots[LEDCUBE_SCHED_SLOTS];
+static bool         schedDirty = false;
+
+/*==========================================================================*/
+/* Functions.                                                               */
+/*==========================================================================*/
+
+/**
+ * @brief   Read the lines of a layer from an animation.
+ *
+ * @param[in] ip      pointer to the first byte of the lines
+ * @return    lines   state of the lines
+ */
+static ledcube_layer_t animReadLines(const uint8_t *ip) {
+
+  uint8_t i;
+  ledcube_layer_t lines = 0;
+
+  for (i = 0; i < LEDCUBE_LAYER_BYTES; i++)
+    lines |= (ledcube_layer_t)LEDCUBE_ANIM_READ(ip + i) << (8 * i);
+
+  return lines & LEDCUBE_LAYER_ALL;
+}
+
+/**
+ * @brief   Prepare a player to play an animation.
+ *
+ * @param[out] pp     pointer to the player
+ * @param[in]  anim   pointer to the animation to play
+ */
+void ledCubePlayerInit(ledcube_player_t *pp, const uint8_t *anim) {
+
+  uint8_t i;
+
+  pp->anim  = anim;
+  pp->ip    = anim;
+  pp->depth = 0;
+  pp->level = LEDCUBE_LEVEL_MAX;
+  pp->state = LEDCUBE_PLAYER_RUN;
+
+  for (i = 0; i < LEDCUBE_LAYERS; i++)
+    pp->pattern[i] = 0;
+}
+
+/**
+ * @brief   Run an animation up to its next frame.
+ * @details The instructions are interpreted up to the next SHOW, the
+ *          pattern of the player is then the frame to display.
+ *          The animation is a table of instructions, see LEDCUBE_OP_xxx,
+ *          it can be placed in flash with LEDCUBE_ANIM_FLASH.
+ *
+ * @param[in,out] pp      pointer to the player
+ * @param[out]    tempo   time to display the frame (ms)
+ * @return        show    true if a frame is ready, false if the player
+ *                        stopped, its state tells if an error occured
+ */
+bool ledCubePlayerStep(ledcube_player_t *pp, uint16_t *tempo) {
+
+  uint8_t op, i;
+
+  while (pp->state == LEDCUBE_PLAYER_RUN) {
+    op = LEDCUBE_ANIM_READ(pp->ip++);
+
+    switch (op) {
+      case LEDCUBE_OP_END:
+        pp->state = LEDCUBE_PLAYER_STOP;
+      break;
+
+      case LEDCUBE_OP_SHOW:
+        *tempo = LEDCUBE_ANIM_READ(pp->ip) |
+                 (LEDCUBE_ANIM_READ(pp->ip + 1) << 8);
+        pp->ip += 2;
+        return true;
+
+      case LEDCUBE_OP_CLEAR:
+      case LEDCUBE_OP_FILL:
+        for (i = 0; i < LEDCUBE_LAYERS; i++)
+          pp->pattern[i] = (op == LEDCUBE_OP_FILL) ? LEDCUBE_LAYER_ALL : 0;
+      break;
+
+      case LEDCUBE_OP_LINES:
+        for (i = 0; i < LEDCUBE_LAYERS; i++)
+          pp->pattern[i] = animReadLines(pp->ip);
+        pp->ip += LEDCUBE_LAYER_BYTES;
+      break;
+
+      case LEDCUBE_OP_LAYER:
+        i = LEDCUBE_ANIM_READ(pp->ip++);
+        if (i >= LEDCUBE_LAYERS) {
+          pp->state = LEDCUBE_PLAYER_ERROR;
+          break;
+        }
+        pp->pattern[i] = animReadLines(pp->ip);
+        pp->ip += LEDCUBE_LAYER_BYTES;
+      break;
+
+      case LEDCUBE_OP_LEVEL:
+        pp->level = LEDCUBE_ANIM_READ(pp->ip++);
+      break;
+
+      case LEDCUBE_OP_LOOP:
+        if (pp->depth >= LEDCUBE_ANIM_DEPTH) {
+          pp->state = LEDCUBE_PLAYER_ERROR;
+          break;
+        }
+        pp->loopCount[pp->depth] = LEDCUBE_ANIM_READ(pp->ip++);
+        pp->loopStart[pp->depth++] = pp->ip;
+      break;
+
+      case LEDCUBE_OP_NEXT:
+        if (pp->depth == 0) {
+          pp->state = LEDCUBE_PLAYER_ERROR;
+          break;
+        }
+        if (pp->loopCount[pp->depth - 1] > 1) {
+          pp->loopCount[pp->depth - 1]--;
+          pp->ip = pp->loopStart[pp->depth - 1];
+        }
+        else
+          pp->depth--;
+      break;
+
+      case LEDCUBE_OP_ROTATE:
+      case LEDCUBE_OP_MIRROR:
+        i = LEDCUBE_ANIM_READ(pp->ip++);
+        if (i > LEDCUBE_AXIS_Z) {
+          pp->state = LEDCUBE_PLAYER_ERROR;
+          break;
+        }
+        ledCubeTransform(pp->pattern, op, i, 0);
+      break;
+
+      case LEDCUBE_OP_SHIFT:
+        i = LEDCUBE_ANIM_READ(pp->ip++);
+        if (i > LEDCUBE_AXIS_Z) {
+          pp->state = LEDCUBE_PLAYER_ERROR;
+          break;
+        }
+        ledCubeTransform(pp->pattern, op, i,
+                         (int8_t)LEDCUBE_ANIM_READ(pp->ip++));
+      break;
+
+      default:
+        pp->state = LEDCUBE_PLAYER_ERROR;
+      break;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief   Play an animation on the cube.
+ * @details The steps are displayed on absolute deadlines, so the time spent
+ *          waiting for the buffer swaps does not add up over the animation.
+ * @note    This function blocks until the end of the animation, use the
+ *          scheduler to play animations without blocking.
+ *
+ * @param[in] anim    pointer to the animation to play
+ * @return    msg     the result of the animation
+ * @retval    MSG_OK    the animation was played up to its end
+ * @retval    MSG_RESET the animation contains an invalid instruction
+ */
+msg_t ledCubePlay(const uint8_t *anim) {
+
+  ledcube_player_t  player;
+  ledcube_frame_t   *fp;
+  systime_t         prev, next = chVTGetSystemTime();
+  uint16_t          tempo;
+  uint8_t           i;
+
+  ledCubePlayerInit(&player, anim);
+
+  while (ledCubePlayerStep(&player, &tempo)) {
+    fp = ledCubeGetBackBuffer();
+    for (i = 0; i < LEDCUBE_LAYERS; i++)
+      ledCubeFrameSetLines(fp, i, player.pattern[i], player.level);
+    ledCubeSwapBuffers();
+    ledCubeWaitSwap();
+
+    /* A late step is not waited for, the next ones catch up. */
+    prev = next;
+    next += MS2ST(tempo);
+    (void)chThdSleepUntilWindowed(prev, next);
+  }
+
+  return (player.state == LEDCUBE_PLAYER_ERROR) ? MSG_RESET : MSG_OK;
+}
+
+/*==========================================================================*/
+/* Scheduler.                                                               */
+/*==========================================================================*/
+
+/**
+ * @brief   Run the animation of a slot up to its next frame.
+ *
+ * @param[in] sp    pointer to the slot
+ * @param[in] now   current system time
+ */
+static void schedStep(sched_slot_t *sp, systime_t now) {
+
+  uint16_t tempo = 0;
+
+  if (!ledCubePlayerStep(&sp->player, &tempo) && sp->loop &&
+      (sp->player.state == LEDCUBE_PLAYER_STOP)) {
+    ledCubePlayerInit(&sp->player, sp->player.anim);
+    (void)ledCubePlayerStep(&sp->player, &tempo);
+  }
+
+  /* Keep the steps on their deadlines unless the slot is late. */
+  if (chVTTimeElapsedSinceX(sp->start) > (systime_t)(sp->interval + 1))
+    sp->start = now;
+  else
+    sp->start += sp->interval;
+
+  sp->interval = MS2ST(tempo);
+  schedDirty = true;
+}
+
+/**
+ * @brief   Draw the frames of all the running animations.
+ * @details The slots are drawn in order, a slot covers the previous ones in
+ *          its region.
+ *
+ * @param[out] fp   pointer to the frame to draw
+ */
+static void schedCompose(ledcube_frame_t *fp) {
+
+  uint8_t         i, z, b;
+  sched_slot_t    *sp;
+  ledcube_layer_t lines;
+
+  ledCubeFrameClear(fp);
+
+  for (i = 0; i < LEDCUBE_SCHED_SLOTS; i++) {
+    sp = &schedSlots[i];
+    if (sp->player.state != LEDCUBE_PLAYER_RUN)
+      continue;
+
+    for (z = 0; z < LEDCUBE_LAYERS; z++) {
+      lines = sp->player.pattern[z] & sp->region[z];
+      for (b = 0; b < LEDCUBE_BAM_BITS; b++) {
+        fp->layer[z][b] &= (ledcube_layer_t)~sp->region[z];
+        if (sp->player.level & (1U << b))
+          fp->layer[z][b] |= lines;
+      }
+    }
+  }
+}
+
+/**
+ * @brief   Start an animation in a slot of the scheduler.
+ * @details The animation only changes the leds of its region, it replaces
+ *          the animation already running in the slot.
+ *
+ * @param[in] slot    slot used by the animation
+ * @param[in] anim    pointer to the animation to play
+ * @param[in] region  leds of each layer used by the animation, NULL for the
+ *                    whole cube
+ * @param[in] loop    true to restart the animation when it ends
+ * @return    msg     the result of the operation
+ * @retval    MSG_OK    the animation is started
+ * @retval    MSG_RESET the slot does not exist
+ */
+msg_t ledCubeSchedStart(uint8_t slot, const uint8_t *anim,
+                        const ledcube_layer_t *region, bool loop) {
+
+  sched_slot_t  *sp;
+  uint8_t       z;
+
+  if (slot >= LEDCUBE_SCHED_SLOTS)
+    return MSG_RESET;
+
+  sp = &schedSlots[slot];
+  ledCubePlayerInit(&sp->player, anim);
+
+  for (z = 0; z < LEDCUBE_LAYERS; z++)
+    sp->region[z] = (region != NULL) ? region[z] : LEDCUBE_LAYER_ALL;
+
+  sp->loop     = loop;
+  sp->start    = chVTGetSystemTime();
+  sp->interval = 0;
+
+  return MSG_OK;
+}
+
+/**
+ * @brief   Stop the animation of a slot of the scheduler.
+ *
+ * @param[in] slot    slot to stop
+ */
+void ledCubeSchedStop(uint8_t slot) {
+
+  if (slot < LEDCUBE_SCHED_SLOTS) {
+    schedSlots[slot].player.state = LEDCUBE_PLAYER_STOP;
+    schedDirty = true;
+  }
+}
+
+/**
+ * @brief   Tell if an animation is running in a slot of the scheduler.
+ *
+ * @param[in] slot      slot to check
+ * @return    running   true if an animation is running
+ */
+bool ledCubeSchedIsRunning(uint8_t slot) {
+
+  return (slot < LEDCUBE_SCHED_SLOTS) &&
+         (schedSlots[slot].player.state == LEDCUBE_PLAYER_RUN);
+}
+
+/**
+ * @brief   Advance the animations whose deadline is reached.
+ * @details This function never blocks, it is meant to be called from the
+ *          loop of a thread doing other jobs, sensor polling for example.
+ *
+ * @return  delay   time before the next deadline, TIME_INFINITE if no
+ *                  animation is running
+ */
+systime_t ledCubeSchedPoll(void) {
+
+  systime_t     now = chVTGetSystemTime();
+  systime_t     delay = TIME_INFINITE;
+  systime_t     elapsed;
+  sched_slot_t  *sp;
+  uint8_t       i;
+
+  for (i = 0; i < LEDCUBE_SCHED_SLOTS; i++) {
+    sp = &schedSlots[i];
+
+    if (sp->player.state != LEDCUBE_PLAYER_RUN)
+      continue;
+
+    if (chVTTimeElapsedSinceX(sp->start) >= sp->interval)
+      schedStep(sp, now);
+
+    if (sp->player.state != LEDCUBE_PLAYER_RUN)
+      continue;
+
+    elapsed = chVTTimeElapsedSinceX(sp->start);
+    if (elapsed >= sp->interval)
+      delay = TIME_IMMEDIATE;
+    else if ((systime_t)(sp->interval - elapsed) < delay)
+      delay = (systime_t)(sp->interval - elapsed);
+  }
+
+  if (schedDirty) {
+    /* The previous frame is not displayed yet, retry at the next tick. */
+    if (ledCubeIsSwapPending())
+      return (delay < (systime_t)1) ? delay : (systime_t)1;
+
+    schedCompose(ledCubeGetBackBuffer());
+    ledCubeSwapBuffers();
+    schedDirty = false;
+  }
+
+  return delay;
+}
+
+/*==========================================================================*/
+/* Demo.                                                                    */
+/*==========================================================================*/
+
+/**
+ * @brief   This demo function play all the demo animations, one per call.
+ * @note    This function blocks until the end of the animation.
+ */
+void ledCubeDemo(void) {
+
+  (void)ledCubePlay(demoAnims[demoIndex]);
+
+  if (++demoIndex >= DEMO_ANIMS_NBR)
+    demoIndex = 0;
+}
+
+/**
+ * @brief   Play all the demo animations one after the other without
+ *          blocking.
+ * @details The demo uses the slot 0 of the scheduler, this function must
+ *          be called again after the returned delay.
+ *
+ * @return  delay   time before the next call, TIME_IMMEDIATE when an
+ *                  animation ended and the next one must be started
+ */
+systime_t ledCubeDemoPoll(void) {
+
+  systime_t delay;
+
+  if (!ledCubeSchedIsRunning(0)) {
+    (void)ledCubeSchedStart(0, demoAnims[demoIndex], NULL, false);
+
+    if (++demoIndex >= DEMO_ANIMS_NBR)
+      demoIndex = 0;
+  }
+
+  delay = ledCubeSchedPoll();
+
+  /* The animation ended during the poll, the next one starts at once. */
+  if (!ledCubeSchedIsRunning(0))
+    return TIME_IMMEDIATE;
+
+  return delay;
+}
@@ -0,0 +1,324 @@
+/**
+ *
+ * @file    ledcube_stream.c
+ *
+ * @brief   Led cube frame stream source file.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+/*==========================================================================*/
+/* Includes files.                                                          */
+/*==========================================================================*/
+
+/* ChibiOS files. */
+#include "hal.h"
+
+/* Driver files. */
+#include "ledcube.h"
+
+/*==========================================================================*/
+/* Driver local definitions.                                                */
+/*==========================================================================*/
+
+/*
+ * Position in the packet being received.
+ */
+#define STREAM_SYNC0    0
+#define STREAM_SYNC1    1
+#define STREAM_SEQ      2
+#define STREAM_TIME     3
+#define STREAM_SIZE     4
+#define STREAM_PAYLOAD  5
+#define STREAM_CRC      6
+
+#define STREAM_RX_SIZE  16  /**< Bytes read at once from a channel.         */
+
+/*
+ * Longest delay of a frame, the half of the system time range.
+ */
+#define STREAM_MAX_OFFSET ((systime_t)~(systime_t)0 >> 1)
+
+/*==========================================================================*/
+/* Functions.                                                               */
+/*==========================================================================*/
+
+/**
+ * @brief   Update a CRC-8 (polynomial 0x07) with one byte.
+ *
+ * @param[in] crc   current CRC
+ * @param[in] b     byte to add
+ * @return    crc   updated CRC
+ */
+static uint8_t streamCrc(uint8_t crc, uint8_t b) {
+
+  uint8_t i;
+
+  crc ^= b;
+  for (i = 0; i < 8; i++)
+    crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+
+  return crc;
+}
+
+/**
+ * @brief   Convert a difference of timestamps to system ticks.
+ * @details The difference is converted on 64 bits, MS2ST() overflows above
+ *          a few minutes. A timestamp going backwards gives no delay, a
+ *          difference too large for the system time is clamped.
+ *
+ * @param[in] ms      difference of timestamps (ms)
+ * @return    ticks   delay in system ticks
+ */
+static systime_t streamOffset(uint32_t ms) {
+
+  uint64_t ticks;
+
+  if ((int32_t)ms < 0)
+    return 0;
+
+  ticks = ((uint64_t)ms * CH_CFG_ST_FREQUENCY + 999) / 1000;
+  if (ticks > STREAM_MAX_OFFSET)
+    ticks = STREAM_MAX_OFFSET;
+
+  return (systime_t)ticks;
+}
+
+/**
+ * @brief   Put the received frame in the queue.
+ *
+ * @param[in] sp    pointer to the frame stream
+ */
+static void streamPush(ledcube_stream_t *sp) {
+
+  uint8_t next = (uint8_t)((sp->head + 1) % LEDCUBE_STREAM_QUEUE);
+
+  sp->stats.frames++;
+
+  /* A sequence number going backwards is a restart of the source, the
+     receiver resyncs on it. */
+  if (sp->synced && ((int16_t)(sp->rx.seq - sp->nextSeq) > 0))
+    sp->stats.lost += (uint16_t)(sp->rx.seq - sp->nextSeq);
+
+  sp->synced = true;
+  sp->nextSeq = (uint16_t)(sp->rx.seq + 1);
+
+  if (next == sp->tail) {
+    sp->stats.overruns++;
+    return;
+  }
+
+  sp->queue[sp->head] = sp->rx;
+
+  /* Publish the frame only once it is fully copied. */
+  chSysLock();
+  sp->head = next;
+  chSysUnlock();
+}
+
+/**
+ * @brief   Initialize a frame stream.
+ *
+ * @param[out] sp   pointer to the frame stream
+ */
+void ledCubeStreamInit(ledcube_stream_t *sp) {
+
+  sp->head    = 0;
+  sp->tail    = 0;
+  sp->state   = STREAM_SYNC0;
+  sp->synced  = false;
+  sp->started = false;
+
+  sp->stats.frames    = 0;
+  sp->stats.displayed = 0;
+  sp->stats.errors    = 0;
+  sp->stats.lost      = 0;
+  sp->stats.overruns  = 0;
+  sp->stats.underruns = 0;
+  sp->stats.late      = 0;
+}
+
+/**
+ * @brief   Give bytes of the stream to the receiver.
+ * @details The bytes can come from a memory buffer or from any channel,
+ *          a packet can be split between several calls.
+ *
+ * @param[in] sp    pointer to the frame stream
+ * @param[in] buf   pointer to the received bytes
+ * @param[in] n     number of received bytes
+ */
+void ledCubeStreamFeed(ledcube_stream_t *sp, const uint8_t *buf, size_t n) {
+
+  uint8_t b, i;
+
+  while (n--) {
+    b = *buf++;
+
+    switch (sp->state) {
+      case STREAM_SYNC0:
+        if (b == LEDCUBE_STREAM_SYNC0)
+          sp->state = STREAM_SYNC1;
+      break;
+
+      case STREAM_SYNC1:
+        if (b == LEDCUBE_STREAM_SYNC1) {
+          sp->state = STREAM_SEQ;
+          sp->count = 0;
+          sp->crc   = 0;
+          sp->rx.seq = 0;
+          sp->rx.timestamp = 0;
+        }
+        else if (b != LEDCUBE_STREAM_SYNC0)
+          sp->state = STREAM_SYNC0;
+      break;
+
+      case STREAM_SEQ:
+        sp->crc = streamCrc(sp->crc, b);
+        sp->rx.seq |= (uint16_t)b << (8 * sp->count);
+        if (++sp->count == 2) {
+          sp->state = STREAM_TIME;
+          sp->count = 0;
+        }
+      break;
+
+      case STREAM_TIME:
+        sp->crc = streamCrc(sp->crc, b);
+        sp->rx.timestamp |= (uint32_t)b << (8 * sp->count);
+        if (++sp->count == 4) {
+          sp->state = STREAM_SIZE;
+          sp->count = 0;
+          sp->size  = 0;
+        }
+      break;
+
+      case STREAM_SIZE:
+        sp->crc = streamCrc(sp->crc, b);
+        sp->size |= (uint16_t)b << (8 * sp->count);
+        if (++sp->count < 2)
+          break;
+        if (sp->size != LEDCUBE_STREAM_PAYLOAD) {
+          sp->stats.errors++;
+          sp->state = STREAM_SYNC0;
+          break;
+        }
+        ledCubeFrameClear(&sp->rx.frame);
+        sp->state = STREAM_PAYLOAD;
+        sp->count = 0;
+      break;
+
+      case STREAM_PAYLOAD:
+        sp->crc = streamCrc(sp->crc, b);
+        i = (uint8_t)(sp->count / LEDCUBE_LAYER_BYTES);
+        sp->rx.frame.layer[i / LEDCUBE_BAM_BITS][i % LEDCUBE_BAM_BITS] |=
+          (ledcube_layer_t)((ledcube_layer_t)b <<
+                            (8 * (sp->count % LEDCUBE_LAYER_BYTES)));
+        if (++sp->count == LEDCUBE_STREAM_PAYLOAD)
+          sp->state = STREAM_CRC;
+      break;
+
+      case STREAM_CRC:
+        if (b == sp->crc)
+          streamPush(sp);
+        else
+          sp->stats.errors++;
+        sp->state = STREAM_SYNC0;
+      break;
+
+      default:
+        sp->state = STREAM_SYNC0;
+      break;
+    }
+  }
+}
+
+/**
+ * @brief   Receive the stream from a channel, a serial driver for example.
+ *
+ * @param[in] sp        pointer to the frame stream
+ * @param[in] chp       pointer to the channel
+ * @param[in] timeout   time to wait for the bytes
+ * @return    n         number of bytes received
+ */
+size_t ledCubeStreamReceive(ledcube_stream_t *sp, BaseChannel *chp,
+                            systime_t timeout) {
+
+  uint8_t buf[STREAM_RX_SIZE];
+  size_t  n;
+
+  n = chnReadTimeout(chp, buf, STREAM_RX_SIZE, timeout);
+  ledCubeStreamFeed(sp, buf, n);
+
+  return n;
+}
+
+/**
+ * @brief   Display the frame of the stream whose time has come.
+ * @details The frames are displayed following their timestamps, the first
+ *          frame being displayed at once. When several frames are due only
+ *          the last one is displayed.
+ *
+ * @param[in] sp      pointer to the frame stream
+ * @return    delay   time before the next frame is due, TIME_INFINITE if
+ *                    the queue is empty
+ */
+systime_t ledCubeStreamDisplay(ledcube_stream_t *sp) {
+
+  ledcube_stream_frame_t  *fp;
+  systime_t               now = chVTGetSystemTime();
+  systime_t               offset;
+  uint8_t                 next;
+
+  if (sp->tail == sp->head) {
+    if (sp->started)
+      sp->stats.underruns++;
+    return TIME_INFINITE;
+  }
+
+  fp = &sp->queue[sp->tail];
+
+  if (!sp->started) {
+    sp->started = true;
+    sp->origin  = fp->timestamp;
+    sp->start   = now;
+  }
+
+  offset = streamOffset(fp->timestamp - sp->origin);
+  if ((systime_t)(now - sp->start) < offset)
+    return (systime_t)(offset - (systime_t)(now - sp->start));
+
+  /* Skip the frames already replaced by a newer due frame. */
+  next = (uint8_t)((sp->tail + 1) % LEDCUBE_STREAM_QUEUE);
+  while ((next != sp->head) &&
+         ((systime_t)(now - sp->start) >=
+          streamOffset(sp->queue[next].timestamp - sp->origin))) {
+    sp->stats.late++;
+    sp->tail = next;
+    fp = &sp->queue[next];
+    next = (uint8_t)((next + 1) % LEDCUBE_STREAM_QUEUE);
+  }
+
+  ledCubeWaitSwap();
+  *ledCubeGetBackBuffer() = fp->frame;
+  ledCubeSwapBuffers();
+  sp->stats.displayed++;
+
+  /* Move the playback clock origin to keep the differences small. */
+  sp->start  += streamOffset(fp->timestamp - sp->origin);
+  sp->origin = fp->timestamp;
+
+  chSysLock();
+  sp->tail = next;
+  chSysUnlock();
+
+  if (next == sp->head)
+    return TIME_INFINITE;
+
+  offset = streamOffset(sp->queue[next].timestamp - sp->origin);
+  if ((systime_t)(now - sp->start) >= offset)
+    return TIME_IMMEDIATE;
+
+  return (systime_t)(offset - (systime_t)(now - sp->start));
+}
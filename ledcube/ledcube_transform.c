@@ -0,0 +1,288 @@
+/**
+ *
+ * @file    ledcube_transform.c
+ *
+ * @brief   Led cube rotations, mirrors and shifts source file.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+/*==========================================================================*/
+/* Includes files.                                                          */
+/*==========================================================================*/
+
+/* ChibiOS files. */
+#include "hal.h"
+
+/* Driver files. */
+#include "ledcube.h"
+
+/*==========================================================================*/
+/* Driver local definitions.                                                */
+/*==========================================================================*/
+
+#define XF_N        (LEDCUBE_SIZE - 1)  /**< Last coordinate of an axis.    */
+
+/**
+ * @brief   Leds of the row 0 of a layer.
+ */
+#define XF_ROW0     ((ledcube_layer_t)((1U << LEDCUBE_SIZE) - 1))
+
+/**
+ * @brief   Leds of the column 0 of a layer, one bit per row.
+ */
+#define XF_COL0     ((ledcube_layer_t)(LEDCUBE_LAYER_ALL / XF_ROW0))
+
+/**
+ * @brief   Leds of the columns 0 to k - 1 of a layer.
+ */
+#define XF_COLS(k)                                                          \
+  ((ledcube_layer_t)(XF_COL0 * (ledcube_layer_t)((1U << (k)) - 1)))
+
+/**
+ * @brief   Leds of the main diagonal of a layer, x == y.
+ */
+#define XF_DIAG_BIT(y)                                                      \
+  (((y) < LEDCUBE_SIZE) ?                                                   \
+   LEDCUBE_LAYER_LINE(((y) * (LEDCUBE_SIZE + 1)) % LEDCUBE_LAYER_LEDS) : 0)
+#define XF_DIAG0                                                            \
+  ((ledcube_layer_t)(XF_DIAG_BIT(0) | XF_DIAG_BIT(1) | XF_DIAG_BIT(2) |     \
+                     XF_DIAG_BIT(3) | XF_DIAG_BIT(4) | XF_DIAG_BIT(5) |     \
+                     XF_DIAG_BIT(6) | XF_DIAG_BIT(7)))
+
+/*==========================================================================*/
+/* Driver local functions.                                                  */
+/*==========================================================================*/
+
+/**
+ * @brief   Swap the rows and the columns of a layer, (x, y) to (y, x).
+ * @details The leds of a diagonal x - y == k all move by k * (size - 1)
+ *          lines, so the layer is moved one diagonal at a time.
+ *
+ * @param[in] p       leds of the layer
+ * @return    res     leds of the transposed layer
+ */
+static ledcube_layer_t xformTranspose(ledcube_layer_t p) {
+
+  ledcube_layer_t res = p & XF_DIAG0;
+  ledcube_layer_t lo = 0, hi = 0;
+  uint8_t         k;
+
+  for (k = 1; k < LEDCUBE_SIZE; k++) {
+    lo |= (ledcube_layer_t)(XF_COL0 << (k - 1));
+    hi |= (ledcube_layer_t)(XF_COL0 << (LEDCUBE_SIZE - k));
+    res |= (ledcube_layer_t)((p & (XF_DIAG0 << k) & ~lo) << (k * XF_N));
+    res |= (ledcube_layer_t)((p & (XF_DIAG0 >> k) & ~hi) >> (k * XF_N));
+  }
+
+  return res & LEDCUBE_LAYER_ALL;
+}
+
+/**
+ * @brief   Reverse the columns of a layer, x to size - 1 - x.
+ *
+ * @param[in] p       leds of the layer
+ * @return    res     leds of the mirrored layer
+ */
+static ledcube_layer_t xformMirrorX(ledcube_layer_t p) {
+
+  ledcube_layer_t res = 0;
+  uint8_t         x;
+
+  for (x = 0; x < LEDCUBE_SIZE / 2; x++) {
+    res |= (ledcube_layer_t)((p & (XF_COL0 << x)) << (XF_N - 2 * x));
+    res |= (ledcube_layer_t)((p & (XF_COL0 << (XF_N - x))) >> (XF_N - 2 * x));
+  }
+  if (LEDCUBE_SIZE & 1)
+    res |= p & (ledcube_layer_t)(XF_COL0 << (LEDCUBE_SIZE / 2));
+
+  return res;
+}
+
+/**
+ * @brief   Reverse the rows of a layer, y to size - 1 - y.
+ *
+ * @param[in] p       leds of the layer
+ * @return    res     leds of the mirrored layer
+ */
+static ledcube_layer_t xformMirrorY(ledcube_layer_t p) {
+
+  ledcube_layer_t res = 0;
+  uint8_t         y;
+
+  for (y = 0; y < LEDCUBE_SIZE; y++) {
+    res |= (ledcube_layer_t)(((p >> (y * LEDCUBE_SIZE)) & XF_ROW0) <<
+                             ((XF_N - y) * LEDCUBE_SIZE));
+  }
+
+  return res;
+}
+
+/*==========================================================================*/
+/* Functions.                                                               */
+/*==========================================================================*/
+
+/**
+ * @brief   Turn a pattern by a quarter turn around an axis.
+ * @details The first face is moved to the second one:
+ *          - around X, (x, y, z) goes to (x, z, size - 1 - y),
+ *          - around Y, (x, y, z) goes to (z, y, size - 1 - x),
+ *          - around Z, (x, y, z) goes to (y, size - 1 - x, z).
+ *          A turn around Z works on whole layers, the other ones move a
+ *          row or a column of a layer at once.
+ *
+ * @param[in,out] pattern   leds turned on for each layer
+ * @param[in]     axis      axis of the rotation, LEDCUBE_AXIS_xxx
+ */
+void ledCubeRotate(ledcube_layer_t *pattern, uint8_t axis) {
+
+  ledcube_layer_t res[LEDCUBE_LAYERS];
+  uint8_t         z, i;
+
+  if (axis == LEDCUBE_AXIS_Z) {
+    for (z = 0; z < LEDCUBE_LAYERS; z++)
+      pattern[z] = xformMirrorY(xformTranspose(pattern[z]));
+    return;
+  }
+
+  for (z = 0; z < LEDCUBE_LAYERS; z++)
+    res[z] = 0;
+
+  for (z = 0; z < LEDCUBE_LAYERS; z++) {
+    for (i = 0; i < LEDCUBE_SIZE; i++) {
+      if (axis == LEDCUBE_AXIS_X) {
+        /* The row i of the layer z is the row z of the layer n - i. */
+        res[XF_N - i] |= (ledcube_layer_t)
+          (((pattern[z] >> (i * LEDCUBE_SIZE)) & XF_ROW0) <<
+           (z * LEDCUBE_SIZE));
+      }
+      else {
+        /* The column i of the layer z is the column z of the layer n - i. */
+        res[XF_N - i] |= (ledcube_layer_t)
+          (((pattern[z] >> i) & XF_COL0) << z);
+      }
+    }
+  }
+
+  for (z = 0; z < LEDCUBE_LAYERS; z++)
+    pattern[z] = res[z];
+}
+
+/**
+ * @brief   Mirror a pattern along an axis.
+ *
+ * @param[in,out] pattern   leds turned on for each layer
+ * @param[in]     axis      axis of the mirror, LEDCUBE_AXIS_xxx
+ */
+void ledCubeMirror(ledcube_layer_t *pattern, uint8_t axis) {
+
+  ledcube_layer_t p;
+  uint8_t         z;
+
+  if (axis == LEDCUBE_AXIS_Z) {
+    for (z = 0; z < LEDCUBE_LAYERS / 2; z++) {
+      p = pattern[z];
+      pattern[z] = pattern[XF_N - z];
+      pattern[XF_N - z] = p;
+    }
+    return;
+  }
+
+  for (z = 0; z < LEDCUBE_LAYERS; z++) {
+    pattern[z] = (axis == LEDCUBE_AXIS_X) ? xformMirrorX(pattern[z]) :
+                                            xformMirrorY(pattern[z]);
+  }
+}
+
+/**
+ * @brief   Shift a pattern along an axis, with wrap around.
+ *
+ * @param[in,out] pattern   leds turned on for each layer
+ * @param[in]     axis      axis of the shift, LEDCUBE_AXIS_xxx
+ * @param[in]     step      number of leds, negative to shift backward
+ */
+void ledCubeShift(ledcube_layer_t *pattern, uint8_t axis, int8_t step) {
+
+  ledcube_layer_t res[LEDCUBE_LAYERS];
+  ledcube_layer_t lo, hi;
+  uint8_t         s, z;
+
+  s = (uint8_t)((LEDCUBE_SIZE + (step % LEDCUBE_SIZE)) % LEDCUBE_SIZE);
+  if (s == 0)
+    return;
+
+  if (axis == LEDCUBE_AXIS_Z) {
+    for (z = 0; z < LEDCUBE_LAYERS; z++)
+      res[(z + s) % LEDCUBE_LAYERS] = pattern[z];
+    for (z = 0; z < LEDCUBE_LAYERS; z++)
+      pattern[z] = res[z];
+  }
+  else if (axis == LEDCUBE_AXIS_X) {
+    /* The columns moving past the last one wrap to the first ones. */
+    lo = XF_COLS(LEDCUBE_SIZE - s);
+    hi = XF_COLS(s);
+    for (z = 0; z < LEDCUBE_LAYERS; z++) {
+      pattern[z] = (ledcube_layer_t)(((pattern[z] & lo) << s) |
+                                     ((pattern[z] >> (LEDCUBE_SIZE - s)) &
+                                      hi));
+    }
+  }
+  else {
+    /* The rows are a rotation of the whole layer. */
+    for (z = 0; z < LEDCUBE_LAYERS; z++) {
+      pattern[z] = (ledcube_layer_t)
+        (((pattern[z] << (s * LEDCUBE_SIZE)) |
+          (pattern[z] >> (LEDCUBE_LAYER_LEDS - s * LEDCUBE_SIZE))) &
+         LEDCUBE_LAYER_ALL);
+    }
+  }
+}
+
+/**
+ * @brief   Apply a transformation to a pattern.
+ *
+ * @param[in,out] pattern   leds turned on for each layer
+ * @param[in]     op        LEDCUBE_OP_ROTATE, LEDCUBE_OP_SHIFT or
+ *                          LEDCUBE_OP_MIRROR
+ * @param[in]     axis      axis of the transformation
+ * @param[in]     step      step of the shift, with wrap around
+ */
+void ledCubeTransform(ledcube_layer_t *pattern, uint8_t op, uint8_t axis,
+                      int8_t step) {
+
+  if (op == LEDCUBE_OP_ROTATE)
+    ledCubeRotate(pattern, axis);
+  else if (op == LEDCUBE_OP_SHIFT)
+    ledCubeShift(pattern, axis, step);
+  else
+    ledCubeMirror(pattern, axis);
+}
+
+/**
+ * @brief   Apply a transformation to a frame.
+ * @details Each bit plane of the frame is transformed, so the leds keep
+ *          their brightness.
+ *
+ * @param[in,out] fp        pointer to the frame
+ * @param[in]     op        LEDCUBE_OP_ROTATE, LEDCUBE_OP_SHIFT or
+ *                          LEDCUBE_OP_MIRROR
+ * @param[in]     axis      axis of the transformation
+ * @param[in]     step      step of the shift, with wrap around
+ */
+void ledCubeFrameTransform(ledcube_frame_t *fp, uint8_t op, uint8_t axis,
+                           int8_t step) {
+
+  ledcube_layer_t plane[LEDCUBE_LAYERS];
+  uint8_t         z, b;
+
+  for (b = 0; b < LEDCUBE_BAM_BITS; b++) {
+    for (z = 0; z < LEDCUBE_LAYERS; z++)
+      plane[z] = fp->layer[z][b];
+    ledCubeTransform(plane, op, axis, step);
+    for (z = 0; z < LEDCUBE_LAYERS; z++)
+      fp->layer[z][b] = plane[z];
+  }
+}
@@ -0,0 +1,402 @@
+/**
+ *
+ * @file    sensorhub.c
+ *
+ * @brief   Sensor hub sampling scheduler source file.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Driver files. */
+#include "sensorhub.h"
+
+/*==========================================================================*/
+/* Driver local definitions.                                                */
+/*==========================================================================*/
+
+#define HUB_DONE  2   /**< No operation left in the cycle for the stream.   */
+
+/*==========================================================================*/
+/* Driver local functions.                                                  */
+/*==========================================================================*/
+
+/**
+ * @brief   Count a sample of a stream.
+ *
+ * @param[in] sp    pointer to the stream
+ */
+static void hubSample(sensorhub_stream_t *sp) {
+
+  systime_t now = chVTGetSystemTime();
+  systime_t period;
+
+  if (sp->stats.samples == 0)
+    sp->stats.first = now;
+  else {
+    period = (systime_t)(now - sp->stats.last);
+    if ((sp->stats.samples == 1) || (period < sp->stats.minPeriod))
+      sp->stats.minPeriod = period;
+    if (period > sp->stats.maxPeriod)
+      sp->stats.maxPeriod = period;
+  }
+
+  sp->stats.last = now;
+  sp->stats.samples++;
+}
+
+/**
+ * @brief   Tell if a device has a stream with a conversion.
+ *
+ * @param[in] hp      pointer to the hub
+ * @param[in] device  device of the streams
+ * @return    conv    true if a stream of the device has a conversion
+ */
+static bool hubConverts(const sensorhub_t *hp, uint8_t device) {
+
+  uint8_t i;
+
+  for (i = 0; i < hp->n; i++) {
+    if ((hp->streams[i].device == device) && (hp->streams[i].start != NULL))
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * @brief   Get the bus time of the operation of a slot.
+ *
+ * @param[in] hp      pointer to the hub
+ * @param[in] slp     pointer to the slot
+ * @return    cost    bus time of the operation
+ */
+static systime_t hubSlotCost(const sensorhub_t *hp,
+                             const sensorhub_slot_t *slp) {
+
+  const sensorhub_stream_t *sp = &hp->streams[slp->stream];
+
+  return (slp->op == SENSORHUB_OP_START) ? sp->startCost : sp->fetchCost;
+}
+
+/**
+ * @brief   Repeat the fetch of a stream in the free bus windows of a cycle.
+ * @details From the fetch of the stream, a fetch is added each repeat time
+ *          or, if the bus is then busy, at the end of the slot in the way.
+ *          The slots stay in the order of their offsets.
+ *
+ * @param[in] hp      pointer to the hub
+ * @param[in] stream  stream without conversion
+ * @param[in] base    offset of the fetch of the stream
+ */
+static void hubFill(sensorhub_t *hp, uint8_t stream, systime_t base) {
+
+  const sensorhub_stream_t *sp = &hp->streams[stream];
+  systime_t cost = sp->fetchCost;
+  systime_t t = base + sp->repeat, off, s, e;
+  uint8_t   i;
+  bool      moved;
+
+  while (hp->nslots < SENSORHUB_MAX_SLOTS) {
+    /* Move the fetch after the slots in its way, or to the next cycle if
+       it does not end in this one. The fetch of the next cycle comes a
+       repeat time after the last one at least. */
+    do {
+      if (t + sp->repeat > base + hp->cycle)
+        return;
+      moved = false;
+      off = t % hp->cycle;
+      if (off + cost > hp->cycle) {
+        t += hp->cycle - off;
+        moved = true;
+        continue;
+      }
+      for (i = 0; i < hp->nslots; i++) {
+        s = t - off + hp->slots[i].offset;
+        e = s + hubSlotCost(hp, &hp->slots[i]);
+        if ((t < e) && (s < t + cost)) {
+          t = e;
+          moved = true;
+          break;
+        }
+      }
+    } while (moved);
+
+    for (i = hp->nslots; (i > 0) && (hp->slots[i - 1].offset > off); i--)
+      hp->slots[i] = hp->slots[i - 1];
+    hp->slots[i].offset = off;
+    hp->slots[i].stream = stream;
+    hp->slots[i].op     = SENSORHUB_OP_FETCH;
+    hp->nslots++;
+    hp->busTime += cost;
+    t += sp->repeat;
+  }
+}
+
+/*==========================================================================*/
+/* Driver functions.                                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Initialize a hub and compute its sampling cycle.
+ * @details The operations of the streams are placed on the bus one after
+ *          the other, each one as soon as the bus, its device and its
+ *          conversion allow it. When several operations are ready the one
+ *          of the stream with the longest conversion goes first, so the
+ *          long conversions start early and the other transfers fill their
+ *          conversion windows. Every stream gives one sample per cycle.
+ *          The streams without conversion are then fetched again in the bus
+ *          windows left free, so the bus does not sit idle during the long
+ *          conversions, see sensorhub_stream_t.
+ *
+ * @param[out] hp       pointer to the hub
+ * @param[in]  streams  pointer to the streams, their stats are cleared
+ * @param[in]  n        number of streams
+ *
+ * @return     msg      the result of the operation
+ * @retval     MSG_OK     the cycle is computed
+ * @retval     MSG_RESET too many streams, or a stream is not valid
+ */
+msg_t sensorHubInit(sensorhub_t *hp, sensorhub_stream_t *streams,
+                    uint8_t n) {
+
+  systime_t ready[SENSORHUB_MAX_STREAMS];
+  systime_t fetchAt[SENSORHUB_MAX_STREAMS];
+  uint8_t   next[SENSORHUB_MAX_STREAMS];
+  systime_t devFree[SENSORHUB_MAX_DEVICES];
+  systime_t bus = 0, t, best_t = 0, cost;
+  uint8_t   i, best;
+  sensorhub_stream_t *sp;
+
+  if ((n == 0) || (n > SENSORHUB_MAX_STREAMS))
+    return MSG_RESET;
+
+  for (i = 0; i < SENSORHUB_MAX_DEVICES; i++)
+    devFree[i] = 0;
+
+  for (i = 0; i < n; i++) {
+    sp = &streams[i];
+    if ((sp->fetch == NULL) || (sp->device >= SENSORHUB_MAX_DEVICES))
+      return MSG_RESET;
+
+    ready[i] = 0;
+    next[i] = (sp->start != NULL) ? SENSORHUB_OP_START : SENSORHUB_OP_FETCH;
+
+    sp->stats.samples   = 0;
+    sp->stats.errors    = 0;
+    sp->stats.minPeriod = 0;
+    sp->stats.maxPeriod = 0;
+  }
+
+  hp->streams = streams;
+  hp->n       = n;
+  hp->nslots  = 0;
+  hp->busTime = 0;
+
+  for (;;) {
+    /* Find the operation which can be done first. */
+    best = n;
+    for (i = 0; i < n; i++) {
+      if (next[i] == HUB_DONE)
+        continue;
+
+      t = (ready[i] > bus) ? ready[i] : bus;
+      if ((next[i] == SENSORHUB_OP_START) || (streams[i].start == NULL)) {
+        if (devFree[streams[i].device] > t)
+          t = devFree[streams[i].device];
+      }
+
+      if ((best == n) || (t < best_t) ||
+          ((t == best_t) && (streams[i].convTime > streams[best].convTime))) {
+        best = i;
+        best_t = t;
+      }
+    }
+
+    if (best == n)
+      break;
+
+    sp = &streams[best];
+    hp->slots[hp->nslots].offset = best_t;
+    hp->slots[hp->nslots].stream = best;
+    hp->slots[hp->nslots].op     = next[best];
+    hp->nslots++;
+
+    if (next[best] == SENSORHUB_OP_START) {
+      cost = sp->startCost;
+      bus = best_t + cost;
+      ready[best] = bus + sp->convTime;
+
+      /* The device is converting until the sample is read. */
+      devFree[sp->device] = (systime_t)-1;
+      next[best] = SENSORHUB_OP_FETCH;
+    }
+    else {
+      cost = sp->fetchCost;
+      bus = best_t + cost;
+      devFree[sp->device] = bus;
+      fetchAt[best] = best_t;
+      next[best] = HUB_DONE;
+    }
+
+    hp->busTime += cost;
+  }
+
+  hp->cycle = bus;
+
+  for (i = 0; i < n; i++) {
+    sp = &streams[i];
+    if ((sp->start == NULL) && (sp->repeat > 0) &&
+        !hubConverts(hp, sp->device))
+      hubFill(hp, i, fetchAt[i]);
+  }
+
+  return MSG_OK;
+}
+
+/**
+ * @brief   Run one sampling cycle of a hub.
+ * @details Each slot is started at its offset from the start of the cycle,
+ *          or at once if the previous slots were late. The fetch of a
+ *          stream whose start failed is skipped.
+ *
+ * @param[in] hp    pointer to the hub
+ */
+void sensorHubCycle(sensorhub_t *hp) {
+
+  systime_t           base = chVTGetSystemTime();
+  bool                failed[SENSORHUB_MAX_STREAMS];
+  sensorhub_slot_t    *slp;
+  sensorhub_stream_t  *sp;
+  uint8_t             i;
+
+  for (i = 0; i < hp->n; i++)
+    failed[i] = false;
+
+  for (i = 0; i < hp->nslots; i++) {
+    slp = &hp->slots[i];
+    sp = &hp->streams[slp->stream];
+
+    (void)chThdSleepUntilWindowed(base, base + slp->offset);
+
+    if (slp->op == SENSORHUB_OP_START) {
+      if (sp->start(sp->arg) != MSG_OK) {
+        sp->stats.errors++;
+        failed[slp->stream] = true;
+      }
+    }
+    else if (!failed[slp->stream]) {
+      if (sp->fetch(sp->arg) == MSG_OK)
+        hubSample(sp);
+      else
+        sp->stats.errors++;
+    }
+  }
+
+  (void)chThdSleepUntilWindowed(base, base + hp->cycle);
+}
+
+/**
+ * @brief   Get the achieved sample rate of a stream.
+ *
+ * @param[in] sp      pointer to the stream
+ * @return    rate    samples per 1000 seconds (mHz), 0 if unknown
+ */
+uint32_t sensorHubGetRate(const sensorhub_stream_t *sp) {
+
+  systime_t span = (systime_t)(sp->stats.last - sp->stats.first);
+
+  if ((sp->stats.samples < 2) || (span == 0))
+    return 0;
+
+  return (uint32_t)(((uint64_t)(sp->stats.samples - 1) * 1000 *
+                     CH_CFG_ST_FREQUENCY) / span);
+}
+
+/**
+ * @brief   Get the jitter of a stream.
+ *
+ * @param[in] sp      pointer to the stream
+ * @return    jitter  difference between the longest and the shortest time
+ *                    between two samples
+ */
+systime_t sensorHubGetJitter(const sensorhub_stream_t *sp) {
+
+  return (systime_t)(sp->stats.maxPeriod - sp->stats.minPeriod);
+}
+
+/*==========================================================================*/
+/* Device streams.                                                          */
+/*==========================================================================*/
+
+/**
+ * @brief   Start a BMP085 temperature conversion.
+ * @note    The conversion time is MS2ST(BMP085_TEMP_CONVERSION_TIME).
+ *
+ * @param[in] arg   pointer to a sensorhub_bmp085_t
+ * @return    msg   the result of the operation
+ */
+msg_t sensorHubBmp085StartTemp(void *arg) {
+
+  sensorhub_bmp085_t *bp = arg;
+
+  return bmp085StartTemp(bp->i2cp, bp->addr);
+}
+
+/**
+ * @brief   Read a BMP085 temperature.
+ *
+ * @param[in] arg   pointer to a sensorhub_bmp085_t
+ * @return    msg   the result of the operation
+ */
+msg_t sensorHubBmp085FetchTemp(void *arg) {
+
+  sensorhub_bmp085_t *bp = arg;
+
+  return bmp085FetchTemp(bp->i2cp, bp->addr, &bp->temp);
+}
+
+/**
+ * @brief   Start a BMP085 pressure conversion.
+ * @note    The conversion time is
+ *          MS2ST(bmp085GetPressureConversionTime(oss)).
+ *
+ * @param[in] arg   pointer to a sensorhub_bmp085_t
+ * @return    msg   the result of the operation
+ */
+msg_t sensorHubBmp085StartPress(void *arg) {
+
+  sensorhub_bmp085_t *bp = arg;
+
+  return bmp085StartPress(bp->i2cp, bp->addr, bp->oss);
+}
+
+/**
+ * @brief   Read a BMP085 pressure.
+ *
+ * @param[in] arg   pointer to a sensorhub_bmp085_t
+ * @return    msg   the result of the operation
+ */
+msg_t sensorHubBmp085FetchPress(void *arg) {
+
+  sensorhub_bmp085_t *bp = arg;
+
+  return bmp085FetchPress(bp->i2cp, bp->addr, bp->oss, &bp->press);
+}
+
+/**
+ * @brief   Read the DS1307 clock, the stream has no conversion.
+ *
+ * @param[in] arg   pointer to a rtcDriver_t
+ * @return    msg   the result of the operation
+ */
+msg_t sensorHubDs1307FetchClock(void *arg) {
+
+  return ds1307GetClock((rtcDriver_t *)arg);
+}
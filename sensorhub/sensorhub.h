@@ -0,0 +1,230 @@
+/**
+ *
+ * @file    sensorhub.h
+ *
+ * @brief   Sensor hub sampling scheduler header file.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+#ifndef SENSORHUB_H
+#define SENSORHUB_H
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* ChibiOS files. */
+#include "ch.h"
+#include "hal.h"
+
+/* Driver files. */
+#include "bmp085.h"
+#include "ds1307.h"
+
+/*==========================================================================*/
+/* Driver pre-compile time settings.                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Number of sample streams of a hub.
+ * @note    The default is 4.
+ */
+#if !defined(SENSORHUB_MAX_STREAMS) || defined(__DOXYGEN__)
+#define SENSORHUB_MAX_STREAMS             4
+#endif
+
+/**
+ * @brief   Number of devices sharing the bus of a hub.
+ * @note    The default is 4.
+ */
+#if !defined(SENSORHUB_MAX_DEVICES) || defined(__DOXYGEN__)
+#define SENSORHUB_MAX_DEVICES             4
+#endif
+
+/**
+ * @brief   Number of operations in the sampling cycle of a hub.
+ * @details The streams without conversion are repeated in the bus windows
+ *          left free by the other streams, up to this number of slots.
+ * @note    The default is 32.
+ */
+#if !defined(SENSORHUB_MAX_SLOTS) || defined(__DOXYGEN__)
+#define SENSORHUB_MAX_SLOTS               32
+#endif
+
+/**
+ * @brief   Size of a block of the binary log, from 20 to 1024 bytes.
+ * @note    The default is 256.
+ */
+#if !defined(SENSORHUB_LOG_BLOCK_SIZE) || defined(__DOXYGEN__)
+#define SENSORHUB_LOG_BLOCK_SIZE          256
+#endif
+
+/*==========================================================================*/
+/* Derived constants and error checks.                                      */
+/*==========================================================================*/
+
+#if (SENSORHUB_MAX_SLOTS < 2 * SENSORHUB_MAX_STREAMS) ||                   \
+    (SENSORHUB_MAX_SLOTS > 255)
+#error "SENSORHUB_MAX_SLOTS must be between 2 * SENSORHUB_MAX_STREAMS and 255"
+#endif
+
+#if (SENSORHUB_LOG_BLOCK_SIZE < 20) || (SENSORHUB_LOG_BLOCK_SIZE > 1024)
+#error "invalid SENSORHUB_LOG_BLOCK_SIZE value"
+#endif
+
+/*==========================================================================*/
+/* Driver macros.                                                           */
+/*==========================================================================*/
+
+/**
+ * @brief   Bus time of a transfer of n bytes at a clock speed, in ticks.
+ * @details Each byte takes 9 clock periods, the start, address and stop
+ *          conditions are counted as two bytes. The time is rounded up to
+ *          one tick at least.
+ */
+#define SENSORHUB_XFER_TIME(n, clock)                                       \
+  ((systime_t)(US2ST((((n) + 2) * 9 * 1000000UL) / (clock)) + 1))
+
+#define SENSORHUB_OP_START  0       /**< The slot starts a conversion.      */
+#define SENSORHUB_OP_FETCH  1       /**< The slot reads a sample.           */
+
+#define SENSORHUB_LOG_MAGIC 0xB5    /**< First byte of a log block.         */
+
+/*==========================================================================*/
+/* Driver data structures and types.                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Operation of a sample stream, start or fetch.
+ */
+typedef msg_t (*sensorhub_op_t)(void *arg);
+
+/**
+ * @brief   Statistics of a sample stream.
+ */
+typedef struct sensorhub_stats {
+  uint32_t    samples;      /**< Samples read.                              */
+  uint32_t    errors;       /**< Failed operations.                         */
+  systime_t   first;        /**< Time of the first sample.                  */
+  systime_t   last;         /**< Time of the last sample.                   */
+  systime_t   minPeriod;    /**< Shortest time between two samples.         */
+  systime_t   maxPeriod;    /**< Longest time between two samples.          */
+} sensorhub_stats_t;
+
+/**
+ * @brief   Sample stream of a device.
+ * @details A stream without conversion only has a fetch operation, the
+ *          fetch of a stream with a conversion follows its start after the
+ *          conversion time. The streams of the same device never convert at
+ *          the same time. A stream without conversion, on a device without
+ *          conversion, with a repeat time is also fetched in the bus windows
+ *          left free by the other streams, at least the repeat time apart.
+ *          With a repeat time of 0 it is fetched once per cycle.
+ */
+typedef struct sensorhub_stream {
+  sensorhub_op_t    start;      /**< Start of the conversion, can be NULL.  */
+  sensorhub_op_t    fetch;      /**< Read of the sample.                    */
+  void              *arg;       /**< Argument of the operations.            */
+  uint8_t           device;     /**< Device of the stream, from 0.          */
+  systime_t         convTime;   /**< Conversion time.                       */
+  systime_t         startCost;  /**< Bus time of the start.                 */
+  systime_t         fetchCost;  /**< Bus time of the fetch.                 */
+  systime_t         repeat;     /**< Least time between fetches, or 0.      */
+  sensorhub_stats_t stats;      /**< Statistics of the stream.              */
+} sensorhub_stream_t;
+
+/**
+ * @brief   Slot of the sampling cycle.
+ */
+typedef struct sensorhub_slot {
+  systime_t offset;   /**< Start of the slot from the start of the cycle.   */
+  uint8_t   stream;   /**< Stream of the slot.                              */
+  uint8_t   op;       /**< Operation, SENSORHUB_OP_xxx.                     */
+} sensorhub_slot_t;
+
+/**
+ * @brief   Sensor hub, the streams sampled on one bus.
+ */
+typedef struct sensorhub {
+  sensorhub_stream_t  *streams;               /**< Streams of the hub.      */
+  uint8_t             n;                      /**< Number of streams.       */
+  sensorhub_slot_t    slots[SENSORHUB_MAX_SLOTS]; /**< Slots of the cycle.  */
+  uint8_t             nslots;                 /**< Number of slots.         */
+  systime_t           cycle;                  /**< Length of the cycle.     */
+  systime_t           busTime;                /**< Bus time of a cycle.     */
+} sensorhub_t;
+
+/**
+ * @brief   BMP085 streams argument.
+ */
+typedef struct sensorhub_bmp085 {
+  I2CDriver *i2cp;    /**< Bus of the sensor.                               */
+  uint8_t   addr;     /**< Address of the sensor.                           */
+  uint8_t   oss;      /**< Oversampling setting of the pressure.            */
+  float     temp;     /**< Last temperature.                                */
+  float     press;    /**< Last pressure.                                   */
+} sensorhub_bmp085_t;
+
+/**
+ * @brief   Binary log of the pressure samples.
+ * @details The samples are grouped in blocks with the RTC time of their
+ *          first sample and a CRC, the other samples only store their
+ *          changes as varints.
+ */
+typedef struct sensorhub_log {
+  BaseSequentialStream  *sink;    /**< Stream receiving the blocks.         */
+  rtcDriver_t           *rtcp;    /**< RTC giving the time of the blocks.   */
+  uint8_t   block[SENSORHUB_LOG_BLOCK_SIZE]; /**< Current block.            */
+  uint16_t  len;                  /**< Length of the current block.         */
+  uint8_t   count;                /**< Samples of the current block.        */
+  systime_t time;                 /**< Time of the last sample, as stored.  */
+  int32_t   press;                /**< Last pressure (Pa).                  */
+  int16_t   temp;                 /**< Last temperature (0.1 deg C).        */
+  uint32_t  samples;              /**< Samples appended.                    */
+  uint32_t  blocks;               /**< Blocks written.                      */
+  uint32_t  bytes;                /**< Bytes written.                       */
+} sensorhub_log_t;
+
+/**
+ * @brief   Sample decoded from a binary log.
+ */
+typedef struct sensorhub_log_sample {
+  uint32_t  epoch;    /**< RTC time (s since 2000), or DS1307_EPOCH_INVALID.*/
+  uint16_t  ms;       /**< Milliseconds of the time.                        */
+  int32_t   press;    /**< Pressure (Pa).                                   */
+  int16_t   temp;     /**< Temperature (0.1 deg C).                         */
+} sensorhub_log_sample_t;
+
+/**
+ * @brief   Callback of the log decoder.
+ */
+typedef void (*sensorhub_log_cb_t)(void *arg,
+                                   const sensorhub_log_sample_t *sp);
+
+/*==========================================================================*/
+/* Functions prototypes.                                                    */
+/*==========================================================================*/
+
+msg_t     sensorHubInit(sensorhub_t *hp, sensorhub_stream_t *streams,
+                        uint8_t n);
+void      sensorHubCycle(sensorhub_t *hp);
+uint32_t  sensorHubGetRate(const sensorhub_stream_t *sp);
+systime_t sensorHubGetJitter(const sensorhub_stream_t *sp);
+msg_t     sensorHubBmp085StartTemp(void *arg);
+msg_t     sensorHubBmp085FetchTemp(void *arg);
+msg_t     sensorHubBmp085StartPress(void *arg);
+msg_t     sensorHubBmp085FetchPress(void *arg);
+msg_t     sensorHubDs1307FetchClock(void *arg);
+void      sensorHubLogInit(sensorhub_log_t *lp, BaseSequentialStream *sink,
+                           rtcDriver_t *rtcp);
+void      sensorHubLogAppend(sensorhub_log_t *lp, systime_t time,
+                             int32_t press, int16_t temp);
+void      sensorHubLogFlush(sensorhub_log_t *lp);
+msg_t     sensorHubLogDecode(const uint8_t *buf, size_t n, size_t *used,
+                             sensorhub_log_cb_t cb, void *arg);
+
+#endif /* SENSORHUB_H */
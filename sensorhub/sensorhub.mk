@@ -0,0 +1,6 @@
+# List of all the sensor hub files.
+SENSORHUBSRC := $(DRIVERS)/sensorhub/sensorhub.c \
+                $(DRIVERS)/sensorhub/sensorhub_log.c
+
+# Required include directories.
+SENSORHUBINC := $(DRIVERS)/sensorhub/
@@ -0,0 +1,344 @@
+/**
+ *
+ * @file    sensorhub_log.c
+ *
+ * @brief   Sensor hub binary log of the pressure samples.
+ *
+ * @author  Theodore Ateba, tf.ateba@gmail.com
+ *
+ * @date    03 January 2017
+ *
+ */
+
+/*==========================================================================*/
+/* Include files.                                                           */
+/*==========================================================================*/
+
+/* Standard files. */
+#include <string.h>
+
+/* Driver files. */
+#include "sensorhub.h"
+
+/*==========================================================================*/
+/* Driver local definitions.                                                */
+/*==========================================================================*/
+
+/*
+ * Block of the log, the integers are little endian:
+ *   0   magic, SENSORHUB_LOG_MAGIC
+ *   1   number of samples, from 1
+ *   2   length of the deltas, 16 bits
+ *   4   RTC time of the first sample (s since 2000), 32 bits
+ *   8   pressure of the first sample (Pa), 32 bits
+ *   12  temperature of the first sample (0.1 deg C), 16 bits
+ *   14  deltas of the next samples
+ *   n   CRC-16/CCITT of the header and the deltas, 16 bits
+ * Each next sample is the time since the previous one (ms) as a varint,
+ * then the changes of the pressure and of the temperature as zigzag
+ * varints.
+ */
+#define LOG_HEADER_SIZE   14
+#define LOG_CRC_SIZE      2
+#define LOG_DELTA_MAX     13      /**< Longest deltas of a sample.          */
+
+/*==========================================================================*/
+/* Driver local functions.                                                  */
+/*==========================================================================*/
+
+/**
+ * @brief   Update a CRC-16/CCITT.
+ *
+ * @param[in] crc     CRC of the previous bytes, 0xFFFF at first
+ * @param[in] buf     pointer to the bytes
+ * @param[in] n       number of bytes
+ * @return    crc     CRC of the bytes
+ */
+static uint16_t logCrc(uint16_t crc, const uint8_t *buf, size_t n) {
+
+  uint8_t i;
+
+  while (n--) {
+    crc ^= (uint16_t)(*buf++ << 8);
+    for (i = 0; i < 8; i++)
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) :
+                             (uint16_t)(crc << 1);
+  }
+
+  return crc;
+}
+
+/**
+ * @brief   Write an unsigned varint, 7 bits per byte from the lowest.
+ *
+ * @param[out] buf    pointer to the bytes, 5 bytes at most are written
+ * @param[in]  val    value to write
+ * @return     n      number of bytes written
+ */
+static uint8_t logPutVarint(uint8_t *buf, uint32_t val) {
+
+  uint8_t n = 0;
+
+  while (val >= 0x80) {
+    buf[n++] = (uint8_t)(val | 0x80);
+    val >>= 7;
+  }
+  buf[n++] = (uint8_t)val;
+
+  return n;
+}
+
+/**
+ * @brief   Write a signed varint, zigzag encoded.
+ *
+ * @param[out] buf    pointer to the bytes, 5 bytes at most are written
+ * @param[in]  val    value to write
+ * @return     n      number of bytes written
+ */
+static uint8_t logPutZigzag(uint8_t *buf, int32_t val) {
+
+  return logPutVarint(buf, ((uint32_t)val << 1) ^ (uint32_t)(val >> 31));
+}
+
+/**
+ * @brief   Read an unsigned varint.
+ *
+ * @param[in]     buf   pointer to the bytes
+ * @param[in,out] pos   position of the varint, then of the next byte
+ * @param[in]     n     number of bytes
+ * @param[out]    val   pointer to the value
+ * @return        ok    false if the varint is truncated or too long
+ */
+static bool logGetVarint(const uint8_t *buf, size_t *pos, size_t n,
+                         uint32_t *val) {
+
+  uint8_t shift;
+
+  *val = 0;
+  for (shift = 0; shift < 35; shift += 7) {
+    if (*pos >= n)
+      return false;
+    *val |= (uint32_t)(buf[*pos] & 0x7F) << shift;
+    if ((buf[(*pos)++] & 0x80) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * @brief   Write a little endian integer.
+ *
+ * @param[out] buf    pointer to the bytes
+ * @param[in]  val    value to write
+ * @param[in]  n      number of bytes
+ */
+static void logPutLe(uint8_t *buf, uint32_t val, uint8_t n) {
+
+  while (n--) {
+    *buf++ = (uint8_t)val;
+    val >>= 8;
+  }
+}
+
+/**
+ * @brief   Read a little endian integer.
+ *
+ * @param[in] buf     pointer to the bytes
+ * @param[in] n       number of bytes
+ * @return    val     value read
+ */
+static uint32_t logGetLe(const uint8_t *buf, uint8_t n) {
+
+  uint32_t val = 0;
+
+  while (n--)
+    val = (val << 8) | buf[n];
+
+  return val;
+}
+
+/*==========================================================================*/
+/* Driver functions.                                                        */
+/*==========================================================================*/
+
+/**
+ * @brief   Initialize a log.
+ *
+ * @param[out] lp     pointer to the log
+ * @param[in]  sink   stream receiving the blocks
+ * @param[in]  rtcp   RTC giving the time of the blocks
+ */
+void sensorHubLogInit(sensorhub_log_t *lp, BaseSequentialStream *sink,
+                      rtcDriver_t *rtcp) {
+
+  lp->sink    = sink;
+  lp->rtcp    = rtcp;
+  lp->len     = 0;
+  lp->count   = 0;
+  lp->samples = 0;
+  lp->blocks  = 0;
+  lp->bytes   = 0;
+}
+
+/**
+ * @brief   Append a sample to a log.
+ * @details The first sample of a block is stored with the RTC time in the
+ *          header of the block, the next samples only store their changes.
+ *          The block is written to the sink when it is full.
+ * @note    The RTC time is the last one published by ds1307GetClock().
+ *
+ * @param[in] lp      pointer to the log
+ * @param[in] time    system time of the sample
+ * @param[in] press   compensated pressure (Pa)
+ * @param[in] temp    temperature (0.1 deg C)
+ */
+void sensorHubLogAppend(sensorhub_log_t *lp, systime_t time, int32_t press,
+                        int16_t temp) {
+
+  uint8_t       delta[LOG_DELTA_MAX];
+  uint8_t       n;
+  uint64_t      ms;
+  ds1307_data_t rtc;
+
+  if (lp->count > 0) {
+    /* The time is rounded down to the ms and the time of the previous
+       sample only advances by the ms stored, the rest is carried to the
+       next sample and the decoded times do not drift. A gap too long for
+       32 bits is clamped. */
+    ms = ((uint64_t)(systime_t)(time - lp->time) * 1000U) /
+         CH_CFG_ST_FREQUENCY;
+    if (ms > UINT32_MAX)
+      ms = UINT32_MAX;
+    n  = logPutVarint(delta, (uint32_t)ms);
+    n += logPutZigzag(&delta[n], press - lp->press);
+    n += logPutZigzag(&delta[n], (int32_t)temp - lp->temp);
+
+    if ((lp->count == 255) ||
+        (lp->len + n + LOG_CRC_SIZE > SENSORHUB_LOG_BLOCK_SIZE))
+      sensorHubLogFlush(lp);
+    else {
+      memcpy(&lp->block[lp->len], delta, n);
+      lp->len += n;
+      lp->time += (systime_t)((ms * CH_CFG_ST_FREQUENCY) / 1000U);
+    }
+  }
+
+  if (lp->count == 0) {
+    (void)ds1307GetSnapshot(lp->rtcp, &rtc, NULL);
+    lp->block[0] = SENSORHUB_LOG_MAGIC;
+    logPutLe(&lp->block[4], ds1307GetEpoch(&rtc), 4);
+    logPutLe(&lp->block[8], (uint32_t)press, 4);
+    logPutLe(&lp->block[12], (uint16_t)temp, 2);
+    lp->len = LOG_HEADER_SIZE;
+    lp->time = time;
+  }
+
+  lp->press = press;
+  lp->temp  = temp;
+  lp->count++;
+  lp->samples++;
+}
+
+/**
+ * @brief   Write the current block of a log to its sink.
+ *
+ * @param[in] lp      pointer to the log
+ */
+void sensorHubLogFlush(sensorhub_log_t *lp) {
+
+  uint16_t crc;
+
+  if (lp->count == 0)
+    return;
+
+  lp->block[1] = lp->count;
+  logPutLe(&lp->block[2], lp->len - LOG_HEADER_SIZE, 2);
+  crc = logCrc(0xFFFF, lp->block, lp->len);
+  logPutLe(&lp->block[lp->len], crc, 2);
+
+  (void)streamWrite(lp->sink, lp->block, lp->len + LOG_CRC_SIZE);
+
+  lp->bytes += lp->len + LOG_CRC_SIZE;
+  lp->blocks++;
+  lp->count = 0;
+  lp->len = 0;
+}
+
+/**
+ * @brief   Decode a block of a log.
+ * @details The samples of the block are given to the callback in order.
+ *          The function only uses the bytes given, so the log can be read
+ *          back from a file or a serial line on any machine: the bytes are
+ *          appended to a buffer and the decoded blocks removed from it.
+ *
+ * @param[in]  buf    pointer to the bytes, from the start of a block
+ * @param[in]  n      number of bytes
+ * @param[out] used   number of bytes to remove from the buffer
+ * @param[in]  cb     function called for each sample
+ * @param[in]  arg    argument of the callback
+ *
+ * @return     msg    the result of the decoding
+ * @retval     MSG_OK      the block is decoded
+ * @retval     MSG_TIMEOUT the block is not complete, used is 0
+ * @retval     MSG_RESET   the bytes are not a valid block, the used bytes
+ *                         are skipped to look for the next block
+ */
+msg_t sensorHubLogDecode(const uint8_t *buf, size_t n, size_t *used,
+                         sensorhub_log_cb_t cb, void *arg) {
+
+  sensorhub_log_sample_t  s;
+  size_t                  len, pos;
+  uint32_t                ms, val;
+  uint8_t                 count;
+
+  *used = 0;
+  if ((n > 0) && (buf[0] != SENSORHUB_LOG_MAGIC)) {
+    *used = 1;
+    return MSG_RESET;
+  }
+  if (n < LOG_HEADER_SIZE)
+    return MSG_TIMEOUT;
+
+  len = LOG_HEADER_SIZE + logGetLe(&buf[2], 2);
+  if ((buf[1] == 0) || (len + LOG_CRC_SIZE > SENSORHUB_LOG_BLOCK_SIZE)) {
+    *used = 1;
+    return MSG_RESET;
+  }
+  if (n < len + LOG_CRC_SIZE)
+    return MSG_TIMEOUT;
+  if (logCrc(0xFFFF, buf, len) != logGetLe(&buf[len], 2)) {
+    *used = 1;
+    return MSG_RESET;
+  }
+
+  s.epoch = logGetLe(&buf[4], 4);
+  s.ms    = 0;
+  s.press = (int32_t)logGetLe(&buf[8], 4);
+  s.temp  = (int16_t)logGetLe(&buf[12], 2);
+  cb(arg, &s);
+
+  pos = LOG_HEADER_SIZE;
+  for (count = buf[1] - 1; count > 0; count--) {
+    if (!logGetVarint(buf, &pos, len, &ms))
+      break;
+    ms += s.ms;
+    if (s.epoch != DS1307_EPOCH_INVALID)
+      s.epoch += ms / 1000;
+    s.ms = (uint16_t)(ms % 1000);
+
+    if (!logGetVarint(buf, &pos, len, &val))
+      break;
+    s.press += (int32_t)((val >> 1) ^ -(val & 1));
+
+    if (!logGetVarint(buf, &pos, len, &val))
+      break;
+    s.temp = (int16_t)(s.temp + (int32_t)((val >> 1) ^ -(val & 1)));
+
+    cb(arg, &s);
+  }
+
+  *used = len + LOG_CRC_SIZE;
+
+  return ((count == 0) && (pos == len)) ? MSG_OK : MSG_RESET;
+}